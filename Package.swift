@@ -58,6 +58,7 @@ var package = Package(
                 "cython",
                 "docs",
                 "fuzz",
+                "bench",
                 "tools",
                 "m4",
                 "configure.ac",
@@ -291,8 +291,11 @@ extension LockdownClient {
     ///   - escrow: whether to use an escrow bag when creating the file conduit and installation proxy
     ///   - stagingFolder: the destination staging folder, defaulting to "PublicStaging"
     ///   - packageType: the type of the package; only "Developer" is currently supported
-    ///   - cleanup: whether to remove the staging app from the device after installation (regardless of success)
-    public func installApp(from url: URL, escrow: Bool = false, stagingFolder: String = "PublicStaging", packageType: String? = "Developer", cleanup: Bool = true) async throws {
+    ///   - cleanup: whether to remove the staging app from the device after installation (regardless of success); ignored when `sync` is true, since the staged files are needed for the next sync
+    ///   - sync: whether to leave the previously staged app in place and only transmit the files that have changed since the last install
+    ///   - syncManifest: a local file in which to record the content hashes of the transmitted files, so that files that were rebuilt with identical contents are not re-sent by the next sync
+    ///   - unpack: whether to stream the entries of a compressed .ipa to the device as an expanded folder, rather than sending the archive as a single file for the device to extract
+    public func installApp(from url: URL, escrow: Bool = false, stagingFolder: String = "PublicStaging", packageType: String? = "Developer", cleanup: Bool = true, sync: Bool = false, syncManifest: URL? = nil, unpack: Bool = false) async throws {
         var expanded: ObjCBool = false
         let exists = FileManager.default.fileExists(atPath: url.path, isDirectory: &expanded)
         if exists == false {
@@ -303,7 +306,7 @@ extension LockdownClient {
         try client.makeDirectory(path: stagingFolder)
         defer {
             do {
-                if cleanup {
+                if cleanup && !sync {
                     try client.removePathAndContents(path: stagingFolder)
                 }
             } catch {
@@ -313,17 +316,31 @@ extension LockdownClient {
 
         let destPath = stagingFolder + "/" + url.lastPathComponent // e.g. PublicStaging/Signal.ipa
 
-        // make sure there is nothing already in the staging folder
-        try? client.removePathAndContents(path: destPath) // ignore "Object not found" erors
-
-        if expanded.boolValue == false { // a direct .ipa file
-            let handle = try client.fileOpen(filename: destPath, fileMode: .wrOnly)
-            try client.fileWrite(handle: handle, fileURL: url) { complete in
-                //print("progress:", complete)
+        if sync {
+            var manifest: FileConduitSyncManifest? = nil
+            if let syncManifest = syncManifest {
+                manifest = (try? FileConduitSyncManifest(contentsOf: syncManifest)) ?? FileConduitSyncManifest()
+            }
+            let summary = try client.synchronize(from: url, to: destPath, manifest: manifest)
+            if let syncManifest = syncManifest {
+                try summary.manifest.write(to: syncManifest)
             }
-            try client.fileClose(handle: handle)
+            print("synchronized path:", destPath, "uploaded:", summary.uploaded.count, "touched:", summary.touched.count, "unchanged:", summary.unchanged.count, "removed:", summary.removed.count)
         } else {
-            try client.copyFolder(at: url, to: destPath)
+            // make sure there is nothing already in the staging folder
+            try? client.removePathAndContents(path: destPath) // ignore "Object not found" erors
+
+            if expanded.boolValue == false && unpack {
+                try client.upload(archive: ZipArchive(url: url), to: destPath)
+            } else if expanded.boolValue == false { // a direct .ipa file
+                let handle = try client.fileOpen(filename: destPath, fileMode: .wrOnly)
+                try client.fileWrite(handle: handle, fileURL: url) { complete in
+                    //print("progress:", complete)
+                }
+                try client.fileClose(handle: handle)
+            } else {
+                try client.copyFolder(at: url, to: destPath)
+            }
         }
 
         let iproxy = try self.createInstallationProxy(escrow: escrow)
@@ -341,13 +358,41 @@ extension LockdownClient {
         print("installing path:", destPath)
 
         // if unsigned, this will throw: applicationVerificationFailed
-        let disposable = try iproxy.install(pkgPath: destPath, options: Plist(dictionary: dict), callback: nil)
-        disposable.dispose()
+        for try await progress in iproxy.installProgress(pkgPath: destPath, options: Plist(dictionary: dict)) {
+            if let status = progress.status, let percent = progress.percentComplete {
+                print("install status:", status, "(\(percent)%)")
+            }
+        }
     }
 
 }
 
 
+/// A preference value that can be retrieved with `LockdownClient.inventory(keys:)`.
+public struct LockdownKey: Hashable {
+    /// The domain of the value, or nil for the global domain
+    public var domain: String?
+    /// The name of the value
+    public var key: String
+
+    public init(_ key: String, domain: String? = nil) {
+        self.key = key
+        self.domain = domain
+    }
+
+    public static let deviceName = LockdownKey("DeviceName")
+    public static let deviceClass = LockdownKey("DeviceClass")
+    public static let deviceColor = LockdownKey("DeviceColor")
+    public static let uniqueDeviceID = LockdownKey("UniqueDeviceID")
+    public static let productVersion = LockdownKey("ProductVersion")
+    public static let wiFiAddress = LockdownKey("WiFiAddress")
+    public static let devicePublicKey = LockdownKey("DevicePublicKey")
+    public static let batteryLevel = LockdownKey("BatteryCurrentCapacity", domain: "com.apple.mobile.battery")
+
+    /// The values that are available through the accessor properties of `LockdownClient`
+    public static let inventory: [LockdownKey] = [.deviceName, .deviceClass, .deviceColor, .uniqueDeviceID, .productVersion, .wiFiAddress, .devicePublicKey, .batteryLevel]
+}
+
 /// Accessors for various properties.
 extension LockdownClient {
     public var deviceName: String? {
@@ -398,6 +443,79 @@ extension LockdownClient {
         return Plist(rawValue: plist)
     }
 
+    /// Retrieves several preference values in a single batched exchange: the requests are sent back to back and the replies are matched in order, rather than waiting for a round trip per value.
+    /// - Parameter keys: the domains and keys to query, defaulting to the values of the accessor properties
+    /// - Returns: the values by key; keys that the device has no value for, or refused to return, are omitted
+    public func inventory(keys: [LockdownKey] = LockdownKey.inventory) throws -> [LockdownKey: Plist] {
+        guard let lockdown = self.rawValue else {
+            throw LockdownError.deallocated
+        }
+        if keys.isEmpty {
+            return [:]
+        }
+
+        let domains = keys.map { $0.domain.flatMap { strdup($0) } }
+        let names = keys.map { strdup($0.key) }
+        defer {
+            domains.forEach { free($0) }
+            names.forEach { free($0) }
+        }
+        var queries = zip(domains, names).map { lockdownd_value_query_t(domain: UnsafePointer($0), key: UnsafePointer($1)) }
+        var values = [plist_t?](repeating: nil, count: keys.count)
+        do {
+            try attempt(lockdownd_get_values(lockdown, &queries, UInt32(queries.count), &values, nil), LockdownError.init)
+        } catch {
+            // the replies received before the exchange was interrupted are still ours to free
+            for case let value? in values {
+                plist_free(value)
+            }
+            throw error
+        }
+
+        var result: [LockdownKey: Plist] = [:]
+        for (key, value) in zip(keys, values) {
+            if let value = value {
+                result[key] = Plist(rawValue: value)
+            }
+        }
+        return result
+    }
+
+    /// Retrieves all the values of a domain with a single request.
+    /// - Parameters:
+    ///   - domain: the domain to query, or nil for the global domain
+    ///   - keys: the keys to keep from the domain, or nil to keep all of them
+    public func getValues(domain: String? = nil, keys: [String]? = nil) throws -> [String: Plist] {
+        guard let lockdown = self.rawValue else {
+            throw LockdownError.deallocated
+        }
+
+        let names = (keys ?? []).map { UnsafePointer(strdup($0)) }
+        defer { names.forEach { free(UnsafeMutablePointer(mutating: $0)) } }
+        var pplist: plist_t? = nil
+        if keys == nil {
+            try attempt(lockdownd_get_domain_values(lockdown, domain, nil, 0, &pplist), LockdownError.init)
+        } else {
+            try names.withUnsafeBufferPointer { names in
+                try attempt(lockdownd_get_domain_values(lockdown, domain, names.baseAddress, UInt32(names.count), &pplist), LockdownError.init)
+            }
+        }
+        guard let plist = pplist else {
+            throw LockdownError.unknown
+        }
+        var dict = Plist(rawValue: plist)
+        defer { dict.free() }
+        guard let entries = dict.dictionary else {
+            throw LockdownError.plistError
+        }
+
+        var result: [String: Plist] = [:]
+        for (key, value) in entries {
+            result[key] = Plist(rawValue: plist_copy(value.rawValue))
+        }
+        return result
+    }
+
     /// Sets a preferences value using a plist and optional by domain and/or key name.
     public func setValue(domain: String, key:String, value: Plist) throws {
         guard let lockdown = self.rawValue else {
@@ -983,10 +1101,10 @@ public final class InstallationProxy {
         return String(cString: name)
     }
 
-    /// Gets the name from a command dictionary.
+    /// Gets the name from a status dictionary.
     public static func statusGetName(status: Plist) -> String? {
         var pname: UnsafeMutablePointer<Int8>? = nil
-        instproxy_command_get_name(status.rawValue, &pname)
+        instproxy_status_get_name(status.rawValue, &pname)
 
         guard let name = pname else {
             return nil
@@ -1192,6 +1310,67 @@ public final class InstallationProxy {
         }
     }
 
+    /// Install an application on the device, reporting the progress as a sequence of status events that ends when the installation is complete.
+    public func installProgress(pkgPath: String, options: Plist) -> AsyncThrowingStream<InstallationProxyProgress, Error> {
+        progressStream { rawValue, callback, userData in
+            instproxy_install(rawValue, pkgPath, options.rawValue, callback, userData)
+        }
+    }
+
+    /// Upgrade an application on the device, reporting the progress as a sequence of status events that ends when the upgrade is complete.
+    public func upgradeProgress(pkgPath: String, options: Plist) -> AsyncThrowingStream<InstallationProxyProgress, Error> {
+        progressStream { rawValue, callback, userData in
+            instproxy_upgrade(rawValue, pkgPath, options.rawValue, callback, userData)
+        }
+    }
+
+    /// Uninstall an application from the device, reporting the progress as a sequence of status events that ends when the removal is complete.
+    public func uninstallProgress(appID: String, options: Plist) -> AsyncThrowingStream<InstallationProxyProgress, Error> {
+        progressStream { rawValue, callback, userData in
+            instproxy_uninstall(rawValue, appID, options.rawValue, callback, userData)
+        }
+    }
+
+    private typealias ProgressContext = Wrapper<(continuation: AsyncThrowingStream<InstallationProxyProgress, Error>.Continuation, proxy: InstallationProxy)>
+
+    /// Starts an asynchronous command whose status messages are delivered by the shared status pump of the library, and bridges them into a stream.
+    ///
+    /// The stream retains the proxy until the command finishes, since freeing the client would cancel the command. That last reference is dropped off the status thread, so that freeing the client does not wait on the thread that is running the callback.
+    private func progressStream(_ start: @escaping (instproxy_client_t, instproxy_status_cb_t, UnsafeMutableRawPointer) -> instproxy_error_t) -> AsyncThrowingStream<InstallationProxyProgress, Error> {
+        AsyncThrowingStream { continuation in
+            guard let rawValue = self.rawValue else {
+                return continuation.finish(throwing: InstallationProxyError.deallocatedClient)
+            }
+
+            let context = Unmanaged<ProgressContext>.passRetained(ProgressContext(value: (continuation, self)))
+            let rawError = start(rawValue, { (command, status, userData) in
+                guard let userData = userData, let status = Plist(nillableValue: status) else {
+                    return
+                }
+
+                let context = Unmanaged<ProgressContext>.fromOpaque(userData)
+                let continuation = context.takeUnretainedValue().value.continuation
+                if let error = InstallationProxy.statusGetError(status: status) {
+                    continuation.finish(throwing: error)
+                    DispatchQueue.global().async { context.release() }
+                    return
+                }
+
+                let progress = InstallationProxyProgress(command: Plist(nillableValue: command).flatMap(InstallationProxy.commandGetName), status: status)
+                continuation.yield(progress)
+                if progress.isComplete {
+                    continuation.finish()
+                    DispatchQueue.global().async { context.release() }
+                }
+            }, context.toOpaque())
+
+            if let error = InstallationProxyError(rawValue: rawError.rawValue) {
+                context.release()
+                continuation.finish(throwing: error)
+            }
+        }
+    }
+
     /// List archived applications. This function runs synchronously.
     @available(*, deprecated, message: "archive functionality removed in iOS 9")
     public func lookupArchives(options: Plist = Plist(dictionary: [:])) throws -> Plist {
@@ -1357,6 +1536,17 @@ public extension InstallationProxy {
         return appsPlists.array?.map(InstalledAppInfo.init) ?? []
     }
 
+    /// Returns the list of installed apps of the given type, decoded directly from the browse result.
+    func getApps(type appType: ApplicationType) throws -> [InstalledApp] {
+        let opts = Plist(dictionary: [
+            "ApplicationType": Plist(string: appType.rawValue)
+        ])
+
+        var appsPlists = try browse(options: opts)
+        defer { appsPlists.free() }
+        return try PlistDecoder().decode([InstalledApp].self, from: appsPlists)
+    }
+
     /// Returns the list of installed apps of the given type
     @available(*, deprecated, message: "crashes in pointer release")
     func getAppListPages(type appType: ApplicationType, callback: @escaping (InstalledAppInfo) -> ()) throws -> Disposable {
@@ -1610,12 +1800,34 @@ extension InstallationProxyError : LocalizedError {
     }
 }
 
-public struct InstallationProxyStatusError {
+public struct InstallationProxyStatusError: Error {
     public let name: String?
     public let description: String?
     public let code: UInt64
 }
 
+/// A status update of an asynchronous `InstallationProxy` command.
+public struct InstallationProxyProgress {
+    /// The name of the command, e.g. "Install"
+    public let command: String?
+    /// The name of the current step, e.g. "VerifyingApplication", or "Complete" once the command finished
+    public let status: String?
+    /// The estimated progress from 0–100, if the device reported it
+    public let percentComplete: Int32?
+
+    init(command: String?, status: Plist) {
+        self.command = command
+        self.status = InstallationProxy.statusGetName(status: status)
+        var percent: Int32 = -1
+        instproxy_status_get_percent_complete(status.rawValue, &percent)
+        self.percentComplete = percent >= 0 ? percent : nil
+    }
+
+    public var isComplete: Bool {
+        status == "Complete"
+    }
+}
+
 public enum InstallationProxyClientOptionsKey {
     case skipUninstall(Bool)
     case applicationSinf(Plist)
@@ -2497,6 +2709,7 @@ public enum HouseArrestError: Int32, Error {
 
 // MARK: FileConduit
 
+/// A client for the `afc` file service. It can be shared between threads, whose requests are multiplexed over the one connection.
 public final class FileConduit {
 
     /// Starts a new `afc` service on the specified device and connects to it.
@@ -2518,6 +2731,9 @@ public final class FileConduit {
 
     public var rawValue: afc_client_t?
 
+    /// The house arrest client whose connection the conduit talks over, which must stay open for as long as the conduit is used
+    private var houseArrest: HouseArrestClient?
+
     init(rawValue: afc_client_t) {
         self.rawValue = rawValue
     }
@@ -2536,12 +2752,12 @@ public final class FileConduit {
         self.rawValue = client
     }
 
-    /// Connects to the `afc` service on the specified house arrest client.
+    /// Connects to the `afc` service on the specified house arrest client, which is kept alive along with the conduit.
     public init(houseArrest: HouseArrestClient) throws {
         var client: afc_client_t? = nil
         try attempt(afc_client_new_from_house_arrest_client(houseArrest.rawValue, &client), FileConduitError.init)
         self.rawValue = client
-
+        self.houseArrest = houseArrest
     }
 
     /// Get device information for a connected client. The device information returned is the device model as well as the free space, the total capacity and blocksize on the accessed disk partition.
@@ -2563,14 +2779,16 @@ public final class FileConduit {
 
     /// Gets a directory listing of the directory requested.
     public func readDirectory(path: String) throws -> [String] {
-        var directoryInformation: UnsafeMutablePointer<UnsafeMutablePointer<Int8>?>? = nil
-        try attempt(afc_read_directory(rawValue, path,  &directoryInformation), FileConduitError.init)
-
-        defer { afc_dictionary_free(directoryInformation) }
-
-        let idList = String.array(point: directoryInformation)
-        return idList
+        var plisting: UnsafeMutablePointer<afc_directory_listing_t>? = nil
+        try attempt(afc_read_directory_packed(rawValue, path, &plisting), FileConduitError.init)
+        defer { afc_directory_listing_free(plisting) }
 
+        guard let listing = plisting?.pointee else {
+            return []
+        }
+        return (0..<Int(listing.count)).map { i in
+            String(cString: listing.names + Int(listing.offsets[i]))
+        }
     }
 
     /// Gets information about a specific file.
@@ -2583,6 +2801,53 @@ public final class FileConduit {
         return idList
     }
 
+    /// Gets typed information about a specific file.
+    public func getFileInfoTyped(path: String) throws -> FileConduitFileInfo {
+        var pinfo: UnsafeMutablePointer<afc_file_info_t>? = nil
+        try attempt(afc_get_file_info_typed(rawValue, path, &pinfo), FileConduitError.init)
+        defer { afc_file_info_free(pinfo, 1) }
+
+        guard let info = pinfo?.pointee else {
+            throw FileConduitError.unknownError
+        }
+        return FileConduitFileInfo(path: path, info: info)
+    }
+
+    /// Gets information about many files at once, using pipelined requests on the connection.
+    ///
+    /// - Returns: the information for each of the paths, in the same order, or `nil` for paths that could not be queried (e.g., because they do not exist)
+    public func getFileInfo(paths: [String]) throws -> [FileConduitFileInfo?] {
+        let pointers = paths.map { $0.unsafePointer() }
+        defer { pointers.forEach { $0?.deallocate() } }
+
+        var pinfos: UnsafeMutablePointer<afc_file_info_t>? = nil
+        var cpaths = pointers
+        try attempt(afc_get_file_info_many(rawValue, &cpaths, UInt32(paths.count), &pinfos), FileConduitError.init)
+        defer { afc_file_info_free(pinfos, UInt32(paths.count)) }
+
+        let infos = UnsafeBufferPointer(start: pinfos, count: paths.count)
+        return zip(paths, infos).map { path, info in
+            info.status.rawValue == 0 ? FileConduitFileInfo(path: path, info: info) : nil
+        }
+    }
+
+    /// Recursively lists the contents of the given directory, including information about every entry, using pipelined requests for each level of the tree.
+    ///
+    /// - Returns: the entries below the path, parents before their children
+    public func walk(path: String) throws -> [FileConduitFileInfo] {
+        var pentries: UnsafeMutablePointer<afc_walk_entry_t>? = nil
+        var count: UInt32 = 0
+        try attempt(afc_walk(rawValue, path, &pentries, &count), FileConduitError.init)
+        defer { afc_walk_free(pentries, count) }
+
+        return UnsafeBufferPointer(start: pentries, count: Int(count)).compactMap { entry in
+            guard entry.info.status.rawValue == 0, let path = entry.path else {
+                return nil // entries that vanished while walking
+            }
+            return FileConduitFileInfo(path: String(cString: path), info: entry.info)
+        }
+    }
+
     /// Opens a file on the device.
     public func fileOpen(filename: String, fileMode: FileConduitFileMode) throws -> UInt64 {
         var handle: UInt64 = 0
@@ -2660,6 +2925,78 @@ public final class FileConduit {
         } while total > 0
     }
 
+    /// Opens a file on the device like `fileOpen`, but without blocking a thread while waiting for the reply.
+    public func openFile(filename: String, fileMode: FileConduitFileMode) async throws -> UInt64 {
+        let data = try await completion { rawValue, callback, userData in
+            afc_file_open_async(rawValue, filename, afc_file_mode_t(.init(coercing: fileMode.rawValue)), callback, userData)
+        }.data
+        var handle: UInt64 = 0
+        guard withUnsafeMutableBytes(of: &handle, { data.copyBytes(to: $0) }) == MemoryLayout<UInt64>.size else {
+            throw FileConduitError.notEnoughData
+        }
+        return handle
+    }
+
+    /// Closes a file on the device without blocking a thread while waiting for the reply.
+    public func closeFile(handle: UInt64) async throws {
+        _ = try await completion { rawValue, callback, userData in
+            afc_file_close_async(rawValue, handle, callback, userData)
+        }
+    }
+
+    /// Attempts to read the given number of bytes from the given file without blocking a thread while waiting for the reply. The returned data is empty at the end of the file.
+    public func readFile(handle: UInt64, length: UInt32) async throws -> Data {
+        try await completion { rawValue, callback, userData in
+            afc_file_read_async(rawValue, handle, length, callback, userData)
+        }.data
+    }
+
+    /// Writes the given data to a file without blocking a thread while waiting for the reply, and returns the number of bytes written.
+    public func writeFile(handle: UInt64, data: Data) async throws -> UInt32 {
+        let result = try await completion { rawValue, callback, userData in
+            // the data is copied before the call returns
+            data.withUnsafeBytes { pdata in
+                afc_file_write_async(rawValue, handle, pdata.baseAddress?.assumingMemoryBound(to: Int8.self), UInt32(data.count), callback, userData)
+            }
+        }
+        return result.length
+    }
+
+    private typealias CompletionContext = Wrapper<(continuation: CheckedContinuation<(data: Data, length: UInt32), Error>, conduit: FileConduit)>
+
+    /// Queues an asynchronous request with the event thread of the library and suspends until its completion callback.
+    ///
+    /// The context retains the conduit until the request completes, since freeing the client would interrupt it. The resumed task drops that reference rather than the callback, because freeing the client from a completion callback is not allowed.
+    private func completion(_ start: (afc_client_t, afc_completion_cb_t, UnsafeMutableRawPointer) -> afc_error_t) async throws -> (data: Data, length: UInt32) {
+        guard let rawValue = self.rawValue else {
+            throw FileConduitError.invalidArgument
+        }
+
+        var context: Unmanaged<CompletionContext>?
+        defer { context?.release() }
+        return try await withCheckedThrowingContinuation { continuation in
+            let retained = Unmanaged<CompletionContext>.passRetained(CompletionContext(value: (continuation, self)))
+            context = retained
+            let rawError = start(rawValue, { (status, data, length, userData) in
+                guard let userData = userData else {
+                    return
+                }
+
+                let continuation = Unmanaged<CompletionContext>.fromOpaque(userData).takeUnretainedValue().value.continuation
+                if let error = FileConduitError(rawValue: status.rawValue) {
+                    continuation.resume(throwing: error)
+                } else {
+                    let bytes = data.map { Data(bytes: $0, count: Int(length)) } ?? Data()
+                    continuation.resume(returning: (bytes, length))
+                }
+            }, retained.toOpaque())
+
+            if let error = FileConduitError(rawValue: rawError.rawValue) {
+                continuation.resume(throwing: error)
+            }
+        }
+    }
+
     /// Seeks to a given position of a pre-opened file on the device.
     public func fileSeek(handle: UInt64, offset: Int64, whence: Int32) throws {
         try attempt(afc_file_seek(rawValue, handle, offset, whence), FileConduitError.init)
@@ -2706,7 +3043,13 @@ public final class FileConduit {
 
     /// Sets the modification time of a file on the device.
     public func setFileTime(path: String, date: Date) throws {
-        try attempt(afc_set_file_time(rawValue, path, UInt64(date.timeIntervalSinceReferenceDate)), FileConduitError.init)
+        // AFC expects the time in nanoseconds since 1970
+        try setFileTime(path: path, nanoseconds: UInt64(max(0, date.timeIntervalSince1970) * 1_000_000_000))
+    }
+
+    /// Sets the modification time of a file on the device, in nanoseconds since 1970.
+    public func setFileTime(path: String, nanoseconds: UInt64) throws {
+        try attempt(afc_set_file_time(rawValue, path, nanoseconds), FileConduitError.init)
     }
 
     /// Deletes a file or directory including possible contents.
@@ -2767,9 +3110,374 @@ extension FileConduit {
         }
     }
 
+    /// Streams the entries of the zip archive (e.g., an .ipa) into the `remotePath` folder on the device, without extracting them locally.
+    ///
+    /// Entries are decompressed on a background thread and handed over in large buffers to the calling thread, which performs all the AFC operations, so decompression overlaps with the transfer.
+    ///
+    /// - Parameters:
+    ///   - archive: the archive to expand
+    ///   - remotePath: the destination folder on the device, which will be created if needed
+    ///   - progressHandler: called with the path of each file as it is transmitted
+    /// - Returns: the number of uncompressed bytes that were transmitted
+    @discardableResult public func upload(archive: ZipArchive, to remotePath: String, progressHandler: ((String) -> Void)? = nil) throws -> UInt64 {
+        enum Item {
+            case directory(String)
+            case symbolicLink(String, target: String)
+            case file(String)
+            case data(Data)
+            case end
+            case failure(Error)
+        }
+
+        let queue = BoundedQueue<Item>(capacity: 16)
+        let producer = Thread {
+            do {
+                for entry in archive.entries {
+                    let path = try ZipArchive.sanitize(entry.path)
+                    if path.isEmpty {
+                        continue
+                    }
+                    let item: Item
+                    if entry.isDirectory {
+                        item = .directory(path)
+                    } else if entry.isSymbolicLink {
+                        item = try .symbolicLink(path, target: String(decoding: archive.contents(of: entry), as: UTF8.self))
+                    } else {
+                        guard queue.push(.file(path)) else {
+                            return
+                        }
+                        try archive.extract(entry) { buffer in
+                            if !queue.push(.data(Data(buffer))) {
+                                throw ZipArchiveError.cancelled
+                            }
+                        }
+                        item = .end
+                    }
+                    guard queue.push(item) else {
+                        return
+                    }
+                }
+            } catch ZipArchiveError.cancelled {
+                return // the consumer has gone away
+            } catch {
+                queue.push(.failure(error))
+            }
+            queue.close()
+        }
+        producer.start()
+        defer { queue.close() } // unblocks the producer if we bail out early
+
+        var folders: Set<String> = []
+        func makeFolder(_ path: String) throws {
+            if path.isEmpty || folders.contains(path) {
+                return
+            }
+            try makeFolder((path as NSString).deletingLastPathComponent)
+            try makeDirectory(path: remotePath + "/" + path)
+            folders.insert(path)
+        }
+
+        try makeDirectory(path: remotePath)
+        var handle: UInt64? = nil
+        defer {
+            if let handle = handle {
+                try? fileClose(handle: handle)
+            }
+        }
+        var total: UInt64 = 0
+
+        while let item = queue.pop() {
+            switch item {
+            case .directory(let path):
+                try makeFolder(path)
+            case .symbolicLink(let path, let target):
+                try makeFolder((path as NSString).deletingLastPathComponent)
+                try makeLink(linkType: .symLink, target: target, linkName: remotePath + "/" + path)
+            case .file(let path):
+                try makeFolder((path as NSString).deletingLastPathComponent)
+                progressHandler?(path)
+                handle = try fileOpen(filename: remotePath + "/" + path, fileMode: .wrOnly)
+            case .data(let data):
+                if let handle = handle {
+                    _ = try fileWrite(handle: handle, data: data)
+                    total += UInt64(data.count)
+                }
+            case .end:
+                if let open = handle {
+                    handle = nil
+                    try fileClose(handle: open)
+                }
+            case .failure(let error):
+                throw error
+            }
+        }
+        return total
+    }
+
+    /// Incrementally synchronizes the local file or folder at `url` to the `remotePath` on the device.
+    ///
+    /// The remote tree is listed and compared against the local files by size and modification time (at one second granularity); only files that differ are transmitted, and the remote modification time is then set to match the local file so that the next sync will skip it.
+    ///
+    /// When a `manifest` from a previous sync is provided, the content hash of files whose modification time changed (e.g., after a clean CI build) is compared with the hash that was recorded when they were last transmitted, and identical files just have their modification time updated rather than being re-sent.
+    ///
+    /// - Parameters:
+    ///   - url: the local file or folder to synchronize
+    ///   - remotePath: the destination path on the device; the parent folder must already exist
+    ///   - manifest: the manifest returned from the previous sync to the same destination, if any
+    ///   - removeStale: whether to remove remote files and folders that do not exist locally
+    ///   - progressHandler: called with the relative path of each file as it is transmitted
+    /// - Returns: a summary of the changes, including an updated manifest for the next sync
+    @discardableResult public func synchronize(from url: URL, to remotePath: String, manifest: FileConduitSyncManifest? = nil, removeStale: Bool = true, progressHandler: ((String) -> Void)? = nil) throws -> FileConduitSyncSummary {
+        var summary = FileConduitSyncSummary()
+        summary.manifest = manifest ?? FileConduitSyncManifest()
+        let hashing = manifest != nil
+
+        let local = try FileConduitSyncEntry.localTree(at: url)
+        let remote = try remoteTree(at: remotePath, isDirectory: local[""]?.isDirectory == true)
+
+        /// Returns the absolute remote path for the given relative path
+        func absolute(_ relativePath: String) -> String {
+            relativePath.isEmpty ? remotePath : remotePath + "/" + relativePath
+        }
+
+        // first clear out stale remote items, as well as any whose type has changed; deepest paths first so contents are removed before their parent
+        for (relativePath, remoteEntry) in remote.sorted(by: { $0.key > $1.key }) {
+            let localEntry = local[relativePath]
+            if localEntry == nil && !removeStale {
+                continue
+            }
+            if localEntry == nil || localEntry?.isDirectory != remoteEntry.isDirectory {
+                if relativePath.contains("/") && local[(relativePath as NSString).deletingLastPathComponent] == nil {
+                    continue // the parent folder will itself be removed
+                }
+                let path = absolute(relativePath)
+                try removePathAndContents(path: path)
+                // forget the removed item along with anything that was recorded beneath it
+                let contents = path + "/"
+                summary.manifest.entries = summary.manifest.entries.filter { key, _ in
+                    key != path && !key.hasPrefix(contents)
+                }
+                summary.removed.append(relativePath)
+            }
+        }
+
+        // create missing folders, parents first
+        for (relativePath, localEntry) in local.sorted(by: { $0.key < $1.key }) where localEntry.isDirectory {
+            if remote[relativePath]?.isDirectory != true {
+                try makeDirectory(path: absolute(relativePath))
+            }
+        }
+
+        // transmit files whose size or modification time differ
+        for (relativePath, localEntry) in local.sorted(by: { $0.key < $1.key }) where !localEntry.isDirectory {
+            let path = absolute(relativePath)
+            let fileURL = relativePath.isEmpty ? url : url.appendingPathComponent(relativePath)
+            let recorded = summary.manifest.entries[path]
+
+            if let remoteEntry = remote[relativePath], !remoteEntry.isDirectory, remoteEntry.size == localEntry.size {
+                if remoteEntry.mtime / 1_000_000_000 == localEntry.mtime / 1_000_000_000 {
+                    summary.unchanged.append(relativePath)
+                    continue
+                }
+
+                // the remote file is still the one we last sent, so if the local contents hash the same, we only need to update the time
+                if hashing, let recorded = recorded, let recordedHash = recorded.hash, recorded.size == remoteEntry.size, recorded.mtime == remoteEntry.mtime {
+                    let hash = try FileConduitSyncEntry.contentHash(of: fileURL)
+                    if hash == recordedHash {
+                        try setFileTime(path: path, nanoseconds: localEntry.mtime)
+                        summary.manifest.entries[path] = .init(size: localEntry.size, mtime: localEntry.mtime, hash: hash)
+                        summary.touched.append(relativePath)
+                        continue
+                    }
+                }
+            }
+
+            progressHandler?(relativePath)
+            let handle = try fileOpen(filename: path, fileMode: .wrOnly)
+            try fileWrite(handle: handle, fileURL: fileURL, progressHandler: nil)
+            try fileClose(handle: handle)
+            try setFileTime(path: path, nanoseconds: localEntry.mtime)
+
+            let hash = try hashing ? FileConduitSyncEntry.contentHash(of: fileURL) : nil
+            summary.manifest.entries[path] = .init(size: localEntry.size, mtime: localEntry.mtime, hash: hash)
+            summary.uploaded.append(relativePath)
+            summary.bytesUploaded += localEntry.size
+        }
+
+        return summary
+    }
+
+    /// Lists the remote tree at the given path, keyed by the path relative to the root; the root itself is keyed by the empty string.
+    func remoteTree(at remotePath: String, isDirectory: Bool) throws -> [String: FileConduitSyncEntry] {
+        var entries: [String: FileConduitSyncEntry] = [:]
+
+        guard let rootInfo = try getFileInfo(paths: [remotePath]).first ?? nil else {
+            return entries // nothing on the remote side yet
+        }
+        let rootEntry = FileConduitSyncEntry(fileInfo: rootInfo)
+        entries[""] = rootEntry
+
+        if rootEntry.isDirectory && isDirectory {
+            let prefix = remotePath.hasSuffix("/") ? remotePath : remotePath + "/"
+            for info in try walk(path: remotePath) where info.path.hasPrefix(prefix) {
+                entries[String(info.path.dropFirst(prefix.count))] = FileConduitSyncEntry(fileInfo: info)
+            }
+        }
+        return entries
+    }
+}
+
+/// The outcome of a `FileConduit.synchronize` operation.
+public struct FileConduitSyncSummary {
+    /// The relative paths of files that were transmitted to the device
+    public var uploaded: [String] = []
+    /// The relative paths of files whose contents were unchanged, but whose modification time was updated
+    public var touched: [String] = []
+    /// The relative paths of files that were already up-to-date on the device
+    public var unchanged: [String] = []
+    /// The relative paths of files and folders that were removed from the device
+    public var removed: [String] = []
+    /// The total number of bytes that were transmitted
+    public var bytesUploaded: Int64 = 0
+    /// The manifest to pass to the next sync of the same destination
+    public var manifest = FileConduitSyncManifest()
+}
+
+/// A record of the files that were sent by `FileConduit.synchronize`, keyed by the remote path.
+public struct FileConduitSyncManifest: Codable {
+    public struct Entry: Codable {
+        /// The size of the file in bytes
+        public var size: Int64
+        /// The modification time that was set on the remote file, in nanoseconds since 1970
+        public var mtime: UInt64
+        /// The FNV-1a hash of the file contents
+        public var hash: UInt64?
+    }
+
+    public var entries: [String: Entry] = [:]
+
+    public init() {
+    }
+
+    /// Loads a manifest that was previously saved with `write(to:)`
+    public init(contentsOf url: URL) throws {
+        self = try JSONDecoder().decode(Self.self, from: Data(contentsOf: url))
+    }
+
+    /// Saves the manifest to the given file URL
+    public func write(to url: URL) throws {
+        try JSONEncoder().encode(self).write(to: url, options: .atomic)
+    }
+}
+
+/// The size and modification time of a local or remote file.
+struct FileConduitSyncEntry {
+    let isDirectory: Bool
+    let size: Int64
+    /// nanoseconds since 1970
+    let mtime: UInt64
+
+    init(isDirectory: Bool, size: Int64, mtime: UInt64) {
+        self.isDirectory = isDirectory
+        self.size = size
+        self.mtime = mtime
+    }
+
+    init(fileInfo: FileConduitFileInfo) {
+        self.isDirectory = fileInfo.type == .directory
+        self.size = Int64(fileInfo.size)
+        self.mtime = fileInfo.mtime
+    }
+
+    /// Lists the local tree at the given URL, keyed by the path relative to the root; the root itself is keyed by the empty string.
+    static func localTree(at url: URL) throws -> [String: FileConduitSyncEntry] {
+        let fm = FileManager.default
+
+        func entry(atPath path: String) throws -> FileConduitSyncEntry {
+            let attrs = try fm.attributesOfItem(atPath: path)
+            let date = attrs[.modificationDate] as? Date ?? Date(timeIntervalSince1970: 0)
+            return FileConduitSyncEntry(
+                isDirectory: attrs[.type] as? FileAttributeType == .typeDirectory,
+                size: (attrs[.size] as? NSNumber)?.int64Value ?? 0,
+                mtime: UInt64(max(0, date.timeIntervalSince1970) * 1_000_000_000))
+        }
+
+        var entries: [String: FileConduitSyncEntry] = [:]
+        let root = try entry(atPath: url.path)
+        entries[""] = root
+        if root.isDirectory, let enumerator = fm.enumerator(atPath: url.path) {
+            while let relativePath = enumerator.nextObject() as? String {
+                entries[relativePath] = try entry(atPath: url.appendingPathComponent(relativePath).path)
+            }
+        }
+        return entries
+    }
+
+    /// A 64-bit FNV-1a hash of the contents of the given file.
+    static func contentHash(of url: URL) throws -> UInt64 {
+        let data = try Data(contentsOf: url, options: .alwaysMapped)
+        return data.withUnsafeBytes { buffer in
+            var hash: UInt64 = 0xcbf29ce484222325
+            for byte in buffer {
+                hash ^= UInt64(byte)
+                hash = hash &* 0x100000001b3
+            }
+            return hash
+        }
+    }
 }
 
 
+/// The type of a file on the device.
+public enum FileConduitFileType: UInt32 {
+    case unknown = 0
+    case regular = 1
+    case directory = 2
+    case symlink = 3
+    case characterDevice = 4
+    case blockDevice = 5
+    case fifo = 6
+    case socket = 7
+}
+
+/// Information about a file on the device.
+public struct FileConduitFileInfo {
+    /// The fully-qualified path of the file
+    public let path: String
+    public let type: FileConduitFileType
+    /// The size of the file in bytes
+    public let size: UInt64
+    /// The number of blocks allocated for the file
+    public let blocks: UInt64
+    /// The number of hard links to the file
+    public let linkCount: UInt32
+    /// The modification time, in nanoseconds since 1970
+    public let mtime: UInt64
+    /// The creation time, in nanoseconds since 1970
+    public let birthtime: UInt64
+    /// The target of a symbolic link
+    public let linkTarget: String?
+
+    init(path: String, info: afc_file_info_t) {
+        self.path = path
+        self.type = FileConduitFileType(rawValue: .init(coercing: info.type.rawValue)) ?? .unknown
+        self.size = info.size
+        self.blocks = info.blocks
+        self.linkCount = info.nlink
+        self.mtime = info.mtime
+        self.birthtime = info.birthtime
+        self.linkTarget = info.link_target.flatMap { String(cString: $0) }
+    }
+
+    public var modificationDate: Date {
+        Date(timeIntervalSince1970: Double(mtime) / 1_000_000_000)
+    }
+
+    public var creationDate: Date {
+        Date(timeIntervalSince1970: Double(birthtime) / 1_000_000_000)
+    }
+}
+
 public enum FileConduitFileMode: UInt32 {
     case rdOnly = 0x00000001
     case rw = 0x00000002
@@ -3001,40 +3709,63 @@ private func parseLog(message: String) -> SyslogMessageSink? {
 /// A representation of an app installed on a device
 public struct InstalledAppInfo {
     public let rawValue: Plist
-    public let dict: [String: Plist]
 
     public init(rawValue: Plist) {
         self.rawValue = rawValue
+    }
 
+    /// All the properties of the app; prefer the individual accessors, which look up the single key in the underlying plist.
+    public var dict: [String: Plist] {
         let keyValues = rawValue.dictionary?.map { kv in
             (kv.key, kv.value)
         } ?? []
-
-        self.dict = Dictionary(keyValues, uniquingKeysWith: { $1 })
-
+        return Dictionary(keyValues, uniquingKeysWith: { $1 })
     }
 }
 
 public extension InstalledAppInfo {
-    var CFBundleIdentifier: String? { dict["CFBundleIdentifier"]?.string }
-    var CFBundleDevelopmentRegion: String? { dict["CFBundleDevelopmentRegion"]?.string }
-    var CFBundleDisplayName: String? { dict["CFBundleDisplayName"]?.string }
-    var CFBundleExecutable: String? { dict["CFBundleExecutable"]?.string }
-    var CFBundleName: String? { dict["CFBundleName"]?.string }
-    var ApplicationType: String? { dict["ApplicationType"]?.string }
-    var CFBundleShortVersionString: String? { dict["CFBundleShortVersionString"]?.string }
-    var CFBundleVersion: String? { dict["CFBundleVersion"]?.string }
+    var CFBundleIdentifier: String? { rawValue["CFBundleIdentifier"]?.string }
+    var CFBundleDevelopmentRegion: String? { rawValue["CFBundleDevelopmentRegion"]?.string }
+    var CFBundleDisplayName: String? { rawValue["CFBundleDisplayName"]?.string }
+    var CFBundleExecutable: String? { rawValue["CFBundleExecutable"]?.string }
+    var CFBundleName: String? { rawValue["CFBundleName"]?.string }
+    var ApplicationType: String? { rawValue["ApplicationType"]?.string }
+    var CFBundleShortVersionString: String? { rawValue["CFBundleShortVersionString"]?.string }
+    var CFBundleVersion: String? { rawValue["CFBundleVersion"]?.string }
+
+    /// E.g.: `/private/var/containers/Bundle/Application/<UUID>/Music.app`
+    var Path: String? { rawValue["Path"]?.string }
+
+    /// E.g.: `Apple iPhone OS Application Signing` or `TestFlight Beta Distribution`
+    var SignerIdentity: String? { rawValue["SignerIdentity"]?.string }
+
+    var IsDemotedApp: Bool? { rawValue["IsDemotedApp"]?.bool }
+    var IsHostBackupEligible: Bool? { rawValue["IsHostBackupEligible"]?.bool }
+    var IsUpgradeable: Bool? { rawValue["IsUpgradeable"]?.bool }
+    var IsAppClip: Bool? { rawValue["IsAppClip"]?.bool }
+}
+
+/// The properties of an installed app, decoded from an `InstallationProxy.browse` result with `PlistDecoder`.
+public struct InstalledApp: Decodable, Hashable {
+    public var CFBundleIdentifier: String
+    public var CFBundleDevelopmentRegion: String?
+    public var CFBundleDisplayName: String?
+    public var CFBundleExecutable: String?
+    public var CFBundleName: String?
+    public var ApplicationType: String?
+    public var CFBundleShortVersionString: String?
+    public var CFBundleVersion: String?
 
     /// E.g.: `/private/var/containers/Bundle/Application/<UUID>/Music.app`
-    var Path: String? { dict["Path"]?.string }
+    public var Path: String?
 
     /// E.g.: `Apple iPhone OS Application Signing` or `TestFlight Beta Distribution`
-    var SignerIdentity: String? { dict["SignerIdentity"]?.string }
+    public var SignerIdentity: String?
 
-    var IsDemotedApp: Bool? { dict["IsDemotedApp"]?.bool }
-    var IsHostBackupEligible: Bool? { dict["IsHostBackupEligible"]?.bool }
-    var IsUpgradeable: Bool? { dict["IsUpgradeable"]?.bool }
-    var IsAppClip: Bool? { dict["IsAppClip"]?.bool }
+    public var IsDemotedApp: Bool?
+    public var IsHostBackupEligible: Bool?
+    public var IsUpgradeable: Bool?
+    public var IsAppClip: Bool?
 }
 
 private extension UInt32 {
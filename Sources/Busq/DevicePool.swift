@@ -0,0 +1,388 @@
+/**
+ Copyright The Blunder Busq Contributors
+ SPDX-License-Identifier: AGPL-3.0
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+import Foundation
+import libimobiledevice
+
+/// A service client that a `DevicePool` can keep connected between uses.
+public protocol PooledServiceClient: AnyObject {
+    /// The lockdown service that the client connects to.
+    static var serviceIdentifier: AppleServiceIdentifier { get }
+
+    /// Starts the service with the given lockdown client and connects to it.
+    static func connect(lockdown: LockdownClient, escrow: Bool) throws -> Self
+
+    /// Performs a cheap round trip to check that an idle client is still usable.
+    func ping() -> Bool
+}
+
+extension FileConduit: PooledServiceClient {
+    public static var serviceIdentifier: AppleServiceIdentifier { .afc }
+
+    public static func connect(lockdown: LockdownClient, escrow: Bool) throws -> Self {
+        try Self(device: lockdown.device, service: lockdown.getService(service: serviceIdentifier, escrow: escrow))
+    }
+
+    public func ping() -> Bool {
+        (try? getDeviceInfo()) != nil
+    }
+}
+
+extension InstallationProxy: PooledServiceClient {
+    public static var serviceIdentifier: AppleServiceIdentifier { .installationProxy }
+
+    public static func connect(lockdown: LockdownClient, escrow: Bool) throws -> Self {
+        try Self(device: lockdown.device, service: lockdown.getService(service: serviceIdentifier, escrow: escrow))
+    }
+
+    /// Matching an empty capability list is answered without touching the app database.
+    public func ping() -> Bool {
+        var options = Plist(dictionary: [:])
+        defer { options.free() }
+        guard var result = try? checkCapabilitiesMatch(capabilities: [], options: options, result: options) else {
+            return false
+        }
+        result.free()
+        return true
+    }
+}
+
+/// Keeps lockdown sessions and service clients open for each attached device, and lends them out to callers.
+///
+/// Creating a client costs a usbmuxd connect, a TLS handshake and, for lockdown, a `StartSession` exchange. The pool hands out an idle client when one is available, and takes it back when the caller is finished with it. Idle clients are pinged before the device's 10 second inactivity timeout so they stay connected, and are closed once they have been idle for `maxIdleTime`, or as soon as their device is detached.
+///
+/// A client is only ever lent to one caller at a time; concurrent callers for the same device each get their own client.
+public final class DevicePool {
+    /// The pool shared by the process.
+    public static let shared = DevicePool()
+
+    /// The label that is sent to lockdownd for new sessions.
+    public let label: String
+    /// How devices are looked up when the pool connects to them for the first time.
+    public let options: DeviceLookupOptions
+    /// Whether services are started with the escrow bag from the pair record.
+    public let escrow: Bool
+
+    /// The largest number of idle clients that are kept for each device and service.
+    public var maxIdleClients: Int = 4
+    /// How often idle clients are pinged; this must be less than the 10 seconds after which the device drops an idle connection.
+    public var keepAliveInterval: TimeInterval = 4
+    /// How long a client may stay idle before it is closed.
+    public var maxIdleTime: TimeInterval = 120
+
+    fileprivate struct IdleClient {
+        let client: AnyObject
+        let idleSince: Date
+        var pinged: Date
+    }
+
+    fileprivate final class Entry {
+        let device: Device
+        var idle: [String: [IdleClient]] = [:]
+
+        init(device: Device) {
+            self.device = device
+        }
+    }
+
+    private let lock = NSLock()
+    private var entries: [String: Entry] = [:]
+    private var subscription: idevice_subscription_context_t?
+    private var timer: DispatchSourceTimer?
+    private let queue = DispatchQueue(label: "Busq.DevicePool")
+
+    public init(label: String = "Busq", options: DeviceLookupOptions = .usbmux, escrow: Bool = false) {
+        self.label = label
+        self.options = options
+        self.escrow = escrow
+
+        var context: idevice_subscription_context_t? = nil
+        let rawError = idevice_events_subscribe(&context, { (event, userData) in
+            guard let userData = userData,
+                  let rawEvent = event,
+                  let udid = rawEvent.pointee.udid else {
+                return
+            }
+            guard DeviceManager.EventType(rawValue: .init(coercing: rawEvent.pointee.event.rawValue)) == .remove else {
+                return
+            }
+            let pool = Unmanaged<DevicePool>.fromOpaque(userData).takeUnretainedValue()
+            // a removal over an unknown connection type evicts, to be safe
+            let connectionType = ConnectionType(rawValue: .init(coercing: rawEvent.pointee.conn_type.rawValue))
+            if connectionType.map(pool.looksUp) ?? true {
+                pool.evict(udid: String(cString: udid))
+            }
+        }, Unmanaged.passUnretained(self).toOpaque())
+        if rawError.rawValue != 0 {
+            debugPrint("error in idevice_events_subscribe: \(rawError)")
+        }
+        self.subscription = context
+    }
+
+    deinit {
+        if let subscription = subscription {
+            idevice_events_unsubscribe(subscription)
+        }
+        timer?.cancel()
+    }
+
+    /// A client lent out by the pool.
+    ///
+    /// Call `release()` to hand the client back for reuse once the work is done, or `invalidate()` if an error may have left the connection in an unknown state. A lease that is dropped without either closes its client.
+    public final class Lease<Client: AnyObject> {
+        public let client: Client
+        public let udid: String
+        private let key: String
+        private weak var pool: DevicePool?
+        private weak var entry: Entry?
+        private var settled = false
+
+        fileprivate init(client: Client, udid: String, key: String, pool: DevicePool, entry: Entry) {
+            self.client = client
+            self.udid = udid
+            self.key = key
+            self.pool = pool
+            self.entry = entry
+        }
+
+        /// Returns the client to the pool.
+        public func release() {
+            if settled {
+                return
+            }
+            settled = true
+            if let pool = pool, let entry = entry {
+                pool.checkIn(client, key: key, udid: udid, entry: entry)
+            }
+        }
+
+        /// Discards the client instead of returning it to the pool; it is closed once the last reference to it goes away.
+        public func invalidate() {
+            settled = true
+        }
+
+        deinit {
+            invalidate()
+        }
+    }
+
+    /// Lends out a lockdown client with a running session for the device.
+    public func lockdown(udid: String) throws -> Lease<LockdownClient> {
+        let entry = try self.entry(udid: udid)
+        if let client = checkOut(key: Self.lockdownKey, entry: entry, ping: { ($0 as? LockdownClient)?.ping() == true }) as? LockdownClient {
+            return Lease(client: client, udid: udid, key: Self.lockdownKey, pool: self, entry: entry)
+        }
+        let client = try entry.device.createLockdownClient(withHandshake: true, name: label)
+        return Lease(client: client, udid: udid, key: Self.lockdownKey, pool: self, entry: entry)
+    }
+
+    /// Lends out a client for the given service on the device, starting the service with a pooled lockdown session if no idle client is available.
+    public func service<Client: PooledServiceClient>(_ type: Client.Type, udid: String) throws -> Lease<Client> {
+        let entry = try self.entry(udid: udid)
+        let key = type.serviceIdentifier.rawValue
+        if let client = checkOut(key: key, entry: entry, ping: { ($0 as? Client)?.ping() == true }) as? Client {
+            return Lease(client: client, udid: udid, key: key, pool: self, entry: entry)
+        }
+        let client = try withLockdown(udid: udid) { lockdown in
+            try type.connect(lockdown: lockdown, escrow: escrow)
+        }
+        return Lease(client: client, udid: udid, key: key, pool: self, entry: entry)
+    }
+
+    /// Lends out a file conduit for the container (or the `Documents` folder) of the app with the given bundle identifier, vending it through `house_arrest` if no idle conduit is available.
+    public func container(appID: String, documents: Bool = false, udid: String) throws -> Lease<FileConduit> {
+        let entry = try self.entry(udid: udid)
+        let command = documents ? "VendDocuments" : "VendContainer"
+        let key = AppleServiceIdentifier.houseArrest.rawValue + "/" + command + "/" + appID
+        if let client = checkOut(key: key, entry: entry, ping: { ($0 as? FileConduit)?.ping() == true }) as? FileConduit {
+            return Lease(client: client, udid: udid, key: key, pool: self, entry: entry)
+        }
+        let houseArrest = try withLockdown(udid: udid) { lockdown in
+            try lockdown.createHouseArrestClient(escrow: escrow)
+        }
+        try houseArrest.sendCommand(command: command, appid: appID)
+        var result = try houseArrest.getResult()
+        defer { result.free() }
+        if result[key: "Error"] != nil {
+            throw HouseArrestError.invalidMode
+        }
+        let client = try FileConduit(houseArrest: houseArrest)
+        return Lease(client: client, udid: udid, key: key, pool: self, entry: entry)
+    }
+
+    /// Performs the closure with a pooled lockdown client, which is returned to the pool unless the closure throws.
+    public func withLockdown<T>(udid: String, body: (LockdownClient) throws -> T) throws -> T {
+        let lease = try lockdown(udid: udid)
+        let result = try body(lease.client)
+        lease.release()
+        return result
+    }
+
+    /// Performs the closure with a pooled service client, which is returned to the pool unless the closure throws.
+    public func withService<Client: PooledServiceClient, T>(_ type: Client.Type, udid: String, body: (Client) throws -> T) throws -> T {
+        let lease = try service(type, udid: udid)
+        let result = try body(lease.client)
+        lease.release()
+        return result
+    }
+
+    /// Closes the idle clients for the device and forgets it; clients that are currently lent out are closed when they are returned.
+    public func evict(udid: String) {
+        lock.lock()
+        let entry = entries.removeValue(forKey: udid)
+        lock.unlock()
+        let _ = entry // the idle clients are freed here, outside the lock
+    }
+
+    /// Closes every idle client.
+    public func drain() {
+        lock.lock()
+        let evicted = entries
+        entries.removeAll()
+        lock.unlock()
+        let _ = evicted
+    }
+
+    private static let lockdownKey = "lockdown"
+
+    /// Whether the pool's devices may be connected over the given connection type, so that losing it drops their sessions; e.g. a USB pool keeps its sessions when the device leaves the WiFi network.
+    private func looksUp(_ connectionType: ConnectionType) -> Bool {
+        switch connectionType {
+        case .usbmuxd:
+            return options.contains(.usbmux)
+        case .network:
+            return options.contains(.network)
+        }
+    }
+
+    private func entry(udid: String) throws -> Entry {
+        lock.lock()
+        if let entry = entries[udid] {
+            lock.unlock()
+            return entry
+        }
+        lock.unlock()
+
+        let entry = Entry(device: try Device(udid: udid, options: options))
+        lock.lock()
+        defer { lock.unlock() }
+        if let existing = entries[udid] { // another caller connected first
+            return existing
+        }
+        entries[udid] = entry
+        return entry
+    }
+
+    /// Takes the most recently used idle client for the key, pinging it first if it has been a while since it was last known to be alive.
+    private func checkOut(key: String, entry: Entry, ping: (AnyObject) -> Bool) -> AnyObject? {
+        while true {
+            lock.lock()
+            guard let idle = entry.idle[key]?.popLast() else {
+                lock.unlock()
+                return nil
+            }
+            lock.unlock()
+
+            if Date().timeIntervalSince(idle.pinged) < keepAliveInterval || ping(idle.client) {
+                return idle.client
+            }
+        }
+    }
+
+    fileprivate func checkIn(_ client: AnyObject, key: String, udid: String, entry: Entry) {
+        lock.lock()
+        defer { lock.unlock() }
+        guard entries[udid] === entry, entry.idle[key, default: []].count < maxIdleClients else {
+            return // the device was detached, or enough clients are already idle
+        }
+        let now = Date()
+        entry.idle[key, default: []].append(IdleClient(client: client, idleSince: now, pinged: now))
+        startKeepAlive()
+    }
+
+    /// Must be called with the lock held.
+    private func startKeepAlive() {
+        if timer != nil {
+            return
+        }
+        let timer = DispatchSource.makeTimerSource(queue: queue)
+        timer.schedule(deadline: .now() + keepAliveInterval, repeating: keepAliveInterval)
+        timer.setEventHandler { [weak self] in
+            self?.keepAlive()
+        }
+        timer.resume()
+        self.timer = timer
+    }
+
+    /// Pings the idle clients that are due, and drops the ones that fail or have been idle for too long.
+    private func keepAlive() {
+        let now = Date()
+        var due: [(entry: Entry, key: String, idle: IdleClient)] = []
+
+        lock.lock()
+        for entry in entries.values {
+            for (key, clients) in entry.idle {
+                var kept: [IdleClient] = []
+                for idle in clients {
+                    if now.timeIntervalSince(idle.idleSince) >= maxIdleTime {
+                        continue
+                    } else if now.timeIntervalSince(idle.pinged) >= keepAliveInterval * 0.75 {
+                        due.append((entry, key, idle))
+                    } else {
+                        kept.append(idle)
+                    }
+                }
+                entry.idle[key] = kept
+            }
+        }
+        if due.isEmpty && entries.values.allSatisfy({ $0.idle.values.allSatisfy(\.isEmpty) }) {
+            timer?.cancel()
+            timer = nil
+        }
+        lock.unlock()
+
+        // the due clients are out of the idle lists, so nobody can check them out while they are pinged
+        var alive: [(entry: Entry, key: String, idle: IdleClient)] = []
+        for var item in due {
+            let ok: Bool
+            if let lockdown = item.idle.client as? LockdownClient {
+                ok = lockdown.ping()
+            } else if let service = item.idle.client as? PooledServiceClient {
+                ok = service.ping()
+            } else {
+                ok = false
+            }
+            if ok {
+                item.idle.pinged = Date()
+                alive.append(item)
+            }
+        }
+
+        lock.lock()
+        for item in alive where entries.values.contains(where: { $0 === item.entry }) {
+            item.entry.idle[item.key, default: []].insert(item.idle, at: 0)
+        }
+        lock.unlock()
+    }
+}
+
+extension LockdownClient {
+    /// Checks that the lockdown connection is still usable with a `QueryType` round trip.
+    func ping() -> Bool {
+        (try? getQueryType()) != nil
+    }
+}
@@ -0,0 +1,329 @@
+/**
+ Copyright The Blunder Busq Contributors
+ SPDX-License-Identifier: AGPL-3.0
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+import Foundation
+import libplist
+
+/// Decodes `Decodable` values directly from a `Plist` node tree.
+///
+/// Values are read straight from the C nodes: dictionary entries are looked up by key as they are requested, and strings and data are copied once out of the node buffers, so no intermediate `[String: Plist]` dictionaries are built.
+///
+/// ```
+/// let apps = try PlistDecoder().decode([InstalledApp].self, from: browseResult)
+/// ```
+public struct PlistDecoder {
+    /// Contextual information to expose during decoding
+    public var userInfo: [CodingUserInfoKey: Any] = [:]
+
+    public init() {
+    }
+
+    /// Decodes a value of the given type from the given plist node.
+    public func decode<T: Decodable>(_ type: T.Type, from plist: Plist) throws -> T {
+        try PlistNodeDecoder(node: plist.rawValue, codingPath: [], userInfo: userInfo).unbox(type)
+    }
+}
+
+private struct PlistNodeDecoder: Decoder {
+    let node: plist_t?
+    let codingPath: [CodingKey]
+    let userInfo: [CodingUserInfoKey: Any]
+
+    func container<Key: CodingKey>(keyedBy type: Key.Type) throws -> KeyedDecodingContainer<Key> {
+        guard plist_get_node_type(node) == PLIST_DICT else {
+            throw typeMismatch([String: Any].self)
+        }
+        return KeyedDecodingContainer(PlistKeyedContainer<Key>(decoder: self))
+    }
+
+    func unkeyedContainer() throws -> UnkeyedDecodingContainer {
+        guard plist_get_node_type(node) == PLIST_ARRAY else {
+            throw typeMismatch([Any].self)
+        }
+        return PlistUnkeyedContainer(decoder: self)
+    }
+
+    func singleValueContainer() throws -> SingleValueDecodingContainer {
+        PlistSingleValueContainer(decoder: self)
+    }
+
+    func child(_ node: plist_t?, key: CodingKey) -> PlistNodeDecoder {
+        PlistNodeDecoder(node: node, codingPath: codingPath + [key], userInfo: userInfo)
+    }
+
+    func typeMismatch(_ type: Any.Type) -> DecodingError {
+        let found = PlistType(rawValue: plist_get_node_type(node))
+        return DecodingError.typeMismatch(type, DecodingError.Context(codingPath: codingPath, debugDescription: "Expected \(type) but found a plist node of type \(found)"))
+    }
+
+    // MARK: Values
+
+    var isNull: Bool {
+        node == nil || plist_get_node_type(node) == PLIST_NONE
+    }
+
+    func unboxBool() throws -> Bool {
+        guard plist_get_node_type(node) == PLIST_BOOLEAN else {
+            throw typeMismatch(Bool.self)
+        }
+        var value: UInt8 = 0
+        plist_get_bool_val(node, &value)
+        return value != 0
+    }
+
+    func unboxString() throws -> String {
+        var length: UInt64 = 0
+        guard let value = plist_get_string_ptr(node, &length) else {
+            throw typeMismatch(String.self)
+        }
+        return String(decoding: UnsafeRawBufferPointer(start: value, count: Int(length)), as: UTF8.self)
+    }
+
+    func unboxDouble() throws -> Double {
+        switch plist_get_node_type(node) {
+        case PLIST_REAL:
+            var value: Double = 0
+            plist_get_real_val(node, &value)
+            return value
+        case PLIST_UINT:
+            var value: UInt64 = 0
+            plist_get_uint_val(node, &value)
+            return Double(Int64(bitPattern: value))
+        default:
+            throw typeMismatch(Double.self)
+        }
+    }
+
+    func unboxInteger<T: FixedWidthInteger>(_ type: T.Type) throws -> T {
+        guard plist_get_node_type(node) == PLIST_UINT else {
+            throw typeMismatch(type)
+        }
+        var value: UInt64 = 0
+        plist_get_uint_val(node, &value)
+        // integers are stored as 64-bit two's complement values
+        guard let result = T.isSigned ? T(exactly: Int64(bitPattern: value)) : T(exactly: value) else {
+            throw DecodingError.dataCorrupted(DecodingError.Context(codingPath: codingPath, debugDescription: "Number \(value) does not fit in \(type)"))
+        }
+        return result
+    }
+
+    func unboxData() throws -> Data {
+        var length: UInt64 = 0
+        guard let value = plist_get_data_ptr(node, &length) else {
+            throw typeMismatch(Data.self)
+        }
+        return Data(bytes: UnsafeRawPointer(value), count: Int(length))
+    }
+
+    func unboxDate() throws -> Date {
+        guard plist_get_node_type(node) == PLIST_DATE else {
+            throw typeMismatch(Date.self)
+        }
+        var sec: Int32 = 0
+        var usec: Int32 = 0
+        plist_get_date_val(node, &sec, &usec)
+        return Date(timeIntervalSinceReferenceDate: Double(sec) + Double(usec) / 1000000)
+    }
+
+    func unbox<T: Decodable>(_ type: T.Type) throws -> T {
+        // types that have a native plist representation
+        if type == Data.self {
+            return try unboxData() as! T
+        } else if type == Date.self {
+            return try unboxDate() as! T
+        }
+        return try T(from: self)
+    }
+}
+
+private struct PlistKeyedContainer<Key: CodingKey>: KeyedDecodingContainerProtocol {
+    let decoder: PlistNodeDecoder
+
+    var codingPath: [CodingKey] {
+        decoder.codingPath
+    }
+
+    var allKeys: [Key] {
+        var keys: [Key] = []
+        var iter: plist_dict_iter? = nil
+        plist_dict_new_iter(decoder.node, &iter)
+        defer { iter?.deallocate() }
+        while true {
+            var item: plist_t? = nil
+            plist_dict_next_item(decoder.node, iter, nil, &item)
+            guard let value = item else {
+                break
+            }
+            if let name = plist_get_key_ptr(plist_dict_item_get_key(value), nil), let key = Key(stringValue: String(cString: name)) {
+                keys.append(key)
+            }
+        }
+        return keys
+    }
+
+    func contains(_ key: Key) -> Bool {
+        plist_dict_get_item(decoder.node, key.stringValue) != nil
+    }
+
+    private func child(_ key: Key) throws -> PlistNodeDecoder {
+        guard let node = plist_dict_get_item(decoder.node, key.stringValue) else {
+            throw DecodingError.keyNotFound(key, DecodingError.Context(codingPath: codingPath, debugDescription: "No value associated with key \"\(key.stringValue)\""))
+        }
+        return decoder.child(node, key: key)
+    }
+
+    func decodeNil(forKey key: Key) throws -> Bool {
+        decoder.child(plist_dict_get_item(decoder.node, key.stringValue), key: key).isNull
+    }
+
+    func decode(_ type: Bool.Type, forKey key: Key) throws -> Bool { try child(key).unboxBool() }
+    func decode(_ type: String.Type, forKey key: Key) throws -> String { try child(key).unboxString() }
+    func decode(_ type: Double.Type, forKey key: Key) throws -> Double { try child(key).unboxDouble() }
+    func decode(_ type: Float.Type, forKey key: Key) throws -> Float { Float(try child(key).unboxDouble()) }
+    func decode(_ type: Int.Type, forKey key: Key) throws -> Int { try child(key).unboxInteger(type) }
+    func decode(_ type: Int8.Type, forKey key: Key) throws -> Int8 { try child(key).unboxInteger(type) }
+    func decode(_ type: Int16.Type, forKey key: Key) throws -> Int16 { try child(key).unboxInteger(type) }
+    func decode(_ type: Int32.Type, forKey key: Key) throws -> Int32 { try child(key).unboxInteger(type) }
+    func decode(_ type: Int64.Type, forKey key: Key) throws -> Int64 { try child(key).unboxInteger(type) }
+    func decode(_ type: UInt.Type, forKey key: Key) throws -> UInt { try child(key).unboxInteger(type) }
+    func decode(_ type: UInt8.Type, forKey key: Key) throws -> UInt8 { try child(key).unboxInteger(type) }
+    func decode(_ type: UInt16.Type, forKey key: Key) throws -> UInt16 { try child(key).unboxInteger(type) }
+    func decode(_ type: UInt32.Type, forKey key: Key) throws -> UInt32 { try child(key).unboxInteger(type) }
+    func decode(_ type: UInt64.Type, forKey key: Key) throws -> UInt64 { try child(key).unboxInteger(type) }
+    func decode<T: Decodable>(_ type: T.Type, forKey key: Key) throws -> T { try child(key).unbox(type) }
+
+    func nestedContainer<NestedKey: CodingKey>(keyedBy type: NestedKey.Type, forKey key: Key) throws -> KeyedDecodingContainer<NestedKey> {
+        try child(key).container(keyedBy: type)
+    }
+
+    func nestedUnkeyedContainer(forKey key: Key) throws -> UnkeyedDecodingContainer {
+        try child(key).unkeyedContainer()
+    }
+
+    func superDecoder() throws -> Decoder {
+        decoder
+    }
+
+    func superDecoder(forKey key: Key) throws -> Decoder {
+        try child(key)
+    }
+}
+
+private struct PlistIndexKey: CodingKey {
+    let intValue: Int?
+    var stringValue: String { "Index \(intValue ?? 0)" }
+
+    init(intValue: Int) {
+        self.intValue = intValue
+    }
+
+    init?(stringValue: String) {
+        return nil
+    }
+}
+
+private struct PlistUnkeyedContainer: UnkeyedDecodingContainer {
+    let decoder: PlistNodeDecoder
+    let count: Int?
+    private(set) var currentIndex = 0
+
+    init(decoder: PlistNodeDecoder) {
+        self.decoder = decoder
+        self.count = Int(plist_array_get_size(decoder.node))
+    }
+
+    var codingPath: [CodingKey] {
+        decoder.codingPath
+    }
+
+    var isAtEnd: Bool {
+        currentIndex >= (count ?? 0)
+    }
+
+    private mutating func next() throws -> PlistNodeDecoder {
+        guard !isAtEnd else {
+            throw DecodingError.valueNotFound(Any.self, DecodingError.Context(codingPath: codingPath + [PlistIndexKey(intValue: currentIndex)], debugDescription: "Unkeyed container is at end"))
+        }
+        let child = decoder.child(plist_array_get_item(decoder.node, UInt32(currentIndex)), key: PlistIndexKey(intValue: currentIndex))
+        currentIndex += 1
+        return child
+    }
+
+    mutating func decodeNil() throws -> Bool {
+        guard !isAtEnd else {
+            return false
+        }
+        let isNull = decoder.child(plist_array_get_item(decoder.node, UInt32(currentIndex)), key: PlistIndexKey(intValue: currentIndex)).isNull
+        if isNull {
+            currentIndex += 1
+        }
+        return isNull
+    }
+
+    mutating func decode(_ type: Bool.Type) throws -> Bool { try next().unboxBool() }
+    mutating func decode(_ type: String.Type) throws -> String { try next().unboxString() }
+    mutating func decode(_ type: Double.Type) throws -> Double { try next().unboxDouble() }
+    mutating func decode(_ type: Float.Type) throws -> Float { Float(try next().unboxDouble()) }
+    mutating func decode(_ type: Int.Type) throws -> Int { try next().unboxInteger(type) }
+    mutating func decode(_ type: Int8.Type) throws -> Int8 { try next().unboxInteger(type) }
+    mutating func decode(_ type: Int16.Type) throws -> Int16 { try next().unboxInteger(type) }
+    mutating func decode(_ type: Int32.Type) throws -> Int32 { try next().unboxInteger(type) }
+    mutating func decode(_ type: Int64.Type) throws -> Int64 { try next().unboxInteger(type) }
+    mutating func decode(_ type: UInt.Type) throws -> UInt { try next().unboxInteger(type) }
+    mutating func decode(_ type: UInt8.Type) throws -> UInt8 { try next().unboxInteger(type) }
+    mutating func decode(_ type: UInt16.Type) throws -> UInt16 { try next().unboxInteger(type) }
+    mutating func decode(_ type: UInt32.Type) throws -> UInt32 { try next().unboxInteger(type) }
+    mutating func decode(_ type: UInt64.Type) throws -> UInt64 { try next().unboxInteger(type) }
+    mutating func decode<T: Decodable>(_ type: T.Type) throws -> T { try next().unbox(type) }
+
+    mutating func nestedContainer<NestedKey: CodingKey>(keyedBy type: NestedKey.Type) throws -> KeyedDecodingContainer<NestedKey> {
+        try next().container(keyedBy: type)
+    }
+
+    mutating func nestedUnkeyedContainer() throws -> UnkeyedDecodingContainer {
+        try next().unkeyedContainer()
+    }
+
+    mutating func superDecoder() throws -> Decoder {
+        try next()
+    }
+}
+
+private struct PlistSingleValueContainer: SingleValueDecodingContainer {
+    let decoder: PlistNodeDecoder
+
+    var codingPath: [CodingKey] {
+        decoder.codingPath
+    }
+
+    func decodeNil() -> Bool { decoder.isNull }
+    func decode(_ type: Bool.Type) throws -> Bool { try decoder.unboxBool() }
+    func decode(_ type: String.Type) throws -> String { try decoder.unboxString() }
+    func decode(_ type: Double.Type) throws -> Double { try decoder.unboxDouble() }
+    func decode(_ type: Float.Type) throws -> Float { Float(try decoder.unboxDouble()) }
+    func decode(_ type: Int.Type) throws -> Int { try decoder.unboxInteger(type) }
+    func decode(_ type: Int8.Type) throws -> Int8 { try decoder.unboxInteger(type) }
+    func decode(_ type: Int16.Type) throws -> Int16 { try decoder.unboxInteger(type) }
+    func decode(_ type: Int32.Type) throws -> Int32 { try decoder.unboxInteger(type) }
+    func decode(_ type: Int64.Type) throws -> Int64 { try decoder.unboxInteger(type) }
+    func decode(_ type: UInt.Type) throws -> UInt { try decoder.unboxInteger(type) }
+    func decode(_ type: UInt8.Type) throws -> UInt8 { try decoder.unboxInteger(type) }
+    func decode(_ type: UInt16.Type) throws -> UInt16 { try decoder.unboxInteger(type) }
+    func decode(_ type: UInt32.Type) throws -> UInt32 { try decoder.unboxInteger(type) }
+    func decode(_ type: UInt64.Type) throws -> UInt64 { try decoder.unboxInteger(type) }
+    func decode<T: Decodable>(_ type: T.Type) throws -> T { try decoder.unbox(type) }
+}
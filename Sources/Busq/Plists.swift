@@ -148,15 +148,9 @@ public extension Plist {
 
     var key: String? {
         get {
-            guard nodeType == .key else {
+            guard let key = plist_get_key_ptr(rawValue, nil) else {
                 return nil
             }
-            var pkey: UnsafeMutablePointer<Int8>? = nil
-            plist_get_key_val(rawValue, &pkey)
-            guard let key = pkey else {
-                return nil
-            }
-            defer { key.deallocate() }
             return String(cString: key)
         }
         set {
@@ -169,16 +163,11 @@ public extension Plist {
 
     var string: String? {
         get {
-            guard nodeType == .string else {
-                return nil
-            }
-            var pkey: UnsafeMutablePointer<Int8>? = nil
-            plist_get_string_val(rawValue, &pkey)
-            guard let key = pkey else {
+            var length: UInt64 = 0
+            guard let value = plist_get_string_ptr(rawValue, &length) else {
                 return nil
             }
-            defer { key.deallocate() }
-            return String(cString: key)
+            return String(decoding: UnsafeRawBufferPointer(start: value, count: Int(length)), as: UTF8.self)
         }
         set {
             guard let string = newValue else {
@@ -226,16 +215,10 @@ public extension Plist {
 
     var data: Data? {
         get {
-            guard nodeType == .data else {
-                return nil
-            }
-            var pvalue: UnsafeMutablePointer<Int8>? = nil
             var length: UInt64 = 0
-            plist_get_data_val(rawValue, &pvalue, &length)
-            guard let value = pvalue else {
+            guard let value = plist_get_data_ptr(rawValue, &length) else {
                 return nil
             }
-            defer { value.deallocate() }
             return Data(bytes: UnsafeRawPointer(value), count: Int(length))
         }
         set {
@@ -304,6 +287,30 @@ public extension Plist {
 }
 
 
+public extension Plist {
+    /// Calls the given closure with the bytes of a string, key or data node, without copying them.
+    ///
+    /// The buffer is only valid for the duration of the closure and must not be modified. Returns `nil` for nodes of other types.
+    func withUnsafeValueBytes<R>(_ body: (UnsafeRawBufferPointer) throws -> R) rethrows -> R? {
+        var length: UInt64 = 0
+        let pointer: UnsafePointer<Int8>?
+        switch nodeType {
+        case .string:
+            pointer = plist_get_string_ptr(rawValue, &length)
+        case .key:
+            pointer = plist_get_key_ptr(rawValue, &length)
+        case .data:
+            pointer = plist_get_data_ptr(rawValue, &length)
+        default:
+            return nil
+        }
+        guard let pointer = pointer else {
+            return nil
+        }
+        return try body(UnsafeRawBufferPointer(start: pointer, count: Int(length)))
+    }
+}
+
 public extension Plist {
     static func copy(from node: Self) -> Self {
         return node
@@ -346,7 +353,7 @@ public extension Plist {
 
 extension Plist: Equatable {
     public static func == (lhs: Self, rhs: Self) -> Bool {
-        plist_compare_node_value(lhs.rawValue, rhs.rawValue) > 0
+        plist_equal(lhs.rawValue, rhs.rawValue) != 0
     }
 }
 
@@ -378,6 +385,29 @@ public extension Plist {
         self.rawValue = rawValue
     }
 
+    init?(json: String) {
+        let length = json.utf8CString.count
+        var prawValue: plist_t? = nil
+        plist_from_json(json, UInt32(length), &prawValue)
+        guard let rawValue = prawValue else {
+            return nil
+        }
+        self.rawValue = rawValue
+    }
+
+    /// Returns the JSON representation of the plist, or `nil` if it holds nodes that JSON cannot express, such as data or dates.
+    func json(prettify: Bool = false) -> String? {
+        var pjson: UnsafeMutablePointer<Int8>? = nil
+        var length: UInt32 = 0
+        plist_to_json(rawValue, &pjson, &length, prettify ? 1 : 0)
+        guard let json = pjson else {
+            return nil
+        }
+
+        defer { plist_mem_free(json) }
+        return String(cString: json)
+    }
+
     init?(memory: String) {
         let length = memory.utf8CString.count
         var prawValue: plist_t? = nil
@@ -502,10 +532,9 @@ public struct PlistDictIterator: IteratorProtocol {
     }
 
     public func next() -> (key: String, value:Plist)? {
-        var pkey: UnsafeMutablePointer<Int8>? = nil
         var pitem: plist_t? = nil
-        plist_dict_next_item(node.plist.rawValue, rawValue, &pkey, &pitem)
-        guard let key = pkey, let plist = Plist(nillableValue: pitem) else {
+        plist_dict_next_item(node.plist.rawValue, rawValue, nil, &pitem)
+        guard let plist = Plist(nillableValue: pitem), let key = plist_get_key_ptr(plist_dict_item_get_key(pitem), nil) else {
             return nil
         }
         return (String(cString: key), plist)
@@ -539,13 +568,9 @@ public extension Plist {
     }
 
     func getItemKey() -> String? {
-        var pkey: UnsafeMutablePointer<Int8>? = nil
-        plist_dict_get_item_key(rawValue, &pkey)
-
-        guard let key = pkey else {
+        guard let key = plist_get_key_ptr(plist_dict_item_get_key(rawValue), nil) else {
             return nil
         }
-        defer { key.deallocate() }
         return String(cString: key)
     }
 
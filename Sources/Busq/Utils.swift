@@ -26,55 +26,78 @@ extension FileManager {
     ///   - recompress: whether to re-zip the files after signing or just return the extracted URL
     /// - Returns: the resulting signed artifact
     ///
-    /// - Note: only implemented on macOS, since it forks `/usr/bin/zip` and `/usr/bin/codesign`;
-    /// all other platforms currently throw `CocoaError(.featureUnsupported)`
+    /// The archive is extracted and repackaged in-process with `ZipArchive` and `ZipWriter`; when repackaging, files that were not changed by signing are copied over without being recompressed.
+    ///
+    /// - Note: signing forks `/usr/bin/codesign`, which is only available on macOS; other platforms throw `CocoaError(.featureUnsupported)` without extracting anything
     public func prepareIPA(_ url: URL, identity: String, teamID: String, recompress: Bool) throws -> URL {
         #if !os(macOS)
         throw CocoaError(.featureUnsupported)
         #else
         let baseDir = URL(fileURLWithPath: UUID().uuidString, isDirectory: true, relativeTo: URL(fileURLWithPath: NSTemporaryDirectory()))
 
-        let outputDir = URL(fileURLWithPath: url.deletingPathExtension().lastPathComponent, isDirectory: true, relativeTo: baseDir)
-        try self.createDirectory(at: outputDir, withIntermediateDirectories: true, attributes: nil)
-
-        //print("extracting ipa to:", outputDir.path)
+        do {
+            let outputDir = URL(fileURLWithPath: url.deletingPathExtension().lastPathComponent, isDirectory: true, relativeTo: baseDir)
+            try self.createDirectory(at: outputDir, withIntermediateDirectories: true, attributes: nil)
 
-        // extract the file
+            //print("extracting ipa to:", outputDir.path)
 
-        try shell("/usr/bin/unzip", args: ["-o", "-q", url.path, "-d", outputDir.path])
+            // extract the file
+            let archive = try ZipArchive(url: url)
+            try archive.extractAll(to: outputDir)
 
-        print("unzipped to", outputDir.path)
-        try signFolder(outputDir, identity: identity, teamID: teamID)
+            print("unzipped to", outputDir.path)
+            try signFolder(outputDir, identity: identity, teamID: teamID)
 
-        if !recompress {
-            // just upload the output folder directly
-            return outputDir
-        } else {
-            // repackage as an IPA so we can just send a single file
-            // surprisingly, this seems to be slower than sending the expanded ipa directly
-            let repackaged = outputDir.appendingPathExtension("ipa")
-            //print("re-packaging signed ipa to:", repackaged.path)
-
-            // zip cannot trim path components unless it is in the current directoy;
-            // so we need to create a bogus script and execute that instead
-            let script = """
-            #!/bin/sh
-            cd '\(outputDir.path)'
-            /usr/bin/zip -ru '\(repackaged.path)' Payload
-            """
+            if !recompress {
+                // just upload the output folder directly
+                return outputDir
+            } else {
+                // repackage as an IPA so we can just send a single file
+                let repackaged = outputDir.appendingPathExtension("ipa")
+                //print("re-packaging signed ipa to:", repackaged.path)
+                try repackageFolder(outputDir, to: repackaged, reusing: archive)
+                return repackaged
+            }
+        } catch {
+            // don't leave a partially extracted or signed copy behind
+            try? self.removeItem(at: baseDir)
+            throw error
+        }
+        #endif
+    }
 
-            let zipScript = URL(fileURLWithPath: UUID().uuidString, isDirectory: true, relativeTo: URL(fileURLWithPath: NSTemporaryDirectory())).appendingPathExtension("sh")
-            try script.write(to: zipScript, atomically: true, encoding: .utf8)
+    /// Packages the contents of the folder (e.g., the `Payload` folder of an extracted .ipa) into a new zip archive.
+    ///
+    /// - Parameters:
+    ///   - folder: the folder whose contents will be at the root of the archive
+    ///   - archiveURL: the archive to create
+    ///   - original: the archive that the folder was extracted from, if any; files whose size and CRC-32 are unchanged are copied from it verbatim rather than being stored uncompressed
+    public func repackageFolder(_ folder: URL, to archiveURL: URL, reusing original: ZipArchive? = nil) throws {
+        let root = folder.standardizedFileURL.path
+        guard let paths = self.enumerator(atPath: root)?.compactMap({ $0 as? String }) else {
+            throw CocoaError(.fileReadUnknown)
+        }
 
-            // doesn't work with sandbox
-            // try self.setAttributes([.posixPermissions: NSNumber(value: 0o777)], ofItemAtPath: zipScript.path)
+        var originals: [String: ZipArchive.Entry] = [:]
+        for entry in original?.entries ?? [] {
+            originals[(try? ZipArchive.sanitize(entry.path)) ?? entry.path] = entry
+        }
 
-            //print("zipScript:", zipScript.path)
-            try shell("/bin/sh", args: [zipScript.path])
-            
-            return repackaged
+        let writer = try ZipWriter(url: archiveURL)
+        for path in paths.sorted() {
+            let fullPath = root + "/" + path
+            let attrs = try self.attributesOfItem(atPath: fullPath)
+            let date = attrs[.modificationDate] as? Date ?? Date()
+            switch attrs[.type] as? FileAttributeType {
+            case .typeDirectory?:
+                try writer.addDirectory(path: path, permissions: (attrs[.posixPermissions] as? NSNumber)?.intValue ?? 0o755, modificationDate: date)
+            case .typeSymbolicLink?:
+                try writer.addSymbolicLink(path: path, target: self.destinationOfSymbolicLink(atPath: fullPath), modificationDate: date)
+            default:
+                try writer.addFile(path: path, contentsOf: URL(fileURLWithPath: fullPath), reusing: original.flatMap { archive in originals[path].map { (archive: archive, entry: $0) } })
+            }
         }
-        #endif
+        try writer.finish()
     }
 
     /// Codesigns the nested `.app` and `.framework` folders in the given directory.
@@ -270,3 +293,54 @@ extension FileManager {
     return output
     #endif
 }
+
+/// A blocking first-in-first-out queue with a fixed capacity, for handing work from a producer thread to a consumer thread.
+///
+/// `push` blocks while the queue is full and `pop` blocks while it is empty; once either side calls `close`, pushes are rejected and `pop` returns `nil` when the remaining elements have been drained.
+final class BoundedQueue<Element> {
+    private let condition = NSCondition()
+    private let capacity: Int
+    private var elements: [Element] = []
+    private var closed = false
+
+    init(capacity: Int) {
+        self.capacity = capacity
+    }
+
+    /// Appends the element, waiting for space if needed; returns false if the queue has been closed.
+    @discardableResult func push(_ element: Element) -> Bool {
+        condition.lock()
+        defer { condition.unlock() }
+        while !closed && elements.count >= capacity {
+            condition.wait()
+        }
+        if closed {
+            return false
+        }
+        elements.append(element)
+        condition.broadcast()
+        return true
+    }
+
+    /// Removes the oldest element, waiting for one if needed; returns nil once the queue is closed and empty.
+    func pop() -> Element? {
+        condition.lock()
+        defer { condition.unlock() }
+        while !closed && elements.isEmpty {
+            condition.wait()
+        }
+        if elements.isEmpty {
+            return nil
+        }
+        let element = elements.removeFirst() // the capacity is small, so shifting is cheap
+        condition.broadcast()
+        return element
+    }
+
+    func close() {
+        condition.lock()
+        closed = true
+        condition.broadcast()
+        condition.unlock()
+    }
+}
@@ -0,0 +1,1021 @@
+/**
+ Copyright The Blunder Busq Contributors
+ SPDX-License-Identifier: AGPL-3.0
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+import Foundation
+
+public enum ZipArchiveError: Error {
+    /// The file does not have a zip end of central directory record
+    case notAnArchive
+    /// The archive structure or a compressed stream is malformed
+    case corruptArchive(String)
+    /// The entry uses a compression method other than stored (0) or deflate (8)
+    case unsupportedCompression(path: String, method: UInt16)
+    /// The entry is encrypted or spans multiple disks
+    case unsupportedFeature(path: String)
+    /// The entry path is absolute or escapes the extraction folder
+    case unsafePath(String)
+    /// The extracted size or CRC-32 does not match the central directory
+    case checksumMismatch(path: String)
+    /// The consumer stopped reading before the entry was complete
+    case cancelled
+}
+
+extension ZipArchiveError : LocalizedError {
+    public var errorDescription: String? {
+        switch self {
+        case .notAnArchive: return "The file is not a zip archive"
+        case .corruptArchive(let reason): return "The zip archive is corrupt: \(reason)"
+        case .unsupportedCompression(let path, let method): return "Unsupported compression method \(method) for entry: \(path)"
+        case .unsupportedFeature(let path): return "Encrypted or multi-disk entries are not supported: \(path)"
+        case .unsafePath(let path): return "Refusing to extract entry outside of the destination: \(path)"
+        case .checksumMismatch(let path): return "Checksum mismatch for entry: \(path)"
+        case .cancelled: return "The operation was cancelled"
+        }
+    }
+}
+
+/// A read-only zip archive (such as an `.ipa`) whose entries can be streamed without first being extracted to disk.
+///
+/// The central directory is parsed up front; entry contents are read on demand through a separate file handle for each entry, so multiple entries can be extracted concurrently from different threads. Stored and deflated entries are supported, with the deflate decoding done in-process so that it works the same on every platform.
+public final class ZipArchive {
+    /// The size of the buffers handed to extraction consumers
+    public static let defaultBufferSize = 512 * 1024
+
+    public struct Entry {
+        /// The path of the entry within the archive; directories end with a `/`
+        public let path: String
+        /// The compression method: 0 for stored, 8 for deflate
+        public let method: UInt16
+        public let crc32: UInt32
+        public let compressedSize: UInt64
+        public let uncompressedSize: UInt64
+        let flags: UInt16
+        let versionMadeBy: UInt16
+        let dosTime: UInt16
+        let dosDate: UInt16
+        let externalAttributes: UInt32
+        let localHeaderOffset: UInt64
+
+        /// The unix mode of the entry, if it was created on a unix system
+        var unixMode: UInt32? {
+            (versionMadeBy >> 8) == 3 ? externalAttributes >> 16 : nil
+        }
+
+        public var isDirectory: Bool {
+            path.hasSuffix("/") || (unixMode.map { $0 & 0o170000 == 0o040000 } ?? false)
+        }
+
+        public var isSymbolicLink: Bool {
+            unixMode.map { $0 & 0o170000 == 0o120000 } ?? false
+        }
+
+        /// The posix permissions of the entry, if known
+        public var posixPermissions: Int? {
+            guard let mode = unixMode, mode & 0o7777 != 0 else {
+                return nil
+            }
+            return Int(mode & 0o7777)
+        }
+
+        /// The modification date, which zip stores in local time with a two-second granularity
+        public var modificationDate: Date {
+            var components = DateComponents()
+            components.year = Int(dosDate >> 9) + 1980
+            components.month = Int((dosDate >> 5) & 0xF)
+            components.day = Int(dosDate & 0x1F)
+            components.hour = Int(dosTime >> 11)
+            components.minute = Int((dosTime >> 5) & 0x3F)
+            components.second = Int(dosTime & 0x1F) * 2
+            return Calendar(identifier: .gregorian).date(from: components) ?? Date(timeIntervalSince1970: 0)
+        }
+    }
+
+    public let url: URL
+    public let entries: [Entry]
+
+    /// Opens the archive at the given file URL and reads its central directory.
+    public init(url: URL) throws {
+        self.url = url
+        let handle = try FileHandle(forReadingFrom: url)
+        defer { try? handle.close() }
+        self.entries = try ZipArchive.readCentralDirectory(handle)
+    }
+
+    /// Streams the uncompressed contents of the entry to the consumer in buffers of up to `bufferSize` bytes, verifying the size and CRC-32 once the entry is complete.
+    public func extract(_ entry: Entry, bufferSize: Int = ZipArchive.defaultBufferSize, consumer: (UnsafeRawBufferPointer) throws -> Void) throws {
+        var crc = CRC32()
+        var total: UInt64 = 0
+        func verify(_ buffer: UnsafeRawBufferPointer) throws {
+            crc.update(buffer)
+            total += UInt64(buffer.count)
+            try consumer(buffer)
+        }
+
+        switch entry.method {
+        case 0:
+            try readCompressed(entry, bufferSize: bufferSize, consumer: verify)
+        case 8:
+            let source = try compressedSource(entry)
+            try withoutActuallyEscaping(verify) { sink in
+                try Inflater(bufferSize: bufferSize, source: source, sink: sink).inflate()
+            }
+        default:
+            throw ZipArchiveError.unsupportedCompression(path: entry.path, method: entry.method)
+        }
+
+        if total != entry.uncompressedSize || crc.value != entry.crc32 {
+            throw ZipArchiveError.checksumMismatch(path: entry.path)
+        }
+    }
+
+    /// Returns the uncompressed contents of the entry.
+    public func contents(of entry: Entry) throws -> Data {
+        var data = Data()
+        data.reserveCapacity(Int(clamping: entry.uncompressedSize))
+        try extract(entry) { data.append(contentsOf: $0) }
+        return data
+    }
+
+    /// Streams the raw (possibly compressed) bytes of the entry, e.g., for copying it to another archive without recompressing.
+    public func readCompressed(_ entry: Entry, bufferSize: Int = ZipArchive.defaultBufferSize, consumer: (UnsafeRawBufferPointer) throws -> Void) throws {
+        let source = try compressedSource(entry)
+        let buffer = UnsafeMutableRawBufferPointer.allocate(byteCount: bufferSize, alignment: 16)
+        defer { buffer.deallocate() }
+        while true {
+            let count = try source(buffer)
+            if count == 0 {
+                break
+            }
+            try consumer(UnsafeRawBufferPointer(rebasing: buffer[0..<count]))
+        }
+    }
+
+    /// Extracts all the entries into the given folder, which will be created if needed.
+    ///
+    /// Folders are created first, then the files are decompressed in parallel, and finally symbolic links are created.
+    public func extractAll(to directory: URL) throws {
+        let root = directory.standardizedFileURL.path
+        let fm = FileManager.default
+        try fm.createDirectory(atPath: root, withIntermediateDirectories: true, attributes: nil)
+
+        var files: [(entry: Entry, path: String)] = []
+        var links: [(entry: Entry, path: String)] = []
+        var folders = Set<String>()
+        for entry in entries {
+            let relativePath = try ZipArchive.sanitize(entry.path)
+            if relativePath.isEmpty {
+                continue
+            }
+            let path = root + "/" + relativePath
+            if entry.isDirectory {
+                folders.insert(path)
+            } else {
+                folders.insert((path as NSString).deletingLastPathComponent)
+                if entry.isSymbolicLink {
+                    links.append((entry, path))
+                } else {
+                    files.append((entry, path))
+                }
+            }
+        }
+
+        for folder in folders.sorted() {
+            try fm.createDirectory(atPath: folder, withIntermediateDirectories: true, attributes: nil)
+        }
+
+        let lock = NSLock()
+        var firstError: Error? = nil
+        DispatchQueue.concurrentPerform(iterations: files.count) { i in
+            let (entry, path) = files[i]
+            do {
+                try self.extract(entry, toFile: path)
+            } catch {
+                lock.lock()
+                if firstError == nil {
+                    firstError = error
+                }
+                lock.unlock()
+            }
+        }
+        if let error = firstError {
+            throw error
+        }
+
+        for (entry, path) in links {
+            let target = try String(decoding: contents(of: entry), as: UTF8.self)
+            try? fm.removeItem(atPath: path)
+            try fm.createSymbolicLink(atPath: path, withDestinationPath: target)
+        }
+    }
+
+    private func extract(_ entry: Entry, toFile path: String) throws {
+        let fm = FileManager.default
+        if !fm.createFile(atPath: path, contents: nil) {
+            throw CocoaError(.fileWriteUnknown)
+        }
+        let out = try FileHandle(forWritingTo: URL(fileURLWithPath: path))
+        defer { try? out.close() }
+        try extract(entry) { buffer in
+            try out.write(contentsOf: buffer)
+        }
+        if let permissions = entry.posixPermissions {
+            // executables must keep their bits for signing and installation
+            try fm.setAttributes([.posixPermissions: NSNumber(value: permissions)], ofItemAtPath: path)
+        }
+    }
+
+    /// Returns the entry path with any leading `./` removed, throwing if it is absolute or contains `..` components.
+    static func sanitize(_ path: String) throws -> String {
+        if path.hasPrefix("/") || path.contains("\\") {
+            throw ZipArchiveError.unsafePath(path)
+        }
+        let components = path.split(separator: "/").filter { $0 != "." }
+        if components.contains("..") {
+            throw ZipArchiveError.unsafePath(path)
+        }
+        return components.joined(separator: "/")
+    }
+
+    /// Returns a source that reads the raw bytes of the entry sequentially into the buffer it is passed, returning 0 at the end of the entry.
+    private func compressedSource(_ entry: Entry) throws -> (UnsafeMutableRawBufferPointer) throws -> Int {
+        if entry.flags & 0x1 != 0 {
+            throw ZipArchiveError.unsupportedFeature(path: entry.path)
+        }
+        let handle = try FileHandle(forReadingFrom: url)
+        let header = try ZipArchive.readBytes(handle, count: 30, at: entry.localHeaderOffset)
+        guard header.uint32(at: 0) == 0x04034b50 else {
+            throw ZipArchiveError.corruptArchive("missing local header for \(entry.path)")
+        }
+        try handle.seek(toOffset: entry.localHeaderOffset + 30 + UInt64(header.uint16(at: 26)) + UInt64(header.uint16(at: 28)))
+        var remaining = entry.compressedSize
+        return { buffer in
+            let count = Int(min(UInt64(buffer.count), remaining))
+            if count == 0 {
+                return 0
+            }
+            guard let data = try handle.read(upToCount: count), data.count == count else {
+                throw ZipArchiveError.corruptArchive("unexpected end of file")
+            }
+            data.copyBytes(to: buffer)
+            remaining -= UInt64(count)
+            return count
+        }
+    }
+
+    private static func readCentralDirectory(_ handle: FileHandle) throws -> [Entry] {
+        let fileSize = try handle.seekToEnd()
+        guard fileSize >= 22 else {
+            throw ZipArchiveError.notAnArchive
+        }
+
+        // the end of central directory record is followed by a comment of up to 64K
+        let tailSize = min(fileSize, 22 + 0xFFFF)
+        let tailOffset = fileSize - tailSize
+        let tail = try readBytes(handle, count: Int(tailSize), at: tailOffset)
+        guard let eocd = stride(from: tail.count - 22, through: 0, by: -1).first(where: { tail.uint32(at: $0) == 0x06054b50 }) else {
+            throw ZipArchiveError.notAnArchive
+        }
+
+        var count = UInt64(tail.uint16(at: eocd + 10))
+        var directorySize = UInt64(tail.uint32(at: eocd + 12))
+        var directoryOffset = UInt64(tail.uint32(at: eocd + 16))
+
+        if (count == 0xFFFF || directorySize == 0xFFFFFFFF || directoryOffset == 0xFFFFFFFF) && tailOffset + UInt64(eocd) >= 20 {
+            // zip64: the locator immediately precedes the end of central directory record
+            let locatorOffset = tailOffset + UInt64(eocd) - 20
+            let locator = try readBytes(handle, count: 20, at: locatorOffset)
+            if locator.uint32(at: 0) == 0x07064b50 {
+                let record = try readBytes(handle, count: 56, at: locator.uint64(at: 8))
+                guard record.uint32(at: 0) == 0x06064b50 else {
+                    throw ZipArchiveError.corruptArchive("missing zip64 end of central directory")
+                }
+                count = record.uint64(at: 32)
+                directorySize = record.uint64(at: 40)
+                directoryOffset = record.uint64(at: 48)
+            }
+        }
+
+        guard directoryOffset + directorySize <= fileSize else {
+            throw ZipArchiveError.corruptArchive("central directory out of bounds")
+        }
+
+        let directory = try readBytes(handle, count: Int(directorySize), at: directoryOffset)
+        var entries: [Entry] = []
+        entries.reserveCapacity(Int(min(count, UInt64(directorySize / 46))))
+
+        var pos = 0
+        for _ in 0..<count {
+            guard pos + 46 <= directory.count, directory.uint32(at: pos) == 0x02014b50 else {
+                throw ZipArchiveError.corruptArchive("invalid central directory header")
+            }
+            let nameLength = Int(directory.uint16(at: pos + 28))
+            let extraLength = Int(directory.uint16(at: pos + 30))
+            let commentLength = Int(directory.uint16(at: pos + 32))
+            let nameStart = pos + 46
+            let extraStart = nameStart + nameLength
+            let next = extraStart + extraLength + commentLength
+            guard next <= directory.count else {
+                throw ZipArchiveError.corruptArchive("truncated central directory")
+            }
+
+            var uncompressedSize = UInt64(directory.uint32(at: pos + 24))
+            var compressedSize = UInt64(directory.uint32(at: pos + 20))
+            var localHeaderOffset = UInt64(directory.uint32(at: pos + 42))
+
+            // the zip64 extra field holds only the values that overflowed, in this order
+            var extra = extraStart
+            while extra + 4 <= extraStart + extraLength {
+                let id = directory.uint16(at: extra)
+                let size = Int(directory.uint16(at: extra + 2))
+                if id == 0x0001 {
+                    var field = extra + 4
+                    if uncompressedSize == 0xFFFFFFFF && field + 8 <= extra + 4 + size {
+                        uncompressedSize = directory.uint64(at: field)
+                        field += 8
+                    }
+                    if compressedSize == 0xFFFFFFFF && field + 8 <= extra + 4 + size {
+                        compressedSize = directory.uint64(at: field)
+                        field += 8
+                    }
+                    if localHeaderOffset == 0xFFFFFFFF && field + 8 <= extra + 4 + size {
+                        localHeaderOffset = directory.uint64(at: field)
+                    }
+                }
+                extra += 4 + size
+            }
+
+            entries.append(Entry(
+                path: String(decoding: directory[nameStart..<extraStart], as: UTF8.self),
+                method: directory.uint16(at: pos + 10),
+                crc32: directory.uint32(at: pos + 16),
+                compressedSize: compressedSize,
+                uncompressedSize: uncompressedSize,
+                flags: directory.uint16(at: pos + 8),
+                versionMadeBy: directory.uint16(at: pos + 4),
+                dosTime: directory.uint16(at: pos + 12),
+                dosDate: directory.uint16(at: pos + 14),
+                externalAttributes: directory.uint32(at: pos + 38),
+                localHeaderOffset: localHeaderOffset))
+            pos = next
+        }
+        return entries
+    }
+
+    static func readBytes(_ handle: FileHandle, count: Int, at offset: UInt64) throws -> [UInt8] {
+        try handle.seek(toOffset: offset)
+        guard let data = try handle.read(upToCount: count), data.count == count else {
+            throw ZipArchiveError.corruptArchive("unexpected end of file")
+        }
+        return [UInt8](data)
+    }
+}
+
+/// Writes a zip archive in a single streaming pass.
+///
+/// Entries are either stored (with the CRC-32 patched into the local header once the data has been written) or copied verbatim from another `ZipArchive`, so a re-signed app can be repackaged without recompressing the files that did not change.
+public final class ZipWriter {
+    private let handle: FileHandle
+    private var offset: UInt64 = 0
+    private var centralDirectory: [UInt8] = []
+    private var count: UInt64 = 0
+    private var lastCentralHeader = 0
+    private var finished = false
+
+    /// Creates (or truncates) the archive at the given file URL.
+    public init(url: URL) throws {
+        if !FileManager.default.createFile(atPath: url.path, contents: nil) {
+            throw CocoaError(.fileWriteUnknown)
+        }
+        self.handle = try FileHandle(forWritingTo: url)
+    }
+
+    deinit {
+        try? handle.close()
+    }
+
+    /// Adds a folder entry.
+    public func addDirectory(path: String, permissions: Int = 0o755, modificationDate: Date = Date()) throws {
+        let name = path.hasSuffix("/") ? path : path + "/"
+        let mode = UInt32(0o040000 | (permissions & 0o7777))
+        try addHeader(path: name, method: 0, crc32: 0, compressedSize: 0, uncompressedSize: 0, mode: mode, date: modificationDate)
+    }
+
+    /// Adds a symbolic link entry, whose contents are the link target.
+    public func addSymbolicLink(path: String, target: String, modificationDate: Date = Date()) throws {
+        let bytes = Array(target.utf8)
+        var crc = CRC32()
+        bytes.withUnsafeBytes { crc.update($0) }
+        try addHeader(path: path, method: 0, crc32: crc.value, compressedSize: UInt64(bytes.count), uncompressedSize: UInt64(bytes.count), mode: 0o120755, date: modificationDate)
+        try bytes.withUnsafeBytes { try emit($0) }
+    }
+
+    /// Adds the contents of the local file as a stored entry.
+    ///
+    /// If `original` is an entry with the same size and CRC-32 as the file, its compressed bytes are copied from `archive` instead.
+    public func addFile(path: String, contentsOf url: URL, reusing original: (archive: ZipArchive, entry: ZipArchive.Entry)? = nil) throws {
+        let attrs = try FileManager.default.attributesOfItem(atPath: url.path)
+        let size = (attrs[.size] as? NSNumber)?.uint64Value ?? 0
+        let permissions = (attrs[.posixPermissions] as? NSNumber)?.intValue ?? 0o644
+        let date = attrs[.modificationDate] as? Date ?? Date()
+
+        let input = try FileHandle(forReadingFrom: url)
+        defer { try? input.close() }
+
+        /// Reads the whole file, passing each buffer to the block and returning the CRC-32
+        func scan(_ block: (UnsafeRawBufferPointer) throws -> Void) throws -> UInt32 {
+            var crc = CRC32()
+            var position: UInt64 = 0
+            try input.seek(toOffset: 0)
+            while position < size {
+                guard let chunk = try input.read(upToCount: Int(min(UInt64(ZipArchive.defaultBufferSize), size - position))), !chunk.isEmpty else {
+                    throw CocoaError(.fileReadUnknown) // the file shrank while we were reading it
+                }
+                try chunk.withUnsafeBytes { buffer in
+                    crc.update(buffer)
+                    try block(buffer)
+                }
+                position += UInt64(chunk.count)
+            }
+            return crc.value
+        }
+
+        if let original = original, original.entry.method != 0, original.entry.uncompressedSize == size, try scan({ _ in }) == original.entry.crc32 {
+            return try addEntry(original.entry, from: original.archive, path: path)
+        }
+
+        let mode = UInt32(0o100000 | (permissions & 0o7777))
+        let headerOffset = try addHeader(path: path, method: 0, crc32: 0, compressedSize: size, uncompressedSize: size, mode: mode, date: date)
+        let crc = try scan { try emit($0) }
+        try patchCRC(crc, headerOffset: headerOffset)
+    }
+
+    /// Copies the entry verbatim (without decompressing it) from another archive, optionally under a different path.
+    public func addEntry(_ entry: ZipArchive.Entry, from archive: ZipArchive, path: String? = nil) throws {
+        let mode = entry.unixMode ?? (entry.isDirectory ? 0o040755 : 0o100644)
+        try addHeader(path: path ?? entry.path, method: entry.method, crc32: entry.crc32, compressedSize: entry.compressedSize, uncompressedSize: entry.uncompressedSize, mode: mode, dosDateTime: (entry.dosTime, entry.dosDate))
+        try archive.readCompressed(entry) { try emit($0) }
+    }
+
+    /// Writes the central directory and end records; no entries can be added afterwards.
+    public func finish() throws {
+        guard !finished else {
+            return
+        }
+        finished = true
+
+        let directoryOffset = offset
+        let directorySize = UInt64(centralDirectory.count)
+        var tail = centralDirectory
+        centralDirectory = []
+
+        if count >= 0xFFFF || directoryOffset >= 0xFFFFFFFF || directorySize >= 0xFFFFFFFF {
+            let recordOffset = directoryOffset + directorySize
+            tail.append32(0x06064b50)
+            tail.append64(44) // size of the remaining record
+            tail.append16(0x0300 | 45)
+            tail.append16(45)
+            tail.append32(0)
+            tail.append32(0)
+            tail.append64(count)
+            tail.append64(count)
+            tail.append64(directorySize)
+            tail.append64(directoryOffset)
+
+            tail.append32(0x07064b50)
+            tail.append32(0)
+            tail.append64(recordOffset)
+            tail.append32(1)
+        }
+
+        tail.append32(0x06054b50)
+        tail.append16(0)
+        tail.append16(0)
+        tail.append16(UInt16(min(count, 0xFFFF)))
+        tail.append16(UInt16(min(count, 0xFFFF)))
+        tail.append32(UInt32(min(directorySize, 0xFFFFFFFF)))
+        tail.append32(UInt32(min(directoryOffset, 0xFFFFFFFF)))
+        tail.append16(0) // comment length
+
+        try tail.withUnsafeBytes { try emit($0) }
+    }
+
+    /// Writes the local header and records the central directory header, returning the offset of the local header.
+    @discardableResult private func addHeader(path: String, method: UInt16, crc32: UInt32, compressedSize: UInt64, uncompressedSize: UInt64, mode: UInt32, date: Date) throws -> UInt64 {
+        try addHeader(path: path, method: method, crc32: crc32, compressedSize: compressedSize, uncompressedSize: uncompressedSize, mode: mode, dosDateTime: ZipWriter.dosDateTime(date))
+    }
+
+    @discardableResult private func addHeader(path: String, method: UInt16, crc32: UInt32, compressedSize: UInt64, uncompressedSize: UInt64, mode: UInt32, dosDateTime: (time: UInt16, date: UInt16)) throws -> UInt64 {
+        precondition(!finished, "entry added after finish()")
+        let name = Array(path.utf8)
+        let headerOffset = offset
+        let largeSizes = compressedSize >= 0xFFFFFFFF || uncompressedSize >= 0xFFFFFFFF
+        let version: UInt16 = largeSizes || headerOffset >= 0xFFFFFFFF ? 45 : 20
+        let flags: UInt16 = 0x0800 // names are UTF-8
+
+        var local: [UInt8] = []
+        local.reserveCapacity(30 + name.count + 20)
+        local.append32(0x04034b50)
+        local.append16(version)
+        local.append16(flags)
+        local.append16(method)
+        local.append16(dosDateTime.time)
+        local.append16(dosDateTime.date)
+        local.append32(crc32)
+        local.append32(largeSizes ? 0xFFFFFFFF : UInt32(compressedSize))
+        local.append32(largeSizes ? 0xFFFFFFFF : UInt32(uncompressedSize))
+        local.append16(UInt16(name.count))
+        local.append16(largeSizes ? 20 : 0)
+        local += name
+        if largeSizes {
+            local.append16(0x0001)
+            local.append16(16)
+            local.append64(uncompressedSize)
+            local.append64(compressedSize)
+        }
+        try local.withUnsafeBytes { try emit($0) }
+
+        var extra: [UInt8] = []
+        if uncompressedSize >= 0xFFFFFFFF {
+            extra.append64(uncompressedSize)
+        }
+        if compressedSize >= 0xFFFFFFFF {
+            extra.append64(compressedSize)
+        }
+        if headerOffset >= 0xFFFFFFFF {
+            extra.append64(headerOffset)
+        }
+
+        lastCentralHeader = centralDirectory.count
+        centralDirectory.append32(0x02014b50)
+        centralDirectory.append16(0x0300 | version) // made by unix, so the mode is honored
+        centralDirectory.append16(version)
+        centralDirectory.append16(flags)
+        centralDirectory.append16(method)
+        centralDirectory.append16(dosDateTime.time)
+        centralDirectory.append16(dosDateTime.date)
+        centralDirectory.append32(crc32)
+        centralDirectory.append32(UInt32(min(compressedSize, 0xFFFFFFFF)))
+        centralDirectory.append32(UInt32(min(uncompressedSize, 0xFFFFFFFF)))
+        centralDirectory.append16(UInt16(name.count))
+        centralDirectory.append16(extra.isEmpty ? 0 : UInt16(4 + extra.count))
+        centralDirectory.append16(0) // comment
+        centralDirectory.append16(0) // disk
+        centralDirectory.append16(0) // internal attributes
+        centralDirectory.append32((mode << 16) | (mode & 0o170000 == 0o040000 ? 0x10 : 0))
+        centralDirectory.append32(UInt32(min(headerOffset, 0xFFFFFFFF)))
+        centralDirectory += name
+        if !extra.isEmpty {
+            centralDirectory.append16(0x0001)
+            centralDirectory.append16(UInt16(extra.count))
+            centralDirectory += extra
+        }
+
+        count += 1
+        return headerOffset
+    }
+
+    private func patchCRC(_ crc32: UInt32, headerOffset: UInt64) throws {
+        var bytes: [UInt8] = []
+        bytes.append32(crc32)
+        try handle.seek(toOffset: headerOffset + 14)
+        try handle.write(contentsOf: bytes)
+        try handle.seek(toOffset: offset)
+        // the central directory header for this entry is the last one that was added
+        let field = lastCentralHeader + 16
+        centralDirectory.replaceSubrange(field..<field + 4, with: bytes)
+    }
+
+    private func emit(_ buffer: UnsafeRawBufferPointer) throws {
+        try handle.write(contentsOf: buffer)
+        offset += UInt64(buffer.count)
+    }
+
+    static func dosDateTime(_ date: Date) -> (time: UInt16, date: UInt16) {
+        let c = Calendar(identifier: .gregorian).dateComponents([.year, .month, .day, .hour, .minute, .second], from: date)
+        let year = min(max((c.year ?? 1980) - 1980, 0), 127)
+        let time = ((c.hour ?? 0) << 11) | ((c.minute ?? 0) << 5) | ((c.second ?? 0) / 2)
+        let day = (year << 9) | ((c.month ?? 1) << 5) | (c.day ?? 1)
+        return (UInt16(time), UInt16(day))
+    }
+}
+
+/// A streaming decoder for raw deflate (RFC 1951) data, as used by compressed zip entries.
+///
+/// The Compression framework is only available on Apple platforms, so this is a small table-driven decoder that pulls its input from `source` and hands the decoded bytes to `sink` in large chunks, keeping only the 32K history window between flushes.
+final class Inflater {
+    static let windowSize = 32 * 1024
+    static let maxMatch = 258
+
+    static let lengthBase = [3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258]
+    static let lengthExtra = [0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0]
+    static let distanceBase = [1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577]
+    static let distanceExtra = [0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13]
+    static let codeLengthOrder = [16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15]
+
+    static let fixedLiterals = try! Huffman(lengths: [UInt8](repeating: 8, count: 144) + [UInt8](repeating: 9, count: 112) + [UInt8](repeating: 7, count: 24) + [UInt8](repeating: 8, count: 8))
+    static let fixedDistances = try! Huffman(lengths: [UInt8](repeating: 5, count: 30))
+
+    /// A canonical Huffman code, decoded with a lookup table for the common short codes and a canonical walk for the rest.
+    struct Huffman {
+        static let fastBits = 10
+
+        /// The number of codes of each length
+        private(set) var counts = [Int](repeating: 0, count: 16)
+        /// The symbols ordered by code
+        private(set) var symbols: [UInt16]
+        /// Indexed by the next `fastBits` input bits: the symbol << 4 | code length, or 0 for longer codes
+        private(set) var fast = [UInt16](repeating: 0, count: 1 << Huffman.fastBits)
+
+        init(lengths: [UInt8]) throws {
+            symbols = [UInt16](repeating: 0, count: lengths.count)
+            for length in lengths {
+                counts[Int(length)] += 1
+            }
+            counts[0] = 0
+
+            var left = 1
+            for length in 1..<16 {
+                left = (left << 1) - counts[length]
+                if left < 0 {
+                    throw ZipArchiveError.corruptArchive("over-subscribed huffman code")
+                }
+            }
+
+            var offsets = [Int](repeating: 0, count: 16)
+            for length in 1..<15 {
+                offsets[length + 1] = offsets[length] + counts[length]
+            }
+            var nextCode = [Int](repeating: 0, count: 16)
+            var code = 0
+            for length in 2..<16 {
+                code = (code + counts[length - 1]) << 1
+                nextCode[length] = code
+            }
+
+            for (symbol, length) in lengths.enumerated() where length != 0 {
+                let length = Int(length)
+                symbols[offsets[length]] = UInt16(symbol)
+                offsets[length] += 1
+
+                let assigned = nextCode[length]
+                nextCode[length] += 1
+                if length <= Huffman.fastBits {
+                    // deflate packs codes starting with the most significant bit, so the table is indexed by the reversed code
+                    var reversed = 0
+                    for i in 0..<length {
+                        reversed = (reversed << 1) | ((assigned >> i) & 1)
+                    }
+                    var index = reversed
+                    while index < fast.count {
+                        fast[index] = UInt16(symbol << 4 | length)
+                        index += 1 << length
+                    }
+                }
+            }
+        }
+    }
+
+    private let source: (UnsafeMutableRawBufferPointer) throws -> Int
+    private let sink: (UnsafeRawBufferPointer) throws -> Void
+
+    private let input: UnsafeMutableRawBufferPointer
+    private var inputPosition = 0
+    private var inputEnd = 0
+    private var overrun = 0
+    private var bitBuffer: UInt64 = 0
+    private var bitCount = 0
+
+    private let output: UnsafeMutablePointer<UInt8>
+    private let outputCapacity: Int
+    private var outputPosition = 0
+    private var outputFlushed = 0
+
+    /// - Parameters:
+    ///   - bufferSize: the largest chunk that will be passed to the sink
+    ///   - source: fills the buffer with the next compressed bytes, returning the count, or 0 at the end of the input
+    ///   - sink: receives the decompressed bytes
+    init(bufferSize: Int, source: @escaping (UnsafeMutableRawBufferPointer) throws -> Int, sink: @escaping (UnsafeRawBufferPointer) throws -> Void) {
+        self.source = source
+        self.sink = sink
+        self.input = UnsafeMutableRawBufferPointer.allocate(byteCount: 64 * 1024, alignment: 16)
+        self.outputCapacity = Inflater.windowSize + max(bufferSize, 64 * 1024)
+        self.output = UnsafeMutablePointer<UInt8>.allocate(capacity: outputCapacity)
+    }
+
+    deinit {
+        input.deallocate()
+        output.deallocate()
+    }
+
+    /// Decodes the whole stream, through the final block.
+    func inflate() throws {
+        var final = false
+        repeat {
+            final = try bits(1) == 1
+            switch try bits(2) {
+            case 0:
+                try inflateStored()
+            case 1:
+                try inflateBlock(literals: Inflater.fixedLiterals, distances: Inflater.fixedDistances)
+            case 2:
+                try inflateDynamic()
+            default:
+                throw ZipArchiveError.corruptArchive("invalid deflate block type")
+            }
+        } while !final
+        try flush()
+    }
+
+    /// Hands the pending output to the sink and slides the history window back to the start of the buffer.
+    private func flush() throws {
+        if outputPosition > outputFlushed {
+            try sink(UnsafeRawBufferPointer(start: output + outputFlushed, count: outputPosition - outputFlushed))
+        }
+        if outputPosition > Inflater.windowSize {
+            memmove(output, output + (outputPosition - Inflater.windowSize), Inflater.windowSize)
+            outputPosition = Inflater.windowSize
+        }
+        outputFlushed = outputPosition
+    }
+
+    private func refill() throws {
+        inputPosition = 0
+        inputEnd = try source(input)
+    }
+
+    @inline(__always) private func need(_ count: Int) throws {
+        while bitCount < count {
+            if inputPosition == inputEnd {
+                try refill()
+            }
+            let byte: UInt8
+            if inputPosition < inputEnd {
+                byte = input[inputPosition]
+                inputPosition += 1
+            } else {
+                // the last code may be shorter than the lookahead, so allow a little zero padding
+                overrun += 1
+                if overrun > 4 {
+                    throw ZipArchiveError.corruptArchive("truncated deflate stream")
+                }
+                byte = 0
+            }
+            bitBuffer |= UInt64(byte) << UInt64(bitCount)
+            bitCount += 8
+        }
+    }
+
+    @inline(__always) private func consume(_ count: Int) {
+        bitBuffer >>= UInt64(count)
+        bitCount -= count
+    }
+
+    @inline(__always) private func bits(_ count: Int) throws -> Int {
+        try need(count)
+        let value = Int(bitBuffer & ((1 << UInt64(count)) - 1))
+        consume(count)
+        return value
+    }
+
+    @inline(__always) private func decode(_ huffman: Huffman) throws -> Int {
+        try need(15)
+        let entry = Int(huffman.fast[Int(bitBuffer & UInt64((1 << Huffman.fastBits) - 1))])
+        if entry != 0 {
+            consume(entry & 15)
+            return entry >> 4
+        }
+
+        var code = 0
+        var first = 0
+        var index = 0
+        for length in 1..<16 {
+            code |= Int((bitBuffer >> UInt64(length - 1)) & 1)
+            let count = huffman.counts[length]
+            if code - first < count {
+                consume(length)
+                return Int(huffman.symbols[index + code - first])
+            }
+            index += count
+            first = (first + count) << 1
+            code <<= 1
+        }
+        throw ZipArchiveError.corruptArchive("invalid huffman code")
+    }
+
+    private func inflateStored() throws {
+        consume(bitCount & 7)
+        let length = try bits(16)
+        let complement = try bits(16)
+        if length != ~complement & 0xFFFF {
+            throw ZipArchiveError.corruptArchive("invalid stored block length")
+        }
+
+        var remaining = length
+        while remaining > 0 && bitCount >= 8 {
+            if outputPosition == outputCapacity {
+                try flush()
+            }
+            output[outputPosition] = UInt8(truncatingIfNeeded: bitBuffer)
+            outputPosition += 1
+            consume(8)
+            remaining -= 1
+        }
+        while remaining > 0 {
+            if outputPosition == outputCapacity {
+                try flush()
+            }
+            if inputPosition == inputEnd {
+                try refill()
+                if inputEnd == 0 {
+                    throw ZipArchiveError.corruptArchive("truncated stored block")
+                }
+            }
+            let count = min(remaining, inputEnd - inputPosition, outputCapacity - outputPosition)
+            memcpy(output + outputPosition, input.baseAddress! + inputPosition, count)
+            outputPosition += count
+            inputPosition += count
+            remaining -= count
+        }
+    }
+
+    private func inflateDynamic() throws {
+        let literalCount = try bits(5) + 257
+        let distanceCount = try bits(5) + 1
+        let codeLengthCount = try bits(4) + 4
+
+        var codeLengths = [UInt8](repeating: 0, count: 19)
+        for i in 0..<codeLengthCount {
+            codeLengths[Inflater.codeLengthOrder[i]] = try UInt8(bits(3))
+        }
+        let codeLengthCode = try Huffman(lengths: codeLengths)
+
+        let total = literalCount + distanceCount
+        var lengths = [UInt8]()
+        lengths.reserveCapacity(total + 138)
+        while lengths.count < total {
+            let symbol = try decode(codeLengthCode)
+            switch symbol {
+            case 0..<16:
+                lengths.append(UInt8(symbol))
+            case 16:
+                guard let previous = lengths.last else {
+                    throw ZipArchiveError.corruptArchive("repeated code length without a previous length")
+                }
+                let count = try bits(2) + 3
+                lengths += repeatElement(previous, count: count)
+            case 17:
+                let count = try bits(3) + 3
+                lengths += repeatElement(0, count: count)
+            default:
+                let count = try bits(7) + 11
+                lengths += repeatElement(0, count: count)
+            }
+        }
+        if lengths.count != total || lengths[256] == 0 {
+            throw ZipArchiveError.corruptArchive("invalid code lengths")
+        }
+
+        let literals = try Huffman(lengths: Array(lengths[0..<literalCount]))
+        let distances = try Huffman(lengths: Array(lengths[literalCount...]))
+        try inflateBlock(literals: literals, distances: distances)
+    }
+
+    private func inflateBlock(literals: Huffman, distances: Huffman) throws {
+        while true {
+            if outputPosition + Inflater.maxMatch > outputCapacity {
+                try flush()
+            }
+            let symbol = try decode(literals)
+            if symbol < 256 {
+                output[outputPosition] = UInt8(symbol)
+                outputPosition += 1
+            } else if symbol == 256 {
+                return
+            } else {
+                let lengthCode = symbol - 257
+                if lengthCode >= 29 {
+                    throw ZipArchiveError.corruptArchive("invalid length code")
+                }
+                let length = try Inflater.lengthBase[lengthCode] + bits(Inflater.lengthExtra[lengthCode])
+
+                let distanceCode = try decode(distances)
+                if distanceCode >= 30 {
+                    throw ZipArchiveError.corruptArchive("invalid distance code")
+                }
+                let distance = try Inflater.distanceBase[distanceCode] + bits(Inflater.distanceExtra[distanceCode])
+                if distance > outputPosition {
+                    throw ZipArchiveError.corruptArchive("distance too far back")
+                }
+
+                let from = output + (outputPosition - distance)
+                let to = output + outputPosition
+                if distance >= length {
+                    memcpy(to, from, length)
+                } else {
+                    // overlapping copies repeat the most recent bytes
+                    for i in 0..<length {
+                        to[i] = from[i]
+                    }
+                }
+                outputPosition += length
+            }
+        }
+    }
+}
+
+/// The CRC-32 checksum used by zip, computed eight bytes at a time.
+public struct CRC32 {
+    public private(set) var value: UInt32 = 0
+
+    public init() {
+    }
+
+    /// Eight 256-entry tables, where table `k` advances the CRC of a byte followed by `k` zero bytes
+    static let table: [UInt32] = {
+        var table = [UInt32](repeating: 0, count: 8 * 256)
+        for i in 0..<256 {
+            var c = UInt32(i)
+            for _ in 0..<8 {
+                c = c & 1 != 0 ? (c >> 1) ^ 0xEDB88320 : c >> 1
+            }
+            table[i] = c
+        }
+        for k in 1..<8 {
+            for i in 0..<256 {
+                let previous = table[(k - 1) * 256 + i]
+                table[k * 256 + i] = (previous >> 8) ^ table[Int(previous & 0xFF)]
+            }
+        }
+        return table
+    }()
+
+    public mutating func update(_ buffer: UnsafeRawBufferPointer) {
+        guard var p = buffer.baseAddress?.assumingMemoryBound(to: UInt8.self) else {
+            return
+        }
+        var remaining = buffer.count
+        var crc = ~value
+        CRC32.table.withUnsafeBufferPointer { t in
+            while remaining >= 8 {
+                let lo = crc ^ (UInt32(p[0]) | UInt32(p[1]) << 8 | UInt32(p[2]) << 16 | UInt32(p[3]) << 24)
+                let hi = UInt32(p[4]) | UInt32(p[5]) << 8 | UInt32(p[6]) << 16 | UInt32(p[7]) << 24
+                let a = t[7 * 256 + Int(lo & 0xFF)] ^ t[6 * 256 + Int((lo >> 8) & 0xFF)]
+                let b = t[5 * 256 + Int((lo >> 16) & 0xFF)] ^ t[4 * 256 + Int(lo >> 24)]
+                let c = t[3 * 256 + Int(hi & 0xFF)] ^ t[2 * 256 + Int((hi >> 8) & 0xFF)]
+                let d = t[1 * 256 + Int((hi >> 16) & 0xFF)] ^ t[Int(hi >> 24)]
+                crc = a ^ b ^ c ^ d
+                p += 8
+                remaining -= 8
+            }
+            while remaining > 0 {
+                crc = t[Int((crc ^ UInt32(p[0])) & 0xFF)] ^ (crc >> 8)
+                p += 1
+                remaining -= 1
+            }
+        }
+        value = ~crc
+    }
+}
+
+private extension Array where Element == UInt8 {
+    func uint16(at offset: Int) -> UInt16 {
+        UInt16(self[offset]) | UInt16(self[offset + 1]) << 8
+    }
+
+    func uint32(at offset: Int) -> UInt32 {
+        UInt32(uint16(at: offset)) | UInt32(uint16(at: offset + 2)) << 16
+    }
+
+    func uint64(at offset: Int) -> UInt64 {
+        UInt64(uint32(at: offset)) | UInt64(uint32(at: offset + 4)) << 32
+    }
+
+    mutating func append16(_ value: UInt16) {
+        append(UInt8(truncatingIfNeeded: value))
+        append(UInt8(truncatingIfNeeded: value >> 8))
+    }
+
+    mutating func append32(_ value: UInt32) {
+        append16(UInt16(truncatingIfNeeded: value))
+        append16(UInt16(truncatingIfNeeded: value >> 16))
+    }
+
+    mutating func append64(_ value: UInt64) {
+        append32(UInt32(truncatingIfNeeded: value))
+        append32(UInt32(truncatingIfNeeded: value >> 32))
+    }
+}
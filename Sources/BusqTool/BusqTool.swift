@@ -509,6 +509,14 @@ import ArgumentParser
             If the signed IPA is already present on the device,
             the --skip-transmit flag will install it directly from the remote location
             specified by the arguments.
+
+            The --sync flag keeps the previously transmitted app on the device
+            and only sends the files that have changed, which is much faster
+            for repeated installs of an expanded app folder.
+
+            The --unpack flag decompresses the IPA on the fly and streams its
+            files to the device as an expanded folder, overlapping the
+            decompression with the transfer.
             """)
 
         @OptionGroup var options: BusqTool.Options
@@ -527,6 +535,15 @@ import ArgumentParser
         @Flag(name: [.long, .customShort("p")], help: "show file transfer progress.")
         var progress = false
 
+        @Flag(name: [.long, .customShort("s")], help: "only transmit files that changed since the last install.")
+        var sync = false
+
+        @Option(name: [.long, .customShort("m")], help: "local manifest file for detecting rebuilt files with unchanged contents when syncing.")
+        var manifest: String?
+
+        @Flag(name: [.long, .customShort("k")], help: "stream the ipa contents to the device as an expanded folder.")
+        var unpack = false
+
         @Option(name: [.long, .customShort("i")], help: "signing identity.")
         var identity: String = ""
 
@@ -563,7 +580,32 @@ import ArgumentParser
                         let dir = "/busq"
                         try conduit.makeDirectory(path: dir)
                         installPath = dir + "/" + argPath.lastPathComponent
-                        try transmit(argPath, to: installPath, conduit: conduit, progress: progress, overwrite: true)
+                        if sync {
+                            let manifestURL = manifest.map { URL(fileURLWithPath: $0) }
+                            let previous = manifestURL.map { (try? FileConduitSyncManifest(contentsOf: $0)) ?? FileConduitSyncManifest() }
+                            let showProgress = progress
+                            let summary = try conduit.synchronize(from: argPath, to: installPath, manifest: previous) { path in
+                                if showProgress {
+                                    print("Transmitting:", path)
+                                }
+                            }
+                            if let manifestURL = manifestURL {
+                                try summary.manifest.write(to: manifestURL)
+                            }
+                            print("Synchronized:", installPath, "uploaded:", summary.uploaded.count, "(\(summary.bytesUploaded) bytes)", "touched:", summary.touched.count, "unchanged:", summary.unchanged.count, "removed:", summary.removed.count)
+                        } else if unpack && argPath.pathExtension == "ipa" {
+                            installPath = dir + "/" + argPath.deletingPathExtension().lastPathComponent
+                            try? conduit.removePathAndContents(path: installPath)
+                            let showProgress = progress
+                            let bytes = try conduit.upload(archive: ZipArchive(url: argPath), to: installPath) { path in
+                                if showProgress {
+                                    print("Transmitting:", path)
+                                }
+                            }
+                            print("Unpacked:", installPath, "(\(bytes) bytes)")
+                        } else {
+                            try transmit(argPath, to: installPath, conduit: conduit, progress: progress, overwrite: true)
+                        }
                     }
 
                     if upgrade {
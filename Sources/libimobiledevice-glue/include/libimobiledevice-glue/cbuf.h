@@ -29,7 +29,16 @@ struct char_buf {
 };
 
 struct char_buf* char_buf_new();
+struct char_buf* char_buf_new_with_capacity(unsigned int capacity);
 void char_buf_free(struct char_buf* cbuf);
 void char_buf_append(struct char_buf* cbuf, unsigned int length, unsigned char* data);
 
+/* Makes sure that length more bytes fit without reallocating.
+ * Returns 0 on success or -1 if the buffer could not be grown. */
+int char_buf_reserve(struct char_buf* cbuf, unsigned int length);
+
+/* Grows the buffer by length bytes and returns a pointer to the new
+ * (uninitialized) region for the caller to fill in, or NULL on failure. */
+unsigned char* char_buf_extend(struct char_buf* cbuf, unsigned int length);
+
 #endif /* __CBUF_H */
@@ -31,8 +31,17 @@ struct tlv_buf {
 typedef struct tlv_buf* tlv_buf_t;
 
 tlv_buf_t tlv_buf_new();
+tlv_buf_t tlv_buf_new_with_capacity(unsigned int capacity);
 void tlv_buf_free(tlv_buf_t tlv);
 
+/* Number of bytes that a value of the given length occupies once split
+ * into tagged fragments of at most 255 bytes each. */
+unsigned int tlv_encoded_length(unsigned int length);
+
+/* Makes sure that length more (encoded) bytes fit without reallocating.
+ * Returns 0 on success or -1 if the buffer could not be grown. */
+int tlv_buf_reserve(tlv_buf_t tlv, unsigned int length);
+
 void tlv_buf_append(tlv_buf_t tlv, uint8_t tag, unsigned int length, void* data);
 unsigned char* tlv_get_data_ptr(const void* tlv_data, void* tlv_end, uint8_t tag, uint8_t* length);
 int tlv_data_get_uint(const void* tlv_data, unsigned int tlv_length, uint8_t tag, uint64_t* value);
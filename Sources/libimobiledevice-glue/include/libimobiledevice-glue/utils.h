@@ -50,7 +50,8 @@ int buffer_write_to_filename(const char *filename, const char *buffer, uint64_t
 
 enum plist_format_t {
 	PLIST_FORMAT_XML,
-	PLIST_FORMAT_BINARY
+	PLIST_FORMAT_BINARY,
+	PLIST_FORMAT_JSON
 };
 
 int plist_read_from_filename(plist_t *plist, const char *filename);
@@ -26,19 +26,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include "common.h"
 #include "libimobiledevice-glue/cbuf.h"
 
-LIBIMOBILEDEVICE_GLUE_API struct char_buf* char_buf_new()
+LIBIMOBILEDEVICE_GLUE_API struct char_buf* char_buf_new_with_capacity(unsigned int capacity)
 {
 	struct char_buf* cbuf = (struct char_buf*)malloc(sizeof(struct char_buf));
-	cbuf->capacity = 256;
+	if (!cbuf) {
+		return NULL;
+	}
+	cbuf->capacity = (capacity > 0) ? capacity : 1;
 	cbuf->length = 0;
 	cbuf->data = (unsigned char*)malloc(cbuf->capacity);
 	return cbuf;
 }
 
+LIBIMOBILEDEVICE_GLUE_API struct char_buf* char_buf_new()
+{
+	return char_buf_new_with_capacity(256);
+}
+
 LIBIMOBILEDEVICE_GLUE_API void char_buf_free(struct char_buf* cbuf)
 {
 	if (cbuf) {
@@ -47,21 +56,49 @@ LIBIMOBILEDEVICE_GLUE_API void char_buf_free(struct char_buf* cbuf)
 	}
 }
 
-LIBIMOBILEDEVICE_GLUE_API void char_buf_append(struct char_buf* cbuf, unsigned int length, unsigned char* data)
+LIBIMOBILEDEVICE_GLUE_API int char_buf_reserve(struct char_buf* cbuf, unsigned int length)
 {
 	if (!cbuf || !cbuf->data) {
-		return;
+		return -1;
+	}
+	if (length <= cbuf->capacity - cbuf->length) {
+		return 0;
+	}
+	if (length > UINT_MAX - cbuf->length) {
+		fprintf(stderr, "%s: ERROR: Buffer size overflow\n", __func__);
+		return -1;
+	}
+	unsigned int required = cbuf->length + length;
+	/* grow geometrically so that a series of small appends stays linear */
+	unsigned int newcapacity = cbuf->capacity;
+	while (newcapacity < required) {
+		newcapacity = (newcapacity > UINT_MAX / 2) ? required : newcapacity * 2;
 	}
-	if (cbuf->length + length > cbuf->capacity) {
-		unsigned int newcapacity = cbuf->capacity + ((length / 256) + 1) * 256;
-		unsigned char* newdata = realloc(cbuf->data, newcapacity);
-		if (!newdata) {
-			fprintf(stderr, "%s: ERROR: Failed to realloc\n", __func__);
-			return;
-		}
-		cbuf->data = newdata;
-		cbuf->capacity = newcapacity;
+	unsigned char* newdata = realloc(cbuf->data, newcapacity);
+	if (!newdata) {
+		fprintf(stderr, "%s: ERROR: Failed to realloc\n", __func__);
+		return -1;
 	}
-	memcpy(cbuf->data + cbuf->length, data, length);
+	cbuf->data = newdata;
+	cbuf->capacity = newcapacity;
+	return 0;
+}
+
+LIBIMOBILEDEVICE_GLUE_API unsigned char* char_buf_extend(struct char_buf* cbuf, unsigned int length)
+{
+	if (char_buf_reserve(cbuf, length) < 0) {
+		return NULL;
+	}
+	unsigned char* p = cbuf->data + cbuf->length;
 	cbuf->length += length;
+	return p;
+}
+
+LIBIMOBILEDEVICE_GLUE_API void char_buf_append(struct char_buf* cbuf, unsigned int length, unsigned char* data)
+{
+	unsigned char* p = char_buf_extend(cbuf, length);
+	if (!p) {
+		return;
+	}
+	memcpy(p, data, length);
 }
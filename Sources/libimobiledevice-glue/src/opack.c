@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include "common.h"
 #include "libimobiledevice-glue/cbuf.h"
@@ -35,7 +36,51 @@
 
 #define MAC_EPOCH 978307200
 
-static void opack_encode_node(plist_t node, struct char_buf* cbuf)
+/* Copies len bytes to out at offset pos, unless out is NULL (size pass) */
+static inline size_t opack_put(unsigned char* out, size_t pos, const void* data, size_t len)
+{
+	if (out && len > 0) {
+		memcpy(out + pos, data, len);
+	}
+	return pos + len;
+}
+
+static inline size_t opack_put_byte(unsigned char* out, size_t pos, uint8_t byte)
+{
+	if (out) {
+		out[pos] = byte;
+	}
+	return pos + 1;
+}
+
+/* Writes the header of a string (base 0x40) or data (base 0x70) object */
+static size_t opack_put_length_header(unsigned char* out, size_t pos, uint8_t base, uint64_t len)
+{
+	if (len <= 0x20) {
+		return opack_put_byte(out, pos, base + (uint8_t)len);
+	}
+	if (len <= 0xFF) {
+		pos = opack_put_byte(out, pos, base + 0x21);
+		return opack_put_byte(out, pos, (uint8_t)len);
+	}
+	if (len <= 0xFFFF) {
+		uint16_t u16val = htole16((uint16_t)len);
+		pos = opack_put_byte(out, pos, base + 0x22);
+		return opack_put(out, pos, &u16val, 2);
+	}
+	if ((len >> 32) == 0) {
+		uint32_t u32val = htole32((uint32_t)len);
+		pos = opack_put_byte(out, pos, base + 0x23);
+		return opack_put(out, pos, &u32val, 4);
+	}
+	uint64_t u64val = htole64(len);
+	pos = opack_put_byte(out, pos, base + 0x24);
+	return opack_put(out, pos, &u64val, 8);
+}
+
+/* Encodes node into out starting at pos and returns the position after it.
+ * With out == NULL nothing is written, which yields the encoded size. */
+static size_t opack_encode_node(plist_t node, unsigned char* out, size_t pos)
 {
 	plist_type type = plist_get_node_type(node);
 	switch (type) {
@@ -43,8 +88,8 @@ static void opack_encode_node(plist_t node, struct char_buf* cbuf)
 			uint32_t count = plist_dict_get_size(node);
 			uint8_t blen = 0xEF;
 			if (count < 15)
-				blen = (uint8_t)count-32;	
-			char_buf_append(cbuf, 1, &blen);
+				blen = (uint8_t)count-32;
+			pos = opack_put_byte(out, pos, blen);
 			plist_dict_iter iter = NULL;
 			plist_dict_new_iter(node, &iter);
 			if (iter) {
@@ -54,14 +99,13 @@ static void opack_encode_node(plist_t node, struct char_buf* cbuf)
 					plist_dict_next_item(node, iter, NULL, &sub);
 					if (sub) {
 						plist_t key = plist_dict_item_get_key(sub);
-						opack_encode_node(key, cbuf);
-						opack_encode_node(sub, cbuf);
+						pos = opack_encode_node(key, out, pos);
+						pos = opack_encode_node(sub, out, pos);
 					}
 				} while (sub);
 				free(iter);
 				if (count > 14) {
-					uint8_t term = 0x03;
-					char_buf_append(cbuf, 1, &term);
+					pos = opack_put_byte(out, pos, 0x03);
 				}
 			}
 		}	break;
@@ -70,7 +114,7 @@ static void opack_encode_node(plist_t node, struct char_buf* cbuf)
 			uint8_t blen = 0xDF;
 			if (count < 15)
 				blen = (uint8_t)(count-48);
-			char_buf_append(cbuf, 1, &blen);
+			pos = opack_put_byte(out, pos, blen);
 			plist_array_iter iter = NULL;
 			plist_array_new_iter(node, &iter);
 			if (iter) {
@@ -79,19 +123,17 @@ static void opack_encode_node(plist_t node, struct char_buf* cbuf)
 					sub = NULL;
 					plist_array_next_item(node, iter, &sub);
 					if (sub) {
-						opack_encode_node(sub, cbuf);
+						pos = opack_encode_node(sub, out, pos);
 					}
 				} while (sub);
 				free(iter);
 				if (count > 14) {
-					uint8_t term = 0x03;
-					char_buf_append(cbuf, 1, &term);
+					pos = opack_put_byte(out, pos, 0x03);
 				}
 			}
 		}	break;
 		case PLIST_BOOLEAN: {
-			uint8_t bval = 2 - plist_bool_val_is_true(node);
-			char_buf_append(cbuf, 1, &bval);
+			pos = opack_put_byte(out, pos, 2 - plist_bool_val_is_true(node));
 		}	break;
 		case PLIST_UINT: {
 			uint64_t u64val = 0;
@@ -99,24 +141,19 @@ static void opack_encode_node(plist_t node, struct char_buf* cbuf)
 			if ((uint8_t)u64val == u64val) {
 				uint8_t u8val = (uint8_t)u64val;
 				if (u8val > 0x27) {
-					uint8_t blen = 0x30;
-					char_buf_append(cbuf, 1, &blen);
-					char_buf_append(cbuf, 1, &u8val);
+					pos = opack_put_byte(out, pos, 0x30);
+					pos = opack_put_byte(out, pos, u8val);
 				} else {
-					u8val += 8;
-					char_buf_append(cbuf, 1, &u8val);
+					pos = opack_put_byte(out, pos, u8val + 8);
 				}
 			} else if ((uint32_t)u64val == u64val) {
-				uint8_t blen = 0x32;
-				char_buf_append(cbuf, 1, &blen);
-				uint32_t u32val = (uint32_t)u64val;
-				u32val = htole32(u32val);
-				char_buf_append(cbuf, 4, (unsigned char*)&u32val);
+				uint32_t u32val = htole32((uint32_t)u64val);
+				pos = opack_put_byte(out, pos, 0x32);
+				pos = opack_put(out, pos, &u32val, 4);
 			} else {
-				uint8_t blen = 0x33;
-				char_buf_append(cbuf, 1, &blen);
 				u64val = htole64(u64val);
-				char_buf_append(cbuf, 8, (unsigned char*)&u64val);
+				pos = opack_put_byte(out, pos, 0x33);
+				pos = opack_put(out, pos, &u64val, 8);
 			}
 		}	break;
 		case PLIST_REAL: {
@@ -127,114 +164,54 @@ static void opack_encode_node(plist_t node, struct char_buf* cbuf)
 				uint32_t u32val = 0;
 				memcpy(&u32val, &fval, 4);
 				u32val = float_bswap32(u32val);
-				uint8_t blen = 0x35;
-				char_buf_append(cbuf, 1, &blen);
-				char_buf_append(cbuf, 4, (unsigned char*)&u32val);
+				pos = opack_put_byte(out, pos, 0x35);
+				pos = opack_put(out, pos, &u32val, 4);
 			} else {
 				uint64_t u64val = 0;
 				memcpy(&u64val, &dval, 8);
 				u64val = float_bswap64(u64val);
-				uint8_t blen = 0x36;
-				char_buf_append(cbuf, 1, &blen);
-				char_buf_append(cbuf, 8, (unsigned char*)&u64val);
+				pos = opack_put_byte(out, pos, 0x36);
+				pos = opack_put(out, pos, &u64val, 8);
 			}
 		}	break;
 		case PLIST_DATE: {
 			int32_t sec = 0;
-			int32_t usec = 0;	
+			int32_t usec = 0;
 			plist_get_date_val(node, &sec, &usec);
 			time_t tsec = sec;
 			tsec -= MAC_EPOCH;
 			double dval = (double)tsec + ((double)usec / 1000000);
-			uint8_t blen = 0x06;
-			char_buf_append(cbuf, 1, &blen);
 			uint64_t u64val = 0;
 			memcpy(&u64val, &dval, 8);
 			u64val = float_bswap64(u64val);
-			char_buf_append(cbuf, 8, (unsigned char*)&u64val);
+			pos = opack_put_byte(out, pos, 0x06);
+			pos = opack_put(out, pos, &u64val, 8);
 		}	break;
 		case PLIST_STRING:
 		case PLIST_KEY: {
 			uint64_t len = 0;
-			char* str = NULL;
+			const char* str = NULL;
 			if (type == PLIST_KEY) {
-				plist_get_key_val(node, &str);
-				len = strlen(str);
-			} else {
-				str = (char*)plist_get_string_ptr(node, &len);
-			}
-			if (len > 0x20) {
-				if (len > 0xFF) {
-					if (len > 0xFFFF) {
-						if (len >> 32) {
-							uint8_t blen = 0x64;
-							char_buf_append(cbuf, 1, &blen);
-							uint64_t u64val = htole64(len);
-							char_buf_append(cbuf, 8, (unsigned char*)&u64val);
-						} else {
-							uint8_t blen = 0x63;
-							char_buf_append(cbuf, 1, &blen);
-							uint32_t u32val = htole32((uint32_t)len);
-							char_buf_append(cbuf, 4, (unsigned char*)&u32val);
-						}
-					} else {
-						uint8_t blen = 0x62;
-						char_buf_append(cbuf, 1, &blen);
-						uint16_t u16val = htole16((uint16_t)len);
-						char_buf_append(cbuf, 2, (unsigned char*)&u16val);
-					}
-				} else {
-					uint8_t blen = 0x61;
-					char_buf_append(cbuf, 1, &blen);
-					char_buf_append(cbuf, 1, (unsigned char*)&len);
-				}
+				str = plist_get_key_ptr(node, &len);
 			} else {
-				uint8_t blen = 0x40 + len;
-				char_buf_append(cbuf, 1, &blen);
-			}
-			char_buf_append(cbuf, len, (unsigned char*)str);
-			if (type == PLIST_KEY) {
-				free(str);
+				str = plist_get_string_ptr(node, &len);
 			}
+			pos = opack_put_length_header(out, pos, 0x40, len);
+			pos = opack_put(out, pos, str, len);
 		}	break;
 		case PLIST_DATA: {
 			uint64_t len = 0;
 			const char* data = plist_get_data_ptr(node, &len);
-			if (len > 0x20) {
-				if (len > 0xFF) {
-					if (len > 0xFFFF) {
-						if (len >> 32) {
-							uint8_t blen = 0x94;
-							char_buf_append(cbuf, 1, &blen);
-							uint32_t u64val = htole64(len);
-							char_buf_append(cbuf, 8, (unsigned char*)&u64val);
-						} else {
-							uint8_t blen = 0x93;
-							char_buf_append(cbuf, 1, &blen);
-							uint32_t u32val = htole32((uint32_t)len);
-							char_buf_append(cbuf, 4, (unsigned char*)&u32val);
-						}
-					} else {
-						uint8_t blen = 0x92;
-						char_buf_append(cbuf, 1, &blen);
-						uint16_t u16val = htole16((uint16_t)len);
-						char_buf_append(cbuf, 2, (unsigned char*)&u16val);
-					}
-				} else {
-					uint8_t blen = 0x91;
-					char_buf_append(cbuf, 1, &blen);
-					char_buf_append(cbuf, 1, (unsigned char*)&len);
-				}
-			} else {
-				uint8_t blen = 0x70 + len;
-				char_buf_append(cbuf, 1, &blen);
-			}
-			char_buf_append(cbuf, len, (unsigned char*)data);
+			pos = opack_put_length_header(out, pos, 0x70, len);
+			pos = opack_put(out, pos, data, len);
 		}	break;
 		default:
-			fprintf(stderr, "%s: ERROR: Unsupported data type in plist\n", __func__);
+			if (!out) {
+				fprintf(stderr, "%s: ERROR: Unsupported data type in plist\n", __func__);
+			}
 			break;
 	}
+	return pos;
 }
 
 LIBIMOBILEDEVICE_GLUE_API void opack_encode_from_plist(plist_t plist, unsigned char** out, unsigned int* out_len)
@@ -242,8 +219,22 @@ LIBIMOBILEDEVICE_GLUE_API void opack_encode_from_plist(plist_t plist, unsigned c
 	if (!plist || !out || !out_len) {
 		return;
 	}
-	struct char_buf* cbuf = char_buf_new();
-	opack_encode_node(plist, cbuf);
+	/* measure first so the whole payload is encoded into one allocation */
+	size_t size = opack_encode_node(plist, NULL, 0);
+	if (size > UINT_MAX) {
+		fprintf(stderr, "%s: ERROR: Encoded size too large\n", __func__);
+		return;
+	}
+	struct char_buf* cbuf = char_buf_new_with_capacity((unsigned int)size);
+	if (!cbuf) {
+		return;
+	}
+	unsigned char* p = char_buf_extend(cbuf, (unsigned int)size);
+	if (!p) {
+		char_buf_free(cbuf);
+		return;
+	}
+	opack_encode_node(plist, p, 0);
 	*out = cbuf->data;
 	*out_len = cbuf->length;
 	cbuf->data = NULL;
@@ -27,18 +27,27 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include "common.h"
 #include "libimobiledevice-glue/tlv.h"
 #include "endianness.h"
 
-LIBIMOBILEDEVICE_GLUE_API tlv_buf_t tlv_buf_new()
+LIBIMOBILEDEVICE_GLUE_API tlv_buf_t tlv_buf_new_with_capacity(unsigned int capacity)
 {
 	tlv_buf_t tlv = malloc(sizeof(struct tlv_buf));
-	tlv->capacity = 1024;
+	if (!tlv) {
+		return NULL;
+	}
+	tlv->capacity = (capacity > 0) ? capacity : 1;
 	tlv->length = 0;
 	tlv->data = malloc(tlv->capacity);
-	return tlv;	
+	return tlv;
+}
+
+LIBIMOBILEDEVICE_GLUE_API tlv_buf_t tlv_buf_new()
+{
+	return tlv_buf_new_with_capacity(1024);
 }
 
 LIBIMOBILEDEVICE_GLUE_API void tlv_buf_free(tlv_buf_t tlv)
@@ -49,21 +58,43 @@ LIBIMOBILEDEVICE_GLUE_API void tlv_buf_free(tlv_buf_t tlv)
 	}
 }
 
-LIBIMOBILEDEVICE_GLUE_API void tlv_buf_append(tlv_buf_t tlv, uint8_t tag, unsigned int length, void* data)
+LIBIMOBILEDEVICE_GLUE_API unsigned int tlv_encoded_length(unsigned int length)
+{
+	/* every (up to) 255 byte fragment is preceded by a tag and a length byte */
+	return (length / 255) * 257 + ((length % 255) ? (length % 255) + 2 : 0);
+}
+
+LIBIMOBILEDEVICE_GLUE_API int tlv_buf_reserve(tlv_buf_t tlv, unsigned int length)
 {
 	if (!tlv || !tlv->data) {
-		return;
+		return -1;
 	}
-	unsigned int req_len = (length > 255) ? (length / 255) * 257 + (2 + (length % 255)) : length;
-	if (tlv->length + req_len > tlv->capacity) {
-		unsigned int newcapacity = tlv->capacity + ((req_len / 1024) + 1) * 1024;
-		unsigned char* newdata = realloc(tlv->data, newcapacity);
-		if (!newdata) {
-			fprintf(stderr, "%s: ERROR: Failed to realloc\n", __func__);
-			return;
-		}
-		tlv->data = newdata;
-		tlv->capacity = newcapacity;
+	if (length <= tlv->capacity - tlv->length) {
+		return 0;
+	}
+	if (length > UINT_MAX - tlv->length) {
+		fprintf(stderr, "%s: ERROR: Buffer size overflow\n", __func__);
+		return -1;
+	}
+	unsigned int required = tlv->length + length;
+	unsigned int newcapacity = tlv->capacity;
+	while (newcapacity < required) {
+		newcapacity = (newcapacity > UINT_MAX / 2) ? required : newcapacity * 2;
+	}
+	unsigned char* newdata = realloc(tlv->data, newcapacity);
+	if (!newdata) {
+		fprintf(stderr, "%s: ERROR: Failed to realloc\n", __func__);
+		return -1;
+	}
+	tlv->data = newdata;
+	tlv->capacity = newcapacity;
+	return 0;
+}
+
+LIBIMOBILEDEVICE_GLUE_API void tlv_buf_append(tlv_buf_t tlv, uint8_t tag, unsigned int length, void* data)
+{
+	if (tlv_buf_reserve(tlv, tlv_encoded_length(length)) < 0) {
+		return;
 	}
 	unsigned char* p = tlv->data + tlv->length;
 	unsigned int cur = 0;
@@ -164,9 +195,8 @@ LIBIMOBILEDEVICE_GLUE_API int tlv_data_copy_data(const void* tlv_data, unsigned
 	*out = NULL;
 	*out_len = 0;
 
-	unsigned char* dest = NULL;
+	/* add up the fragments first so the value is copied into a single allocation */
 	unsigned int dest_len = 0;
-
 	unsigned char* ptr = (unsigned char*)tlv_data;
 	unsigned char* end = (unsigned char*)tlv_data + tlv_length;
 	while (ptr < end) {
@@ -175,19 +205,32 @@ LIBIMOBILEDEVICE_GLUE_API int tlv_data_copy_data(const void* tlv_data, unsigned
 		if (!ptr) {
 			break;
 		}
-		unsigned char* newdest = realloc(dest, dest_len + length);
-		if (!newdest) {
-			free(dest);
+		if (ptr + length > end) {
 			return 0;
 		}
-		dest = newdest;
-		memcpy(dest + dest_len, ptr, length);
 		dest_len += length;
 		ptr += length;
 	}
+	if (dest_len == 0) {
+		return 0;
+	}
+
+	unsigned char* dest = malloc(dest_len);
 	if (!dest) {
 		return 0;
 	}
+	unsigned char* d = dest;
+	ptr = (unsigned char*)tlv_data;
+	while (ptr < end) {
+		uint8_t length = 0;
+		ptr = tlv_get_data_ptr(ptr, end, tag, &length);
+		if (!ptr) {
+			break;
+		}
+		memcpy(d, ptr, length);
+		d += length;
+		ptr += length;
+	}
 
 	*out = (void*)dest;
 	*out_len = dest_len;
@@ -340,6 +340,24 @@ LIBIMOBILEDEVICE_GLUE_API int plist_read_from_filename(plist_t *plist, const cha
 	return 1;
 }
 
+struct plist_file_writer {
+	const char *filename;
+	FILE *f;
+};
+
+/* opens the file with the first chunk, so a plist that can't be written
+ * in the requested format leaves an existing file untouched */
+static int plist_write_to_file_cb(const char *data, size_t length, void *user_data)
+{
+	struct plist_file_writer *writer = (struct plist_file_writer*)user_data;
+	if (!writer->f) {
+		writer->f = fopen(writer->filename, "wb");
+		if (!writer->f)
+			return -1;
+	}
+	return (fwrite(data, 1, length, writer->f) == length) ? 0 : -1;
+}
+
 LIBIMOBILEDEVICE_GLUE_API int plist_write_to_filename(plist_t plist, const char *filename, enum plist_format_t format)
 {
 	char *buffer = NULL;
@@ -348,8 +366,22 @@ LIBIMOBILEDEVICE_GLUE_API int plist_write_to_filename(plist_t plist, const char
 	if (!plist || !filename)
 		return 0;
 
-	if (format == PLIST_FORMAT_XML)
-		plist_to_xml(plist, &buffer, &length);
+	if (format == PLIST_FORMAT_XML || format == PLIST_FORMAT_JSON) {
+		/* stream the document to the file instead of building it in memory */
+		struct plist_file_writer writer = { filename, NULL };
+		plist_err_t err;
+		if (format == PLIST_FORMAT_XML)
+			err = plist_write_xml(plist, plist_write_to_file_cb, &writer);
+		else
+			err = plist_write_json(plist, plist_write_to_file_cb, &writer, 0);
+		if (!writer.f)
+			return 0;
+		if (fclose(writer.f) != 0 && err == PLIST_ERR_SUCCESS)
+			err = PLIST_ERR_IO;
+		if (err == PLIST_ERR_IO)
+			errno = EIO;
+		return (err == PLIST_ERR_SUCCESS) ? 1 : 0;
+	}
 	else if (format == PLIST_FORMAT_BINARY)
 		plist_to_bin(plist, &buffer, &length);
 	else
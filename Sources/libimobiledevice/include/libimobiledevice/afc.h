@@ -89,6 +89,49 @@ typedef enum {
 	AFC_LOCK_UN = 8 | 4  /**< unlock */
 } afc_lock_op_t;
 
+/** File types as reported by the st_ifmt field of the file information */
+typedef enum {
+	AFC_FILE_TYPE_UNKNOWN      = 0,
+	AFC_FILE_TYPE_REGULAR      = 1, /**< S_IFREG */
+	AFC_FILE_TYPE_DIRECTORY    = 2, /**< S_IFDIR */
+	AFC_FILE_TYPE_SYMLINK      = 3, /**< S_IFLNK */
+	AFC_FILE_TYPE_CHAR_DEVICE  = 4, /**< S_IFCHR */
+	AFC_FILE_TYPE_BLOCK_DEVICE = 5, /**< S_IFBLK */
+	AFC_FILE_TYPE_FIFO         = 6, /**< S_IFIFO */
+	AFC_FILE_TYPE_SOCKET       = 7  /**< S_IFSOCK */
+} afc_file_type_t;
+
+/** Typed information about a file, as returned by afc_get_file_info_typed() and afc_get_file_info_many() */
+typedef struct {
+	afc_error_t status;     /**< result of the request for this file; the other fields are only valid on AFC_E_SUCCESS */
+	uint64_t size;          /**< st_size */
+	uint64_t blocks;        /**< st_blocks */
+	uint32_t nlink;         /**< st_nlink */
+	afc_file_type_t type;   /**< st_ifmt */
+	uint64_t mtime;         /**< st_mtime in nanoseconds since epoch */
+	uint64_t birthtime;     /**< st_birthtime in nanoseconds since epoch */
+	char *link_target;      /**< LinkTarget of a symbolic link, or NULL */
+} afc_file_info_t;
+
+/** A directory listing packed into a single allocation, as returned by afc_read_directory_packed() */
+typedef struct {
+	uint32_t count;           /**< number of entries */
+	const char *names;        /**< the NUL-terminated entry names, back to back */
+	const uint32_t *offsets;  /**< offset of each entry name within names */
+} afc_directory_listing_t;
+
+/** An entry of a recursive directory listing, as returned by afc_walk() */
+typedef struct {
+	char *path;             /**< fully-qualified path of the entry */
+	afc_file_info_t info;   /**< information about the entry */
+} afc_walk_entry_t;
+
+/** Receives the data read by afc_file_read_pipelined(); returns non-zero to stop reading */
+typedef int (*afc_file_read_cb_t)(const char *data, uint32_t length, void *user_data);
+
+/** Receives the result of an asynchronous operation; the data is only valid during the call */
+typedef void (*afc_completion_cb_t)(afc_error_t status, const char *data, uint32_t length, void *user_data);
+
 typedef struct afc_client_private afc_client_private;
 typedef afc_client_private *afc_client_t; /**< The client handle. */
 
@@ -102,6 +145,10 @@ typedef afc_client_private *afc_client_t; /**< The client handle. */
  * @param client Pointer that will be set to a newly allocated afc_client_t
  *        upon successful return.
  *
+ * @note The client may be used by several threads at once. Their requests are
+ *       sent over the same connection without waiting for each other's
+ *       replies, so operations on different files overlap.
+ *
  * @return AFC_E_SUCCESS on success, AFC_E_INVALID_ARG if device or service is
  *         invalid, AFC_E_MUX_ERROR if the connection cannot be established,
  *         or AFC_E_NO_MEM if there is a memory allocation problem.
@@ -123,9 +170,12 @@ afc_error_t afc_client_start_service(idevice_t device, afc_client_t* client, con
 
 /**
  * Frees up an AFC client. If the connection was created by the client itself,
- * the connection will be closed.
+ * the connection will be closed. Asynchronous operations that have not
+ * completed yet are completed with AFC_E_OP_INTERRUPTED.
  *
  * @param client The client to free.
+ *
+ * @note Must not be called from a completion callback.
  */
 afc_error_t afc_client_free(afc_client_t client);
 
@@ -156,6 +206,19 @@ afc_error_t afc_get_device_info(afc_client_t client, char ***device_information)
  */
 afc_error_t afc_read_directory(afc_client_t client, const char *path, char ***directory_information);
 
+/**
+ * Gets a directory listing of the directory requested as a single packed
+ * buffer, without allocating each entry name separately.
+ *
+ * @param client The client to get a directory listing from.
+ * @param path The directory for listing. (must be a fully-qualified path)
+ * @param listing Pointer that will be set to the listing upon successful
+ *        return. Free with afc_directory_listing_free().
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_read_directory_packed(afc_client_t client, const char *path, afc_directory_listing_t **listing);
+
 /**
  * Gets information about a specific file.
  *
@@ -169,6 +232,56 @@ afc_error_t afc_read_directory(afc_client_t client, const char *path, char ***di
  */
 afc_error_t afc_get_file_info(afc_client_t client, const char *path, char ***file_information);
 
+/**
+ * Gets information about a specific file as a typed structure. The reply is
+ * parsed in a single pass; only the link target of a symbolic link is
+ * allocated separately.
+ *
+ * @param client The client to use to get the information of the file.
+ * @param path The fully-qualified path to the file.
+ * @param file_info Pointer that will be set to the file information upon
+ *        successful return. Free with afc_file_info_free() and a count of 1.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_get_file_info_typed(afc_client_t client, const char *path, afc_file_info_t **file_info);
+
+/**
+ * Gets information about many files at once. The requests are pipelined on
+ * the connection, so this needs far fewer round trips than calling
+ * afc_get_file_info() for each path.
+ *
+ * @param client The client to use to get the information of the files.
+ * @param paths The fully-qualified paths of the files.
+ * @param count The number of paths.
+ * @param file_infos Pointer that will be set to an array of count entries,
+ *        in the order of the paths, upon successful return. The status field
+ *        of each entry holds the result for that path. Free with
+ *        afc_file_info_free().
+ *
+ * @return AFC_E_SUCCESS if the information was retrieved (even if it failed
+ *         for some of the paths) or an AFC_E_* error value.
+ */
+afc_error_t afc_get_file_info_many(afc_client_t client, const char **paths, uint32_t count, afc_file_info_t **file_infos);
+
+/**
+ * Recursively lists the contents of a directory, including the information
+ * about each entry. Each level of the tree is listed and queried with
+ * pipelined requests.
+ *
+ * @param client The client to use.
+ * @param path The directory to list. (must be a fully-qualified path)
+ * @param entries Pointer that will be set to an array of the entries below
+ *        path (not including path itself or "." and ".." entries), parents
+ *        before their children. Free with afc_walk_free().
+ * @param count Pointer that will be set to the number of entries.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value. Subdirectories
+ *         that can't be listed are skipped, but an error listing path itself
+ *         is returned.
+ */
+afc_error_t afc_walk(afc_client_t client, const char *path, afc_walk_entry_t **entries, uint32_t *count);
+
 /**
  * Opens a file on the device.
  *
@@ -216,6 +329,27 @@ afc_error_t afc_file_lock(afc_client_t client, uint64_t handle, afc_lock_op_t op
  */
 afc_error_t afc_file_read(afc_client_t client, uint64_t handle, char *data, uint32_t length, uint32_t *bytes_read);
 
+/**
+ * Reads the remainder of the given file, keeping several read requests of the
+ * given size in flight so the transfer is not limited by round trips. The
+ * data is passed to the callback in file order.
+ *
+ * @param client The relevant AFC client
+ * @param handle File handle of a previously opened file
+ * @param chunk_size The number of bytes to request per read, or 0 for a
+ *        default size
+ * @param read_cb Callback that receives the data; returning non-zero stops
+ *        the transfer
+ * @param user_data Passed to the callback
+ * @param bytes_read Pointer that will be set to the number of bytes passed to
+ *        the callback. Can be NULL.
+ *
+ * @return AFC_E_SUCCESS when the end of the file was reached,
+ *         AFC_E_OP_INTERRUPTED if the callback stopped the transfer, or an
+ *         AFC_E_* error value.
+ */
+afc_error_t afc_file_read_pipelined(afc_client_t client, uint64_t handle, uint32_t chunk_size, afc_file_read_cb_t read_cb, void *user_data, uint64_t *bytes_read);
+
 /**
  * Writes a given number of bytes to a file.
  *
@@ -229,6 +363,71 @@ afc_error_t afc_file_read(afc_client_t client, uint64_t handle, char *data, uint
  */
 afc_error_t afc_file_write(afc_client_t client, uint64_t handle, const char *data, uint32_t length, uint32_t *bytes_written);
 
+/**
+ * Opens a file on the device without waiting for the reply.
+ *
+ * Asynchronous requests of all clients are sent and their replies received
+ * by a single background thread, so any number of operations can be in
+ * flight without tying up a thread each. The callback is invoked exactly
+ * once, on that thread or on a thread that is waiting for a reply on the
+ * same client, and should return quickly.
+ *
+ * @param client The client to use to open the file.
+ * @param filename The file to open. (must be a fully-qualified path)
+ * @param file_mode The mode to use to open the file.
+ * @param callback Receives the result; on success the data is the 64-bit
+ *        file handle.
+ * @param user_data Passed to the callback
+ *
+ * @return AFC_E_SUCCESS if the request was queued or an AFC_E_* error value,
+ *         in which case the callback is not invoked.
+ */
+afc_error_t afc_file_open_async(afc_client_t client, const char *filename, afc_file_mode_t file_mode, afc_completion_cb_t callback, void *user_data);
+
+/**
+ * Reads up to the given number of bytes from a file without waiting for the
+ * reply. See afc_file_open_async() for how the callback is invoked.
+ *
+ * @param client The client to use.
+ * @param handle File handle of a previously opened file
+ * @param length The number of bytes to read
+ * @param callback Receives the result and the data that was read
+ * @param user_data Passed to the callback
+ *
+ * @return AFC_E_SUCCESS if the request was queued or an AFC_E_* error value.
+ */
+afc_error_t afc_file_read_async(afc_client_t client, uint64_t handle, uint32_t length, afc_completion_cb_t callback, void *user_data);
+
+/**
+ * Writes data to a file without waiting for the reply. The data is copied,
+ * so the buffer can be reused as soon as the function returns. See
+ * afc_file_open_async() for how the callback is invoked.
+ *
+ * @param client The client to use.
+ * @param handle File handle of a previously opened file
+ * @param data The data to write to the file.
+ * @param length How much data to write.
+ * @param callback Receives the result; on success the length is the number
+ *        of bytes written and the data is NULL.
+ * @param user_data Passed to the callback
+ *
+ * @return AFC_E_SUCCESS if the request was queued or an AFC_E_* error value.
+ */
+afc_error_t afc_file_write_async(afc_client_t client, uint64_t handle, const char *data, uint32_t length, afc_completion_cb_t callback, void *user_data);
+
+/**
+ * Closes a file without waiting for the reply. See afc_file_open_async()
+ * for how the callback is invoked.
+ *
+ * @param client The client to use.
+ * @param handle File handle of a previously opened file
+ * @param callback Receives the result
+ * @param user_data Passed to the callback
+ *
+ * @return AFC_E_SUCCESS if the request was queued or an AFC_E_* error value.
+ */
+afc_error_t afc_file_close_async(afc_client_t client, uint64_t handle, afc_completion_cb_t callback, void *user_data);
+
 /**
  * Seeks to a given position of a pre-opened file on the device.
  *
@@ -368,6 +567,36 @@ afc_error_t afc_get_device_info_key(afc_client_t client, const char *key, char *
  */
 afc_error_t afc_dictionary_free(char **dictionary);
 
+/**
+ * Frees up a file information array as returned by afc_get_file_info_typed()
+ * or afc_get_file_info_many().
+ *
+ * @param file_infos The array to free.
+ * @param count The number of entries in the array.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_file_info_free(afc_file_info_t *file_infos, uint32_t count);
+
+/**
+ * Frees up a directory listing as returned by afc_walk().
+ *
+ * @param entries The entries to free.
+ * @param count The number of entries.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_walk_free(afc_walk_entry_t *entries, uint32_t count);
+
+/**
+ * Frees up a directory listing as returned by afc_read_directory_packed().
+ *
+ * @param listing The listing to free.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+afc_error_t afc_directory_listing_free(afc_directory_listing_t *listing);
+
 #ifdef __cplusplus
 }
 #endif
@@ -93,6 +93,9 @@ typedef struct {
 /** Callback to notifiy if a device was added or removed. */
 typedef void (*idevice_event_cb_t) (const idevice_event_t *event, void *user_data);
 
+/** Represents a device event subscription, see idevice_events_subscribe() */
+typedef struct idevice_subscription_context* idevice_subscription_context_t;
+
 /* functions */
 
 /**
@@ -122,6 +125,32 @@ idevice_error_t idevice_event_subscribe(idevice_event_cb_t callback, void *user_
  */
 idevice_error_t idevice_event_unsubscribe(void);
 
+/**
+ * Subscribe a callback function that will be called when device add/remove
+ * events occur. Unlike idevice_event_subscribe(), any number of callbacks
+ * can be subscribed at the same time.
+ *
+ * @param context A pointer to an idevice_subscription_context_t that will be
+ *    set upon creation of the subscription. The returned context must be
+ *    passed to idevice_events_unsubscribe() to unsubscribe the callback.
+ * @param callback Callback function to call.
+ * @param user_data Application-specific data passed as parameter
+ *   to the registered callback function.
+ *
+ * @return IDEVICE_E_SUCCESS on success or an error value when an error occurred.
+ */
+idevice_error_t idevice_events_subscribe(idevice_subscription_context_t *context, idevice_event_cb_t callback, void *user_data);
+
+/**
+ * Unsubscribe the event callback function that has been registered with
+ *  idevice_events_subscribe().
+ *
+ * @param context A valid context as returned from idevice_events_subscribe().
+ *
+ * @return IDEVICE_E_SUCCESS on success or an error value when an error occurred.
+ */
+idevice_error_t idevice_events_unsubscribe(idevice_subscription_context_t context);
+
 /* discovery (synchronous) */
 
 /**
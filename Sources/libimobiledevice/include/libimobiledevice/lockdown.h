@@ -100,6 +100,12 @@ struct lockdownd_service_descriptor {
 };
 typedef struct lockdownd_service_descriptor *lockdownd_service_descriptor_t;
 
+/** A domain and key to retrieve with lockdownd_get_values() */
+typedef struct {
+	const char *domain; /**< The domain to query, or NULL for the global domain */
+	const char *key;    /**< The key name to query, or NULL to query all keys of the domain */
+} lockdownd_value_query_t;
+
 
 typedef enum {
 	LOCKDOWN_CU_PAIRING_PIN_REQUESTED, /**< PIN requested: data_ptr is a char* buffer, and data_size points to the size of this buffer that must not be exceeded and has to be updated to the actual number of characters filled into the buffer. */
@@ -185,6 +191,45 @@ lockdownd_error_t lockdownd_query_type(lockdownd_client_t client, char **type);
  */
 lockdownd_error_t lockdownd_get_value(lockdownd_client_t client, const char *domain, const char *key, plist_t *value);
 
+/**
+ * Retrieves several preference values in a single exchange. The GetValue
+ * requests are sent back to back without waiting for each reply, and the
+ * replies are matched to the queries in order.
+ *
+ * @param client An initialized lockdownd client.
+ * @param queries An array of count domain/key pairs to query
+ * @param count The number of queries
+ * @param values An array of count plist nodes that will be set to the value
+ *  of each query, or NULL if the device did not return a value for it. The
+ *  caller is responsible for freeing the values with plist_free(), including
+ *  the ones received before an error interrupted the exchange.
+ * @param errors An optional array of count error codes that will be set to
+ *  the result of each query, or NULL
+ *
+ * @return LOCKDOWN_E_SUCCESS if all queries were exchanged with the device,
+ *  even if some of them failed (see errors), LOCKDOWN_E_INVALID_ARG when
+ *  client, queries or values is NULL, or the error that interrupted the
+ *  exchange
+ */
+lockdownd_error_t lockdownd_get_values(lockdownd_client_t client, const lockdownd_value_query_t *queries, uint32_t count, plist_t *values, lockdownd_error_t *errors);
+
+/**
+ * Retrieves all values of a domain with a single request and picks the
+ * given keys from it.
+ *
+ * @param client An initialized lockdownd client.
+ * @param domain The domain to query on or NULL for global domain
+ * @param keys An array of count key names to pick, or NULL for all keys
+ * @param count The number of key names
+ * @param values A PLIST_DICT holding the requested keys that have a value
+ *  on the device. The caller is responsible for freeing it with plist_free().
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, LOCKDOWN_E_INVALID_ARG when client
+ *  or values is NULL, LOCKDOWN_E_PLIST_ERROR if the domain is not a
+ *  dictionary
+ */
+lockdownd_error_t lockdownd_get_domain_values(lockdownd_client_t client, const char *domain, const char * const *keys, uint32_t count, plist_t *values);
+
 /**
  * Sets a preferences value using a plist and optional by domain and/or key name.
  *
@@ -50,6 +50,44 @@ typedef enum {
 typedef struct mobilebackup2_client_private mobilebackup2_client_private;
 typedef mobilebackup2_client_private *mobilebackup2_client_t; /**< The client handle. */
 
+/** Flags for mobilebackup2_receive_files() */
+typedef enum {
+	MOBILEBACKUP2_RECEIVE_FSYNC = 1 << 0 /**< flush each file to stable storage before closing it */
+} mobilebackup2_receive_flags_t;
+
+/** Statistics collected by mobilebackup2_receive_files() */
+typedef struct {
+	uint64_t bytes;          /**< file data bytes written to disk */
+	uint32_t files;          /**< files written to disk */
+	uint32_t deduplicated;   /**< files replaced by a link to identical content in the content store */
+	uint64_t deduplicated_bytes; /**< size of the deduplicated files */
+	uint64_t elapsed_usec;   /**< time spent receiving, in microseconds */
+	int error;               /**< errno of the first local failure, or 0 */
+	char *error_path;        /**< the file that could not be written, or NULL; must be freed by the caller */
+} mobilebackup2_receive_stats_t;
+
+/**
+ * Reports the progress of mobilebackup2_receive_files(); returns non-zero to
+ * stop receiving. remote_error is set when the device sent an error message
+ * instead of a file, and is NULL otherwise.
+ */
+typedef int (*mobilebackup2_receive_cb_t)(uint64_t bytes_received, uint32_t files_received, const char *remote_error, void *user_data);
+
+/** Statistics collected by mobilebackup2_send_files() */
+typedef struct {
+	uint64_t bytes;          /**< file data bytes sent */
+	uint32_t files;          /**< files sent */
+	uint32_t failed;         /**< files that could not be read and were reported to the device as failed */
+	uint64_t elapsed_usec;   /**< time spent sending, in microseconds */
+} mobilebackup2_send_stats_t;
+
+/**
+ * Reports each file sent by mobilebackup2_send_files(); returns non-zero to
+ * stop sending after the files that are already queued. error is 0 if the
+ * file was sent, or the errno value describing why it could not be read.
+ */
+typedef int (*mobilebackup2_send_cb_t)(const char *path, uint64_t size, int error, uint64_t bytes_sent, void *user_data);
+
 
 /**
  * Connects to the mobilebackup2 service on the specified device.
@@ -206,6 +244,102 @@ mobilebackup2_error_t mobilebackup2_send_request(mobilebackup2_client_t client,
  */
 mobilebackup2_error_t mobilebackup2_send_status_response(mobilebackup2_client_t client, int status_code, const char *status1, plist_t status2);
 
+/**
+ * Sets a content store that received backup files are shared with.
+ *
+ * When set, mobilebackup2_receive_files() hashes each backup data file while
+ * writing it. If the store already holds a file with the same content, the
+ * received file is replaced by a hardlink to it, otherwise the received file
+ * is linked into the store. Backups of similar devices that use the same
+ * store (which needs to be on the same file system as the backups) thus
+ * share the disk space of identical files.
+ *
+ * @note Content stores are not supported on Windows.
+ *
+ * @param client The MobileBackup client to use.
+ * @param store_dir The folder of the content store, which is created as
+ *     needed, or NULL to stop using a content store.
+ *
+ * @return MOBILEBACKUP2_E_SUCCESS on success, MOBILEBACKUP2_E_INVALID_ARG if
+ *     client is invalid, or MOBILEBACKUP2_E_UNKNOWN_ERROR if content stores
+ *     are not supported on this platform.
+ */
+mobilebackup2_error_t mobilebackup2_set_content_store(mobilebackup2_client_t client, const char *store_dir);
+
+/**
+ * Removes the files from a content store that are no longer used by any
+ * backup, i.e. that have no other hardlinks.
+ *
+ * @param store_dir The folder of the content store.
+ * @param removed_files Pointer that will be set to the number of removed
+ *     files. Can be NULL.
+ * @param removed_bytes Pointer that will be set to the size of the removed
+ *     files. Can be NULL.
+ *
+ * @return MOBILEBACKUP2_E_SUCCESS on success, MOBILEBACKUP2_E_INVALID_ARG if
+ *     store_dir is not a folder, or MOBILEBACKUP2_E_UNKNOWN_ERROR if content
+ *     stores are not supported on this platform.
+ */
+mobilebackup2_error_t mobilebackup2_content_store_prune(const char *store_dir, uint32_t *removed_files, uint64_t *removed_bytes);
+
+/**
+ * Receives the files of a DLMessageUploadFiles message into a local folder.
+ *
+ * File data is received into large reusable buffers and handed to a writer
+ * thread, which creates the files (and any missing parent folders) and writes
+ * them with vectored writes, so receiving from the device never waits on the
+ * disk. A file that is only partially received is removed. Files are
+ * shared with the content store set with mobilebackup2_set_content_store().
+ *
+ * @note The caller still needs to reply to the message with
+ *     mobilebackup2_send_status_response(), using the error in stats.
+ *
+ * @param client The MobileBackup client to use.
+ * @param backup_dir The local folder that the received file names are
+ *     relative to.
+ * @param flags A combination of mobilebackup2_receive_flags_t values.
+ * @param status_cb Callback invoked after each block of data and for each
+ *     error message from the device. Can be NULL.
+ * @param user_data Passed to the callback.
+ * @param stats Pointer to a structure that will be filled with the number of
+ *     files and bytes written, the time taken, and the first local error.
+ *     Can be NULL.
+ *
+ * @return MOBILEBACKUP2_E_SUCCESS when all files were received (even if some
+ *     could not be written, see stats) or the callback stopped the transfer,
+ *     MOBILEBACKUP2_E_INVALID_ARG if client or backup_dir is invalid, or
+ *     MOBILEBACKUP2_E_MUX_ERROR if receiving from the device failed.
+ */
+mobilebackup2_error_t mobilebackup2_receive_files(mobilebackup2_client_t client, const char *backup_dir, uint32_t flags, mobilebackup2_receive_cb_t status_cb, void *user_data, mobilebackup2_receive_stats_t *stats);
+
+/**
+ * Sends the files requested by a DLMessageDownloadFiles message from a local
+ * folder, including the terminating marker.
+ *
+ * A reader thread reads the upcoming files ahead of time and serializes file
+ * names, data and status codes into large buffers, which are then sent with
+ * a single call each, so many small files share one send. Files that cannot
+ * be read are reported to the device with an error code instead.
+ *
+ * @note The caller still needs to reply to the message with
+ *     mobilebackup2_send_status_response(), listing the files that failed.
+ *
+ * @param client The MobileBackup client to use.
+ * @param backup_dir The local folder that the requested file names are
+ *     relative to.
+ * @param files The PLIST_ARRAY of file names from the message.
+ * @param status_cb Callback invoked after each file has been sent. Can be
+ *     NULL.
+ * @param user_data Passed to the callback.
+ * @param stats Pointer to a structure that will be filled with the number of
+ *     files and bytes sent and the time taken. Can be NULL.
+ *
+ * @return MOBILEBACKUP2_E_SUCCESS on success (even if some files could not be
+ *     read), MOBILEBACKUP2_E_INVALID_ARG if one or more parameters are
+ *     invalid, or MOBILEBACKUP2_E_MUX_ERROR if sending to the device failed.
+ */
+mobilebackup2_error_t mobilebackup2_send_files(mobilebackup2_client_t client, const char *backup_dir, plist_t files, mobilebackup2_send_cb_t status_cb, void *user_data, mobilebackup2_send_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,6 +28,11 @@
 #include <stdlib.h>
 #ifndef WIN32
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#else
+#include <winsock2.h>
+#define poll WSAPoll
 #endif
 #include <string.h>
 
@@ -36,27 +41,9 @@
 #include "common/debug.h"
 #include "endianness.h"
 
-/**
- * Locks an AFC client, done for thread safety stuff
- *
- * @param client The AFC client connection to lock
- */
-static void afc_lock(afc_client_t client)
-{
-	debug_info("Locked");
-	mutex_lock(&client->mutex);
-}
-
-/**
- * Unlocks an AFC client, done for thread safety stuff.
- *
- * @param client The AFC
- */
-static void afc_unlock(afc_client_t client)
-{
-	debug_info("Unlocked");
-	mutex_unlock(&client->mutex);
-}
+static void afc_events_wake(void);
+static int afc_fd_readable(int fd);
+static void afc_async_cancel(afc_client_t client);
 
 /**
  * Makes a connection to the AFC service on the device using the given
@@ -76,6 +63,8 @@ LIBIMOBILEDEVICE_API afc_error_t afc_client_new_with_service_client(service_clie
 		return AFC_E_INVALID_ARG;
 
 	afc_client_t client_loc = (afc_client_t) malloc(sizeof(struct afc_client_private));
+	if (!client_loc)
+		return AFC_E_NO_MEM;
 	client_loc->parent = service_client;
 	client_loc->free_parent = 0;
 
@@ -90,7 +79,17 @@ LIBIMOBILEDEVICE_API afc_error_t afc_client_new_with_service_client(service_clie
 	client_loc->afc_packet->entire_length = 0;
 	client_loc->afc_packet->this_length = 0;
 	memcpy(client_loc->afc_packet->magic, AFC_MAGIC, AFC_MAGIC_LEN);
-	mutex_init(&client_loc->mutex);
+	mutex_init(&client_loc->send_mutex);
+	mutex_init(&client_loc->reply_mutex);
+	client_loc->pending = NULL;
+	client_loc->send_queue = NULL;
+	client_loc->async_pending = 0;
+	client_loc->async_registered = 0;
+	client_loc->async_busy = 0;
+	client_loc->reading = 0;
+	client_loc->rx_header_length = 0;
+	client_loc->rx_data = NULL;
+	client_loc->rx_data_length = 0;
 
 	*client = client_loc;
 	return AFC_E_SUCCESS;
@@ -127,61 +126,152 @@ LIBIMOBILEDEVICE_API afc_error_t afc_client_free(afc_client_t client)
 	if (!client || !client->afc_packet)
 		return AFC_E_INVALID_ARG;
 
+	afc_async_cancel(client);
+
 	if (client->free_parent && client->parent) {
 		service_client_free(client->parent);
 		client->parent = NULL;
 	}
 	free(client->afc_packet);
-	mutex_destroy(&client->mutex);
+	free(client->rx_data);
+	mutex_destroy(&client->send_mutex);
+	mutex_destroy(&client->reply_mutex);
 	free(client);
 	return AFC_E_SUCCESS;
 }
 
+static int _afc_check_packet_buffer(afc_client_t client, uint32_t data_len)
+{
+	if (data_len > client->packet_extra) {
+		client->packet_extra = (data_len & ~8) + 8;
+		AFCPacket* newpkt = (AFCPacket*)realloc(client->afc_packet, sizeof(AFCPacket) + client->packet_extra);
+		if (!newpkt) {
+			return -1;
+		}
+		client->afc_packet = newpkt;
+	}
+	return 0;
+}
+
+#define AFC_PACKET_DATA_PTR ((char*)client->afc_packet + sizeof(AFCPacket))
+
 /**
- * Dispatches an AFC packet over a client.
+ * Prepares a request object that will receive the reply to a packet sent
+ * with afc_dispatch_packet().
+ */
+static void afc_request_init(struct afc_request *req)
+{
+	memset(req, 0, sizeof(struct afc_request));
+	cond_init(&req->cond);
+}
+
+/**
+ * Removes a request from the list of requests that are waiting for a reply.
+ *
+ * @return 1 if the request was in the list, 0 if it was not.
+ *
+ * @note The reply mutex must be held by the caller.
+ */
+static int afc_request_unlink(afc_client_t client, struct afc_request *req)
+{
+	struct afc_request **link = &client->pending;
+	while (*link) {
+		if (*link == req) {
+			*link = req->next;
+			req->next = NULL;
+			return 1;
+		}
+		link = &(*link)->next;
+	}
+	return 0;
+}
+
+/**
+ * Releases a request object. If its reply has not arrived yet, the request
+ * is forgotten and the reply is discarded when it arrives.
+ */
+static void afc_request_finish(afc_client_t client, struct afc_request *req)
+{
+	mutex_lock(&client->reply_mutex);
+	afc_request_unlink(client, req);
+	mutex_unlock(&client->reply_mutex);
+	free(req->data);
+	req->data = NULL;
+	cond_destroy(&req->cond);
+}
+
+/**
+ * Dispatches an AFC packet over a client and registers the request that will
+ * receive its reply. Packets from concurrent callers are sent one at a time.
  *
  * @param client The client to send data through.
+ * @param req The request that will receive the reply, initialized with
+ *  afc_request_init().
  * @param operation The operation to perform.
  * @param data The data to send together with the header.
  * @param data_length The length of the data to send with the header.
  * @param payload The data to send after the header has been sent.
  * @param payload_length The length of data to send after the header.
- * @param bytes_sent The total number of bytes actually sent.
+ * @param bytes_sent The total number of bytes actually sent, or NULL.
  *
- * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value. If sending
+ *  fails after a reader has already failed the request because of the same
+ *  broken connection, AFC_E_SUCCESS is returned, since the request was
+ *  completed and, if asynchronous, freed by that reader.
  */
-static afc_error_t afc_dispatch_packet(afc_client_t client, uint64_t operation, uint32_t data_length, const char* payload, uint32_t payload_length, uint32_t *bytes_sent)
+static afc_error_t afc_dispatch_packet(afc_client_t client, struct afc_request *req, uint64_t operation, const char *data, uint32_t data_length, const char* payload, uint32_t payload_length, uint32_t *bytes_sent)
 {
 	uint32_t sent = 0;
+	uint32_t total = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
 
 	if (!client || !client->parent || !client->afc_packet)
 		return AFC_E_INVALID_ARG;
 
-	*bytes_sent = 0;
+	if (bytes_sent)
+		*bytes_sent = 0;
 
 	if (!payload || !payload_length)
 		payload_length = 0;
 
+	mutex_lock(&client->send_mutex);
+
+	if (_afc_check_packet_buffer(client, data_length) < 0) {
+		mutex_unlock(&client->send_mutex);
+		debug_info("Failed to realloc packet buffer");
+		return AFC_E_NO_MEM;
+	}
+	if (data_length > 0) {
+		memcpy(AFC_PACKET_DATA_PTR, data, data_length);
+	}
+
 	client->afc_packet->packet_num++;
 	client->afc_packet->operation = operation;
 	client->afc_packet->entire_length = sizeof(AFCPacket) + data_length + payload_length;
 	client->afc_packet->this_length = sizeof(AFCPacket) + data_length;
 
+	/* the reply may be read by another thread as soon as the packet is out */
+	req->packet_num = client->afc_packet->packet_num;
+	mutex_lock(&client->reply_mutex);
+	struct afc_request **link = &client->pending;
+	while (*link) {
+		link = &(*link)->next;
+	}
+	req->next = NULL;
+	*link = req;
+	mutex_unlock(&client->reply_mutex);
+
 	debug_info("packet length = %i", client->afc_packet->this_length);
 
 	/* send AFC packet header and data */
 	AFCPacket_to_LE(client->afc_packet);
 	debug_buffer((char*)client->afc_packet, sizeof(AFCPacket) + data_length);
-	sent = 0;
 	service_send(client->parent, (void*)client->afc_packet, sizeof(AFCPacket) + data_length, &sent);
 	AFCPacket_from_LE(client->afc_packet);
-	*bytes_sent += sent;
+	total += sent;
 	if (sent < sizeof(AFCPacket) + data_length) {
-		return AFC_E_SUCCESS;
-	}
-
-	sent = 0;
-	if (payload_length > 0) {
+		ret = AFC_E_NOT_ENOUGH_DATA;
+	} else if (payload_length > 0) {
 		if (payload_length > 256) {
 			debug_info("packet payload follows (256/%u)", payload_length);
 			debug_buffer(payload, 256);
@@ -189,170 +279,896 @@ static afc_error_t afc_dispatch_packet(afc_client_t client, uint64_t operation,
 			debug_info("packet payload follows");
 			debug_buffer(payload, payload_length);
 		}
+		sent = 0;
 		service_send(client->parent, payload, payload_length, &sent);
+		total += sent;
+		if (sent < payload_length) {
+			ret = AFC_E_NOT_ENOUGH_DATA;
+		}
 	}
-	*bytes_sent += sent;
-	if (sent < payload_length) {
-		return AFC_E_SUCCESS;
+
+	mutex_unlock(&client->send_mutex);
+
+	if (ret != AFC_E_SUCCESS) {
+		mutex_lock(&client->reply_mutex);
+		if (!afc_request_unlink(client, req)) {
+			/* a reader already completed the request with the error of the connection */
+			ret = AFC_E_SUCCESS;
+		}
+		mutex_unlock(&client->reply_mutex);
 	}
+	if (bytes_sent)
+		*bytes_sent = total;
 
-	return AFC_E_SUCCESS;
+	return ret;
 }
 
 /**
- * Receives data through an AFC client and sets a variable to the received data.
+ * Receives up to length bytes from the connection.
  *
  * @param client The client to receive data on.
- * @param bytes The char* to point to the newly-received data.
- * @param bytes_recv How much data was received.
+ * @param data Buffer that receives the data.
+ * @param length The number of bytes to receive at most.
+ * @param received Pointer that will be set to the number of bytes received.
+ * @param nonblocking If set, only data that has already arrived is
+ *  received, and received is set to 0 if there is none.
  *
- * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ * @return AFC_E_SUCCESS, or AFC_E_MUX_ERROR if the connection failed.
  */
-static afc_error_t afc_receive_data(afc_client_t client, char **bytes, uint32_t *bytes_recv)
+static afc_error_t afc_receive(afc_client_t client, char *data, uint32_t length, uint32_t *received, int nonblocking)
 {
-	AFCPacket header;
-	uint32_t entire_len = 0;
-	uint32_t this_len = 0;
-	uint32_t current_count = 0;
-	uint64_t param1 = -1;
-	char* dump_here = NULL;
-
-	if (bytes_recv) {
-		*bytes_recv = 0;
-	}
-	if (bytes) {
-		*bytes = NULL;
+	*received = 0;
+	if (!nonblocking) {
+		service_receive(client->parent, data, length, received);
+		return (*received > 0) ? AFC_E_SUCCESS : AFC_E_MUX_ERROR;
 	}
 
-	/* first, read the AFC header */
-	service_receive(client->parent, (char*)&header, sizeof(AFCPacket), bytes_recv);
-	AFCPacket_from_LE(&header);
-	if (*bytes_recv == 0) {
-		debug_info("Just didn't get enough.");
+	int fd = -1;
+	if (idevice_connection_get_fd(client->parent->connection, &fd) != IDEVICE_E_SUCCESS) {
 		return AFC_E_MUX_ERROR;
-	} else if (*bytes_recv < sizeof(AFCPacket)) {
-		debug_info("Did not even get the AFCPacket header");
+	}
+	if (!afc_fd_readable(fd)) {
+		return AFC_E_SUCCESS;
+	}
+	/* the data is there, so the timeout only matters if another reader took it */
+	service_error_t err = service_receive_with_timeout(client->parent, data, length, received, 1);
+	if (*received == 0 && err != SERVICE_E_TIMEOUT) {
 		return AFC_E_MUX_ERROR;
 	}
+	return AFC_E_SUCCESS;
+}
 
-	/* check if it's a valid AFC header */
-	if (strncmp(header.magic, AFC_MAGIC, AFC_MAGIC_LEN)) {
-		debug_info("Invalid AFC packet received (magic != " AFC_MAGIC ")!");
-	}
+/**
+ * Forgets the packet that was being received.
+ */
+static void afc_reset_packet(afc_client_t client)
+{
+	free(client->rx_data);
+	client->rx_data = NULL;
+	client->rx_data_length = 0;
+	client->rx_header_length = 0;
+}
 
-	/* check if it has the correct packet number */
-	if (header.packet_num != client->afc_packet->packet_num) {
-		/* otherwise print a warning but do not abort */
-		debug_info("ERROR: Unexpected packet number (%lld != %lld) aborting.", header.packet_num, client->afc_packet->packet_num);
-		return AFC_E_OP_HEADER_INVALID;
-	}
+/**
+ * Reads the next AFC packet from the connection, whichever request it
+ * belongs to.
+ *
+ * The packet is assembled in the client, so a reader that does not block
+ * can return when no more data has arrived, and the next reader continues
+ * where it left off.
+ *
+ * @param client The client to receive data on.
+ * @param nonblocking If set, only the data that has already arrived is
+ *  received.
+ * @param header The header of the received packet.
+ * @param bytes Pointer that will be set to the data that follows the header.
+ * @param bytes_recv Pointer that will be set to the length of the data.
+ *
+ * @return AFC_E_SUCCESS on success, AFC_E_OP_WOULD_BLOCK if nonblocking is
+ *  set and the rest of the packet has not arrived yet, or an AFC_E_* error
+ *  value if the connection failed.
+ *
+ * @note Only one thread may be reading, see afc_read_reply().
+ */
+static afc_error_t afc_read_packet(afc_client_t client, int nonblocking, AFCPacket *header, char **bytes, uint32_t *bytes_recv)
+{
+	uint32_t recv_bytes = 0;
+	uint32_t entire_len = 0;
+	afc_error_t err;
 
-	/* then, read the attached packet */
-	if (header.this_length < sizeof(AFCPacket)) {
-		debug_info("Invalid AFCPacket header received!");
-		return AFC_E_OP_HEADER_INVALID;
-	} else if ((header.this_length == header.entire_length)
-			&& header.entire_length == sizeof(AFCPacket)) {
-		debug_info("Empty AFCPacket received!");
-		*bytes_recv = 0;
-		if (header.operation == AFC_OP_DATA) {
-			return AFC_E_SUCCESS;
-		} else {
-			return AFC_E_IO_ERROR;
+	*bytes = NULL;
+	*bytes_recv = 0;
+
+	/* first, read the AFC header */
+	while (client->rx_header_length < sizeof(AFCPacket)) {
+		err = afc_receive(client, (char*)&client->rx_header + client->rx_header_length, sizeof(AFCPacket) - client->rx_header_length, &recv_bytes, nonblocking);
+		if (err != AFC_E_SUCCESS) {
+			debug_info("Did not even get the AFCPacket header");
+			afc_reset_packet(client);
+			return AFC_E_MUX_ERROR;
+		}
+		if (recv_bytes == 0) {
+			return AFC_E_OP_WOULD_BLOCK;
+		}
+		client->rx_header_length += recv_bytes;
+		if (client->rx_header_length < sizeof(AFCPacket)) {
+			continue;
 		}
-	}
 
-	debug_info("received AFC packet, full len=%lld, this len=%lld, operation=0x%llx", header.entire_length, header.this_length, header.operation);
+		AFCPacket_from_LE(&client->rx_header);
 
-	entire_len = (uint32_t)header.entire_length - sizeof(AFCPacket);
-	this_len = (uint32_t)header.this_length - sizeof(AFCPacket);
+		/* check if it's a valid AFC header */
+		if (strncmp(client->rx_header.magic, AFC_MAGIC, AFC_MAGIC_LEN)) {
+			debug_info("Invalid AFC packet received (magic != " AFC_MAGIC ")!");
+		}
 
-	dump_here = (char*)malloc(entire_len);
-	if (this_len > 0) {
-		service_receive(client->parent, dump_here, this_len, bytes_recv);
-		if (*bytes_recv <= 0) {
-			free(dump_here);
-			debug_info("Did not get packet contents!");
-			return AFC_E_NOT_ENOUGH_DATA;
-		} else if (*bytes_recv < this_len) {
-			free(dump_here);
-			debug_info("Could not receive this_len=%d bytes", this_len);
-			return AFC_E_NOT_ENOUGH_DATA;
+		if (client->rx_header.this_length < sizeof(AFCPacket) || client->rx_header.entire_length < client->rx_header.this_length) {
+			debug_info("Invalid AFCPacket header received!");
+			afc_reset_packet(client);
+			return AFC_E_OP_HEADER_INVALID;
 		}
-	}
 
-	current_count = this_len;
+		debug_info("received AFC packet %lld, full len=%lld, this len=%lld, operation=0x%llx", client->rx_header.packet_num, client->rx_header.entire_length, client->rx_header.this_length, client->rx_header.operation);
 
-	if (entire_len > this_len) {
-		while (current_count < entire_len) {
-			service_receive(client->parent, dump_here+current_count, entire_len - current_count, bytes_recv);
-			if (*bytes_recv <= 0) {
-				debug_info("Error receiving data (recv returned %d)", *bytes_recv);
-				break;
+		entire_len = (uint32_t)client->rx_header.entire_length - sizeof(AFCPacket);
+		if (entire_len > 0) {
+			client->rx_data = (char*)malloc(entire_len);
+			if (!client->rx_data) {
+				afc_reset_packet(client);
+				return AFC_E_NO_MEM;
 			}
-			current_count += *bytes_recv;
 		}
-		if (current_count < entire_len) {
-			debug_info("WARNING: could not receive full packet (read %s, size %d)", current_count, entire_len);
+	}
+
+	entire_len = (uint32_t)client->rx_header.entire_length - sizeof(AFCPacket);
+	while (client->rx_data_length < entire_len) {
+		err = afc_receive(client, client->rx_data + client->rx_data_length, entire_len - client->rx_data_length, &recv_bytes, nonblocking);
+		if (err != AFC_E_SUCCESS) {
+			debug_info("Could not receive the packet contents (read %u, size %u)", client->rx_data_length, entire_len);
+			afc_reset_packet(client);
+			return AFC_E_NOT_ENOUGH_DATA;
+		}
+		if (recv_bytes == 0) {
+			return AFC_E_OP_WOULD_BLOCK;
 		}
+		client->rx_data_length += recv_bytes;
 	}
 
-	if (current_count >= sizeof(uint64_t)) {
-		param1 = le64toh(*(uint64_t*)(dump_here));
+	if (entire_len > 0) {
+		debug_info("packet data size = %i", entire_len);
+		if (entire_len > 256) {
+			debug_info("packet data follows (256/%u)", entire_len);
+			debug_buffer(client->rx_data, 256);
+		} else {
+			debug_info("packet data follows");
+			debug_buffer(client->rx_data, entire_len);
+		}
 	}
 
-	debug_info("packet data size = %i", current_count);
-	if (current_count > 256) {
-		debug_info("packet data follows (256/%u)", current_count);
-		debug_buffer(dump_here, 256);
-	} else {
-		debug_info("packet data follows");
-		debug_buffer(dump_here, current_count);
+	*header = client->rx_header;
+	*bytes = client->rx_data;
+	*bytes_recv = entire_len;
+	client->rx_data = NULL;
+	afc_reset_packet(client);
+	return AFC_E_SUCCESS;
+}
+
+/**
+ * Interprets a received packet as the reply to a request.
+ *
+ * @param header The header of the received packet.
+ * @param bytes The data of the packet; freed and set to NULL if the reply
+ *  is an error.
+ * @param bytes_recv The length of the data.
+ *
+ * @return AFC_E_SUCCESS or the error reported by the device.
+ */
+static afc_error_t afc_reply_status(const AFCPacket *header, char **bytes, uint32_t *bytes_recv)
+{
+	uint64_t param1 = -1;
+
+	if (*bytes_recv == 0) {
+		debug_info("Empty AFCPacket received!");
+		if (header->operation == AFC_OP_DATA) {
+			return AFC_E_SUCCESS;
+		} else {
+			return AFC_E_IO_ERROR;
+		}
+	}
+
+	if (*bytes_recv >= sizeof(uint64_t)) {
+		param1 = le64toh(*(uint64_t*)(*bytes));
 	}
 
 	/* check operation types */
-	if (header.operation == AFC_OP_STATUS) {
+	if (header->operation == AFC_OP_STATUS) {
 		/* status response */
 		debug_info("got a status response, code=%lld", param1);
 
 		if (param1 != AFC_E_SUCCESS) {
 			/* error status */
-			/* free buffer */
-			free(dump_here);
+			free(*bytes);
+			*bytes = NULL;
+			*bytes_recv = 0;
 			return (afc_error_t)param1;
 		}
-	} else if (header.operation == AFC_OP_DATA) {
+	} else if (header->operation == AFC_OP_DATA) {
 		/* data response */
 		debug_info("got a data response");
-	} else if (header.operation == AFC_OP_FILE_OPEN_RES) {
+	} else if (header->operation == AFC_OP_FILE_OPEN_RES) {
 		/* file handle response */
 		debug_info("got a file handle response, handle=%lld", param1);
-	} else if (header.operation == AFC_OP_FILE_TELL_RES) {
+	} else if (header->operation == AFC_OP_FILE_TELL_RES) {
 		/* tell response */
 		debug_info("got a tell response, position=%lld", param1);
 	} else {
 		/* unknown operation code received */
-		free(dump_here);
+		free(*bytes);
+		*bytes = NULL;
 		*bytes_recv = 0;
 
-		debug_info("WARNING: Unknown operation code received 0x%llx param1=%lld", header.operation, param1);
+		debug_info("WARNING: Unknown operation code received 0x%llx param1=%lld", header->operation, param1);
 #ifndef WIN32
-		fprintf(stderr, "%s: WARNING: Unknown operation code received 0x%llx param1=%lld", __func__, (long long)header.operation, (long long)param1);
+		fprintf(stderr, "%s: WARNING: Unknown operation code received 0x%llx param1=%lld", __func__, (long long)header->operation, (long long)param1);
 #endif
 
 		return AFC_E_OP_NOT_SUPPORTED;
 	}
 
+	return AFC_E_SUCCESS;
+}
+
+/**
+ * Appends a request to a list of requests.
+ */
+static void afc_request_append(struct afc_request **list, struct afc_request *req)
+{
+	while (*list) {
+		list = &(*list)->next;
+	}
+	req->next = NULL;
+	*list = req;
+}
+
+/**
+ * Marks a request as done. Completed asynchronous requests are moved to the
+ * given list, and their callbacks must be invoked with afc_run_completions()
+ * once the reply mutex has been released; otherwise the waiting caller is
+ * woken up.
+ *
+ * @note The reply mutex must be held by the caller, and the request must
+ *  not be in the list of pending requests anymore.
+ */
+static void afc_request_complete(afc_client_t client, struct afc_request *req, afc_error_t status, struct afc_request **completed)
+{
+	req->status = status;
+	req->done = 1;
+	if (req->callback) {
+		client->async_pending--;
+		afc_request_append(completed, req);
+	} else if (req->waiting) {
+		cond_signal(&req->cond);
+	}
+}
+
+/**
+ * Invokes the callbacks of completed asynchronous requests and frees them.
+ */
+static void afc_run_completions(struct afc_request *completed)
+{
+	while (completed) {
+		struct afc_request *req = completed;
+		completed = req->next;
+		if (req->status != AFC_E_SUCCESS) {
+			req->callback(req->status, NULL, 0, req->user_data);
+		} else if (req->operation == AFC_OP_FILE_WRITE) {
+			req->callback(req->status, NULL, req->payload_length, req->user_data);
+		} else {
+			req->callback(req->status, req->data, req->length, req->user_data);
+		}
+		free(req->data);
+		free(req->args);
+		free(req->payload);
+		cond_destroy(&req->cond);
+		free(req);
+	}
+}
+
+/**
+ * Reads one packet from the connection and hands it to the request with the
+ * matching packet number. If the connection fails, all pending requests fail.
+ *
+ * @param client The client to receive data on.
+ * @param nonblocking If set, only the data that has already arrived is
+ *  read, and the packet may be left incomplete for the next reader.
+ * @param completed List that receives the asynchronous requests that have
+ *  completed.
+ *
+ * @note The reply mutex must be held by the caller and no other thread may
+ *  be reading. The mutex is released while reading.
+ */
+static void afc_read_reply(afc_client_t client, int nonblocking, struct afc_request **completed)
+{
+	struct afc_request *other = NULL;
+
+	client->reading = 1;
+	mutex_unlock(&client->reply_mutex);
+
+	AFCPacket header;
+	char *data = NULL;
+	uint32_t length = 0;
+	afc_error_t status = AFC_E_SUCCESS;
+	afc_error_t err = afc_read_packet(client, nonblocking, &header, &data, &length);
+	if (err == AFC_E_SUCCESS) {
+		status = afc_reply_status(&header, &data, &length);
+	}
+
+	mutex_lock(&client->reply_mutex);
+	client->reading = 0;
+	if (err == AFC_E_OP_WOULD_BLOCK) {
+		return;
+	}
+	if (err != AFC_E_SUCCESS) {
+		/* the connection is out of sync, so none of the outstanding replies will arrive */
+		while ((other = client->pending) != NULL) {
+			client->pending = other->next;
+			other->next = NULL;
+			afc_request_complete(client, other, err, completed);
+		}
+		return;
+	}
+
+	for (other = client->pending; other; other = other->next) {
+		if (other->packet_num == header.packet_num) {
+			break;
+		}
+	}
+	if (!other) {
+		debug_info("Discarding reply to packet %lld that nobody is waiting for", header.packet_num);
+		free(data);
+		return;
+	}
+	afc_request_unlink(client, other);
+	other->data = data;
+	other->length = length;
+	afc_request_complete(client, other, status, completed);
+}
+
+/**
+ * Lets another caller that is waiting for a reply take over reading.
+ *
+ * @note The reply mutex must be held by the caller.
+ */
+static void afc_hand_off_reading(afc_client_t client)
+{
+	struct afc_request *other = NULL;
+
+	if (client->reading) {
+		return;
+	}
+	for (other = client->pending; other; other = other->next) {
+		if (other->waiting) {
+			cond_signal(&other->cond);
+			break;
+		}
+	}
+}
+
+/**
+ * Waits for the reply to a request sent with afc_dispatch_packet().
+ *
+ * There is no dedicated reader thread. Instead, one of the waiting callers
+ * reads packets from the connection and hands each one to the request with
+ * the matching packet number, waking its caller. When its own reply has
+ * arrived, it passes the job on to another waiting caller. Callers that are
+ * not reading wait on the condition of their request.
+ *
+ * @param client The client to receive data on.
+ * @param req The request to wait for.
+ * @param bytes Pointer that will be set to the reply data, or NULL. The
+ *  caller is responsible for freeing the memory.
+ * @param bytes_recv Pointer that will be set to the length of the reply
+ *  data, or NULL.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+static afc_error_t afc_wait_reply(afc_client_t client, struct afc_request *req, char **bytes, uint32_t *bytes_recv)
+{
+	mutex_lock(&client->reply_mutex);
+	while (!req->done) {
+		if (client->reading) {
+			req->waiting = 1;
+			cond_wait(&req->cond, &client->reply_mutex);
+			req->waiting = 0;
+			continue;
+		}
+
+		struct afc_request *completed = NULL;
+		afc_read_reply(client, 0, &completed);
+		if (completed) {
+			/* replies to asynchronous requests may arrive here as well */
+			mutex_unlock(&client->reply_mutex);
+			afc_run_completions(completed);
+			mutex_lock(&client->reply_mutex);
+		}
+	}
+	afc_hand_off_reading(client);
+	if (client->async_pending > 0) {
+		/* the event thread leaves the connection alone while a caller is reading */
+		afc_events_wake();
+	}
+	mutex_unlock(&client->reply_mutex);
+
+	if (req->status != AFC_E_SUCCESS) {
+		free(req->data);
+		req->data = NULL;
+		req->length = 0;
+	}
 	if (bytes) {
-		*bytes = dump_here;
+		*bytes = req->data;
+		req->data = NULL;
+	}
+	if (bytes_recv) {
+		*bytes_recv = req->length;
+	}
+
+	return req->status;
+}
+
+/**
+ * Sends a request and waits for its reply.
+ *
+ * @param client The AFC client to use.
+ * @param operation The operation to perform.
+ * @param data The arguments to send together with the header.
+ * @param data_length The length of the arguments.
+ * @param payload The data to send after the arguments, or NULL.
+ * @param payload_length The length of the payload.
+ * @param bytes Pointer that will be set to the reply data, or NULL. The
+ *  caller is responsible for freeing the memory.
+ * @param bytes_recv Pointer that will be set to the length of the reply
+ *  data, or NULL.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+static afc_error_t afc_request(afc_client_t client, uint64_t operation, const char *data, uint32_t data_length, const char *payload, uint32_t payload_length, char **bytes, uint32_t *bytes_recv)
+{
+	struct afc_request req;
+
+	if (bytes)
+		*bytes = NULL;
+	if (bytes_recv)
+		*bytes_recv = 0;
+
+	afc_request_init(&req);
+	afc_error_t ret = afc_dispatch_packet(client, &req, operation, data, data_length, payload, payload_length, NULL);
+	if (ret == AFC_E_SUCCESS) {
+		ret = afc_wait_reply(client, &req, bytes, bytes_recv);
+	}
+	afc_request_finish(client, &req);
+
+	return ret;
+}
+
+/**
+ * Builds the arguments of a request that consist of a 64-bit value followed
+ * by one or two strings.
+ *
+ * @param value The value, which is sent in little endian byte order.
+ * @param str1 The first string.
+ * @param str2 The second string, or NULL.
+ * @param length Pointer that will be set to the length of the arguments.
+ *
+ * @return The arguments, which the caller must free, or NULL if out of memory.
+ */
+static char *afc_build_args(uint64_t value, const char *str1, const char *str2, uint32_t *length)
+{
+	size_t len1 = strlen(str1) + 1;
+	size_t len2 = (str2) ? strlen(str2) + 1 : 0;
+	char *args = (char*)malloc(8 + len1 + len2);
+	if (!args) {
+		return NULL;
+	}
+	value = htole64(value);
+	memcpy(args, &value, 8);
+	memcpy(args + 8, str1, len1);
+	if (str2) {
+		memcpy(args + 8 + len1, str2, len2);
+	}
+	*length = (uint32_t)(8 + len1 + len2);
+	return args;
+}
+
+/*
+ * Asynchronous requests are queued on the client and sent by a single event
+ * thread that serves all clients. It polls the connections of the clients
+ * that have asynchronous requests in flight and, whenever no caller is
+ * already reading one of them, reads what has arrived of the next reply and
+ * invokes the callbacks of the requests that completed. A reply that has
+ * not fully arrived stays in the client until the connection is readable
+ * again, so a slow device does not hold up the others. Sending still blocks
+ * until the device has accepted the request.
+ *
+ * The mutex of the event thread only guards the registry of clients; it is
+ * never held while sending or receiving, so queueing a request does not wait
+ * for the I/O of any device. Instead, the event thread holds a reference on
+ * the clients it is working with, and afc_async_cancel() waits until those
+ * are dropped.
+ */
+static struct afc_event_loop {
+	mutex_t mutex; /* guards the registry of clients and their references */
+	cond_t idle_cond; /* signalled when the event thread drops a reference on an unregistered client */
+	afc_client_t *clients;
+	uint32_t count;
+	uint32_t capacity;
+	THREAD_T thread;
+#ifndef WIN32
+	int wake[2];
+#endif
+} afc_events;
+static thread_once_t afc_events_once = THREAD_ONCE_INIT;
+
+static void afc_events_wake(void)
+{
+#ifndef WIN32
+	char c = 0;
+	if (afc_events.wake[1] >= 0 && write(afc_events.wake[1], &c, 1) < 0) {
+		/* the pipe is full, so a wake-up is pending anyway */
+	}
+#endif
+}
+
+static int afc_fd_readable(int fd)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return poll(&pfd, 1, 0) > 0;
+}
+
+/**
+ * Checks whether a client is still served by the event thread.
+ *
+ * @note The mutex of the event thread must be held by the caller.
+ */
+static int afc_events_registered(afc_client_t client)
+{
+	uint32_t i;
+	for (i = 0; i < afc_events.count; i++) {
+		if (afc_events.clients[i] == client) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Drops the references the event thread took on clients, and wakes up
+ * afc_async_cancel() if it is waiting for one of them.
+ */
+static void afc_events_release(afc_client_t *clients, uint32_t count)
+{
+	uint32_t i;
+	int idle = 0;
+
+	if (count == 0) {
+		return;
+	}
+	mutex_lock(&afc_events.mutex);
+	for (i = 0; i < count; i++) {
+		if (--clients[i]->async_busy == 0 && !clients[i]->async_registered) {
+			idle = 1;
+		}
+	}
+	if (idle) {
+		cond_signal(&afc_events.idle_cond);
+	}
+	mutex_unlock(&afc_events.mutex);
+}
+
+/**
+ * Sends the asynchronous requests that were queued on a client. Requests
+ * that cannot be sent are moved to the list of completed requests.
+ */
+static void afc_send_queued(afc_client_t client, struct afc_request **completed)
+{
+	for (;;) {
+		mutex_lock(&client->reply_mutex);
+		struct afc_request *req = client->send_queue;
+		if (req) {
+			client->send_queue = req->next;
+			req->next = NULL;
+		}
+		mutex_unlock(&client->reply_mutex);
+		if (!req) {
+			break;
+		}
+
+		/* the request may complete and be freed by a reader as soon as it is out */
+		char *args = req->args;
+		char *payload = req->payload;
+		req->args = NULL;
+		req->payload = NULL;
+		afc_error_t err = afc_dispatch_packet(client, req, req->operation, args, req->args_length, payload, req->payload_length, NULL);
+		free(args);
+		free(payload);
+		if (err != AFC_E_SUCCESS) {
+			/* still ours, since afc_dispatch_packet() only fails for requests that no reader completed */
+			mutex_lock(&client->reply_mutex);
+			afc_request_complete(client, req, err, completed);
+			mutex_unlock(&client->reply_mutex);
+		}
+	}
+}
+
+static void* afc_event_thread(void *arg)
+{
+	struct pollfd *fds = NULL;
+	afc_client_t *polled = NULL;
+	afc_client_t *held = NULL;
+	uint32_t capacity = 0;
+
+	for (;;) {
+		struct afc_request *completed = NULL;
+		uint32_t nfds = 0;
+		uint32_t nheld = 0;
+		uint32_t i;
+
+		/* hold the registered clients, so they can be served without the mutex */
+		mutex_lock(&afc_events.mutex);
+		if (capacity < afc_events.count + 1) {
+			uint32_t newcap = afc_events.count + 8;
+			struct pollfd *newfds = (struct pollfd*)realloc(fds, newcap * sizeof(struct pollfd));
+			if (newfds) {
+				fds = newfds;
+			}
+			afc_client_t *newpolled = (afc_client_t*)realloc(polled, newcap * sizeof(afc_client_t));
+			if (newpolled) {
+				polled = newpolled;
+			}
+			afc_client_t *newheld = (afc_client_t*)realloc(held, newcap * sizeof(afc_client_t));
+			if (newheld) {
+				held = newheld;
+			}
+			if (newfds && newpolled && newheld) {
+				capacity = newcap;
+			}
+		}
+		for (i = 0; i < afc_events.count && nheld + 1 < capacity; i++) {
+			held[nheld] = afc_events.clients[i];
+			held[nheld]->async_busy++;
+			nheld++;
+		}
+		mutex_unlock(&afc_events.mutex);
+
+#ifndef WIN32
+		if (capacity > 0 && afc_events.wake[0] >= 0) {
+			fds[nfds].fd = afc_events.wake[0];
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			polled[nfds] = NULL;
+			nfds++;
+		}
+#endif
+		for (i = 0; i < nheld; i++) {
+			afc_client_t client = held[i];
+			afc_send_queued(client, &completed);
+
+			mutex_lock(&client->reply_mutex);
+			int wanted = (client->async_pending > 0 && client->pending && !client->reading);
+			mutex_unlock(&client->reply_mutex);
+			int fd = -1;
+			if (wanted && idevice_connection_get_fd(client->parent->connection, &fd) == IDEVICE_E_SUCCESS) {
+				fds[nfds].fd = fd;
+				fds[nfds].events = POLLIN;
+				fds[nfds].revents = 0;
+				polled[nfds] = client;
+				nfds++;
+			}
+		}
+		afc_events_release(held, nheld);
+
+		afc_run_completions(completed);
+		completed = NULL;
+
+#ifdef WIN32
+		/* there is no wake-up pipe, so queued requests are picked up by polling */
+		if (nfds == 0) {
+			Sleep(10);
+			continue;
+		}
+		int res = poll(fds, nfds, 10);
+#else
+		int res = poll(fds, nfds, -1);
+#endif
+		if (res <= 0) {
+			continue;
+		}
+
+		/* hold the readable clients that have not been freed since they were polled */
+		nheld = 0;
+		mutex_lock(&afc_events.mutex);
+		for (i = 0; i < nfds; i++) {
+			if (!fds[i].revents) {
+				continue;
+			}
+			afc_client_t client = polled[i];
+			if (!client) {
+#ifndef WIN32
+				char buf[64];
+				while (read(fds[i].fd, buf, sizeof(buf)) > 0);
+#endif
+				continue;
+			}
+			if (afc_events_registered(client)) {
+				client->async_busy++;
+				fds[nheld] = fds[i];
+				held[nheld] = client;
+				nheld++;
+			}
+		}
+		mutex_unlock(&afc_events.mutex);
+
+		for (i = 0; i < nheld; i++) {
+			afc_client_t client = held[i];
+			mutex_lock(&client->reply_mutex);
+			/* a waiting caller may have taken over reading in the meantime */
+			if (!client->reading && client->pending && afc_fd_readable(fds[i].fd)) {
+				afc_read_reply(client, 1, &completed);
+				afc_hand_off_reading(client);
+			}
+			mutex_unlock(&client->reply_mutex);
+		}
+		afc_events_release(held, nheld);
+
+		afc_run_completions(completed);
+	}
+
+	return NULL;
+}
+
+static void afc_events_init(void)
+{
+	mutex_init(&afc_events.mutex);
+	cond_init(&afc_events.idle_cond);
+#ifndef WIN32
+	if (pipe(afc_events.wake) == 0) {
+		fcntl(afc_events.wake[0], F_SETFL, O_NONBLOCK);
+		fcntl(afc_events.wake[1], F_SETFL, O_NONBLOCK);
+	} else {
+		afc_events.wake[0] = -1;
+		afc_events.wake[1] = -1;
+	}
+#endif
+	if (thread_new(&afc_events.thread, afc_event_thread, NULL) == 0) {
+		thread_detach(afc_events.thread);
 	} else {
-		free(dump_here);
+		debug_info("Failed to start the AFC event thread");
+	}
+}
+
+/**
+ * Queues an asynchronous request to be sent by the event thread.
+ *
+ * @param client The AFC client to use.
+ * @param operation The operation to perform.
+ * @param args The arguments, which are freed once the request was sent.
+ * @param args_length The length of the arguments.
+ * @param payload The data to send after the arguments, which is copied.
+ * @param payload_length The length of the payload.
+ * @param callback Receives the result.
+ * @param user_data Passed to the callback.
+ *
+ * @return AFC_E_SUCCESS if the request was queued or an AFC_E_* error value.
+ */
+static afc_error_t afc_request_async(afc_client_t client, uint64_t operation, char *args, uint32_t args_length, const char *payload, uint32_t payload_length, afc_completion_cb_t callback, void *user_data)
+{
+	struct afc_request *req = (struct afc_request*)malloc(sizeof(struct afc_request));
+	if (!req) {
+		free(args);
+		return AFC_E_NO_MEM;
+	}
+	afc_request_init(req);
+	req->callback = callback;
+	req->user_data = user_data;
+	req->operation = operation;
+	req->args = args;
+	req->args_length = args_length;
+	if (payload && payload_length > 0) {
+		req->payload = (char*)malloc(payload_length);
+		if (!req->payload) {
+			afc_request_finish(client, req);
+			free(args);
+			free(req);
+			return AFC_E_NO_MEM;
+		}
+		memcpy(req->payload, payload, payload_length);
+		req->payload_length = payload_length;
+	}
+
+	thread_once(&afc_events_once, afc_events_init);
+
+	mutex_lock(&afc_events.mutex);
+	if (!client->async_registered) {
+		if (afc_events.count == afc_events.capacity) {
+			uint32_t newcap = afc_events.capacity + 8;
+			afc_client_t *clients = (afc_client_t*)realloc(afc_events.clients, newcap * sizeof(afc_client_t));
+			if (!clients) {
+				mutex_unlock(&afc_events.mutex);
+				afc_request_finish(client, req);
+				free(args);
+				free(req->payload);
+				free(req);
+				return AFC_E_NO_MEM;
+			}
+			afc_events.clients = clients;
+			afc_events.capacity = newcap;
+		}
+		afc_events.clients[afc_events.count++] = client;
+		client->async_registered = 1;
 	}
+	mutex_unlock(&afc_events.mutex);
+
+	mutex_lock(&client->reply_mutex);
+	afc_request_append(&client->send_queue, req);
+	client->async_pending++;
+	mutex_unlock(&client->reply_mutex);
+
+	afc_events_wake();
 
-	*bytes_recv = current_count;
 	return AFC_E_SUCCESS;
 }
 
+/**
+ * Stops serving the asynchronous requests of a client that is being freed
+ * and completes the outstanding ones with AFC_E_OP_INTERRUPTED.
+ */
+static void afc_async_cancel(afc_client_t client)
+{
+	struct afc_request *completed = NULL;
+	struct afc_request *req = NULL;
+	struct afc_request **link = NULL;
+
+	if (!client->async_registered) {
+		return;
+	}
+
+	/* once removed and let go of, the event thread no longer touches the client */
+	mutex_lock(&afc_events.mutex);
+	uint32_t i;
+	for (i = 0; i < afc_events.count; i++) {
+		if (afc_events.clients[i] == client) {
+			afc_events.clients[i] = afc_events.clients[--afc_events.count];
+			break;
+		}
+	}
+	client->async_registered = 0;
+	/* the wait is bounded since a signal might wake another waiter */
+	while (client->async_busy > 0) {
+		cond_wait_timeout(&afc_events.idle_cond, &afc_events.mutex, 100);
+	}
+	mutex_unlock(&afc_events.mutex);
+
+	mutex_lock(&client->reply_mutex);
+	while ((req = client->send_queue) != NULL) {
+		client->send_queue = req->next;
+		afc_request_complete(client, req, AFC_E_OP_INTERRUPTED, &completed);
+	}
+	link = &client->pending;
+	while ((req = *link) != NULL) {
+		if (req->callback) {
+			*link = req->next;
+			afc_request_complete(client, req, AFC_E_OP_INTERRUPTED, &completed);
+		} else {
+			link = &req->next;
+		}
+	}
+	mutex_unlock(&client->reply_mutex);
+
+	afc_run_completions(completed);
+}
+
 /**
  * Returns counts of null characters within a string.
  */
@@ -397,21 +1213,6 @@ static char **make_strings_list(char *tokens, uint32_t length)
 	return list;
 }
 
-static int _afc_check_packet_buffer(afc_client_t client, uint32_t data_len)
-{
-	if (data_len > client->packet_extra) {
-		client->packet_extra = (data_len & ~8) + 8;
-		AFCPacket* newpkt = (AFCPacket*)realloc(client->afc_packet, sizeof(AFCPacket) + client->packet_extra);
-		if (!newpkt) {
-			return -1;
-		}
-		client->afc_packet = newpkt;
-	}
-	return 0;
-}
-
-#define AFC_PACKET_DATA_PTR ((char*)client->afc_packet + sizeof(AFCPacket))
-
 LIBIMOBILEDEVICE_API afc_error_t afc_read_directory(afc_client_t client, const char *path, char ***directory_information)
 {
 	uint32_t bytes = 0;
@@ -421,41 +1222,85 @@ LIBIMOBILEDEVICE_API afc_error_t afc_read_directory(afc_client_t client, const c
 	if (!client || !path || !directory_information || (directory_information && *directory_information))
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	uint32_t data_len = (uint32_t)strlen(path)+1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
-		return AFC_E_NO_MEM;
-	}
-
-	/* Send the command */
-	memcpy(AFC_PACKET_DATA_PTR, path, data_len);
-	ret = afc_dispatch_packet(client, AFC_OP_READ_DIR, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive the data */
-	ret = afc_receive_data(client, &data, &bytes);
+	ret = afc_request(client, AFC_OP_READ_DIR, path, (uint32_t)strlen(path)+1, NULL, 0, &data, &bytes);
 	if (ret != AFC_E_SUCCESS) {
-		if (data)
-			free(data);
-		afc_unlock(client);
 		return ret;
 	}
 	/* Parse the data */
 	list_loc = make_strings_list(data, bytes);
-	if (data)
-		free(data);
+	free(data);
 
-	afc_unlock(client);
 	*directory_information = list_loc;
 
 	return ret;
 }
 
+/**
+ * Sends a request with a single path argument and receives the reply.
+ *
+ * @param client The AFC client to use.
+ * @param operation The operation to perform.
+ * @param path The fully-qualified path.
+ * @param bytes Pointer that will be set to the reply data. The caller is
+ *  responsible for freeing the memory.
+ * @param bytes_recv Pointer that will be set to the length of the reply data.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+static afc_error_t afc_path_request(afc_client_t client, uint64_t operation, const char *path, char **bytes, uint32_t *bytes_recv)
+{
+	return afc_request(client, operation, path, (uint32_t)strlen(path)+1, NULL, 0, bytes, bytes_recv);
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_read_directory_packed(afc_client_t client, const char *path, afc_directory_listing_t **listing)
+{
+	uint32_t bytes = 0;
+	uint32_t count = 0;
+	uint32_t i = 0;
+	uint32_t j = 0;
+	char *data = NULL;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || !path || !listing)
+		return AFC_E_INVALID_ARG;
+
+	ret = afc_path_request(client, AFC_OP_READ_DIR, path, &data, &bytes);
+	if (ret != AFC_E_SUCCESS) {
+		return ret;
+	}
+
+	/* a trailing name without terminator is dropped */
+	while (bytes > 0 && data[bytes-1] != '\0') {
+		bytes--;
+	}
+	count = (data) ? count_nullspaces(data, bytes) : 0;
+
+	/* header, offsets and names share one allocation */
+	afc_directory_listing_t *result = (afc_directory_listing_t*)malloc(sizeof(afc_directory_listing_t) + sizeof(uint32_t) * count + bytes);
+	if (!result) {
+		free(data);
+		return AFC_E_NO_MEM;
+	}
+	uint32_t *offsets = (uint32_t*)(result + 1);
+	char *names = (char*)(offsets + count);
+	if (bytes > 0) {
+		memcpy(names, data, bytes);
+	}
+	free(data);
+
+	for (i = 0; i < count; i++) {
+		offsets[i] = j;
+		j += (uint32_t)strlen(names + j) + 1;
+	}
+
+	result->count = count;
+	result->names = names;
+	result->offsets = offsets;
+	*listing = result;
+
+	return AFC_E_SUCCESS;
+}
+
 LIBIMOBILEDEVICE_API afc_error_t afc_get_device_info(afc_client_t client, char ***device_information)
 {
 	uint32_t bytes = 0;
@@ -465,28 +1310,13 @@ LIBIMOBILEDEVICE_API afc_error_t afc_get_device_info(afc_client_t client, char *
 	if (!client || !device_information)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	/* Send the command */
-	ret = afc_dispatch_packet(client, AFC_OP_GET_DEVINFO, 0, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive the data */
-	ret = afc_receive_data(client, &data, &bytes);
+	ret = afc_request(client, AFC_OP_GET_DEVINFO, NULL, 0, NULL, 0, &data, &bytes);
 	if (ret != AFC_E_SUCCESS) {
-		if (data)
-			free(data);
-		afc_unlock(client);
 		return ret;
 	}
 	/* Parse the data */
 	list = make_strings_list(data, bytes);
-	if (data)
-		free(data);
-
-	afc_unlock(client);
+	free(data);
 
 	*device_information = list;
 
@@ -522,387 +1352,671 @@ LIBIMOBILEDEVICE_API afc_error_t afc_get_device_info_key(afc_client_t client, co
 
 LIBIMOBILEDEVICE_API afc_error_t afc_remove_path(afc_client_t client, const char *path)
 {
-	uint32_t bytes = 0;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
 	if (!client || !path || !client->afc_packet || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
+	ret = afc_path_request(client, AFC_OP_REMOVE_PATH, path, NULL, NULL);
 
-	uint32_t data_len = (uint32_t)strlen(path)+1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
+	/* special case; unknown error actually means directory not empty */
+	if (ret == AFC_E_UNKNOWN_ERROR)
+		ret = AFC_E_DIR_NOT_EMPTY;
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_rename_path(afc_client_t client, const char *from, const char *to)
+{
+	if (!client || !from || !to || !client->afc_packet || !client->parent)
+		return AFC_E_INVALID_ARG;
+
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	size_t from_len = strlen(from);
+	size_t to_len = strlen(to);
+
+	uint32_t data_len = (uint32_t)(from_len+1 + to_len+1);
+	char *data = (char*)malloc(data_len);
+	if (!data) {
 		return AFC_E_NO_MEM;
 	}
 
 	/* Send command */
-	memcpy(AFC_PACKET_DATA_PTR, path, data_len);
-	ret = afc_dispatch_packet(client, AFC_OP_REMOVE_PATH, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	memcpy(data, from, from_len+1);
+	memcpy(data + from_len+1, to, to_len+1);
+	ret = afc_request(client, AFC_OP_RENAME_PATH, data, data_len, NULL, 0, NULL, NULL);
+	free(data);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_make_directory(afc_client_t client, const char *path)
+{
+	if (!client || !path)
+		return AFC_E_INVALID_ARG;
+
+	return afc_path_request(client, AFC_OP_MAKE_DIR, path, NULL, NULL);
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_get_file_info(afc_client_t client, const char *path, char ***file_information)
+{
+	char *received = NULL;
+	uint32_t bytes = 0;
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+
+	if (!client || !path || !file_information)
+		return AFC_E_INVALID_ARG;
+
+	ret = afc_path_request(client, AFC_OP_GET_FILE_INFO, path, &received, &bytes);
+	if (received) {
+		*file_information = make_strings_list(received, bytes);
+		free(received);
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
 
-	/* special case; unknown error actually means directory not empty */
-	if (ret == AFC_E_UNKNOWN_ERROR)
-		ret = AFC_E_DIR_NOT_EMPTY;
+	return ret;
+}
+
+/**
+ * Callback invoked by afc_pipeline_path_requests() for each reply, in the
+ * order of the requests.
+ */
+typedef void (*afc_reply_cb_t)(void *user_data, uint32_t index, afc_error_t status, const char *data, uint32_t length);
+
+/**
+ * Sends one request with a path argument for each of the given paths, keeping
+ * up to AFC_PIPELINE_DEPTH requests in flight on the connection, and passes
+ * the replies to the given callback as they arrive.
+ *
+ * @param client The AFC client to use.
+ * @param operation The operation to perform for each path.
+ * @param paths The fully-qualified paths.
+ * @param count The number of paths.
+ * @param reply_cb The callback that receives the reply for each path.
+ * @param user_data Passed to the callback.
+ *
+ * @return AFC_E_SUCCESS if all replies were received (even if individual
+ *  requests failed), or an AFC_E_* error value if the connection failed.
+ */
+static afc_error_t afc_pipeline_path_requests(afc_client_t client, uint64_t operation, const char **paths, uint32_t count, afc_reply_cb_t reply_cb, void *user_data)
+{
+	struct afc_request reqs[AFC_PIPELINE_DEPTH];
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
+
+	while (received < count) {
+		/* fill the pipeline */
+		while (sent < count && sent - received < AFC_PIPELINE_DEPTH) {
+			struct afc_request *req = &reqs[sent % AFC_PIPELINE_DEPTH];
+			afc_request_init(req);
+			ret = afc_dispatch_packet(client, req, operation, paths[sent], (uint32_t)strlen(paths[sent])+1, NULL, 0, NULL);
+			if (ret != AFC_E_SUCCESS) {
+				afc_request_finish(client, req);
+				goto leave;
+			}
+			sent++;
+		}
+
+		/* then collect the next reply */
+		struct afc_request *req = &reqs[received % AFC_PIPELINE_DEPTH];
+		char *data = NULL;
+		uint32_t bytes = 0;
+		afc_error_t status = afc_wait_reply(client, req, &data, &bytes);
+		afc_request_finish(client, req);
+		if (status == AFC_E_MUX_ERROR || status == AFC_E_NOT_ENOUGH_DATA || status == AFC_E_OP_HEADER_INVALID) {
+			/* the connection is out of sync, so the remaining replies are lost */
+			received++;
+			ret = status;
+			goto leave;
+		}
+		reply_cb(user_data, received, status, data, bytes);
+		free(data);
+		received++;
+	}
+
+leave:
+	/* forget the requests that are still in flight */
+	while (received < sent) {
+		afc_request_finish(client, &reqs[received % AFC_PIPELINE_DEPTH]);
+		received++;
+	}
+
+	return ret;
+}
+
+/**
+ * Parses the key/value pairs of a GetFileInfo reply into a typed structure.
+ */
+static void afc_parse_file_info(const char *data, uint32_t length, afc_file_info_t *info)
+{
+	uint32_t i = 0;
 
-	afc_unlock(client);
+	while (i < length) {
+		const char *key = data + i;
+		size_t key_len = strnlen(key, length - i);
+		if (i + key_len + 1 >= length) {
+			break;
+		}
+		const char *val = key + key_len + 1;
+		size_t val_len = strnlen(val, length - i - key_len - 1);
+		if (i + key_len + 1 + val_len >= length) {
+			/* unterminated value */
+			break;
+		}
 
-	return ret;
+		if (!strcmp(key, "st_size")) {
+			info->size = strtoull(val, NULL, 10);
+		} else if (!strcmp(key, "st_blocks")) {
+			info->blocks = strtoull(val, NULL, 10);
+		} else if (!strcmp(key, "st_nlink")) {
+			info->nlink = (uint32_t)strtoul(val, NULL, 10);
+		} else if (!strcmp(key, "st_mtime")) {
+			info->mtime = strtoull(val, NULL, 10);
+		} else if (!strcmp(key, "st_birthtime")) {
+			info->birthtime = strtoull(val, NULL, 10);
+		} else if (!strcmp(key, "st_ifmt")) {
+			if (!strcmp(val, "S_IFREG")) {
+				info->type = AFC_FILE_TYPE_REGULAR;
+			} else if (!strcmp(val, "S_IFDIR")) {
+				info->type = AFC_FILE_TYPE_DIRECTORY;
+			} else if (!strcmp(val, "S_IFLNK")) {
+				info->type = AFC_FILE_TYPE_SYMLINK;
+			} else if (!strcmp(val, "S_IFCHR")) {
+				info->type = AFC_FILE_TYPE_CHAR_DEVICE;
+			} else if (!strcmp(val, "S_IFBLK")) {
+				info->type = AFC_FILE_TYPE_BLOCK_DEVICE;
+			} else if (!strcmp(val, "S_IFIFO")) {
+				info->type = AFC_FILE_TYPE_FIFO;
+			} else if (!strcmp(val, "S_IFSOCK")) {
+				info->type = AFC_FILE_TYPE_SOCKET;
+			}
+		} else if (!strcmp(key, "LinkTarget")) {
+			free(info->link_target);
+			info->link_target = strdup(val);
+		}
+
+		i += key_len + 1 + val_len + 1;
+	}
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_rename_path(afc_client_t client, const char *from, const char *to)
+static void afc_file_info_reply_cb(void *user_data, uint32_t index, afc_error_t status, const char *data, uint32_t length)
 {
-	if (!client || !from || !to || !client->afc_packet || !client->parent)
-		return AFC_E_INVALID_ARG;
+	afc_file_info_t *info = ((afc_file_info_t*)user_data) + index;
+	info->status = status;
+	if (status == AFC_E_SUCCESS && data) {
+		afc_parse_file_info(data, length, info);
+	}
+}
 
+LIBIMOBILEDEVICE_API afc_error_t afc_get_file_info_typed(afc_client_t client, const char *path, afc_file_info_t **file_info)
+{
+	char *received = NULL;
 	uint32_t bytes = 0;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
-	size_t from_len = strlen(from);
-	size_t to_len = strlen(to);
+	if (!client || !path || !file_info)
+		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
+	ret = afc_path_request(client, AFC_OP_GET_FILE_INFO, path, &received, &bytes);
+	if (ret != AFC_E_SUCCESS) {
+		return ret;
+	}
 
-	uint32_t data_len = (uint32_t)(from_len+1 + to_len+1);
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
+	afc_file_info_t *info = (afc_file_info_t*)calloc(1, sizeof(afc_file_info_t));
+	if (!info) {
+		free(received);
 		return AFC_E_NO_MEM;
 	}
-
-	/* Send command */
-	memcpy(AFC_PACKET_DATA_PTR, from, from_len+1);
-	memcpy(AFC_PACKET_DATA_PTR + from_len+1, to, to_len+1);
-	ret = afc_dispatch_packet(client, AFC_OP_RENAME_PATH, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	if (received) {
+		afc_parse_file_info(received, bytes, info);
+		free(received);
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
+	*file_info = info;
 
-	afc_unlock(client);
-
-	return ret;
+	return AFC_E_SUCCESS;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_make_directory(afc_client_t client, const char *path)
+LIBIMOBILEDEVICE_API afc_error_t afc_get_file_info_many(afc_client_t client, const char **paths, uint32_t count, afc_file_info_t **file_infos)
 {
-	uint32_t bytes = 0;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
-	if (!client)
+	if (!client || !paths || !file_infos || !client->afc_packet || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	uint32_t data_len = (uint32_t)strlen(path)+1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
+	afc_file_info_t *infos = (afc_file_info_t*)calloc(count ? count : 1, sizeof(afc_file_info_t));
+	if (!infos) {
 		return AFC_E_NO_MEM;
 	}
 
-	/* Send command */
-	memcpy(AFC_PACKET_DATA_PTR, path, data_len);
-	ret = afc_dispatch_packet(client, AFC_OP_MAKE_DIR, data_len, NULL, 0, &bytes);
+	ret = afc_pipeline_path_requests(client, AFC_OP_GET_FILE_INFO, paths, count, afc_file_info_reply_cb, infos);
+
 	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+		afc_file_info_free(infos, count);
+		return ret;
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
 
+	*file_infos = infos;
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API afc_error_t afc_get_file_info(afc_client_t client, const char *path, char ***file_information)
+struct afc_walk_state {
+	afc_walk_entry_t *entries;
+	uint32_t count;
+	uint32_t capacity;
+	const char **dirs;
+	uint32_t first_entry;
+	int top_level;
+	afc_error_t error;
+};
+
+static void afc_walk_read_dir_cb(void *user_data, uint32_t index, afc_error_t status, const char *data, uint32_t length)
 {
-	char *received = NULL;
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	struct afc_walk_state *state = (struct afc_walk_state*)user_data;
+	const char *dir = state->dirs[index];
+	size_t dir_len = strlen(dir);
+	uint32_t i = 0;
+
+	if (status != AFC_E_SUCCESS) {
+		/* subdirectories that vanished or are unreadable are skipped, but
+		 * the walk fails if the directory it started from can't be listed */
+		if (state->top_level) {
+			state->error = status;
+		}
+		return;
+	}
+	if (!data) {
+		return;
+	}
 
-	if (!client || !path || !file_information)
+	while (i < length && state->error == AFC_E_SUCCESS) {
+		const char *name = data + i;
+		size_t name_len = strnlen(name, length - i);
+		i += name_len + 1;
+		if (name_len == 0 || !strcmp(name, ".") || !strcmp(name, "..")) {
+			continue;
+		}
+		if (state->count == state->capacity) {
+			uint32_t capacity = state->capacity ? state->capacity * 2 : 256;
+			afc_walk_entry_t *entries = (afc_walk_entry_t*)realloc(state->entries, capacity * sizeof(afc_walk_entry_t));
+			if (!entries) {
+				state->error = AFC_E_NO_MEM;
+				return;
+			}
+			state->entries = entries;
+			state->capacity = capacity;
+		}
+		afc_walk_entry_t *entry = state->entries + state->count;
+		memset(entry, 0, sizeof(afc_walk_entry_t));
+		entry->path = (char*)malloc(dir_len + 1 + name_len + 1);
+		if (!entry->path) {
+			state->error = AFC_E_NO_MEM;
+			return;
+		}
+		memcpy(entry->path, dir, dir_len);
+		/* avoid a double slash when walking from the root */
+		size_t offset = (dir_len > 0 && dir[dir_len-1] == '/') ? dir_len : dir_len + 1;
+		entry->path[offset-1] = '/';
+		memcpy(entry->path + offset, name, name_len + 1);
+		state->count++;
+	}
+}
+
+static void afc_walk_file_info_cb(void *user_data, uint32_t index, afc_error_t status, const char *data, uint32_t length)
+{
+	struct afc_walk_state *state = (struct afc_walk_state*)user_data;
+	afc_file_info_t *info = &state->entries[state->first_entry + index].info;
+	info->status = status;
+	if (status == AFC_E_SUCCESS && data) {
+		afc_parse_file_info(data, length, info);
+	}
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_walk(afc_client_t client, const char *path, afc_walk_entry_t **entries, uint32_t *count)
+{
+	afc_error_t ret = AFC_E_SUCCESS;
+	struct afc_walk_state state;
+	const char **level = NULL;
+	uint32_t level_count = 1;
+	uint32_t level_start = 0;
+	uint32_t new_count = 0;
+	uint32_t i = 0;
+
+	if (!client || !path || !entries || !count || !client->afc_packet || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
+	memset(&state, 0, sizeof(state));
+	state.top_level = 1;
+	state.error = AFC_E_SUCCESS;
 
-	uint32_t data_len = (uint32_t)strlen(path)+1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
+	level = (const char**)malloc(sizeof(char*));
+	if (!level) {
 		return AFC_E_NO_MEM;
 	}
+	level[0] = path;
+
+	/* breadth-first: list all directories of one level, then stat all of their children */
+	while (level_count > 0) {
+		state.dirs = level;
+		ret = afc_pipeline_path_requests(client, AFC_OP_READ_DIR, level, level_count, afc_walk_read_dir_cb, &state);
+		if (ret == AFC_E_SUCCESS) {
+			ret = state.error;
+		}
+		if (ret != AFC_E_SUCCESS) {
+			break;
+		}
+		state.top_level = 0;
 
-	debug_info("We got %p and %p", client->afc_packet, AFC_PACKET_DATA_PTR);
+		new_count = state.count - level_start;
+		const char **children = (const char**)realloc(level, (new_count ? new_count : 1) * sizeof(char*));
+		if (!children) {
+			ret = AFC_E_NO_MEM;
+			break;
+		}
+		level = children;
+		for (i = 0; i < new_count; i++) {
+			level[i] = state.entries[level_start + i].path;
+		}
 
-	/* Send command */
-	memcpy(AFC_PACKET_DATA_PTR, path, data_len);
-	ret = afc_dispatch_packet(client, AFC_OP_GET_FILE_INFO, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
+		state.first_entry = level_start;
+		ret = afc_pipeline_path_requests(client, AFC_OP_GET_FILE_INFO, level, new_count, afc_walk_file_info_cb, &state);
+		if (ret != AFC_E_SUCCESS) {
+			break;
+		}
 
-	/* Receive data */
-	ret = afc_receive_data(client, &received, &bytes);
-	if (received) {
-		*file_information = make_strings_list(received, bytes);
-		free(received);
+		/* the next level consists of the subdirectories that were just found */
+		level_count = 0;
+		for (i = 0; i < new_count; i++) {
+			afc_walk_entry_t *entry = &state.entries[level_start + i];
+			if (entry->info.status == AFC_E_SUCCESS && entry->info.type == AFC_FILE_TYPE_DIRECTORY) {
+				level[level_count++] = entry->path;
+			}
+		}
+		level_start = state.count;
 	}
 
-	afc_unlock(client);
+	free(level);
+
+	if (ret != AFC_E_SUCCESS) {
+		afc_walk_free(state.entries, state.count);
+		return ret;
+	}
 
+	*entries = state.entries;
+	*count = state.count;
 	return ret;
 }
 
 LIBIMOBILEDEVICE_API afc_error_t afc_file_open(afc_client_t client, const char *filename, afc_file_mode_t file_mode, uint64_t *handle)
 {
-	if (!client || !client->parent || !client->afc_packet)
+	if (!client || !client->parent || !client->afc_packet || !filename || !handle)
 		return AFC_E_INVALID_ARG;
 
-	//uint64_t file_mode_loc = htole64(file_mode);
 	uint32_t bytes = 0;
+	uint32_t data_len = 0;
+	char *data = NULL;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
 	/* set handle to 0 so in case an error occurs, the handle is invalid */
 	*handle = 0;
 
-	afc_lock(client);
-
-	uint32_t data_len = (uint32_t)(strlen(filename)+1 + 8);
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
+	char *args = afc_build_args(file_mode, filename, NULL, &data_len);
+	if (!args) {
 		return AFC_E_NO_MEM;
 	}
 
 	/* Send command */
-	//memcpy(AFC_PACKET_DATA_PTR, &file_mode_loc, 8);
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = htole64(file_mode);
-	memcpy(AFC_PACKET_DATA_PTR + 8, filename, data_len-8);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_OPEN, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		debug_info("Didn't receive a response to the command");
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive the data */
-	char* data = NULL;
-	ret = afc_receive_data(client, &data, &bytes);
-	if ((ret == AFC_E_SUCCESS) && (bytes > 0) && data) {
-		afc_unlock(client);
-
+	ret = afc_request(client, AFC_OP_FILE_OPEN, args, data_len, NULL, 0, &data, &bytes);
+	free(args);
+	if ((ret == AFC_E_SUCCESS) && (bytes >= sizeof(uint64_t)) && data) {
 		/* Get the file handle */
 		memcpy(handle, data, sizeof(uint64_t));
-		free(data);
-		return ret;
+	} else {
+		debug_info("Didn't get any further data");
 	}
-	/* in case memory was allocated but no data received or an error occurred */
 	free(data);
 
-	debug_info("Didn't get any further data");
-
-	afc_unlock(client);
-
 	return ret;
 }
 
 LIBIMOBILEDEVICE_API afc_error_t afc_file_read(afc_client_t client, uint64_t handle, char *data, uint32_t length, uint32_t *bytes_read)
 {
 	char *input = NULL;
-	uint32_t current_count = 0, bytes_loc = 0;
+	uint32_t bytes_loc = 0;
 	struct readinfo {
 		uint64_t handle;
 		uint64_t size;
-	};
+	} readinfo;
 	afc_error_t ret = AFC_E_SUCCESS;
 
 	if (!client || !client->afc_packet || !client->parent || handle == 0)
 		return AFC_E_INVALID_ARG;
 	debug_info("called for length %i", length);
 
-	//uint32_t data_len = 8 + 8;
-
-	afc_lock(client);
+	*bytes_read = 0;
 
-	/* Send the read command */
-	struct readinfo* readinfo = (struct readinfo*)(AFC_PACKET_DATA_PTR);
-	readinfo->handle = handle;
-	readinfo->size = htole64(length);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_READ, sizeof(struct readinfo), NULL, 0, &bytes_loc);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive the data */
-	ret = afc_receive_data(client, &input, &bytes_loc);
-	debug_info("afc_receive_data returned error: %d", ret);
+	/* Send the read command and receive the data */
+	readinfo.handle = handle;
+	readinfo.size = htole64(length);
+	ret = afc_request(client, AFC_OP_FILE_READ, (const char*)&readinfo, sizeof(readinfo), NULL, 0, &input, &bytes_loc);
+	debug_info("afc_request returned error: %d", ret);
 	debug_info("bytes returned: %i", bytes_loc);
 	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
 		return ret;
-	} else if (bytes_loc == 0) {
-		if (input)
-			free(input);
-		afc_unlock(client);
-		*bytes_read = current_count;
-		/* FIXME: check that's actually a success */
-		return ret;
-	} else {
-		if (input) {
-			debug_info("%d", bytes_loc);
-			memcpy(data + current_count, input, (bytes_loc > length) ? length : bytes_loc);
-			free(input);
-			input = NULL;
-			current_count += (bytes_loc > length) ? length : bytes_loc;
+	}
+	if (input && bytes_loc > 0) {
+		*bytes_read = (bytes_loc > length) ? length : bytes_loc;
+		memcpy(data, input, *bytes_read);
+	}
+	free(input);
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_read_pipelined(afc_client_t client, uint64_t handle, uint32_t chunk_size, afc_file_read_cb_t read_cb, void *user_data, uint64_t *bytes_read)
+{
+	struct afc_request reqs[AFC_FILE_READ_PIPELINE_DEPTH];
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	uint64_t total = 0;
+	int done = 0;
+	struct readinfo {
+		uint64_t handle;
+		uint64_t size;
+	} readinfo;
+	afc_error_t ret = AFC_E_SUCCESS;
+
+	if (!client || !client->afc_packet || !client->parent || handle == 0 || !read_cb)
+		return AFC_E_INVALID_ARG;
+
+	if (chunk_size == 0)
+		chunk_size = AFC_FILE_READ_CHUNK_SIZE;
+
+	readinfo.handle = handle;
+	readinfo.size = htole64(chunk_size);
+
+	do {
+		/* keep the pipeline full until the end of the file shows up */
+		while (!done && sent - received < AFC_FILE_READ_PIPELINE_DEPTH) {
+			struct afc_request *req = &reqs[sent % AFC_FILE_READ_PIPELINE_DEPTH];
+			afc_request_init(req);
+			afc_error_t err = afc_dispatch_packet(client, req, AFC_OP_FILE_READ, (const char*)&readinfo, sizeof(readinfo), NULL, 0, NULL);
+			if (err != AFC_E_SUCCESS) {
+				afc_request_finish(client, req);
+				ret = err;
+				goto leave;
+			}
+			sent++;
+		}
+
+		struct afc_request *req = &reqs[received % AFC_FILE_READ_PIPELINE_DEPTH];
+		char *input = NULL;
+		uint32_t bytes = 0;
+		afc_error_t err = afc_wait_reply(client, req, &input, &bytes);
+		afc_request_finish(client, req);
+		received++;
+		if (err != AFC_E_SUCCESS) {
+			if (err == AFC_E_MUX_ERROR || err == AFC_E_NOT_ENOUGH_DATA || err == AFC_E_OP_HEADER_INVALID) {
+				/* the connection is out of sync, so the remaining replies are lost */
+				ret = err;
+				goto leave;
+			}
+			if (!done)
+				ret = err;
+			done = 1;
+			continue;
+		}
+		if (bytes == 0) {
+			done = 1;
+		} else if (!done) {
+			if (read_cb(input, bytes, user_data) != 0) {
+				ret = AFC_E_OP_INTERRUPTED;
+				done = 1;
+			} else {
+				total += bytes;
+			}
 		}
+		free(input);
+	} while (received < sent);
+
+leave:
+	/* forget the requests that are still in flight */
+	while (received < sent) {
+		afc_request_finish(client, &reqs[received % AFC_FILE_READ_PIPELINE_DEPTH]);
+		received++;
 	}
-	afc_unlock(client);
-	*bytes_read = current_count;
+
+	if (bytes_read)
+		*bytes_read = total;
+
 	return ret;
 }
 
 LIBIMOBILEDEVICE_API afc_error_t afc_file_write(afc_client_t client, uint64_t handle, const char *data, uint32_t length, uint32_t *bytes_written)
 {
-	uint32_t current_count = 0;
+	struct afc_request req;
 	uint32_t bytes_loc = 0;
 	afc_error_t ret = AFC_E_SUCCESS;
 
 	if (!client || !client->afc_packet || !client->parent || !bytes_written || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	uint32_t data_len = 8;
-
-	afc_lock(client);
-
 	debug_info("Write length: %i", length);
 
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = handle;
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_WRITE, data_len, data, length, &bytes_loc);
-
-	current_count += bytes_loc - (sizeof(AFCPacket) + 8);
-
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		*bytes_written = current_count;
-		return AFC_E_SUCCESS;
+	afc_request_init(&req);
+	ret = afc_dispatch_packet(client, &req, AFC_OP_FILE_WRITE, (const char*)&handle, 8, data, length, &bytes_loc);
+	*bytes_written = (bytes_loc > sizeof(AFCPacket) + 8) ? bytes_loc - (uint32_t)(sizeof(AFCPacket) + 8) : 0;
+	if (ret == AFC_E_SUCCESS) {
+		ret = afc_wait_reply(client, &req, NULL, NULL);
+		if (ret != AFC_E_SUCCESS) {
+			debug_info("uh oh?");
+		}
 	}
+	afc_request_finish(client, &req);
 
-	ret = afc_receive_data(client, NULL, &bytes_loc);
-	afc_unlock(client);
-	if (ret != AFC_E_SUCCESS) {
-		debug_info("uh oh?");
-	}
-	*bytes_written = current_count;
 	return ret;
 }
 
 LIBIMOBILEDEVICE_API afc_error_t afc_file_close(afc_client_t client, uint64_t handle)
 {
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
-
 	if (!client || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	uint32_t data_len = 8;
+	debug_info("File handle %i", handle);
 
-	afc_lock(client);
+	return afc_request(client, AFC_OP_FILE_CLOSE, (const char*)&handle, 8, NULL, 0, NULL, NULL);
+}
 
-	debug_info("File handle %i", handle);
+LIBIMOBILEDEVICE_API afc_error_t afc_file_open_async(afc_client_t client, const char *filename, afc_file_mode_t file_mode, afc_completion_cb_t callback, void *user_data)
+{
+	if (!client || !client->parent || !client->afc_packet || !filename || !callback)
+		return AFC_E_INVALID_ARG;
 
-	/* Send command */
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = handle;
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_CLOSE, data_len, NULL, 0, &bytes);
+	uint32_t data_len = 0;
+	char *args = afc_build_args(file_mode, filename, NULL, &data_len);
+	if (!args) {
+		return AFC_E_NO_MEM;
+	}
 
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_UNKNOWN_ERROR;
+	return afc_request_async(client, AFC_OP_FILE_OPEN, args, data_len, NULL, 0, callback, user_data);
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_file_read_async(afc_client_t client, uint64_t handle, uint32_t length, afc_completion_cb_t callback, void *user_data)
+{
+	if (!client || !client->parent || !client->afc_packet || handle == 0 || !callback)
+		return AFC_E_INVALID_ARG;
+
+	char *args = (char*)malloc(16);
+	if (!args) {
+		return AFC_E_NO_MEM;
 	}
+	uint64_t size = htole64(length);
+	memcpy(args, &handle, 8);
+	memcpy(args + 8, &size, 8);
+
+	return afc_request_async(client, AFC_OP_FILE_READ, args, 16, NULL, 0, callback, user_data);
+}
 
-	/* Receive the response */
-	ret = afc_receive_data(client, NULL, &bytes);
+LIBIMOBILEDEVICE_API afc_error_t afc_file_write_async(afc_client_t client, uint64_t handle, const char *data, uint32_t length, afc_completion_cb_t callback, void *user_data)
+{
+	if (!client || !client->parent || !client->afc_packet || handle == 0 || (!data && length > 0) || !callback)
+		return AFC_E_INVALID_ARG;
+
+	char *args = (char*)malloc(8);
+	if (!args) {
+		return AFC_E_NO_MEM;
+	}
+	memcpy(args, &handle, 8);
 
-	afc_unlock(client);
+	return afc_request_async(client, AFC_OP_FILE_WRITE, args, 8, data, length, callback, user_data);
+}
 
-	return ret;
+LIBIMOBILEDEVICE_API afc_error_t afc_file_close_async(afc_client_t client, uint64_t handle, afc_completion_cb_t callback, void *user_data)
+{
+	if (!client || !client->parent || !client->afc_packet || handle == 0 || !callback)
+		return AFC_E_INVALID_ARG;
+
+	char *args = (char*)malloc(8);
+	if (!args) {
+		return AFC_E_NO_MEM;
+	}
+	memcpy(args, &handle, 8);
+
+	return afc_request_async(client, AFC_OP_FILE_CLOSE, args, 8, NULL, 0, callback, user_data);
 }
 
 LIBIMOBILEDEVICE_API afc_error_t afc_file_lock(afc_client_t client, uint64_t handle, afc_lock_op_t operation)
 {
-	uint32_t bytes = 0;
 	struct lockinfo {
 		uint64_t handle;
 		uint64_t op;
-	};
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	} lockinfo;
 
 	if (!client || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
 	debug_info("file handle %i", handle);
 
-	/* Send command */
-	struct lockinfo* lockinfo = (struct lockinfo*)(AFC_PACKET_DATA_PTR);
-	lockinfo->handle = handle;
-	lockinfo->op = htole64(operation);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_LOCK, sizeof(struct lockinfo), NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		debug_info("could not send lock command");
-		return AFC_E_UNKNOWN_ERROR;
-	}
-	/* Receive the response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
-
-	return ret;
+	lockinfo.handle = handle;
+	lockinfo.op = htole64(operation);
+	return afc_request(client, AFC_OP_FILE_LOCK, (const char*)&lockinfo, sizeof(lockinfo), NULL, 0, NULL, NULL);
 }
 
 LIBIMOBILEDEVICE_API afc_error_t afc_file_seek(afc_client_t client, uint64_t handle, int64_t offset, int whence)
 {
-	uint32_t bytes = 0;
 	struct seekinfo {
 		uint64_t handle;
 		uint64_t whence;
 		int64_t offset;
-	};
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	} seekinfo;
 
 	if (!client || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	/* Send the command */
-	struct seekinfo* seekinfo = (struct seekinfo*)(AFC_PACKET_DATA_PTR);
-	seekinfo->handle = handle;
-	seekinfo->whence = htole64(whence);
-	seekinfo->offset = (int64_t)htole64(offset);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_SEEK, sizeof(struct seekinfo), NULL, 0, &bytes);
-
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
-
-	return ret;
+	seekinfo.handle = handle;
+	seekinfo.whence = htole64(whence);
+	seekinfo.offset = (int64_t)htole64(offset);
+	return afc_request(client, AFC_OP_FILE_SEEK, (const char*)&seekinfo, sizeof(seekinfo), NULL, 0, NULL, NULL);
 }
 
 LIBIMOBILEDEVICE_API afc_error_t afc_file_tell(afc_client_t client, uint64_t handle, uint64_t *position)
@@ -914,62 +2028,30 @@ LIBIMOBILEDEVICE_API afc_error_t afc_file_tell(afc_client_t client, uint64_t han
 	if (!client || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	uint32_t data_len = 8;
-
-	afc_lock(client);
-
-	/* Send the command */
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = handle;
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_TELL, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-
-	/* Receive the data */
-	ret = afc_receive_data(client, &buffer, &bytes);
-	if (bytes > 0 && buffer) {
+	ret = afc_request(client, AFC_OP_FILE_TELL, (const char*)&handle, 8, NULL, 0, &buffer, &bytes);
+	if (bytes >= sizeof(uint64_t) && buffer) {
 		/* Get the position */
 		memcpy(position, buffer, sizeof(uint64_t));
 		*position = le64toh(*position);
 	}
 	free(buffer);
 
-	afc_unlock(client);
-
 	return ret;
 }
 
 LIBIMOBILEDEVICE_API afc_error_t afc_file_truncate(afc_client_t client, uint64_t handle, uint64_t newsize)
 {
-	uint32_t bytes = 0;
 	struct truncinfo {
 		uint64_t handle;
 		uint64_t newsize;
-	};
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	} truncinfo;
 
 	if (!client || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	/* Send command */
-	struct truncinfo* truncinfo = (struct truncinfo*)(AFC_PACKET_DATA_PTR);
-	truncinfo->handle = handle;
-	truncinfo->newsize = htole64(newsize);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_SET_SIZE, sizeof(struct truncinfo), NULL, 0, &bytes);
-
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
-
-	return ret;
+	truncinfo.handle = handle;
+	truncinfo.newsize = htole64(newsize);
+	return afc_request(client, AFC_OP_FILE_SET_SIZE, (const char*)&truncinfo, sizeof(truncinfo), NULL, 0, NULL, NULL);
 }
 
 LIBIMOBILEDEVICE_API afc_error_t afc_truncate(afc_client_t client, const char *path, uint64_t newsize)
@@ -977,30 +2059,14 @@ LIBIMOBILEDEVICE_API afc_error_t afc_truncate(afc_client_t client, const char *p
 	if (!client || !path || !client->afc_packet || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
-
-	afc_lock(client);
-
-	uint32_t data_len = 8 + (uint32_t)(strlen(path)+1);
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
+	uint32_t data_len = 0;
+	char *args = afc_build_args(newsize, path, NULL, &data_len);
+	if (!args) {
 		return AFC_E_NO_MEM;
 	}
 
-	/* Send command */
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = htole64(newsize);
-	memcpy(AFC_PACKET_DATA_PTR + 8, path, data_len-8);
-	ret = afc_dispatch_packet(client, AFC_OP_TRUNCATE, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
+	afc_error_t ret = afc_request(client, AFC_OP_TRUNCATE, args, data_len, NULL, 0, NULL, NULL);
+	free(args);
 
 	return ret;
 }
@@ -1010,38 +2076,18 @@ LIBIMOBILEDEVICE_API afc_error_t afc_make_link(afc_client_t client, afc_link_typ
 	if (!client || !target || !linkname || !client->afc_packet || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
-
-	size_t target_len = strlen(target);
-	size_t link_len = strlen(linkname);
-
-	afc_lock(client);
-
-	uint32_t data_len = 8 + target_len + 1 + link_len + 1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
-		return AFC_E_NO_MEM;
-	}
-
 	debug_info("link type: %lld", htole64(linktype));
-	debug_info("target: %s, length:%d", target, target_len);
-	debug_info("linkname: %s, length:%d", linkname, link_len);
+	debug_info("target: %s, length:%d", target, strlen(target));
+	debug_info("linkname: %s, length:%d", linkname, strlen(linkname));
 
-	/* Send command */
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = htole64(linktype);
-	memcpy(AFC_PACKET_DATA_PTR + 8, target, target_len + 1);
-	memcpy(AFC_PACKET_DATA_PTR + 8 + target_len + 1, linkname, link_len + 1);
-	ret = afc_dispatch_packet(client, AFC_OP_MAKE_LINK, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	uint32_t data_len = 0;
+	char *args = afc_build_args(linktype, target, linkname, &data_len);
+	if (!args) {
+		return AFC_E_NO_MEM;
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
 
-	afc_unlock(client);
+	afc_error_t ret = afc_request(client, AFC_OP_MAKE_LINK, args, data_len, NULL, 0, NULL, NULL);
+	free(args);
 
 	return ret;
 }
@@ -1051,64 +2097,65 @@ LIBIMOBILEDEVICE_API afc_error_t afc_set_file_time(afc_client_t client, const ch
 	if (!client || !path || !client->afc_packet || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
-
-	afc_lock(client);
-
-	uint32_t data_len = 8 + strlen(path) + 1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
+	uint32_t data_len = 0;
+	char *args = afc_build_args(mtime, path, NULL, &data_len);
+	if (!args) {
 		return AFC_E_NO_MEM;
 	}
 
-	/* Send command */
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = htole64(mtime);
-	memcpy(AFC_PACKET_DATA_PTR + 8, path, data_len-8);
-	ret = afc_dispatch_packet(client, AFC_OP_SET_FILE_MOD_TIME, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
+	afc_error_t ret = afc_request(client, AFC_OP_SET_FILE_MOD_TIME, args, data_len, NULL, 0, NULL, NULL);
+	free(args);
 
 	return ret;
 }
 
 LIBIMOBILEDEVICE_API afc_error_t afc_remove_path_and_contents(afc_client_t client, const char *path)
 {
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
-
 	if (!client || !path || !client->afc_packet || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
+	return afc_path_request(client, AFC_OP_REMOVE_PATH_AND_CONTENTS, path, NULL, NULL);
+}
 
-	uint32_t data_len = strlen(path) + 1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
-		return AFC_E_NO_MEM;
+LIBIMOBILEDEVICE_API afc_error_t afc_file_info_free(afc_file_info_t *file_infos, uint32_t count)
+{
+	uint32_t i = 0;
+
+	if (!file_infos)
+		return AFC_E_INVALID_ARG;
+
+	for (i = 0; i < count; i++) {
+		free(file_infos[i].link_target);
 	}
+	free(file_infos);
 
-	/* Send command */
-	memcpy(AFC_PACKET_DATA_PTR, path, data_len);
-	ret = afc_dispatch_packet(client, AFC_OP_REMOVE_PATH_AND_CONTENTS, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	return AFC_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API afc_error_t afc_walk_free(afc_walk_entry_t *entries, uint32_t count)
+{
+	uint32_t i = 0;
+
+	if (!entries)
+		return AFC_E_INVALID_ARG;
+
+	for (i = 0; i < count; i++) {
+		free(entries[i].path);
+		free(entries[i].info.link_target);
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
+	free(entries);
 
-	afc_unlock(client);
+	return AFC_E_SUCCESS;
+}
 
-	return ret;
+LIBIMOBILEDEVICE_API afc_error_t afc_directory_listing_free(afc_directory_listing_t *listing)
+{
+	if (!listing)
+		return AFC_E_INVALID_ARG;
+
+	free(listing);
+
+	return AFC_E_SUCCESS;
 }
 
 LIBIMOBILEDEVICE_API afc_error_t afc_dictionary_free(char **dictionary)
@@ -50,11 +50,49 @@ typedef struct {
 	(x)->packet_num    = le64toh((x)->packet_num); \
 	(x)->operation     = le64toh((x)->operation);
 
+/* Maximum number of requests kept in flight by the batched operations */
+#define AFC_PIPELINE_DEPTH 32
+
+/* Default request size and number of requests in flight for pipelined file reads */
+#define AFC_FILE_READ_CHUNK_SIZE (1024 * 1024)
+#define AFC_FILE_READ_PIPELINE_DEPTH 4
+
+/* A request that is waiting for its reply, matched by packet number */
+struct afc_request {
+	uint64_t packet_num;
+	afc_error_t status;
+	char *data;
+	uint32_t length;
+	int done;
+	int waiting;
+	cond_t cond;
+	/* set for asynchronous requests, which are sent by the event thread */
+	afc_completion_cb_t callback;
+	void *user_data;
+	uint64_t operation;
+	char *args;
+	uint32_t args_length;
+	char *payload;
+	uint32_t payload_length;
+	struct afc_request *next;
+};
+
 struct afc_client_private {
 	service_client_t parent;
 	AFCPacket *afc_packet;
 	uint32_t packet_extra;
-	mutex_t mutex;
+	mutex_t send_mutex; /* serializes outgoing packets and guards afc_packet */
+	mutex_t reply_mutex; /* guards the fields below and the pending requests */
+	struct afc_request *pending;
+	struct afc_request *send_queue; /* asynchronous requests that have not been sent yet */
+	uint32_t async_pending; /* asynchronous requests that have not completed yet */
+	int async_registered; /* guarded by the event thread's mutex */
+	uint32_t async_busy; /* references held by the event thread, guarded by its mutex */
+	int reading;
+	AFCPacket rx_header; /* the packet being received, kept across reads of the event thread */
+	uint32_t rx_header_length;
+	char *rx_data;
+	uint32_t rx_data_length;
 	int free_parent;
 };
 
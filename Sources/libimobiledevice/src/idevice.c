@@ -213,21 +213,42 @@ BOOL WINAPI DllMain(HINSTANCE hModule, DWORD dwReason, LPVOID lpReserved)
 
 static idevice_event_cb_t event_cb = NULL;
 
-static void usbmux_event_cb(const usbmuxd_event_t *event, void *user_data)
-{
-	idevice_event_t ev;
+struct idevice_subscription_context {
+	idevice_event_cb_t callback;
+	void *user_data;
+	usbmuxd_subscription_context_t ctx;
+};
 
-	ev.event = event->event;
-	ev.udid = event->device.udid;
-	ev.conn_type = 0;
+static void usbmux_event_convert(const usbmuxd_event_t *event, idevice_event_t *ev)
+{
+	ev->event = event->event;
+	ev->udid = event->device.udid;
+	ev->conn_type = 0;
 	if (event->device.conn_type == CONNECTION_TYPE_USB) {
-		ev.conn_type = CONNECTION_USBMUXD;
+		ev->conn_type = CONNECTION_USBMUXD;
 	} else if (event->device.conn_type == CONNECTION_TYPE_NETWORK) {
-		ev.conn_type = CONNECTION_NETWORK;
+		ev->conn_type = CONNECTION_NETWORK;
 	} else {
 		debug_info("Unknown connection type %d", event->device.conn_type);
 	}
+}
+
+static void usbmux_context_event_cb(const usbmuxd_event_t *event, void *user_data)
+{
+	idevice_subscription_context_t context = (idevice_subscription_context_t)user_data;
+	idevice_event_t ev;
+
+	usbmux_event_convert(event, &ev);
+	if (context->callback) {
+		context->callback(&ev, context->user_data);
+	}
+}
 
+static void usbmux_event_cb(const usbmuxd_event_t *event, void *user_data)
+{
+	idevice_event_t ev;
+
+	usbmux_event_convert(event, &ev);
 	if (event_cb) {
 		event_cb(&ev, user_data);
 	}
@@ -256,6 +277,41 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_event_unsubscribe(void)
 	return IDEVICE_E_SUCCESS;
 }
 
+LIBIMOBILEDEVICE_API idevice_error_t idevice_events_subscribe(idevice_subscription_context_t *context, idevice_event_cb_t callback, void *user_data)
+{
+	if (!context || !callback) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+	idevice_subscription_context_t ctx = (idevice_subscription_context_t)calloc(1, sizeof(struct idevice_subscription_context));
+	if (!ctx) {
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+	ctx->callback = callback;
+	ctx->user_data = user_data;
+	int res = usbmuxd_events_subscribe(&ctx->ctx, usbmux_context_event_cb, ctx);
+	if (res != 0) {
+		free(ctx);
+		debug_info("ERROR: usbmuxd_events_subscribe() returned %d!", res);
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+	*context = ctx;
+	return IDEVICE_E_SUCCESS;
+}
+
+LIBIMOBILEDEVICE_API idevice_error_t idevice_events_unsubscribe(idevice_subscription_context_t context)
+{
+	if (!context) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+	int res = usbmuxd_events_unsubscribe(context->ctx);
+	free(context);
+	if (res != 0) {
+		debug_info("ERROR: usbmuxd_events_unsubscribe() returned %d!", res);
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+	return IDEVICE_E_SUCCESS;
+}
+
 LIBIMOBILEDEVICE_API idevice_error_t idevice_get_device_list_extended(idevice_info_t **devices, int *count)
 {
 	usbmuxd_device_info_t *dev_list;
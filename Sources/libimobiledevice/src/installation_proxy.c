@@ -23,18 +23,26 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #ifndef WIN32
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 #endif
 #include <plist/plist.h>
+#include <libimobiledevice-glue/collection.h>
 
 #include "installation_proxy.h"
 #include "property_list_service.h"
 #include "common/debug.h"
 
+/* how long the status pump waits for the rest of a status message once its connection is readable */
+#define INSTPROXY_STATUS_RECEIVE_TIMEOUT 5000
+
 typedef enum {
 	INSTPROXY_COMMAND_TYPE_ASYNC,
 	INSTPROXY_COMMAND_TYPE_SYNC
@@ -45,8 +53,14 @@ struct instproxy_status_data {
 	plist_t command;
 	instproxy_status_cb_t cbfunc;
 	void *user_data;
+	char *command_name;
+	int fd;
+	int done;
+	int cancelled;
 };
 
+static void instproxy_status_pump_cancel(instproxy_client_t client);
+
 /**
  * Converts an error string identifier to a instproxy_error_t value.
  * Used internally to get correct error codes from a response.
@@ -249,6 +263,7 @@ LIBIMOBILEDEVICE_API instproxy_error_t instproxy_client_new(idevice_t device, lo
 	client_loc->parent = plistclient;
 	mutex_init(&client_loc->mutex);
 	client_loc->receive_status_thread = THREAD_T_NULL;
+	client_loc->status_op = NULL;
 
 	*client = client_loc;
 	return INSTPROXY_E_SUCCESS;
@@ -266,6 +281,8 @@ LIBIMOBILEDEVICE_API instproxy_error_t instproxy_client_free(instproxy_client_t
 	if (!client)
 		return INSTPROXY_E_INVALID_ARG;
 
+	instproxy_status_pump_cancel(client);
+
 	property_list_service_client_t parent = client->parent;
 	client->parent = NULL;
 	if (client->receive_status_thread) {
@@ -309,12 +326,116 @@ static instproxy_error_t instproxy_send_command(instproxy_client_t client, plist
 	return res;
 }
 
+/**
+ * Internally used function that processes a single status message of a
+ * command and invokes the status callback for it.
+ *
+ * @param command Operation specificiation in plist. Will be passed to the
+ *        status_cb callback.
+ * @param command_name The name of the command, for debug messages.
+ * @param node The received status message.
+ * @param status_cb Pointer to a callback function or NULL
+ * @param user_data Callback data passed to status_cb.
+ * @param res Will be set to the status of the command.
+ *
+ * @return 1 if the command completed or failed, 0 if more status messages
+ *     will follow.
+ */
+static int instproxy_handle_status(plist_t command, const char *command_name, plist_t node, instproxy_status_cb_t status_cb, void *user_data, instproxy_error_t *res)
+{
+	int complete = 0;
+	char* status_name = NULL;
+	char* error_name = NULL;
+	char* error_description = NULL;
+	uint64_t error_code = 0;
+#ifndef STRIP_DEBUG_CODE
+	int percent_complete = 0;
+#endif
+
+	/* check status for possible error to allow reporting it and aborting it gracefully */
+	*res = instproxy_status_get_error(node, &error_name, &error_description, &error_code);
+	if (*res != INSTPROXY_E_SUCCESS) {
+		debug_info("command: %s, error %d, code 0x%08"PRIx64", name: %s, description: \"%s\"", command_name, *res, error_code, error_name, error_description ? error_description: "N/A");
+		complete = 1;
+	}
+
+	if (error_name) {
+		free(error_name);
+		error_name = NULL;
+	}
+
+	if (error_description) {
+		free(error_description);
+		error_description = NULL;
+	}
+
+	/* check status from response */
+	instproxy_status_get_name(node, &status_name);
+	if (!status_name) {
+		debug_info("ignoring message without Status key:");
+		debug_plist(node);
+	} else {
+		if (!strcmp(status_name, "Complete")) {
+			complete = 1;
+		} else {
+			*res = INSTPROXY_E_OP_IN_PROGRESS;
+		}
+#ifndef STRIP_DEBUG_CODE
+		percent_complete = -1;
+		instproxy_status_get_percent_complete(node, &percent_complete);
+		if (percent_complete >= 0) {
+			debug_info("command: %s, status: %s, percent (%d%%)", command_name, status_name, percent_complete);
+		} else {
+			debug_info("command: %s, status: %s", command_name, status_name);
+		}
+#endif
+		free(status_name);
+		status_name = NULL;
+	}
+
+	/* invoke status callback function */
+	if (status_cb) {
+		status_cb(command, node, user_data);
+	}
+
+	return complete;
+}
+
+/**
+ * Passes a final error status to the status callback when the connection
+ * failed while a command was in progress, since the device will not send
+ * one anymore.
+ *
+ * @param command Operation specificiation in plist. Will be passed to the
+ *        status_cb callback.
+ * @param err The error that occurred while receiving.
+ * @param status_cb Pointer to a callback function or NULL
+ * @param user_data Callback data passed to status_cb.
+ */
+static void instproxy_report_receive_error(plist_t command, instproxy_error_t err, instproxy_status_cb_t status_cb, void *user_data)
+{
+	char description[80];
+
+	if (!status_cb) {
+		return;
+	}
+
+	snprintf(description, sizeof(description), "Lost the connection to the installation proxy (error %d)", err);
+
+	plist_t status = plist_new_dict();
+	plist_dict_set_item(status, "Error", plist_new_string("ConnectionLost"));
+	plist_dict_set_item(status, "ErrorDescription", plist_new_string(description));
+	status_cb(command, status, user_data);
+	plist_free(status);
+}
+
 /**
  * Internally used function that will synchronously receive messages from
  * the specified installation_proxy until it completes or an error occurs.
  *
  * If status_cb is not NULL, the callback function will be called each time
- * a status update or error message is received.
+ * a status update or error message is received, and with a final error
+ * status if the connection fails.
  *
  * @param client The connected installation proxy client
  * @param status_cb Pointer to a callback function or NULL
@@ -328,13 +449,6 @@ static instproxy_error_t instproxy_receive_status_loop(instproxy_client_t client
 	int complete = 0;
 	plist_t node = NULL;
 	char* command_name = NULL;
-	char* status_name = NULL;
-	char* error_name = NULL;
-	char* error_description = NULL;
-	uint64_t error_code = 0;
-#ifndef STRIP_DEBUG_CODE
-	int percent_complete = 0;
-#endif
 
 	instproxy_command_get_name(command, &command_name);
 
@@ -347,68 +461,261 @@ static instproxy_error_t instproxy_receive_status_loop(instproxy_client_t client
 		/* break out if we have a communication problem */
 		if (res != INSTPROXY_E_SUCCESS && res != INSTPROXY_E_RECEIVE_TIMEOUT) {
 			debug_info("could not receive plist, error %d", res);
+			instproxy_report_receive_error(command, res, status_cb, user_data);
 			break;
 		}
 
 		/* parse status response */
 		if (node) {
-			/* check status for possible error to allow reporting it and aborting it gracefully */
-			res = instproxy_status_get_error(node, &error_name, &error_description, &error_code);
-			if (res != INSTPROXY_E_SUCCESS) {
-				debug_info("command: %s, error %d, code 0x%08"PRIx64", name: %s, description: \"%s\"", command_name, res, error_code, error_name, error_description ? error_description: "N/A");
-				complete = 1;
-			}
+			complete = instproxy_handle_status(command, command_name, node, status_cb, user_data, &res);
+			plist_free(node);
+			node = NULL;
+		}
+	} while (!complete && client->parent);
 
-			if (error_name) {
-				free(error_name);
-				error_name = NULL;
+	if (command_name)
+		free(command_name);
+
+	return res;
+}
+
+#ifndef WIN32
+/*
+ * The status pump is a single thread that waits for status messages on the
+ * connections of all clients with an asynchronous command in progress and
+ * dispatches them to the status callbacks, instead of running one receive
+ * thread per command. It is started with the first command and exits when
+ * no commands are left.
+ */
+static struct {
+	mutex_t mutex;
+	cond_t cond;
+	struct collection ops;
+	THREAD_T thread;
+	int running;
+	int wakeup[2];
+} status_pump;
+static thread_once_t status_pump_once = THREAD_ONCE_INIT;
+
+static void instproxy_status_pump_init(void)
+{
+	mutex_init(&status_pump.mutex);
+	cond_init(&status_pump.cond);
+	collection_init(&status_pump.ops);
+	status_pump.thread = THREAD_T_NULL;
+	status_pump.running = 0;
+	if (pipe(status_pump.wakeup) < 0) {
+		debug_info("could not create wakeup pipe: %s", strerror(errno));
+		status_pump.wakeup[0] = status_pump.wakeup[1] = -1;
+		return;
+	}
+	fcntl(status_pump.wakeup[0], F_SETFL, fcntl(status_pump.wakeup[0], F_GETFL) | O_NONBLOCK);
+	fcntl(status_pump.wakeup[1], F_SETFL, fcntl(status_pump.wakeup[1], F_GETFL) | O_NONBLOCK);
+}
+
+/**
+ * Interrupts the poll of the status pump so it picks up added or cancelled
+ * commands.
+ */
+static void instproxy_status_pump_wakeup(void)
+{
+	char c = 0;
+	if (write(status_pump.wakeup[1], &c, 1) < 0) {
+		/* the pipe is full, so a wakeup is pending anyway */
+	}
+}
+
+static void instproxy_status_data_free(struct instproxy_status_data *data)
+{
+	if (data->client) {
+		data->client->status_op = NULL;
+	}
+	if (data->command) {
+		plist_free(data->command);
+	}
+	free(data->command_name);
+	free(data);
+}
+
+static void* instproxy_status_pump_thread(void* arg)
+{
+	struct pollfd *fds = NULL;
+	struct instproxy_status_data **ops = NULL;
+	int capacity = 0;
+	int count = 0;
+	int i;
+
+	while (1) {
+		mutex_lock(&status_pump.mutex);
+		count = collection_count(&status_pump.ops);
+		if (count == 0) {
+			debug_info("no commands left, exiting");
+			thread_detach(status_pump.thread);
+			status_pump.thread = THREAD_T_NULL;
+			status_pump.running = 0;
+			mutex_unlock(&status_pump.mutex);
+			break;
+		}
+		if (count + 1 > capacity) {
+			capacity = count + 16;
+			fds = (struct pollfd*)realloc(fds, sizeof(struct pollfd) * capacity);
+			ops = (struct instproxy_status_data**)realloc(ops, sizeof(struct instproxy_status_data*) * capacity);
+		}
+		fds[0].fd = status_pump.wakeup[0];
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		count = 0;
+		FOREACH(struct instproxy_status_data *op, &status_pump.ops) {
+			ops[count] = op;
+			fds[count+1].fd = op->fd;
+			fds[count+1].events = POLLIN;
+			fds[count+1].revents = 0;
+			count++;
+		} ENDFOREACH
+		mutex_unlock(&status_pump.mutex);
+
+		if (poll(fds, count + 1, -1) < 0) {
+			if (errno != EINTR) {
+				debug_info("poll failed: %s", strerror(errno));
 			}
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			char buf[64];
+			while (read(status_pump.wakeup[0], buf, sizeof(buf)) > 0);
+		}
+
+		for (i = 0; i < count; i++) {
+			struct instproxy_status_data *op = ops[i];
+			plist_t node = NULL;
+			instproxy_error_t res = INSTPROXY_E_SUCCESS;
 
-			if (error_description) {
-				free(error_description);
-				error_description = NULL;
+			if (!fds[i+1].revents || op->cancelled) {
+				continue;
 			}
 
-			/* check status from response */
-			instproxy_status_get_name(node, &status_name);
-			if (!status_name) {
-				debug_info("ignoring message without Status key:");
-				debug_plist(node);
-			} else {
-				if (!strcmp(status_name, "Complete")) {
-					complete = 1;
-				} else {
-					res = INSTPROXY_E_OP_IN_PROGRESS;
-				}
-#ifndef STRIP_DEBUG_CODE
-				percent_complete = -1;
-				instproxy_status_get_percent_complete(node, &percent_complete);
-				if (percent_complete >= 0) {
-					debug_info("command: %s, status: %s, percent (%d%%)", command_name, status_name, percent_complete);
-				} else {
-					debug_info("command: %s, status: %s", command_name, status_name);
-				}
-#endif
-				free(status_name);
-				status_name = NULL;
+			instproxy_lock(op->client);
+			res = instproxy_error(property_list_service_receive_plist_with_timeout(op->client->parent, &node, INSTPROXY_STATUS_RECEIVE_TIMEOUT));
+			instproxy_unlock(op->client);
+
+			if (res != INSTPROXY_E_SUCCESS && res != INSTPROXY_E_RECEIVE_TIMEOUT) {
+				debug_info("could not receive plist, error %d", res);
+				op->done = 1;
+				instproxy_report_receive_error(op->command, res, op->cbfunc, op->user_data);
+				continue;
 			}
 
-			/* invoke status callback function */
-			if (status_cb) {
-				status_cb(command, node, user_data);
+			if (node) {
+				op->done = instproxy_handle_status(op->command, op->command_name, node, op->cbfunc, op->user_data, &res);
+				plist_free(node);
 			}
+		}
 
-			plist_free(node);
-			node = NULL;
+		/* retire the commands that are complete or cancelled */
+		mutex_lock(&status_pump.mutex);
+		for (i = 0; i < count; i++) {
+			struct instproxy_status_data *op = ops[i];
+			if (op->done || op->cancelled) {
+				debug_info("done with %s, cleaning up.", op->command_name);
+				collection_remove(&status_pump.ops, op);
+				instproxy_status_data_free(op);
+			}
 		}
-	} while (!complete && client->parent);
+		cond_signal(&status_pump.cond);
+		mutex_unlock(&status_pump.mutex);
+	}
 
-	if (command_name)
-		free(command_name);
+	free(fds);
+	free(ops);
 
-	return res;
+	return NULL;
+}
+
+/**
+ * Hands an asynchronous command over to the status pump.
+ *
+ * @param data The command, with fd set to the connection to wait on.
+ *
+ * @return 0 on success or -1 if the status pump is not available.
+ */
+static int instproxy_status_pump_add(struct instproxy_status_data *data)
+{
+	thread_once(&status_pump_once, instproxy_status_pump_init);
+	if (status_pump.wakeup[0] < 0) {
+		return -1;
+	}
+
+	mutex_lock(&status_pump.mutex);
+	collection_add(&status_pump.ops, data);
+	data->client->status_op = data;
+	if (status_pump.running) {
+		instproxy_status_pump_wakeup();
+	} else if (thread_new(&status_pump.thread, instproxy_status_pump_thread, NULL) == 0) {
+		status_pump.running = 1;
+	} else {
+		collection_remove(&status_pump.ops, data);
+		data->client->status_op = NULL;
+		mutex_unlock(&status_pump.mutex);
+		return -1;
+	}
+	mutex_unlock(&status_pump.mutex);
+
+	return 0;
+}
+
+/**
+ * Stops dispatching status messages of the command in progress on the given
+ * client, and waits until the status pump has let go of it.
+ *
+ * When called on the status pump thread itself, e.g. because a status
+ * callback released the last reference to the client, the command is
+ * detached from the client instead, and retired by the pump once the
+ * callback returns.
+ *
+ * @param client The installation proxy client
+ */
+static void instproxy_status_pump_cancel(instproxy_client_t client)
+{
+	thread_once(&status_pump_once, instproxy_status_pump_init);
+
+	mutex_lock(&status_pump.mutex);
+	if (client->status_op && status_pump.running && pthread_equal(status_pump.thread, THREAD_ID)) {
+		client->status_op->cancelled = 1;
+		client->status_op->client = NULL;
+		client->status_op = NULL;
+	} else if (client->status_op) {
+		client->status_op->cancelled = 1;
+		instproxy_status_pump_wakeup();
+		/* the wait is bounded since a signal might wake another waiter */
+		while (client->status_op) {
+			cond_wait_timeout(&status_pump.cond, &status_pump.mutex, 100);
+		}
+	}
+	mutex_unlock(&status_pump.mutex);
 }
 
+/**
+ * Gets the file descriptor the status pump can wait on for the given client.
+ *
+ * @return The file descriptor, or -1 if the connection cannot be polled
+ *     (e.g. because buffered SSL data would go unnoticed).
+ */
+static int instproxy_get_status_fd(instproxy_client_t client)
+{
+	int fd = -1;
+	idevice_connection_t connection = client->parent->parent->connection;
+	if (connection->ssl_data || idevice_connection_get_fd(connection, &fd) != IDEVICE_E_SUCCESS) {
+		return -1;
+	}
+	return fd;
+}
+#else
+static void instproxy_status_pump_cancel(instproxy_client_t client)
+{
+}
+#endif
+
 /**
  * Internally used "receive status" thread function that will call the specified
  * callback function when status update messages (or error messages) are
@@ -434,6 +741,7 @@ static void* instproxy_receive_status_loop_thread(void* arg)
 	if (data->command) {
 		plist_free(data->command);
 	}
+	free(data->command_name);
 
 	if (data->client->receive_status_thread) {
 		thread_free(data->client->receive_status_thread);
@@ -471,22 +779,35 @@ static instproxy_error_t instproxy_receive_status_loop_with_callback(instproxy_c
 		return INSTPROXY_E_INVALID_ARG;
 	}
 
-	if (client->receive_status_thread) {
+	if (client->receive_status_thread || client->status_op) {
 		return INSTPROXY_E_OP_IN_PROGRESS;
 	}
 
 	instproxy_error_t res = INSTPROXY_E_UNKNOWN_ERROR;
 	if (async == INSTPROXY_COMMAND_TYPE_ASYNC) {
 		/* async mode */
-		struct instproxy_status_data *data = (struct instproxy_status_data*)malloc(sizeof(struct instproxy_status_data));
+		struct instproxy_status_data *data = (struct instproxy_status_data*)calloc(1, sizeof(struct instproxy_status_data));
 		if (data) {
 			data->client = client;
 			data->command = plist_copy(command);
 			data->cbfunc = status_cb;
 			data->user_data = user_data;
+			instproxy_command_get_name(command, &data->command_name);
 
+#ifndef WIN32
+			/* let the shared status pump wait for the status messages */
+			data->fd = instproxy_get_status_fd(client);
+			if (data->fd >= 0 && instproxy_status_pump_add(data) == 0) {
+				return INSTPROXY_E_SUCCESS;
+			}
+#endif
+			/* otherwise fall back to a dedicated receive thread */
 			if (thread_new(&client->receive_status_thread, instproxy_receive_status_loop_thread, data) == 0) {
 				res = INSTPROXY_E_SUCCESS;
+			} else {
+				plist_free(data->command);
+				free(data->command_name);
+				free(data);
 			}
 		}
 	} else {
@@ -516,7 +837,7 @@ static instproxy_error_t instproxy_perform_command(instproxy_client_t client, pl
 		return INSTPROXY_E_INVALID_ARG;
 	}
 
-	if (client->receive_status_thread) {
+	if (client->receive_status_thread || client->status_op) {
 		return INSTPROXY_E_OP_IN_PROGRESS;
 	}
 
@@ -27,10 +27,13 @@
 #include "property_list_service.h"
 #include <libimobiledevice-glue/thread.h>
 
+struct instproxy_status_data;
+
 struct instproxy_client_private {
 	property_list_service_client_t parent;
 	mutex_t mutex;
 	THREAD_T receive_status_thread;
+	struct instproxy_status_data *status_op;
 };
 
 #endif
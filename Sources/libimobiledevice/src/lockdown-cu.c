@@ -626,26 +626,19 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_cu_pairing_create(lockdownd_cli
         		unsigned char ed_sig[64];
 			ed25519_sign(ed_sig, signbuf, 0x64, ed25519_pubkey, ed25519_privkey);
 
-			tlv_buf_t tlvbuf = tlv_buf_new();
-			tlv_buf_append(tlvbuf, 0x01, pairing_uuid_len, (void*)pairing_uuid);
-			tlv_buf_append(tlvbuf, 0x03, sizeof(ed25519_pubkey), ed25519_pubkey);
-			tlv_buf_append(tlvbuf, 0x0a, sizeof(ed_sig), ed_sig);
-
 			/* ACL */
-			unsigned char* odata = NULL;
-			unsigned int olen = 0;
+			unsigned char* acl_data = NULL;
+			unsigned int acl_len = 0;
 			if (acl) {
-				opack_encode_from_plist(acl, &odata, &olen);
+				opack_encode_from_plist(acl, &acl_data, &acl_len);
 			} else {
 				/* defaut ACL */
 				plist_t acl_plist = plist_new_dict();
 				plist_dict_set_item(acl_plist, "com.apple.ScreenCapture", plist_new_bool(1));	
 				plist_dict_set_item(acl_plist, "com.apple.developer", plist_new_bool(1));
-				opack_encode_from_plist(acl_plist, &odata, &olen);
+				opack_encode_from_plist(acl_plist, &acl_data, &acl_len);
 				plist_free(acl_plist);
 			}
-			tlv_buf_append(tlvbuf, 0x12, olen, odata);
-			free(odata);
 
 			/* HOST INFORMATION */
 			char hostname[256];
@@ -688,10 +681,20 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_cu_pairing_create(lockdownd_cli
 			if (host_info) {
 				plist_dict_merge(&info_plist, host_info);
 			}
-			opack_encode_from_plist(info_plist, &odata, &olen);
+			unsigned char* info_data = NULL;
+			unsigned int info_len = 0;
+			opack_encode_from_plist(info_plist, &info_data, &info_len);
 			plist_free(info_plist);
-			tlv_buf_append(tlvbuf, 0x11, olen, odata);
-			free(odata);
+
+			/* all items are known now, so the TLV is built in a single allocation */
+			tlv_buf_t tlvbuf = tlv_buf_new_with_capacity(tlv_encoded_length(pairing_uuid_len) + tlv_encoded_length(sizeof(ed25519_pubkey)) + tlv_encoded_length(sizeof(ed_sig)) + tlv_encoded_length(acl_len) + tlv_encoded_length(info_len));
+			tlv_buf_append(tlvbuf, 0x01, pairing_uuid_len, (void*)pairing_uuid);
+			tlv_buf_append(tlvbuf, 0x03, sizeof(ed25519_pubkey), ed25519_pubkey);
+			tlv_buf_append(tlvbuf, 0x0a, sizeof(ed_sig), ed_sig);
+			tlv_buf_append(tlvbuf, 0x12, acl_len, acl_data);
+			free(acl_data);
+			tlv_buf_append(tlvbuf, 0x11, info_len, info_data);
+			free(info_data);
 
 			size_t encrypted_len = tlvbuf->length + 16;
 			unsigned char* encrypted_buf = (unsigned char*)malloc(encrypted_len);
@@ -700,6 +703,7 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_cu_pairing_create(lockdownd_cli
 
 			tlv_buf_free(tlvbuf);
 
+			tlv_buf_reserve(tlv, tlv_encoded_length(encrypted_len) + tlv_encoded_length(1));
 			tlv_buf_append(tlv, 0x05, encrypted_len, encrypted_buf);
 			free(encrypted_buf);
 		} else {
@@ -414,16 +414,12 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_query_type(lockdownd_client_t c
 	return ret;
 }
 
-LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_get_value(lockdownd_client_t client, const char *domain, const char *key, plist_t *value)
+/**
+ * Creates the request plist for a GetValue query.
+ */
+static plist_t lockdownd_get_value_request(lockdownd_client_t client, const char *domain, const char *key)
 {
-	if (!client)
-		return LOCKDOWN_E_INVALID_ARG;
-
-	plist_t dict = NULL;
-	lockdownd_error_t ret = LOCKDOWN_E_UNKNOWN_ERROR;
-
-	/* setup request plist */
-	dict = plist_new_dict();
+	plist_t dict = plist_new_dict();
 	plist_dict_add_label(dict, client->label);
 	if (domain) {
 		plist_dict_set_item(dict,"Domain", plist_new_string(domain));
@@ -432,6 +428,19 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_get_value(lockdownd_client_t cl
 		plist_dict_set_item(dict,"Key", plist_new_string(key));
 	}
 	plist_dict_set_item(dict,"Request", plist_new_string("GetValue"));
+	return dict;
+}
+
+LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_get_value(lockdownd_client_t client, const char *domain, const char *key, plist_t *value)
+{
+	if (!client)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	plist_t dict = NULL;
+	lockdownd_error_t ret = LOCKDOWN_E_UNKNOWN_ERROR;
+
+	/* setup request plist */
+	dict = lockdownd_get_value_request(client, domain, key);
 
 	/* send to device */
 	ret = lockdownd_send(client, dict);
@@ -468,6 +477,93 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_get_value(lockdownd_client_t cl
 	return ret;
 }
 
+LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_get_values(lockdownd_client_t client, const lockdownd_value_query_t *queries, uint32_t count, plist_t *values, lockdownd_error_t *errors)
+{
+	if (!client || (count > 0 && (!queries || !values)))
+		return LOCKDOWN_E_INVALID_ARG;
+
+	lockdownd_error_t ret = LOCKDOWN_E_SUCCESS;
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		values[i] = NULL;
+		if (errors) {
+			errors[i] = LOCKDOWN_E_UNKNOWN_ERROR;
+		}
+	}
+
+	while (received < count) {
+		/* keep a window of requests in flight */
+		while (sent < count && sent - received < LOCKDOWN_GET_VALUES_WINDOW) {
+			plist_t dict = lockdownd_get_value_request(client, queries[sent].domain, queries[sent].key);
+			ret = lockdownd_send(client, dict);
+			plist_free(dict);
+			if (ret != LOCKDOWN_E_SUCCESS) {
+				return ret;
+			}
+			sent++;
+		}
+
+		plist_t dict = NULL;
+		ret = lockdownd_receive(client, &dict);
+		if (ret != LOCKDOWN_E_SUCCESS) {
+			return ret;
+		}
+
+		lockdownd_error_t res = lockdown_check_result(dict, "GetValue");
+		if (res == LOCKDOWN_E_SUCCESS) {
+			plist_t value_node = plist_dict_get_item(dict, "Value");
+			if (value_node) {
+				values[received] = plist_copy(value_node);
+			}
+		} else {
+			debug_info("GetValue %s/%s failed: %d", (queries[received].domain) ? queries[received].domain : "", (queries[received].key) ? queries[received].key : "", res);
+		}
+		if (errors) {
+			errors[received] = res;
+		}
+		plist_free(dict);
+		received++;
+	}
+
+	return ret;
+}
+
+LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_get_domain_values(lockdownd_client_t client, const char *domain, const char * const *keys, uint32_t count, plist_t *values)
+{
+	if (!client || !values)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	plist_t all = NULL;
+	lockdownd_error_t ret = lockdownd_get_value(client, domain, NULL, &all);
+	if (ret != LOCKDOWN_E_SUCCESS) {
+		return ret;
+	}
+	if (!all || plist_get_node_type(all) != PLIST_DICT) {
+		plist_free(all);
+		return LOCKDOWN_E_PLIST_ERROR;
+	}
+
+	if (!keys) {
+		*values = all;
+		return ret;
+	}
+
+	uint32_t i;
+	*values = plist_new_dict();
+	for (i = 0; i < count; i++) {
+		plist_t node = plist_dict_get_item(all, keys[i]);
+		if (node) {
+			plist_dict_set_item(*values, keys[i], plist_copy(node));
+		}
+	}
+	plist_free(all);
+
+	return ret;
+}
+
 LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_set_value(lockdownd_client_t client, const char *domain, const char *key, plist_t value)
 {
 	if (!client || !value)
@@ -28,6 +28,10 @@
 
 #define LOCKDOWN_PROTOCOL_VERSION "2"
 
+/* number of GetValue requests that lockdownd_get_values() sends ahead of
+ * the replies, bounded so that neither side blocks on a full socket */
+#define LOCKDOWN_GET_VALUES_WINDOW 16
+
 struct lockdownd_client_private {
 	property_list_service_client_t parent;
 	int ssl_enabled;
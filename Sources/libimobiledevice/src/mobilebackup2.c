@@ -23,18 +23,53 @@
 #include <config.h>
 #endif
 #include <plist/plist.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef WIN32
+#include <io.h>
+#include <direct.h>
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/uio.h>
+#endif
+#if defined(HAVE_OPENSSL)
+#include <openssl/evp.h>
+#elif defined(HAVE_GNUTLS)
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#elif defined(HAVE_MBEDTLS)
+#include <mbedtls/sha256.h>
+#endif
+
+#include <libimobiledevice-glue/thread.h>
+#include <libimobiledevice-glue/utils.h>
 
 #include "mobilebackup2.h"
 #include "device_link_service.h"
 #include "common/debug.h"
+#include "endianness.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 #define MBACKUP2_VERSION_INT1 400
 #define MBACKUP2_VERSION_INT2 0
 
 #define IS_FLAG_SET(x, y) ((x & y) == y)
 
+/* the content store relies on hardlinks that can atomically replace files */
+#if !defined(WIN32) && (defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS) || defined(HAVE_MBEDTLS))
+#define HAVE_CONTENT_STORE
+#endif
+
 /**
  * Convert an device_link_service_error_t value to an mobilebackup2_error_t value.
  * Used internally to get correct error codes from the underlying
@@ -82,6 +117,7 @@ LIBIMOBILEDEVICE_API mobilebackup2_error_t mobilebackup2_client_new(idevice_t de
 
 	mobilebackup2_client_t client_loc = (mobilebackup2_client_t) malloc(sizeof(struct mobilebackup2_client_private));
 	client_loc->parent = dlclient;
+	client_loc->content_store = NULL;
 
 	/* perform handshake */
 	ret = mobilebackup2_error(device_link_service_version_exchange(dlclient, MBACKUP2_VERSION_INT1, MBACKUP2_VERSION_INT2));
@@ -112,6 +148,7 @@ LIBIMOBILEDEVICE_API mobilebackup2_error_t mobilebackup2_client_free(mobilebacku
 		device_link_service_disconnect(client->parent, NULL);
 		err = mobilebackup2_error(device_link_service_client_free(client->parent));
 	}
+	free(client->content_store);
 	free(client);
 	return err;
 }
@@ -385,3 +422,1107 @@ LIBIMOBILEDEVICE_API mobilebackup2_error_t mobilebackup2_send_status_response(mo
 
 	return err;
 }
+
+LIBIMOBILEDEVICE_API mobilebackup2_error_t mobilebackup2_set_content_store(mobilebackup2_client_t client, const char *store_dir)
+{
+	if (!client)
+		return MOBILEBACKUP2_E_INVALID_ARG;
+#ifdef HAVE_CONTENT_STORE
+	free(client->content_store);
+	client->content_store = (store_dir) ? strdup(store_dir) : NULL;
+	return MOBILEBACKUP2_E_SUCCESS;
+#else
+	return (store_dir) ? MOBILEBACKUP2_E_UNKNOWN_ERROR : MOBILEBACKUP2_E_SUCCESS;
+#endif
+}
+
+LIBIMOBILEDEVICE_API mobilebackup2_error_t mobilebackup2_content_store_prune(const char *store_dir, uint32_t *removed_files, uint64_t *removed_bytes)
+{
+	if (!store_dir)
+		return MOBILEBACKUP2_E_INVALID_ARG;
+#ifdef HAVE_CONTENT_STORE
+	uint32_t files = 0;
+	uint64_t bytes = 0;
+	DIR *dir = opendir(store_dir);
+	if (!dir) {
+		return MOBILEBACKUP2_E_INVALID_ARG;
+	}
+	struct dirent *ep;
+	while ((ep = readdir(dir))) {
+		if (strlen(ep->d_name) != 2 || !isxdigit((unsigned char)ep->d_name[0]) || !isxdigit((unsigned char)ep->d_name[1])) {
+			continue;
+		}
+		char *subdir = string_build_path(store_dir, ep->d_name, NULL);
+		DIR *sub = opendir(subdir);
+		if (sub) {
+			struct dirent *fp;
+			while ((fp = readdir(sub))) {
+				struct stat st;
+				if (fp->d_name[0] == '.') {
+					continue;
+				}
+				char *fpath = string_build_path(subdir, fp->d_name, NULL);
+				/* the link from the store is the last one, no backup uses it anymore */
+				if (stat(fpath, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink == 1 && remove(fpath) == 0) {
+					files++;
+					bytes += st.st_size;
+				}
+				free(fpath);
+			}
+			closedir(sub);
+			rmdir(subdir);
+		}
+		free(subdir);
+	}
+	closedir(dir);
+	if (removed_files) {
+		*removed_files = files;
+	}
+	if (removed_bytes) {
+		*removed_bytes = bytes;
+	}
+	return MOBILEBACKUP2_E_SUCCESS;
+#else
+	return MOBILEBACKUP2_E_UNKNOWN_ERROR;
+#endif
+}
+
+#define CODE_SUCCESS 0x00
+#define CODE_ERROR_LOCAL 0x06
+#define CODE_ERROR_REMOTE 0x0b
+#define CODE_FILE_DATA 0x0c
+
+enum mb2_write_op_type {
+	MB2_WRITE_OPEN,
+	MB2_WRITE_DATA,
+	MB2_WRITE_CLOSE,
+	MB2_WRITE_ABORT,
+	MB2_WRITE_QUIT
+};
+
+struct mb2_write_op {
+	enum mb2_write_op_type type;
+	char *path;       /* MB2_WRITE_OPEN: the file to create, owned by the op */
+	int dedupe;       /* MB2_WRITE_OPEN: share the file with the content store */
+	int buffer;       /* MB2_WRITE_DATA: index of the buffer holding the data */
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct mb2_receive_context {
+	mutex_t lock;
+	cond_t op_cond;     /* signalled when an operation is queued */
+	cond_t space_cond;  /* signalled when an operation or a buffer is released */
+	struct mb2_write_op ops[MB2_RECEIVE_QUEUE_SIZE];
+	uint32_t op_head;   /* next slot to queue into */
+	uint32_t op_tail;   /* next slot for the writer */
+	char *buffers[MB2_RECEIVE_BUFFER_COUNT];
+	uint32_t refs[MB2_RECEIVE_BUFFER_COUNT];
+	uint32_t flags;
+	const char *content_store;
+
+	/* written by the writer thread, read under the lock */
+	uint64_t bytes;
+	uint32_t files;
+	uint32_t deduplicated;
+	uint64_t deduplicated_bytes;
+	int error;
+	char *error_path;
+};
+
+static double mb2_get_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static void mb2_make_parent_dirs(const char *path)
+{
+	char *dir = strdup(path);
+	char *p = dir;
+	while ((p = strchr(p + 1, '/')) != NULL) {
+		*p = '\0';
+#ifdef WIN32
+		mkdir(dir);
+#else
+		mkdir(dir, 0755);
+#endif
+		*p = '/';
+	}
+	free(dir);
+}
+
+static void mb2_set_error(struct mb2_receive_context *ctx, int error, const char *path)
+{
+	mutex_lock(&ctx->lock);
+	if (!ctx->error) {
+		ctx->error = error;
+		ctx->error_path = strdup(path);
+	}
+	mutex_unlock(&ctx->lock);
+}
+
+#ifdef HAVE_CONTENT_STORE
+struct mb2_hash {
+#if defined(HAVE_OPENSSL)
+	EVP_MD_CTX *ctx;
+#elif defined(HAVE_GNUTLS)
+	gnutls_hash_hd_t ctx;
+#elif defined(HAVE_MBEDTLS)
+	mbedtls_sha256_context ctx;
+#endif
+	int active;
+};
+
+static void mb2_hash_start(struct mb2_hash *hash)
+{
+#if defined(HAVE_OPENSSL)
+	hash->ctx = EVP_MD_CTX_new();
+	EVP_DigestInit_ex(hash->ctx, EVP_sha256(), NULL);
+#elif defined(HAVE_GNUTLS)
+	gnutls_hash_init(&hash->ctx, GNUTLS_DIG_SHA256);
+#elif defined(HAVE_MBEDTLS)
+	mbedtls_sha256_init(&hash->ctx);
+	mbedtls_sha256_starts(&hash->ctx, 0);
+#endif
+	hash->active = 1;
+}
+
+static void mb2_hash_update(struct mb2_hash *hash, const char *data, uint32_t length)
+{
+#if defined(HAVE_OPENSSL)
+	EVP_DigestUpdate(hash->ctx, data, length);
+#elif defined(HAVE_GNUTLS)
+	gnutls_hash(hash->ctx, data, length);
+#elif defined(HAVE_MBEDTLS)
+	mbedtls_sha256_update(&hash->ctx, (const unsigned char*)data, length);
+#endif
+}
+
+/* finishes the hash if digest is given, and releases it */
+static void mb2_hash_finish(struct mb2_hash *hash, unsigned char *digest)
+{
+	unsigned char discard[32];
+	if (!hash->active) {
+		return;
+	}
+#if defined(HAVE_OPENSSL)
+	EVP_DigestFinal_ex(hash->ctx, (digest) ? digest : discard, NULL);
+	EVP_MD_CTX_free(hash->ctx);
+#elif defined(HAVE_GNUTLS)
+	gnutls_hash_deinit(hash->ctx, (digest) ? digest : discard);
+#elif defined(HAVE_MBEDTLS)
+	if (digest) {
+		mbedtls_sha256_finish(&hash->ctx, digest);
+	}
+	mbedtls_sha256_free(&hash->ctx);
+#endif
+	(void)discard;
+	hash->active = 0;
+}
+
+/* only the data files in the hashed subfolders of a backup are shared, as
+ * the files at the top of a backup are rewritten in place */
+static int mb2_is_content_file(const char *fname)
+{
+	const char *name = strrchr(fname, '/');
+	const char *parent = name;
+	if (!name || name == fname) {
+		return 0;
+	}
+	while (parent > fname && *(parent - 1) != '/') {
+		parent--;
+	}
+	return (name - parent == 2 && isxdigit((unsigned char)parent[0]) && isxdigit((unsigned char)parent[1]));
+}
+
+/* replaces the file at path with a hardlink to identical content from the
+ * store, or adds it to the store; returns 1 if the file was replaced */
+static int mb2_content_store_add(const char *store, const char *path, const unsigned char *digest)
+{
+	char hex[65];
+	char sub[3];
+	int i;
+	int res = 0;
+
+	for (i = 0; i < 32; i++) {
+		sprintf(hex + i*2, "%02x", digest[i]);
+	}
+	sub[0] = hex[0];
+	sub[1] = hex[1];
+	sub[2] = '\0';
+	char *store_path = string_build_path(store, sub, hex, NULL);
+	char *tmp = string_concat(path, ".dedup", NULL);
+
+	remove(tmp);
+	for (i = 0; i < 2; i++) {
+		if (link(store_path, tmp) == 0) {
+			if (rename(tmp, path) == 0) {
+				res = 1;
+			} else {
+				remove(tmp);
+			}
+			break;
+		}
+		if (errno != ENOENT) {
+			break;
+		}
+		/* new content, the received file becomes the stored copy */
+		if (link(path, store_path) == 0) {
+			break;
+		}
+		if (errno == ENOENT) {
+			mb2_make_parent_dirs(store_path);
+			if (link(path, store_path) == 0) {
+				break;
+			}
+		}
+		if (errno != EEXIST) {
+			debug_info("could not add '%s' to the content store: %s", path, strerror(errno));
+			break;
+		}
+		/* another backup stored the same content in the meantime */
+	}
+
+	free(tmp);
+	free(store_path);
+	return res;
+}
+#endif
+
+static int mb2_write_all(int fd, struct mb2_receive_context *ctx, struct mb2_write_op *ops, int count)
+{
+#ifdef WIN32
+	int i;
+	for (i = 0; i < count; i++) {
+		const char *data = ctx->buffers[ops[i].buffer] + ops[i].offset;
+		uint32_t done = 0;
+		while (done < ops[i].length) {
+			int res = write(fd, data + done, ops[i].length - done);
+			if (res < 0) {
+				if (errno == EINTR)
+					continue;
+				return -1;
+			}
+			done += res;
+		}
+	}
+	return 0;
+#else
+	struct iovec iov[MB2_RECEIVE_IOV_MAX];
+	int first = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = ctx->buffers[ops[i].buffer] + ops[i].offset;
+		iov[i].iov_len = ops[i].length;
+	}
+	while (first < count) {
+		ssize_t res = writev(fd, iov + first, count - first);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		/* skip over what was written, which may end in the middle of a buffer */
+		while (first < count && (size_t)res >= iov[first].iov_len) {
+			res -= iov[first].iov_len;
+			first++;
+		}
+		if (first < count) {
+			iov[first].iov_base = (char*)iov[first].iov_base + res;
+			iov[first].iov_len -= res;
+		}
+	}
+	return 0;
+#endif
+}
+
+static void* mb2_writer_thread(void *arg)
+{
+	struct mb2_receive_context *ctx = (struct mb2_receive_context*)arg;
+	struct mb2_write_op batch[MB2_RECEIVE_IOV_MAX];
+	char *path = NULL;
+	int fd = -1;
+	int done = 0;
+#ifdef HAVE_CONTENT_STORE
+	struct mb2_hash hash;
+	uint64_t file_bytes = 0;
+	hash.active = 0;
+#endif
+
+	while (!done) {
+		int count = 0;
+		mutex_lock(&ctx->lock);
+		while (ctx->op_head == ctx->op_tail) {
+			cond_wait(&ctx->op_cond, &ctx->lock);
+		}
+		/* take a single control operation, or a run of consecutive writes */
+		do {
+			batch[count++] = ctx->ops[ctx->op_tail % MB2_RECEIVE_QUEUE_SIZE];
+			ctx->op_tail++;
+		} while (batch[0].type == MB2_WRITE_DATA && count < MB2_RECEIVE_IOV_MAX && ctx->op_head != ctx->op_tail
+				 && ctx->ops[ctx->op_tail % MB2_RECEIVE_QUEUE_SIZE].type == MB2_WRITE_DATA);
+		cond_signal(&ctx->space_cond);
+		mutex_unlock(&ctx->lock);
+
+		switch (batch[0].type) {
+		case MB2_WRITE_OPEN:
+			free(path);
+			path = batch[0].path;
+			/* replace rather than overwrite, in case the old file is still referenced elsewhere */
+			remove(path);
+			fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+			if (fd < 0 && errno == ENOENT) {
+				mb2_make_parent_dirs(path);
+				fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+			}
+			if (fd < 0) {
+				mb2_set_error(ctx, errno, path);
+			}
+#ifdef HAVE_CONTENT_STORE
+			mb2_hash_finish(&hash, NULL);
+			file_bytes = 0;
+			if (fd >= 0 && batch[0].dedupe) {
+				mb2_hash_start(&hash);
+			}
+#endif
+			break;
+		case MB2_WRITE_DATA: {
+			int i;
+			uint64_t length = 0;
+			if (fd >= 0) {
+				if (mb2_write_all(fd, ctx, batch, count) < 0) {
+					mb2_set_error(ctx, errno, path);
+					close(fd);
+					fd = -1;
+				}
+			}
+			for (i = 0; i < count; i++) {
+				length += batch[i].length;
+#ifdef HAVE_CONTENT_STORE
+				if (fd >= 0 && hash.active) {
+					mb2_hash_update(&hash, ctx->buffers[batch[i].buffer] + batch[i].offset, batch[i].length);
+				}
+#endif
+			}
+#ifdef HAVE_CONTENT_STORE
+			file_bytes += length;
+#endif
+			mutex_lock(&ctx->lock);
+			for (i = 0; i < count; i++) {
+				ctx->refs[batch[i].buffer]--;
+			}
+			if (fd >= 0) {
+				ctx->bytes += length;
+			}
+			cond_signal(&ctx->space_cond);
+			mutex_unlock(&ctx->lock);
+			} break;
+		case MB2_WRITE_CLOSE:
+			if (fd >= 0) {
+#ifndef WIN32
+				if ((ctx->flags & MOBILEBACKUP2_RECEIVE_FSYNC) && fsync(fd) < 0) {
+					mb2_set_error(ctx, errno, path);
+				}
+#endif
+				if (close(fd) < 0) {
+					mb2_set_error(ctx, errno, path);
+				} else {
+					int deduplicated = 0;
+#ifdef HAVE_CONTENT_STORE
+					if (hash.active && file_bytes >= MB2_CONTENT_STORE_MIN_SIZE) {
+						unsigned char digest[32];
+						mb2_hash_finish(&hash, digest);
+						deduplicated = mb2_content_store_add(ctx->content_store, path, digest);
+					}
+#endif
+					mutex_lock(&ctx->lock);
+					ctx->files++;
+					if (deduplicated) {
+						ctx->deduplicated++;
+#ifdef HAVE_CONTENT_STORE
+						ctx->deduplicated_bytes += file_bytes;
+#endif
+					}
+					mutex_unlock(&ctx->lock);
+				}
+				fd = -1;
+			}
+#ifdef HAVE_CONTENT_STORE
+			mb2_hash_finish(&hash, NULL);
+#endif
+			break;
+		case MB2_WRITE_ABORT:
+			if (fd >= 0) {
+				close(fd);
+				fd = -1;
+			}
+#ifdef HAVE_CONTENT_STORE
+			mb2_hash_finish(&hash, NULL);
+#endif
+			if (path) {
+				remove(path);
+			}
+			break;
+		case MB2_WRITE_QUIT:
+			done = 1;
+			break;
+		}
+	}
+
+	if (fd >= 0) {
+		close(fd);
+	}
+#ifdef HAVE_CONTENT_STORE
+	mb2_hash_finish(&hash, NULL);
+#endif
+	free(path);
+	return NULL;
+}
+
+static void mb2_queue_op(struct mb2_receive_context *ctx, struct mb2_write_op *op)
+{
+	mutex_lock(&ctx->lock);
+	while (ctx->op_head - ctx->op_tail >= MB2_RECEIVE_QUEUE_SIZE) {
+		cond_wait(&ctx->space_cond, &ctx->lock);
+	}
+	ctx->ops[ctx->op_head % MB2_RECEIVE_QUEUE_SIZE] = *op;
+	ctx->op_head++;
+	if (op->type == MB2_WRITE_DATA) {
+		ctx->refs[op->buffer]++;
+	}
+	cond_signal(&ctx->op_cond);
+	mutex_unlock(&ctx->lock);
+}
+
+static int mb2_acquire_buffer(struct mb2_receive_context *ctx, int previous)
+{
+	int buffer = -1;
+	mutex_lock(&ctx->lock);
+	if (previous >= 0) {
+		ctx->refs[previous]--;
+	}
+	while (buffer < 0) {
+		int i;
+		for (i = 0; i < MB2_RECEIVE_BUFFER_COUNT; i++) {
+			if (ctx->refs[i] == 0) {
+				buffer = i;
+				break;
+			}
+		}
+		if (buffer < 0) {
+			cond_wait(&ctx->space_cond, &ctx->lock);
+		}
+	}
+	ctx->refs[buffer] = 1; /* held by the receiver until it is full */
+	mutex_unlock(&ctx->lock);
+	return buffer;
+}
+
+static mobilebackup2_error_t mb2_receive_exact(mobilebackup2_client_t client, char *data, uint32_t length)
+{
+	uint32_t done = 0;
+	while (done < length) {
+		uint32_t received = 0;
+		mobilebackup2_error_t err = mobilebackup2_receive_raw(client, data + done, length - done, &received);
+		if (err != MOBILEBACKUP2_E_SUCCESS) {
+			return err;
+		}
+		if (received == 0) {
+			return MOBILEBACKUP2_E_MUX_ERROR;
+		}
+		done += received;
+	}
+	return MOBILEBACKUP2_E_SUCCESS;
+}
+
+/* receives a length-prefixed file name, which is set to NULL at the end of
+ * the list; returns MOBILEBACKUP2_E_RECEIVE_TIMEOUT if the device needs more
+ * time to prepare the next file */
+static mobilebackup2_error_t mb2_receive_filename(mobilebackup2_client_t client, char **filename)
+{
+	uint32_t nlen = 0;
+	uint32_t received = 0;
+	mobilebackup2_error_t err;
+
+	free(*filename);
+	*filename = NULL;
+
+	err = mobilebackup2_receive_raw(client, (char*)&nlen, 4, &received);
+	if (err != MOBILEBACKUP2_E_SUCCESS) {
+		return err;
+	}
+	if (received == 0) {
+		return MOBILEBACKUP2_E_RECEIVE_TIMEOUT;
+	}
+	if (received != 4) {
+		return MOBILEBACKUP2_E_MUX_ERROR;
+	}
+	nlen = be32toh(nlen);
+	if (nlen == 0) {
+		return MOBILEBACKUP2_E_SUCCESS;
+	}
+	if (nlen > 4096) {
+		debug_info("too large filename length (%u)", nlen);
+		return MOBILEBACKUP2_E_MUX_ERROR;
+	}
+
+	*filename = (char*)malloc(nlen + 1);
+	err = mb2_receive_exact(client, *filename, nlen);
+	if (err != MOBILEBACKUP2_E_SUCCESS) {
+		free(*filename);
+		*filename = NULL;
+		return err;
+	}
+	(*filename)[nlen] = '\0';
+	return MOBILEBACKUP2_E_SUCCESS;
+}
+
+/* receives the length and code that precede each hunk; a length of 0 ends the transfer */
+static mobilebackup2_error_t mb2_receive_hunk_header(mobilebackup2_client_t client, uint32_t *nlen, char *code)
+{
+	mobilebackup2_error_t err = mb2_receive_exact(client, (char*)nlen, 4);
+	if (err != MOBILEBACKUP2_E_SUCCESS) {
+		return err;
+	}
+	*nlen = be32toh(*nlen);
+	if (*nlen == 0) {
+		return MOBILEBACKUP2_E_SUCCESS;
+	}
+	return mb2_receive_exact(client, code, 1);
+}
+
+LIBIMOBILEDEVICE_API mobilebackup2_error_t mobilebackup2_receive_files(mobilebackup2_client_t client, const char *backup_dir, uint32_t flags, mobilebackup2_receive_cb_t status_cb, void *user_data, mobilebackup2_receive_stats_t *stats)
+{
+	if (!client || !client->parent || !backup_dir)
+		return MOBILEBACKUP2_E_INVALID_ARG;
+
+	struct mb2_receive_context *ctx = (struct mb2_receive_context*)calloc(1, sizeof(struct mb2_receive_context));
+	if (!ctx)
+		return MOBILEBACKUP2_E_UNKNOWN_ERROR;
+
+	int i;
+	for (i = 0; i < MB2_RECEIVE_BUFFER_COUNT; i++) {
+		ctx->buffers[i] = (char*)malloc(MB2_RECEIVE_BUFFER_SIZE);
+		if (!ctx->buffers[i]) {
+			while (i-- > 0) {
+				free(ctx->buffers[i]);
+			}
+			free(ctx);
+			return MOBILEBACKUP2_E_UNKNOWN_ERROR;
+		}
+	}
+	ctx->flags = flags;
+	ctx->content_store = client->content_store;
+	mutex_init(&ctx->lock);
+	cond_init(&ctx->op_cond);
+	cond_init(&ctx->space_cond);
+
+	double start_time = mb2_get_time();
+
+	THREAD_T writer = THREAD_T_NULL;
+	if (thread_new(&writer, mb2_writer_thread, ctx) != 0) {
+		cond_destroy(&ctx->space_cond);
+		cond_destroy(&ctx->op_cond);
+		mutex_destroy(&ctx->lock);
+		for (i = 0; i < MB2_RECEIVE_BUFFER_COUNT; i++) {
+			free(ctx->buffers[i]);
+		}
+		free(ctx);
+		return MOBILEBACKUP2_E_UNKNOWN_ERROR;
+	}
+
+	mobilebackup2_error_t err = MOBILEBACKUP2_E_SUCCESS;
+	struct mb2_write_op op;
+	char *dname = NULL;
+	char *fname = NULL;
+	uint64_t bytes_received = 0;
+	uint32_t files_received = 0;
+	int buffer = mb2_acquire_buffer(ctx, -1);
+	uint32_t buffer_pos = 0;
+	int stop = 0;
+
+	while (!stop) {
+		uint32_t nlen = 0;
+		char code = 0;
+		int had_data = 0;
+
+		/* the device path, which is not needed, followed by the local path */
+		while ((err = mb2_receive_filename(client, &dname)) == MOBILEBACKUP2_E_RECEIVE_TIMEOUT) {
+			if (status_cb && status_cb(bytes_received, files_received, NULL, user_data)) {
+				stop = 1;
+				break;
+			}
+		}
+		if (stop || err != MOBILEBACKUP2_E_SUCCESS || !dname) {
+			break;
+		}
+		while ((err = mb2_receive_filename(client, &fname)) == MOBILEBACKUP2_E_RECEIVE_TIMEOUT) {
+			if (status_cb && status_cb(bytes_received, files_received, NULL, user_data)) {
+				stop = 1;
+				break;
+			}
+		}
+		if (stop || err != MOBILEBACKUP2_E_SUCCESS || !fname) {
+			break;
+		}
+
+		err = mb2_receive_hunk_header(client, &nlen, &code);
+		if (err != MOBILEBACKUP2_E_SUCCESS) {
+			break;
+		}
+
+		memset(&op, 0, sizeof(op));
+		op.type = MB2_WRITE_OPEN;
+		op.path = string_build_path(backup_dir, fname, NULL);
+#ifdef HAVE_CONTENT_STORE
+		op.dedupe = (ctx->content_store && mb2_is_content_file(fname));
+#endif
+		mb2_queue_op(ctx, &op);
+
+		while (nlen > 0 && code == CODE_FILE_DATA) {
+			uint32_t remaining = nlen - 1;
+			while (remaining > 0) {
+				if (buffer_pos == MB2_RECEIVE_BUFFER_SIZE) {
+					buffer = mb2_acquire_buffer(ctx, buffer);
+					buffer_pos = 0;
+				}
+				uint32_t length = MB2_RECEIVE_BUFFER_SIZE - buffer_pos;
+				if (length > remaining) {
+					length = remaining;
+				}
+				err = mb2_receive_exact(client, ctx->buffers[buffer] + buffer_pos, length);
+				if (err != MOBILEBACKUP2_E_SUCCESS) {
+					break;
+				}
+				memset(&op, 0, sizeof(op));
+				op.type = MB2_WRITE_DATA;
+				op.buffer = buffer;
+				op.offset = buffer_pos;
+				op.length = length;
+				mb2_queue_op(ctx, &op);
+				buffer_pos += length;
+				remaining -= length;
+				bytes_received += length;
+			}
+			if (err != MOBILEBACKUP2_E_SUCCESS) {
+				break;
+			}
+			had_data = 1;
+			if (status_cb && status_cb(bytes_received, files_received, NULL, user_data)) {
+				stop = 1;
+				break;
+			}
+			err = mb2_receive_hunk_header(client, &nlen, &code);
+			if (err != MOBILEBACKUP2_E_SUCCESS) {
+				break;
+			}
+		}
+
+		if (err != MOBILEBACKUP2_E_SUCCESS || stop) {
+			/* remove the partially received file */
+			memset(&op, 0, sizeof(op));
+			op.type = MB2_WRITE_ABORT;
+			mb2_queue_op(ctx, &op);
+			break;
+		}
+
+		memset(&op, 0, sizeof(op));
+		op.type = MB2_WRITE_CLOSE;
+		mb2_queue_op(ctx, &op);
+		files_received++;
+
+		if (nlen == 0) {
+			break;
+		}
+
+		if (nlen > 1) {
+			/* an error message from the device, which also terminates files that were sent as data */
+			char *msg = (char*)malloc(nlen);
+			err = mb2_receive_exact(client, msg, nlen - 1);
+			if (err != MOBILEBACKUP2_E_SUCCESS) {
+				free(msg);
+				break;
+			}
+			msg[nlen - 1] = '\0';
+			if (code == CODE_ERROR_REMOTE && !had_data && status_cb && status_cb(bytes_received, files_received, msg, user_data)) {
+				stop = 1;
+			}
+			free(msg);
+		}
+
+		/* stop at the first file that could not be written, like a synchronous receive would */
+		mutex_lock(&ctx->lock);
+		if (ctx->error) {
+			stop = 1;
+		}
+		mutex_unlock(&ctx->lock);
+	}
+
+	free(dname);
+	free(fname);
+
+	memset(&op, 0, sizeof(op));
+	op.type = MB2_WRITE_QUIT;
+	mb2_queue_op(ctx, &op);
+	thread_join(writer);
+	thread_free(writer);
+
+	if (stats) {
+		stats->bytes = ctx->bytes;
+		stats->files = ctx->files;
+		stats->elapsed_usec = (uint64_t)(mb2_get_time() - start_time);
+		stats->deduplicated = ctx->deduplicated;
+		stats->deduplicated_bytes = ctx->deduplicated_bytes;
+		stats->error = ctx->error;
+		stats->error_path = ctx->error_path;
+	} else {
+		free(ctx->error_path);
+	}
+
+	cond_destroy(&ctx->space_cond);
+	cond_destroy(&ctx->op_cond);
+	mutex_destroy(&ctx->lock);
+	for (i = 0; i < MB2_RECEIVE_BUFFER_COUNT; i++) {
+		free(ctx->buffers[i]);
+	}
+	free(ctx);
+
+	return (err == MOBILEBACKUP2_E_SUCCESS || stop) ? MOBILEBACKUP2_E_SUCCESS : MOBILEBACKUP2_E_MUX_ERROR;
+}
+
+struct mb2_sent_file {
+	char *path;
+	uint64_t size;
+	int error;
+};
+
+struct mb2_send_buffer {
+	char *data;
+	uint32_t length;
+	uint64_t file_bytes;           /* file data contained in this buffer */
+	struct mb2_sent_file *files;   /* files whose last hunk is in this buffer */
+	uint32_t num_files;
+	uint32_t files_capacity;
+};
+
+struct mb2_send_context {
+	mutex_t lock;
+	cond_t filled_cond;  /* signalled when the reader publishes a buffer */
+	cond_t free_cond;    /* signalled when the sender releases a buffer */
+	struct mb2_send_buffer buffers[MB2_SEND_BUFFER_COUNT];
+	uint32_t filled;     /* buffers published by the reader */
+	uint32_t sent;       /* buffers released by the sender */
+	int done;            /* the reader has published its last buffer */
+	int stop;            /* stop after the current file */
+	int failed;          /* sending failed, the rest of the stream is discarded */
+	const char *backup_dir;
+	plist_t files;
+};
+
+/* hands the current buffer to the sender and waits for the next one to become free */
+static struct mb2_send_buffer* mb2_send_publish(struct mb2_send_context *ctx, int last)
+{
+	struct mb2_send_buffer *buf = NULL;
+	mutex_lock(&ctx->lock);
+	ctx->filled++;
+	if (last) {
+		ctx->done = 1;
+	}
+	cond_signal(&ctx->filled_cond);
+	if (!last) {
+		while (ctx->filled - ctx->sent >= MB2_SEND_BUFFER_COUNT) {
+			cond_wait(&ctx->free_cond, &ctx->lock);
+		}
+		buf = &ctx->buffers[ctx->filled % MB2_SEND_BUFFER_COUNT];
+	}
+	mutex_unlock(&ctx->lock);
+	return buf;
+}
+
+/* makes sure that at least length bytes are available in the current buffer */
+static struct mb2_send_buffer* mb2_send_reserve(struct mb2_send_context *ctx, struct mb2_send_buffer *buf, uint32_t length)
+{
+	if (MB2_SEND_BUFFER_SIZE - buf->length < length) {
+		buf = mb2_send_publish(ctx, 0);
+	}
+	return buf;
+}
+
+static void mb2_send_put_hunk_header(struct mb2_send_buffer *buf, uint32_t length, char code)
+{
+	uint32_t nlen = htobe32(length + 1);
+	memcpy(buf->data + buf->length, &nlen, 4);
+	buf->data[buf->length + 4] = code;
+	buf->length += 5;
+}
+
+/* records a file whose status hunk is in the buffer; returns -1 if out of memory */
+static int mb2_send_add_file(struct mb2_send_buffer *buf, const char *path, uint64_t size, int error)
+{
+	if (buf->num_files == buf->files_capacity) {
+		uint32_t capacity = (buf->files_capacity) ? buf->files_capacity * 2 : 64;
+		struct mb2_sent_file *files = (struct mb2_sent_file*)realloc(buf->files, capacity * sizeof(struct mb2_sent_file));
+		if (!files) {
+			return -1;
+		}
+		buf->files = files;
+		buf->files_capacity = capacity;
+	}
+	char *path_copy = strdup(path);
+	if (!path_copy) {
+		return -1;
+	}
+	buf->files[buf->num_files].path = path_copy;
+	buf->files[buf->num_files].size = size;
+	buf->files[buf->num_files].error = error;
+	buf->num_files++;
+	return 0;
+}
+
+static int mb2_send_should_stop(struct mb2_send_context *ctx, int abort_only)
+{
+	int res;
+	mutex_lock(&ctx->lock);
+	res = (abort_only) ? ctx->failed : (ctx->stop || ctx->failed);
+	mutex_unlock(&ctx->lock);
+	return res;
+}
+
+/* serializes the requested files into the wire format, reading ahead of the sender */
+static void* mb2_reader_thread(void *arg)
+{
+	struct mb2_send_context *ctx = (struct mb2_send_context*)arg;
+	struct mb2_send_buffer *buf = &ctx->buffers[0];
+	uint32_t cnt = plist_array_get_size(ctx->files);
+	uint32_t i;
+
+	for (i = 0; i < cnt && !mb2_send_should_stop(ctx, 0); i++) {
+		plist_t node = plist_array_get_item(ctx->files, i);
+		if (plist_get_node_type(node) != PLIST_STRING) {
+			continue;
+		}
+		const char *path = plist_get_string_ptr(node, NULL);
+		uint32_t pathlen = strlen(path);
+		if (pathlen + 4 > MB2_SEND_BUFFER_SIZE) {
+			continue;
+		}
+
+		/* file name */
+		buf = mb2_send_reserve(ctx, buf, 4 + pathlen);
+		uint32_t nlen = htobe32(pathlen);
+		memcpy(buf->data + buf->length, &nlen, 4);
+		memcpy(buf->data + buf->length + 4, path, pathlen);
+		buf->length += 4 + pathlen;
+
+		/* file contents */
+		char *localfile = string_build_path(ctx->backup_dir, path, NULL);
+		int error = 0;
+		uint64_t total = 0;
+#ifdef WIN32
+		struct _stati64 fst;
+		if (_stati64(localfile, &fst) < 0)
+#else
+		struct stat fst;
+		if (stat(localfile, &fst) < 0)
+#endif
+		{
+			error = errno;
+		} else {
+			total = fst.st_size;
+		}
+		if (!error && total > 0) {
+			int fd = open(localfile, O_RDONLY | O_BINARY);
+			if (fd < 0) {
+				error = errno;
+			} else {
+#if defined(POSIX_FADV_SEQUENTIAL)
+				posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+				uint64_t done = 0;
+				while (done < total) {
+					/* start a new buffer rather than sending a tiny hunk */
+					buf = mb2_send_reserve(ctx, buf, 5 + ((total - done < MB2_SEND_MIN_BLOCK_SIZE) ? (uint32_t)(total - done) : MB2_SEND_MIN_BLOCK_SIZE));
+					uint32_t length = MB2_SEND_BUFFER_SIZE - buf->length - 5;
+					if (length > MB2_SEND_BLOCK_SIZE) {
+						length = MB2_SEND_BLOCK_SIZE;
+					}
+					if (length > total - done) {
+						length = (uint32_t)(total - done);
+					}
+					int r = read(fd, buf->data + buf->length + 5, length);
+					if (r < 0 && errno == EINTR) {
+						continue;
+					}
+					if (r <= 0) {
+						/* the file was truncated while it was being sent */
+						error = (r < 0) ? errno : EIO;
+						break;
+					}
+					mb2_send_put_hunk_header(buf, r, CODE_FILE_DATA);
+					buf->length += r;
+					buf->file_bytes += r;
+					done += r;
+					if (mb2_send_should_stop(ctx, 1)) {
+						break;
+					}
+				}
+				close(fd);
+			}
+		}
+		free(localfile);
+
+		/* status hunk; the file is recorded in the buffer that carries it,
+		 * and if that fails the file is reported as failed to the device */
+		const char *errdesc = (error) ? strerror(error) : "";
+		uint32_t length = strlen(errdesc);
+		const char *nomem = strerror(ENOMEM);
+		uint32_t nomem_length = strlen(nomem);
+		buf = mb2_send_reserve(ctx, buf, 5 + ((length > nomem_length) ? length : nomem_length));
+		if (mb2_send_add_file(buf, path, total, error) < 0) {
+			debug_info("Out of memory recording %s", path);
+			error = ENOMEM;
+			errdesc = nomem;
+			length = nomem_length;
+		}
+		if (error) {
+			mb2_send_put_hunk_header(buf, length, CODE_ERROR_LOCAL);
+			memcpy(buf->data + buf->length, errdesc, length);
+			buf->length += length;
+		} else {
+			mb2_send_put_hunk_header(buf, 0, CODE_SUCCESS);
+		}
+	}
+
+	/* terminating 0 dword */
+	buf = mb2_send_reserve(ctx, buf, 4);
+	memset(buf->data + buf->length, 0, 4);
+	buf->length += 4;
+	mb2_send_publish(ctx, 1);
+
+	return NULL;
+}
+
+LIBIMOBILEDEVICE_API mobilebackup2_error_t mobilebackup2_send_files(mobilebackup2_client_t client, const char *backup_dir, plist_t files, mobilebackup2_send_cb_t status_cb, void *user_data, mobilebackup2_send_stats_t *stats)
+{
+	if (!client || !client->parent || !backup_dir || !files || plist_get_node_type(files) != PLIST_ARRAY)
+		return MOBILEBACKUP2_E_INVALID_ARG;
+
+	struct mb2_send_context *ctx = (struct mb2_send_context*)calloc(1, sizeof(struct mb2_send_context));
+	if (!ctx)
+		return MOBILEBACKUP2_E_UNKNOWN_ERROR;
+
+	int i;
+	for (i = 0; i < MB2_SEND_BUFFER_COUNT; i++) {
+		ctx->buffers[i].data = (char*)malloc(MB2_SEND_BUFFER_SIZE);
+		if (!ctx->buffers[i].data) {
+			while (i-- > 0) {
+				free(ctx->buffers[i].data);
+			}
+			free(ctx);
+			return MOBILEBACKUP2_E_UNKNOWN_ERROR;
+		}
+	}
+	ctx->backup_dir = backup_dir;
+	ctx->files = files;
+	mutex_init(&ctx->lock);
+	cond_init(&ctx->filled_cond);
+	cond_init(&ctx->free_cond);
+
+	double start_time = mb2_get_time();
+
+	THREAD_T reader = THREAD_T_NULL;
+	if (thread_new(&reader, mb2_reader_thread, ctx) != 0) {
+		cond_destroy(&ctx->free_cond);
+		cond_destroy(&ctx->filled_cond);
+		mutex_destroy(&ctx->lock);
+		for (i = 0; i < MB2_SEND_BUFFER_COUNT; i++) {
+			free(ctx->buffers[i].data);
+		}
+		free(ctx);
+		return MOBILEBACKUP2_E_UNKNOWN_ERROR;
+	}
+
+	mobilebackup2_error_t err = MOBILEBACKUP2_E_SUCCESS;
+	uint64_t bytes_sent = 0;
+	uint32_t files_sent = 0;
+	uint32_t files_failed = 0;
+
+	while (1) {
+		mutex_lock(&ctx->lock);
+		while (ctx->filled == ctx->sent && !ctx->done) {
+			cond_wait(&ctx->filled_cond, &ctx->lock);
+		}
+		if (ctx->filled == ctx->sent) {
+			mutex_unlock(&ctx->lock);
+			break;
+		}
+		struct mb2_send_buffer *buf = &ctx->buffers[ctx->sent % MB2_SEND_BUFFER_COUNT];
+		mutex_unlock(&ctx->lock);
+
+		int stop = 0;
+		if (err == MOBILEBACKUP2_E_SUCCESS) {
+			uint32_t bytes = 0;
+			err = mobilebackup2_send_raw(client, buf->data, buf->length, &bytes);
+			if (err == MOBILEBACKUP2_E_SUCCESS && bytes != buf->length) {
+				err = MOBILEBACKUP2_E_MUX_ERROR;
+			}
+			if (err != MOBILEBACKUP2_E_SUCCESS) {
+				debug_info("could only send %u of %u bytes", bytes, buf->length);
+			}
+		}
+		if (err == MOBILEBACKUP2_E_SUCCESS) {
+			uint32_t j;
+			bytes_sent += buf->file_bytes;
+			for (j = 0; j < buf->num_files; j++) {
+				if (buf->files[j].error) {
+					files_failed++;
+				} else {
+					files_sent++;
+				}
+				if (status_cb && status_cb(buf->files[j].path, buf->files[j].size, buf->files[j].error, bytes_sent, user_data)) {
+					stop = 1;
+				}
+			}
+		}
+		for (i = 0; i < (int)buf->num_files; i++) {
+			free(buf->files[i].path);
+		}
+		buf->num_files = 0;
+		buf->length = 0;
+		buf->file_bytes = 0;
+
+		mutex_lock(&ctx->lock);
+		ctx->sent++;
+		if (stop) {
+			ctx->stop = 1;
+		}
+		if (err != MOBILEBACKUP2_E_SUCCESS) {
+			ctx->failed = 1;
+		}
+		cond_signal(&ctx->free_cond);
+		mutex_unlock(&ctx->lock);
+	}
+
+	thread_join(reader);
+	thread_free(reader);
+
+	if (stats) {
+		stats->bytes = bytes_sent;
+		stats->files = files_sent;
+		stats->failed = files_failed;
+		stats->elapsed_usec = (uint64_t)(mb2_get_time() - start_time);
+	}
+
+	cond_destroy(&ctx->free_cond);
+	cond_destroy(&ctx->filled_cond);
+	mutex_destroy(&ctx->lock);
+	for (i = 0; i < MB2_SEND_BUFFER_COUNT; i++) {
+		free(ctx->buffers[i].files);
+		free(ctx->buffers[i].data);
+	}
+	free(ctx);
+
+	return err;
+}
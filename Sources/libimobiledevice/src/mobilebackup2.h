@@ -25,8 +25,33 @@
 #include "libimobiledevice/mobilebackup2.h"
 #include "device_link_service.h"
 
+/* size and number of the reusable buffers that mobilebackup2_receive_files()
+ * receives file data into while the writer thread drains them to disk */
+#define MB2_RECEIVE_BUFFER_SIZE (4 * 1024 * 1024)
+#define MB2_RECEIVE_BUFFER_COUNT 4
+
+/* number of queued open/write/close operations for the writer thread */
+#define MB2_RECEIVE_QUEUE_SIZE 1024
+
+/* maximum number of queued writes that are coalesced into a single writev() */
+#define MB2_RECEIVE_IOV_MAX 64
+
+/* size and number of the buffers that mobilebackup2_send_files() serializes
+ * files into ahead of sending them */
+#define MB2_SEND_BUFFER_SIZE (2 * 1024 * 1024)
+#define MB2_SEND_BUFFER_COUNT 4
+
+/* largest file data hunk that is sent, and the smallest one that is worth
+ * appending to a partially filled buffer */
+#define MB2_SEND_BLOCK_SIZE (256 * 1024)
+#define MB2_SEND_MIN_BLOCK_SIZE (16 * 1024)
+
+/* received files are only deduplicated if they are at least this large */
+#define MB2_CONTENT_STORE_MIN_SIZE 4096
+
 struct mobilebackup2_client_private {
 	device_link_service_client_t parent;
+	char *content_store;
 };
 
 #endif
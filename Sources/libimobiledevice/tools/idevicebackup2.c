@@ -67,11 +67,6 @@
 #endif
 #include <sys/stat.h>
 
-#define CODE_SUCCESS 0x00
-#define CODE_ERROR_LOCAL 0x06
-#define CODE_ERROR_REMOTE 0x0b
-#define CODE_FILE_DATA 0x0c
-
 static int verbose = 1;
 static int quit_flag = 0;
 
@@ -762,268 +757,79 @@ static int errno_to_device_error(int errno_value)
 	}
 }
 
-static int mb2_handle_send_file(mobilebackup2_client_t mobilebackup2, const char *backup_dir, const char *path, plist_t *errplist)
-{
-	uint32_t nlen = 0;
-	uint32_t pathlen = strlen(path);
-	uint32_t bytes = 0;
-	char *localfile = string_build_path(backup_dir, path, NULL);
-	char buf[32768];
-#ifdef WIN32
-	struct _stati64 fst;
-#else
-	struct stat fst;
-#endif
-
-	FILE *f = NULL;
-	uint32_t slen = 0;
-	int errcode = -1;
-	int result = -1;
-	uint32_t length;
-#ifdef WIN32
-	uint64_t total;
-	uint64_t sent;
-#else
-	off_t total;
-	off_t sent;
-#endif
-
-	mobilebackup2_error_t err;
-
-	/* send path length */
-	nlen = htobe32(pathlen);
-	err = mobilebackup2_send_raw(mobilebackup2, (const char*)&nlen, sizeof(nlen), &bytes);
-	if (err != MOBILEBACKUP2_E_SUCCESS) {
-		goto leave_proto_err;
-	}
-	if (bytes != (uint32_t)sizeof(nlen)) {
-		err = MOBILEBACKUP2_E_MUX_ERROR;
-		goto leave_proto_err;
-	}
-
-	/* send path */
-	err = mobilebackup2_send_raw(mobilebackup2, path, pathlen, &bytes);
-	if (err != MOBILEBACKUP2_E_SUCCESS) {
-		goto leave_proto_err;
-	}
-	if (bytes != pathlen) {
-		err = MOBILEBACKUP2_E_MUX_ERROR;
-		goto leave_proto_err;
-	}
-
-#ifdef WIN32
-	if (_stati64(localfile, &fst) < 0)
-#else
-	if (stat(localfile, &fst) < 0)
-#endif
-	{
-		if (errno != ENOENT)
-			printf("%s: stat failed on '%s': %d\n", __func__, localfile, errno);
-		errcode = errno;
-		goto leave;
-	}
-
-	total = fst.st_size;
-
-	char *format_size = string_format_size(total);
-	PRINT_VERBOSE(1, "Sending '%s' (%s)\n", path, format_size);
-	free(format_size);
-
-	if (total == 0) {
-		errcode = 0;
-		goto leave;
-	}
-
-	f = fopen(localfile, "rb");
-	if (!f) {
-		printf("%s: Error opening local file '%s': %d\n", __func__, localfile, errno);
-		errcode = errno;
-		goto leave;
-	}
-
-	sent = 0;
-	do {
-		length = ((total-sent) < (long long)sizeof(buf)) ? (uint32_t)total-sent : (uint32_t)sizeof(buf);
-		/* send data size (file size + 1) */
-		nlen = htobe32(length+1);
-		memcpy(buf, &nlen, sizeof(nlen));
-		buf[4] = CODE_FILE_DATA;
-		err = mobilebackup2_send_raw(mobilebackup2, (const char*)buf, 5, &bytes);
-		if (err != MOBILEBACKUP2_E_SUCCESS) {
-			goto leave_proto_err;
-		}
-		if (bytes != 5) {
-			goto leave_proto_err;
-		}
-
-		/* send file contents */
-		size_t r = fread(buf, 1, sizeof(buf), f);
-		if (r <= 0) {
-			printf("%s: read error\n", __func__);
-			errcode = errno;
-			goto leave;
-		}
-		err = mobilebackup2_send_raw(mobilebackup2, buf, r, &bytes);
-		if (err != MOBILEBACKUP2_E_SUCCESS) {
-			goto leave_proto_err;
-		}
-		if (bytes != (uint32_t)r) {
-			printf("Error: sent only %d of %d bytes\n", bytes, (int)r);
-			goto leave_proto_err;
-		}
-		sent += r;
-	} while (sent < total);
-	fclose(f);
-	f = NULL;
-	errcode = 0;
+struct mb2_send_progress {
+	plist_t errplist;
+};
 
-leave:
-	if (errcode == 0) {
-		result = 0;
-		nlen = 1;
-		nlen = htobe32(nlen);
-		memcpy(buf, &nlen, 4);
-		buf[4] = CODE_SUCCESS;
-		mobilebackup2_send_raw(mobilebackup2, buf, 5, &bytes);
+static int mb2_send_files_cb(const char *path, uint64_t size, int error, uint64_t bytes_sent, void *user_data)
+{
+	struct mb2_send_progress *progress = (struct mb2_send_progress*)user_data;
+	if (error) {
+		if (error != ENOENT)
+			printf("%s: could not send '%s': %s\n", __func__, path, strerror(error));
+		if (!progress->errplist) {
+			progress->errplist = plist_new_dict();
+		}
+		mb2_multi_status_add_file_error(progress->errplist, path, errno_to_device_error(error), strerror(error));
 	} else {
-		if (!*errplist) {
-			*errplist = plist_new_dict();
-		}
-		char *errdesc = strerror(errcode);
-		mb2_multi_status_add_file_error(*errplist, path, errno_to_device_error(errcode), errdesc);
-
-		length = strlen(errdesc);
-		nlen = htobe32(length+1);
-		memcpy(buf, &nlen, 4);
-		buf[4] = CODE_ERROR_LOCAL;
-		slen = 5;
-		memcpy(buf+slen, errdesc, length);
-		slen += length;
-		err = mobilebackup2_send_raw(mobilebackup2, (const char*)buf, slen, &bytes);
-		if (err != MOBILEBACKUP2_E_SUCCESS) {
-			printf("could not send message\n");
-		}
-		if (bytes != slen) {
-			printf("could only send %d from %d\n", bytes, slen);
-		}
+		char *format_size = string_format_size(size);
+		PRINT_VERBOSE(1, "Sent '%s' (%s)\n", path, format_size);
+		free(format_size);
 	}
-
-leave_proto_err:
-	if (f)
-		fclose(f);
-	free(localfile);
-	return result;
+	return 0;
 }
 
-static void mb2_handle_send_files(mobilebackup2_client_t mobilebackup2, plist_t message, const char *backup_dir)
+static void mb2_handle_send_files(mobilebackup2_client_t mobilebackup2, plist_t message, const char *backup_dir, mobilebackup2_send_stats_t *totals)
 {
-	uint32_t cnt;
-	uint32_t i = 0;
-	uint32_t sent;
-	plist_t errplist = NULL;
+	struct mb2_send_progress progress = { NULL };
+	mobilebackup2_send_stats_t stats;
 
 	if (!message || (plist_get_node_type(message) != PLIST_ARRAY) || (plist_array_get_size(message) < 2) || !backup_dir) return;
 
 	plist_t files = plist_array_get_item(message, 1);
-	cnt = plist_array_get_size(files);
-
-	for (i = 0; i < cnt; i++) {
-		plist_t val = plist_array_get_item(files, i);
-		if (plist_get_node_type(val) != PLIST_STRING) {
-			continue;
-		}
-		char *str = NULL;
-		plist_get_string_val(val, &str);
-		if (!str)
-			continue;
+	if (plist_get_node_type(files) != PLIST_ARRAY) return;
 
-		if (mb2_handle_send_file(mobilebackup2, backup_dir, str, &errplist) < 0) {
-			free(str);
-			//printf("Error when sending file '%s' to device\n", str);
-			// TODO: perhaps we can continue, we've got a multi status response?!
-			break;
-		}
-		free(str);
+	memset(&stats, 0, sizeof(stats));
+	if (mobilebackup2_send_files(mobilebackup2, backup_dir, files, mb2_send_files_cb, &progress, &stats) != MOBILEBACKUP2_E_SUCCESS) {
+		printf("ERROR: %s: could not send files\n", __func__);
+	}
+	if (totals) {
+		totals->bytes += stats.bytes;
+		totals->files += stats.files;
+		totals->failed += stats.failed;
+		totals->elapsed_usec += stats.elapsed_usec;
 	}
 
-	/* send terminating 0 dword */
-	uint32_t zero = 0;
-	mobilebackup2_send_raw(mobilebackup2, (char*)&zero, 4, &sent);
-
-	if (!errplist) {
+	if (!progress.errplist) {
 		plist_t emptydict = plist_new_dict();
 		mobilebackup2_send_status_response(mobilebackup2, 0, NULL, emptydict);
 		plist_free(emptydict);
 	} else {
-		mobilebackup2_send_status_response(mobilebackup2, -13, "Multi status", errplist);
-		plist_free(errplist);
+		mobilebackup2_send_status_response(mobilebackup2, -13, "Multi status", progress.errplist);
+		plist_free(progress.errplist);
 	}
 }
 
-static int mb2_receive_filename(mobilebackup2_client_t mobilebackup2, char** filename)
-{
-	uint32_t nlen = 0;
-	uint32_t rlen = 0;
-
-	do {
-		nlen = 0;
-		rlen = 0;
-		mobilebackup2_receive_raw(mobilebackup2, (char*)&nlen, 4, &rlen);
-		nlen = be32toh(nlen);
-
-		if ((nlen == 0) && (rlen == 4)) {
-			// a zero length means no more files to receive
-			return 0;
-		} else if(rlen == 0) {
-			// device needs more time, waiting...
-			continue;
-		} else if (nlen > 4096) {
-			// filename length is too large
-			printf("ERROR: %s: too large filename length (%d)!\n", __func__, nlen);
-			return 0;
-		}
-
-		if (*filename != NULL) {
-			free(*filename);
-			*filename = NULL;
-		}
-
-		*filename = (char*)malloc(nlen+1);
-
-		rlen = 0;
-		mobilebackup2_receive_raw(mobilebackup2, *filename, nlen, &rlen);
-		if (rlen != nlen) {
-			printf("ERROR: %s: could not read filename\n", __func__);
-			return 0;
-		}
-
-		char* p = *filename;
-		p[rlen] = 0;
-
-		break;
-	} while(1 && !quit_flag);
+struct mb2_receive_progress {
+	uint64_t total_size;
+};
 
-	return nlen;
+static int mb2_receive_files_cb(uint64_t bytes_received, uint32_t files_received, const char *remote_error, void *user_data)
+{
+	struct mb2_receive_progress *progress = (struct mb2_receive_progress*)user_data;
+	if (remote_error) {
+		fprintf(stdout, "\nReceived an error message from device: %s\n", remote_error);
+	} else if (progress->total_size > 0) {
+		print_progress(bytes_received, progress->total_size);
+	}
+	return quit_flag;
 }
 
-static int mb2_handle_receive_files(mobilebackup2_client_t mobilebackup2, plist_t message, const char *backup_dir)
+static int mb2_handle_receive_files(mobilebackup2_client_t mobilebackup2, plist_t message, const char *backup_dir, mobilebackup2_receive_stats_t *totals)
 {
-	uint64_t backup_real_size = 0;
-	uint64_t backup_total_size = 0;
-	uint32_t blocksize;
-	uint32_t bdone;
-	uint32_t rlen;
-	uint32_t nlen = 0;
-	uint32_t r;
-	char buf[32768];
-	char *fname = NULL;
-	char *dname = NULL;
-	char *bname = NULL;
-	char code = 0;
-	char last_code = 0;
+	struct mb2_receive_progress progress = { 0 };
+	mobilebackup2_receive_stats_t stats;
 	plist_t node = NULL;
-	FILE *f = NULL;
-	unsigned int file_count = 0;
 	int errcode = 0;
 	char *errdesc = NULL;
 
@@ -1031,149 +837,47 @@ static int mb2_handle_receive_files(mobilebackup2_client_t mobilebackup2, plist_
 
 	node = plist_array_get_item(message, 3);
 	if (plist_get_node_type(node) == PLIST_UINT) {
-		plist_get_uint_val(node, &backup_total_size);
+		plist_get_uint_val(node, &progress.total_size);
 	}
-	if (backup_total_size > 0) {
+	if (progress.total_size > 0) {
 		PRINT_VERBOSE(1, "Receiving files\n");
 	}
 
-	do {
-		if (quit_flag)
-			break;
-
-		nlen = mb2_receive_filename(mobilebackup2, &dname);
-		if (nlen == 0) {
-			break;
-		}
-
-		nlen = mb2_receive_filename(mobilebackup2, &fname);
-		if (!nlen) {
-			break;
-		}
-
-		if (bname != NULL) {
-			free(bname);
-			bname = NULL;
-		}
-
-		bname = string_build_path(backup_dir, fname, NULL);
-
-		if (fname != NULL) {
-			free(fname);
-			fname = NULL;
-		}
-
-		r = 0;
-		nlen = 0;
-		mobilebackup2_receive_raw(mobilebackup2, (char*)&nlen, 4, &r);
-		if (r != 4) {
-			printf("ERROR: %s: could not receive code length!\n", __func__);
-			break;
-		}
-		nlen = be32toh(nlen);
-
-		last_code = code;
-		code = 0;
-
-		mobilebackup2_receive_raw(mobilebackup2, &code, 1, &r);
-		if (r != 1) {
-			printf("ERROR: %s: could not receive code!\n", __func__);
-			break;
-		}
-
-		/* TODO remove this */
-		if ((code != CODE_SUCCESS) && (code != CODE_FILE_DATA) && (code != CODE_ERROR_REMOTE)) {
-			PRINT_VERBOSE(1, "Found new flag %02x\n", code);
-		}
-
-		remove_file(bname);
-		f = fopen(bname, "wb");
-		while (f && (code == CODE_FILE_DATA)) {
-			blocksize = nlen-1;
-			bdone = 0;
-			rlen = 0;
-			while (bdone < blocksize) {
-				if ((blocksize - bdone) < sizeof(buf)) {
-					rlen = blocksize - bdone;
-				} else {
-					rlen = sizeof(buf);
-				}
-				mobilebackup2_receive_raw(mobilebackup2, buf, rlen, &r);
-				if ((int)r <= 0) {
-					break;
-				}
-				fwrite(buf, 1, r, f);
-				bdone += r;
-			}
-			if (bdone == blocksize) {
-				backup_real_size += blocksize;
-			}
-			if (backup_total_size > 0) {
-				print_progress(backup_real_size, backup_total_size);
-			}
-			if (quit_flag)
-				break;
-			nlen = 0;
-			mobilebackup2_receive_raw(mobilebackup2, (char*)&nlen, 4, &r);
-			nlen = be32toh(nlen);
-			if (nlen > 0) {
-				last_code = code;
-				mobilebackup2_receive_raw(mobilebackup2, &code, 1, &r);
-			} else {
-				break;
-			}
-		}
-		if (f) {
-			fclose(f);
-			file_count++;
-		} else {
-			errcode = errno_to_device_error(errno);
-			errdesc = strerror(errno);
-			printf("Error opening '%s' for writing: %s\n", bname, errdesc);
-			break;
-		}
-		if (nlen == 0) {
-			break;
-		}
-
-		/* check if an error message was received */
-		if (code == CODE_ERROR_REMOTE) {
-			/* error message */
-			char *msg = (char*)malloc(nlen);
-			mobilebackup2_receive_raw(mobilebackup2, msg, nlen-1, &r);
-			msg[r] = 0;
-			/* If sent using CODE_FILE_DATA, end marker will be CODE_ERROR_REMOTE which is not an error! */
-			if (last_code != CODE_FILE_DATA) {
-				fprintf(stdout, "\nReceived an error message from device: %s\n", msg);
-			}
-			free(msg);
-		}
-	} while (1);
-
-	if (fname != NULL)
-		free(fname);
-
-	/* if there are leftovers to read, finish up cleanly */
-	if ((int)nlen-1 > 0) {
-		PRINT_VERBOSE(1, "\nDiscarding current data hunk.\n");
-		fname = (char*)malloc(nlen-1);
-		mobilebackup2_receive_raw(mobilebackup2, fname, nlen-1, &r);
-		free(fname);
-		remove_file(bname);
+	memset(&stats, 0, sizeof(stats));
+	if (mobilebackup2_receive_files(mobilebackup2, backup_dir, 0, mb2_receive_files_cb, &progress, &stats) != MOBILEBACKUP2_E_SUCCESS) {
+		printf("ERROR: %s: could not receive files\n", __func__);
 	}
+	if (stats.error) {
+		errcode = errno_to_device_error(stats.error);
+		errdesc = strerror(stats.error);
+		printf("Error opening '%s' for writing: %s\n", stats.error_path, errdesc);
+	}
+	free(stats.error_path);
 
-	/* clean up */
-	if (bname != NULL)
-		free(bname);
-
-	if (dname != NULL)
-		free(dname);
+	if (totals) {
+		totals->bytes += stats.bytes;
+		totals->files += stats.files;
+		totals->deduplicated += stats.deduplicated;
+		totals->deduplicated_bytes += stats.deduplicated_bytes;
+		totals->elapsed_usec += stats.elapsed_usec;
+	}
 
 	plist_t empty_plist = plist_new_dict();
 	mobilebackup2_send_status_response(mobilebackup2, errcode, errdesc, empty_plist);
 	plist_free(empty_plist);
 
-	return file_count;
+	return stats.files;
+}
+
+static void mb2_print_transfer_stats(const char *verb, uint32_t files, uint64_t bytes, uint64_t elapsed_usec)
+{
+	double seconds = elapsed_usec / 1000000.0;
+	if (files == 0 || seconds <= 0) {
+		return;
+	}
+	char *size_str = string_format_size(bytes);
+	PRINT_VERBOSE(1, "%s %u files (%s) in %.1f seconds: %.1f MB/s, %.1f files/s\n", verb, files, size_str, seconds, (bytes / 1000000.0) / seconds, files / seconds);
+	free(size_str);
 }
 
 static void mb2_handle_list_directory(mobilebackup2_client_t mobilebackup2, plist_t message, const char *backup_dir)
@@ -1428,6 +1132,7 @@ static void print_usage(int argc, char **argv)
 	printf("CMD:\n");
 	printf("  backup\tcreate backup for the device\n");
 	printf("    --full\t\tforce full backup from device.\n");
+	printf("    --store DIR\t\tshare identical files with other backups using DIR\n");
 	printf("  restore\trestore last backup to the device\n");
 	printf("    --system\t\trestore system files, too.\n");
 	printf("    --no-reboot\t\tdo NOT reboot the device when done (default: yes).\n");
@@ -1477,6 +1182,7 @@ int main(int argc, char *argv[])
 	int interactive_mode = 0;
 	char* backup_password = NULL;
 	char* newpw = NULL;
+	char* content_store = NULL;
 	struct stat st;
 	plist_t node_tmp = NULL;
 	plist_t info_plist = NULL;
@@ -1565,6 +1271,16 @@ int main(int argc, char *argv[])
 		else if (!strcmp(argv[i], "--skip-apps")) {
 			cmd_flags |= CMD_FLAG_RESTORE_SKIP_APPS;
 		}
+		else if (!strcmp(argv[i], "--store")) {
+			i++;
+			if (!argv[i] || !*argv[i]) {
+				print_usage(argc, argv);
+				return -1;
+			}
+			free(content_store);
+			content_store = strdup(argv[i]);
+			continue;
+		}
 		else if (!strcmp(argv[i], "--password")) {
 			i++;
 			if (!argv[i]) {
@@ -1862,6 +1578,10 @@ int main(int argc, char *argv[])
 		PRINT_VERBOSE(1, "Started \"%s\" service on port %d.\n", MOBILEBACKUP2_SERVICE_NAME, service->port);
 		mobilebackup2_client_new(device, service, &mobilebackup2);
 
+		if (mobilebackup2 && content_store && mobilebackup2_set_content_store(mobilebackup2, content_store) != MOBILEBACKUP2_E_SUCCESS) {
+			printf("WARNING: Content stores are not supported on this platform, ignoring --store.\n");
+		}
+
 		if (service) {
 			lockdownd_service_descriptor_free(service);
 			service = NULL;
@@ -2217,6 +1937,8 @@ checkpoint:
 			mobilebackup2_error_t mberr;
 			char *dlmsg = NULL;
 			int file_count = 0;
+			mobilebackup2_receive_stats_t receive_totals = { 0 };
+			mobilebackup2_send_stats_t send_totals = { 0 };
 			int errcode = 0;
 			const char *errdesc = NULL;
 			int progress_finished = 0;
@@ -2238,11 +1960,11 @@ checkpoint:
 				if (!strcmp(dlmsg, "DLMessageDownloadFiles")) {
 					/* device wants to download files from the computer */
 					mb2_set_overall_progress_from_message(message, dlmsg);
-					mb2_handle_send_files(mobilebackup2, message, backup_directory);
+					mb2_handle_send_files(mobilebackup2, message, backup_directory, &send_totals);
 				} else if (!strcmp(dlmsg, "DLMessageUploadFiles")) {
 					/* device wants to send files to the computer */
 					mb2_set_overall_progress_from_message(message, dlmsg);
-					file_count += mb2_handle_receive_files(mobilebackup2, message, backup_directory);
+					file_count += mb2_handle_receive_files(mobilebackup2, message, backup_directory, &receive_totals);
 				} else if (!strcmp(dlmsg, "DLMessageGetFreeDiskSpace")) {
 					/* device wants to know how much disk space is available on the computer */
 					uint64_t freespace = 0;
@@ -2502,6 +2224,21 @@ files_out:
 				break;
 				case CMD_BACKUP:
 					PRINT_VERBOSE(1, "Received %d files from device.\n", file_count);
+					mb2_print_transfer_stats("Received", receive_totals.files, receive_totals.bytes, receive_totals.elapsed_usec);
+					if (receive_totals.deduplicated > 0) {
+						char *size_str = string_format_size(receive_totals.deduplicated_bytes);
+						PRINT_VERBOSE(1, "Shared %u files (%s) with other backups in the content store.\n", receive_totals.deduplicated, size_str);
+						free(size_str);
+					}
+					if (operation_ok && content_store) {
+						uint32_t removed_files = 0;
+						uint64_t removed_bytes = 0;
+						if (mobilebackup2_content_store_prune(content_store, &removed_files, &removed_bytes) == MOBILEBACKUP2_E_SUCCESS && removed_files > 0) {
+							char *size_str = string_format_size(removed_bytes);
+							PRINT_VERBOSE(1, "Removed %u unused files (%s) from the content store.\n", removed_files, size_str);
+							free(size_str);
+						}
+					}
 					if (operation_ok && mb2_status_check_snapshot_state(backup_directory, udid, "finished")) {
 						PRINT_VERBOSE(1, "Backup Successful.\n");
 					} else {
@@ -2542,6 +2279,7 @@ files_out:
 				}
 				break;
 				case CMD_RESTORE:
+				mb2_print_transfer_stats("Sent", send_totals.files, send_totals.bytes, send_totals.elapsed_usec);
 				if (operation_ok) {
 					if ((cmd_flags & CMD_FLAG_RESTORE_NO_REBOOT) == 0)
 						PRINT_VERBOSE(1, "The device should reboot now.\n");
@@ -2618,6 +2356,7 @@ files_out:
 		free(source_udid);
 		source_udid = NULL;
 	}
+	free(content_store);
 
 	return result_code;
 }
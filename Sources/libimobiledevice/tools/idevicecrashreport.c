@@ -29,11 +29,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <utime.h>
 #ifndef WIN32
 #include <unistd.h>
 #include <signal.h>
 #endif
 #include <libimobiledevice-glue/utils.h>
+#include <libimobiledevice-glue/thread.h>
 
 #include <libimobiledevice/libimobiledevice.h>
 #include <libimobiledevice/lockdown.h>
@@ -43,17 +47,37 @@
 
 #ifdef WIN32
 #include <windows.h>
-#define S_IFLNK S_IFREG
-#define S_IFSOCK S_IFREG
 #endif
 
 #define CRASH_REPORT_MOVER_SERVICE "com.apple.crashreportmover"
 #define CRASH_REPORT_COPY_MOBILE_SERVICE "com.apple.crashreportcopymobile"
 
+#define DEFAULT_JOBS 4
+#define MAX_JOBS 16
+
 const char* target_directory = NULL;
 static int extract_raw_crash_reports = 0;
 static int keep_crash_reports = 0;
 
+struct crash_report {
+	char *source;
+	char *target;
+	uint64_t size;
+	uint64_t mtime;
+};
+
+struct pull_state {
+	afc_client_t afc;
+	struct crash_report *reports;
+	uint32_t count;
+	uint32_t *next;
+	mutex_t *mutex;
+	uint32_t copied;
+	uint32_t skipped;
+	uint32_t failed;
+	uint64_t bytes;
+};
+
 static int file_exists(const char* path)
 {
 	struct stat tst;
@@ -64,6 +88,13 @@ static int file_exists(const char* path)
 #endif
 }
 
+static double get_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
 static int extract_raw_crash_report(const char* filename)
 {
 	int res = 0;
@@ -103,210 +134,273 @@ static int extract_raw_crash_report(const char* filename)
 	return res;
 }
 
-static int afc_client_copy_and_remove_crash_reports(afc_client_t afc, const char* device_directory, const char* host_directory)
+/* assembles the local filename for a path relative to the device directory */
+static char* build_target_filename(const char* host_directory, const char* relative_path)
 {
-	afc_error_t afc_error;
-	int k;
-	int res = -1;
-	int crash_report_count = 0;
-	uint64_t handle;
-	char source_filename[512];
-	char target_filename[512];
-
-	if (!afc)
-		return res;
-
-	char** list = NULL;
-	afc_error = afc_read_directory(afc, device_directory, &list);
-	if (afc_error != AFC_E_SUCCESS) {
-		fprintf(stderr, "ERROR: Could not read device directory '%s'\n", device_directory);
-		return res;
-	}
+	size_t host_directory_length = strlen(host_directory);
+	char* target_filename = (char*)malloc(host_directory_length + strlen(relative_path) + 2);
 
+	strcpy(target_filename, host_directory);
 	/* ensure we have a trailing slash */
-	strcpy(source_filename, device_directory);
-	if (source_filename[strlen(source_filename)-1] != '/') {
-		strcat(source_filename, "/");
+	if (host_directory_length == 0 || target_filename[host_directory_length-1] != '/') {
+		strcat(target_filename, "/");
 	}
-	int device_directory_length = strlen(source_filename);
+	char* name = target_filename + strlen(target_filename);
+	strcpy(name, relative_path);
 
-	/* ensure we have a trailing slash */
-	strcpy(target_filename, host_directory);
-	if (target_filename[strlen(target_filename)-1] != '/') {
-		strcat(target_filename, "/");
+#ifdef WIN32
+	/* replace every ':' with '-' since ':' is an illegal character for file names in windows */
+	char* current_pos = strchr(name, ':');
+	while (current_pos) {
+		*current_pos = '-';
+		current_pos = strchr(current_pos, ':');
+	}
+#endif
+	/* make sure to strip ".synced" extension as seen on iOS 5 */
+	char* p = strrchr(name, '.');
+	if (p != NULL && !strncmp(p, ".synced", 7)) {
+		*p = '\0';
 	}
-	int host_directory_length = strlen(target_filename);
 
-	/* loop over file entries */
-	for (k = 0; list[k]; k++) {
-		if (!strcmp(list[k], ".") || !strcmp(list[k], "..")) {
-			continue;
-		}
+	return target_filename;
+}
 
-		char **fileinfo = NULL;
-		struct stat stbuf;
-		memset(&stbuf, '\0', sizeof(struct stat));
+static int write_to_file_cb(const char *data, uint32_t length, void *user_data)
+{
+	return (fwrite(data, 1, length, (FILE*)user_data) == length) ? 0 : -1;
+}
+
+static void* pull_crash_reports(void* data)
+{
+	struct pull_state* state = (struct pull_state*)data;
+	afc_error_t afc_error;
+	uint64_t handle;
 
-		/* assemble absolute source filename */
-		strcpy(((char*)source_filename) + device_directory_length, list[k]);
+	while (1) {
+		mutex_lock(state->mutex);
+		uint32_t index = (*state->next)++;
+		mutex_unlock(state->mutex);
+		if (index >= state->count) {
+			break;
+		}
+		struct crash_report* report = &state->reports[index];
 
-		/* assemble absolute target filename */
-#ifdef WIN32
-		/* replace every ':' with '-' since ':' is an illegal character for file names in windows */
-		char* current_pos = strchr(list[k], ':');
-		while (current_pos) {
-			*current_pos = '-';
-			current_pos = strchr(current_pos, ':');
+		/* skip reports that were copied before */
+		struct stat st;
+		if (stat(report->target, &st) == 0 && (uint64_t)st.st_size == report->size && (uint64_t)st.st_mtime == report->mtime / 1000000000) {
+			if (!keep_crash_reports) {
+				afc_remove_path(state->afc, report->source);
+			}
+			state->skipped++;
+			continue;
 		}
-#endif
-		char* p = strrchr(list[k], '.');
-		if (p != NULL && !strncmp(p, ".synced", 7)) {
-			/* make sure to strip ".synced" extension as seen on iOS 5 */
-			int newlen = strlen(list[k]) - 7;
-			strncpy(((char*)target_filename) + host_directory_length, list[k], newlen);
-			target_filename[host_directory_length + newlen] = '\0';
-		} else {
-			strcpy(((char*)target_filename) + host_directory_length, list[k]);
+
+		/* copy file to host */
+		afc_error = afc_file_open(state->afc, report->source, AFC_FOPEN_RDONLY, &handle);
+		if (afc_error != AFC_E_SUCCESS) {
+			if (afc_error != AFC_E_OBJECT_NOT_FOUND) {
+				fprintf(stderr, "Unable to open device file '%s' (%d). Skipping...\n", report->source, afc_error);
+				state->failed++;
+			}
+			continue;
 		}
 
-		/* get file information */
-		afc_get_file_info(afc, source_filename, &fileinfo);
-		if (!fileinfo) {
-			printf("Failed to read information for '%s'. Skipping...\n", source_filename);
+		FILE* output = fopen(report->target, "wb");
+		if (output == NULL) {
+			fprintf(stderr, "Unable to open local file '%s'. Skipping...\n", report->target);
+			afc_file_close(state->afc, handle);
+			state->failed++;
 			continue;
 		}
 
-		/* parse file information */
-		int i;
-		for (i = 0; fileinfo[i]; i+=2) {
-			if (!strcmp(fileinfo[i], "st_size")) {
-				stbuf.st_size = atoll(fileinfo[i+1]);
-			} else if (!strcmp(fileinfo[i], "st_ifmt")) {
-				if (!strcmp(fileinfo[i+1], "S_IFREG")) {
-					stbuf.st_mode = S_IFREG;
-				} else if (!strcmp(fileinfo[i+1], "S_IFDIR")) {
-					stbuf.st_mode = S_IFDIR;
-				} else if (!strcmp(fileinfo[i+1], "S_IFLNK")) {
-					stbuf.st_mode = S_IFLNK;
-				} else if (!strcmp(fileinfo[i+1], "S_IFBLK")) {
-					stbuf.st_mode = S_IFBLK;
-				} else if (!strcmp(fileinfo[i+1], "S_IFCHR")) {
-					stbuf.st_mode = S_IFCHR;
-				} else if (!strcmp(fileinfo[i+1], "S_IFIFO")) {
-					stbuf.st_mode = S_IFIFO;
-				} else if (!strcmp(fileinfo[i+1], "S_IFSOCK")) {
-					stbuf.st_mode = S_IFSOCK;
-				}
-			} else if (!strcmp(fileinfo[i], "st_nlink")) {
-				stbuf.st_nlink = atoi(fileinfo[i+1]);
-			} else if (!strcmp(fileinfo[i], "st_mtime")) {
-				stbuf.st_mtime = (time_t)(atoll(fileinfo[i+1]) / 1000000000);
-			} else if (!strcmp(fileinfo[i], "LinkTarget")) {
-				/* report latest crash report filename */
-				printf("Link: %s\n", (char*)target_filename + strlen(target_directory));
-
-				/* remove any previous symlink */
-				if (file_exists(target_filename)) {
-					remove(target_filename);
-				}
+		uint64_t bytes_total = 0;
+		afc_error = afc_file_read_pipelined(state->afc, handle, 0, write_to_file_cb, output, &bytes_total);
+		afc_file_close(state->afc, handle);
+		fclose(output);
 
-#ifndef WIN32
-				/* use relative filename */
-				char* b = strrchr(fileinfo[i+1], '/');
-				if (b == NULL) {
-					b = fileinfo[i+1];
-				} else {
-					b++;
-				}
-
-				/* create a symlink pointing to latest log */
-				if (symlink(b, target_filename) < 0) {
-					fprintf(stderr, "Can't create symlink to %s\n", b);
-				}
-#endif
+		if (afc_error != AFC_E_SUCCESS || report->size != bytes_total) {
+			fprintf(stderr, "File size mismatch for '%s'. Skipping...\n", report->target);
+			state->failed++;
+			continue;
+		}
 
-				if (!keep_crash_reports)
-					afc_remove_path(afc, source_filename);
+		/* keep the device modification time so the report is recognized next time */
+		struct utimbuf times;
+		times.actime = times.modtime = (time_t)(report->mtime / 1000000000);
+		utime(report->target, &times);
 
-				res = 0;
-			}
+		printf("%s: %s\n", (keep_crash_reports ? "Copy": "Move") , report->target + strlen(target_directory));
+
+		/* remove file from device */
+		if (!keep_crash_reports) {
+			afc_remove_path(state->afc, report->source);
 		}
 
-		/* free file information */
-		afc_dictionary_free(fileinfo);
+		/* extract raw crash information into separate '.crash' file */
+		if (extract_raw_crash_reports) {
+			extract_raw_crash_report(report->target);
+		}
 
-		/* recurse into child directories */
-		if (S_ISDIR(stbuf.st_mode)) {
-#ifdef WIN32
-			mkdir(target_filename);
-#else
-			mkdir(target_filename, 0755);
-#endif
-			res = afc_client_copy_and_remove_crash_reports(afc, source_filename, target_filename);
+		state->copied++;
+		state->bytes += bytes_total;
+	}
 
-			/* remove directory from device */
-			if (!keep_crash_reports)
-				afc_remove_path(afc, source_filename);
-		} else if (S_ISREG(stbuf.st_mode)) {
-			/* copy file to host */
-			afc_error = afc_file_open(afc, source_filename, AFC_FOPEN_RDONLY, &handle);
-			if(afc_error != AFC_E_SUCCESS) {
-				if (afc_error == AFC_E_OBJECT_NOT_FOUND) {
-					continue;
-				}
-				fprintf(stderr, "Unable to open device file '%s' (%d). Skipping...\n", source_filename, afc_error);
-				continue;
-			}
+	return NULL;
+}
 
-			FILE* output = fopen(target_filename, "wb");
-			if(output == NULL) {
-				fprintf(stderr, "Unable to open local file '%s'. Skipping...\n", target_filename);
-				afc_file_close(afc, handle);
-				continue;
-			}
+static int afc_client_copy_and_remove_crash_reports(afc_client_t* afc, int jobs, const char* device_directory, const char* host_directory)
+{
+	afc_error_t afc_error;
+	afc_walk_entry_t* entries = NULL;
+	uint32_t count = 0;
+	uint32_t k;
+	int i;
 
-			printf("%s: %s\n", (keep_crash_reports ? "Copy": "Move") , (char*)target_filename + strlen(target_directory));
+	if (!afc || jobs < 1)
+		return -1;
 
-			uint32_t bytes_read = 0;
-			uint32_t bytes_total = 0;
-			unsigned char data[0x1000];
+	double start_time = get_time();
 
-			afc_error = afc_file_read(afc, handle, (char*)data, 0x1000, &bytes_read);
-			while(afc_error == AFC_E_SUCCESS && bytes_read > 0) {
-				fwrite(data, 1, bytes_read, output);
-				bytes_total += bytes_read;
-				afc_error = afc_file_read(afc, handle, (char*)data, 0x1000, &bytes_read);
-			}
-			afc_file_close(afc, handle);
-			fclose(output);
+	afc_error = afc_walk(afc[0], device_directory, &entries, &count);
+	if (afc_error != AFC_E_SUCCESS) {
+		fprintf(stderr, "ERROR: Could not read device directory '%s'\n", device_directory);
+		return -1;
+	}
+
+	size_t device_directory_length = strlen(device_directory);
+	if (device_directory_length > 0 && device_directory[device_directory_length-1] != '/') {
+		device_directory_length++;
+	}
+
+	struct crash_report* reports = (struct crash_report*)calloc(count ? count : 1, sizeof(struct crash_report));
+	uint32_t report_count = 0;
+
+	/* directories and links are handled here, parents before their children */
+	for (k = 0; k < count; k++) {
+		afc_walk_entry_t* entry = &entries[k];
+		if (entry->info.status != AFC_E_SUCCESS) {
+			printf("Failed to read information for '%s'. Skipping...\n", entry->path);
+			continue;
+		}
+
+		char* target_filename = build_target_filename(host_directory, entry->path + device_directory_length);
 
-			if ((uint32_t)stbuf.st_size != bytes_total) {
-				fprintf(stderr, "File size mismatch. Skipping...\n");
-				continue;
+		if (entry->info.link_target) {
+			/* report latest crash report filename */
+			printf("Link: %s\n", target_filename + strlen(target_directory));
+
+			/* remove any previous symlink */
+			if (file_exists(target_filename)) {
+				remove(target_filename);
 			}
 
-			/* remove file from device */
-			if (!keep_crash_reports) {
-				afc_remove_path(afc, source_filename);
+#ifndef WIN32
+			/* use relative filename */
+			char* b = strrchr(entry->info.link_target, '/');
+			if (b == NULL) {
+				b = entry->info.link_target;
+			} else {
+				b++;
 			}
 
-			/* extract raw crash information into separate '.crash' file */
-			if (extract_raw_crash_reports) {
-				extract_raw_crash_report(target_filename);
+			/* create a symlink pointing to latest log */
+			if (symlink(b, target_filename) < 0) {
+				fprintf(stderr, "Can't create symlink to %s\n", b);
 			}
+#endif
 
-			crash_report_count++;
+			if (!keep_crash_reports)
+				afc_remove_path(afc[0], entry->path);
+			free(target_filename);
+		} else if (entry->info.type == AFC_FILE_TYPE_DIRECTORY) {
+#ifdef WIN32
+			mkdir(target_filename);
+#else
+			mkdir(target_filename, 0755);
+#endif
+			free(target_filename);
+		} else if (entry->info.type == AFC_FILE_TYPE_REGULAR) {
+			reports[report_count].source = entry->path;
+			reports[report_count].target = target_filename;
+			reports[report_count].size = entry->info.size;
+			reports[report_count].mtime = entry->info.mtime;
+			report_count++;
+		} else {
+			free(target_filename);
+		}
+	}
 
-			res = 0;
+	/* pull the files concurrently, one connection per worker */
+	mutex_t mutex;
+	uint32_t next = 0;
+	struct pull_state states[MAX_JOBS];
+	THREAD_T threads[MAX_JOBS];
+
+	if (jobs > MAX_JOBS)
+		jobs = MAX_JOBS;
+	if ((uint32_t)jobs > report_count)
+		jobs = (report_count > 0) ? (int)report_count : 1;
+
+	mutex_init(&mutex);
+	memset(states, '\0', sizeof(states));
+	for (i = 0; i < jobs; i++) {
+		states[i].afc = afc[i];
+		states[i].reports = reports;
+		states[i].count = report_count;
+		states[i].next = &next;
+		states[i].mutex = &mutex;
+	}
+	for (i = 1; i < jobs; i++) {
+		if (thread_new(&threads[i], pull_crash_reports, &states[i]) != 0) {
+			states[i].afc = NULL;
+		}
+	}
+	pull_crash_reports(&states[0]);
+
+	uint32_t copied = states[0].copied;
+	uint32_t skipped = states[0].skipped;
+	uint32_t failed = states[0].failed;
+	uint64_t bytes = states[0].bytes;
+	for (i = 1; i < jobs; i++) {
+		if (!states[i].afc) {
+			continue;
+		}
+		thread_join(threads[i]);
+		thread_free(threads[i]);
+		copied += states[i].copied;
+		skipped += states[i].skipped;
+		failed += states[i].failed;
+		bytes += states[i].bytes;
+	}
+	mutex_destroy(&mutex);
+
+	/* remove the now empty directories from the device, children first */
+	if (!keep_crash_reports) {
+		for (k = count; k > 0; k--) {
+			afc_walk_entry_t* entry = &entries[k-1];
+			if (entry->info.status == AFC_E_SUCCESS && entry->info.type == AFC_FILE_TYPE_DIRECTORY && !entry->info.link_target) {
+				afc_remove_path(afc[0], entry->path);
+			}
 		}
 	}
-	afc_dictionary_free(list);
 
-	/* no reports, no error */
-	if (crash_report_count == 0)
-		res = 0;
+	double elapsed = get_time() - start_time;
+	if (elapsed <= 0) {
+		elapsed = 0.001;
+	}
+	char* size_str = string_format_size(bytes);
+	char* rate_str = string_format_size((uint64_t)(bytes / elapsed));
+	printf("%u file(s), %s in %.1f seconds (%.1f files/s, %s/s), %u already copied, %u failed\n", copied, size_str, elapsed, copied / elapsed, rate_str, skipped, failed);
+	free(size_str);
+	free(rate_str);
+
+	for (k = 0; k < report_count; k++) {
+		free(reports[k].target);
+	}
+	free(reports);
+	afc_walk_free(entries, count);
 
-	return res;
+	return 0;
 }
 
 static void print_usage(int argc, char **argv)
@@ -323,6 +417,7 @@ static void print_usage(int argc, char **argv)
 	printf("  -n, --network\t\tconnect to network device\n");
 	printf("  -e, --extract\t\textract raw crash report into separate '.crash' file\n");
 	printf("  -k, --keep\t\tcopy but do not remove crash reports from device\n");
+	printf("  -j, --jobs NUM\tcopy NUM files at a time (default: %d)\n", DEFAULT_JOBS);
 	printf("  -d, --debug\t\tenable communication debugging\n");
 	printf("  -h, --help\t\tprints usage information\n");
 	printf("  -v, --version\t\tprints version information\n");
@@ -335,7 +430,9 @@ int main(int argc, char* argv[])
 {
 	idevice_t device = NULL;
 	lockdownd_client_t lockdownd = NULL;
-	afc_client_t afc = NULL;
+	afc_client_t afc[MAX_JOBS];
+	int jobs = DEFAULT_JOBS;
+	int num_clients = 0;
 
 	idevice_error_t device_error = IDEVICE_E_SUCCESS;
 	lockdownd_error_t lockdownd_error = LOCKDOWN_E_SUCCESS;
@@ -383,6 +480,16 @@ int main(int argc, char* argv[])
 			keep_crash_reports = 1;
 			continue;
 		}
+		else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+			i++;
+			if (!argv[i] || (jobs = atoi(argv[i])) < 1) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			if (jobs > MAX_JOBS)
+				jobs = MAX_JOBS;
+			continue;
+		}
 		else if (target_directory == NULL) {
 			target_directory = argv[i];
 			continue;
@@ -469,39 +576,45 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	lockdownd_error = lockdownd_start_service(lockdownd, CRASH_REPORT_COPY_MOBILE_SERVICE, &service);
-	if (lockdownd_error != LOCKDOWN_E_SUCCESS) {
-		fprintf(stderr, "ERROR: Could not start service %s: %s\n", CRASH_REPORT_COPY_MOBILE_SERVICE, lockdownd_strerror(lockdownd_error));
-		lockdownd_client_free(lockdownd);
-		idevice_free(device);
-		return -1;
-	}
-	lockdownd_client_free(lockdownd);
-
-	afc = NULL;
-	afc_error = afc_client_new(device, service, &afc);
-	if(afc_error != AFC_E_SUCCESS) {
-		lockdownd_client_free(lockdownd);
-		idevice_free(device);
-		return -1;
-	}
+	/* every worker gets its own connection to the copy service */
+	while (num_clients < jobs) {
+		lockdownd_error = lockdownd_start_service(lockdownd, CRASH_REPORT_COPY_MOBILE_SERVICE, &service);
+		if (lockdownd_error != LOCKDOWN_E_SUCCESS) {
+			if (num_clients > 0)
+				break;
+			fprintf(stderr, "ERROR: Could not start service %s: %s\n", CRASH_REPORT_COPY_MOBILE_SERVICE, lockdownd_strerror(lockdownd_error));
+			lockdownd_client_free(lockdownd);
+			idevice_free(device);
+			return -1;
+		}
 
-	if (service) {
+		afc_error = afc_client_new(device, service, &afc[num_clients]);
 		lockdownd_service_descriptor_free(service);
 		service = NULL;
+		if (afc_error != AFC_E_SUCCESS) {
+			if (num_clients > 0)
+				break;
+			lockdownd_client_free(lockdownd);
+			idevice_free(device);
+			return -1;
+		}
+		num_clients++;
 	}
+	lockdownd_client_free(lockdownd);
 
 	/* recursively copy crash reports from the device to a local directory */
-	if (afc_client_copy_and_remove_crash_reports(afc, ".", target_directory) < 0) {
+	if (afc_client_copy_and_remove_crash_reports(afc, num_clients, ".", target_directory) < 0) {
 		fprintf(stderr, "ERROR: Failed to get crash reports from device.\n");
-		afc_client_free(afc);
+		for (i = 0; i < num_clients; i++)
+			afc_client_free(afc[i]);
 		idevice_free(device);
 		return -1;
 	}
 
 	printf("Done.\n");
 
-	afc_client_free(afc);
+	for (i = 0; i < num_clients; i++)
+		afc_client_free(afc[i]);
 	idevice_free(device);
 
 	return 0;
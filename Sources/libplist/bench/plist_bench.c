@@ -0,0 +1,1171 @@
+/*
+ * plist_bench.c
+ * Parse/serialize benchmark for the binary, XML and JSON plist formats
+ *
+ * Copyright (c) 2026 Busq contributors, All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "plist/plist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/time.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable:4996)
+#endif
+
+/*
+ * Allocation counting. On glibc the allocator can be replaced by the
+ * program, so every malloc/calloc/realloc done by libplist (including the
+ * ones behind strdup) is counted and then forwarded to the real allocator.
+ * Other platforms report the count as unavailable.
+ */
+#if defined(__GLIBC__) && !defined(PLIST_BENCH_NO_ALLOC_COUNT)
+#define HAVE_ALLOC_COUNT 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static uint64_t alloc_count = 0;
+
+void *malloc(size_t size)
+{
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+#else
+static uint64_t alloc_count = 0;
+#endif
+
+enum bench_format {
+    FORMAT_BIN = 0,
+    FORMAT_XML,
+    FORMAT_JSON,
+    FORMAT_COUNT
+};
+
+static const char *format_names[FORMAT_COUNT] = { "bin", "xml", "json" };
+
+typedef struct _options
+{
+    char *corpus_dir;
+    char *out_file;
+    uint8_t json, no_generated, list;
+    uint8_t formats[FORMAT_COUNT];
+    unsigned int min_time_ms;
+    unsigned int scale;
+} options_t;
+
+typedef struct {
+    char *name;
+    plist_t root;
+} corpus_entry_t;
+
+typedef struct {
+    corpus_entry_t *entries;
+    size_t count;
+    size_t capacity;
+} corpus_t;
+
+typedef struct {
+    const char *corpus;
+    const char *format;
+    const char *op;
+    uint64_t iterations;
+    double ns_per_op;
+    double mb_per_s;        /* < 0 if not meaningful for the operation */
+    double allocs_per_op;   /* < 0 if allocations can't be counted */
+    long rss_growth_kb;     /* < 0 if not measured */
+} result_t;
+
+/* ---- timing and memory ------------------------------------------------- */
+
+static uint64_t now_ns(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/*
+ * Peak memory of one operation, measured as how far the resident set grew
+ * above what was resident when it started. This needs a high-water mark
+ * that can be reset, which only Linux offers; elsewhere the lifetime
+ * maximum would just repeat the footprint of the whole process, so the
+ * value is reported as unavailable.
+ */
+
+/* Returns a "Vm*:" field of /proc/self/status in KiB, or -1 */
+static long proc_status_kb(const char *field)
+{
+    long kb = -1;
+#ifdef __linux__
+    size_t field_len = strlen(field);
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f) {
+        char line[256];
+        while (fgets(line, sizeof(line), f)) {
+            if (!strncmp(line, field, field_len) && line[field_len] == ':') {
+                kb = strtol(line + field_len + 1, NULL, 10);
+                break;
+            }
+        }
+        fclose(f);
+    }
+#endif
+    return kb;
+}
+
+/* Starts measuring the peak memory of an operation. Returns the resident
+ * set size to pass to rss_growth_kb(), or -1 if it can't be measured. */
+static long rss_growth_start(void)
+{
+#ifdef __linux__
+#ifdef __GLIBC__
+    /* hand freed heap back, so the operation has to grow the resident set */
+    malloc_trim(0);
+#endif
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (!f) {
+        return -1;
+    }
+    int ok = (fputs("5", f) >= 0);
+    if (fclose(f) != 0 || !ok) {
+        return -1;
+    }
+    return proc_status_kb("VmRSS");
+#else
+    return -1;
+#endif
+}
+
+/* Returns how far the resident set grew in KiB since rss_growth_start() */
+static long rss_growth_kb(long start)
+{
+    long peak;
+    if (start < 0) {
+        return -1;
+    }
+    peak = proc_status_kb("VmHWM");
+    if (peak < 0) {
+        return -1;
+    }
+    return (peak > start) ? peak - start : 0;
+}
+
+/* ---- generated corpora --------------------------------------------------- */
+
+/*
+ * The generated documents mirror the structure, key names and value mix of
+ * the replies they are named after, with deterministic pseudo-random content.
+ * Captured documents can be added with --corpus.
+ */
+
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void rng_word(char *buf, size_t len)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz";
+    size_t i;
+    for (i = 0; i < len; i++) {
+        buf[i] = chars[rng_next() % 26];
+    }
+    buf[len] = '\0';
+}
+
+static void rng_uuid(char *buf)
+{
+    snprintf(buf, 37, "%08X-%04X-%04X-%04X-%04X%08X", rng_next(), rng_next() & 0xFFFF, rng_next() & 0xFFFF, rng_next() & 0xFFFF, rng_next() & 0xFFFF, rng_next());
+}
+
+static plist_t rng_data(size_t len)
+{
+    char *buf = malloc(len);
+    size_t i;
+    for (i = 0; i < len; i++) {
+        buf[i] = (char)rng_next();
+    }
+    plist_t node = plist_new_data(buf, len);
+    free(buf);
+    return node;
+}
+
+static void bundle_id(char *buf, size_t size, unsigned int i)
+{
+    char vendor[12], app[16];
+    rng_word(vendor, 4 + rng_next() % 6);
+    rng_word(app, 4 + rng_next() % 10);
+    snprintf(buf, size, "com.%s.%s%u", vendor, app, i);
+}
+
+/* installation_proxy Browse reply */
+static plist_t generate_instproxy_browse(unsigned int scale)
+{
+    unsigned int count = 150 * scale;
+    unsigned int i, j;
+    plist_t list = plist_new_array();
+    for (i = 0; i < count; i++) {
+        char bid[64], name[24], uuid[40], path[160];
+        bundle_id(bid, sizeof(bid), i);
+        rng_word(name, 5 + rng_next() % 12);
+        rng_uuid(uuid);
+
+        plist_t app = plist_new_dict();
+        plist_dict_set_item(app, "CFBundleIdentifier", plist_new_string(bid));
+        plist_dict_set_item(app, "CFBundleName", plist_new_string(name));
+        plist_dict_set_item(app, "CFBundleDisplayName", plist_new_string(name));
+        plist_dict_set_item(app, "CFBundleExecutable", plist_new_string(name));
+        plist_dict_set_item(app, "CFBundleVersion", plist_new_string("1042.7"));
+        plist_dict_set_item(app, "CFBundleShortVersionString", plist_new_string("4.12.1"));
+        plist_dict_set_item(app, "CFBundlePackageType", plist_new_string("APPL"));
+        plist_dict_set_item(app, "ApplicationType", plist_new_string((i % 5) ? "User" : "System"));
+        snprintf(path, sizeof(path), "/private/var/containers/Bundle/Application/%s/%s.app", uuid, name);
+        plist_dict_set_item(app, "Path", plist_new_string(path));
+        rng_uuid(uuid);
+        snprintf(path, sizeof(path), "/private/var/mobile/Containers/Data/Application/%s", uuid);
+        plist_dict_set_item(app, "Container", plist_new_string(path));
+        plist_dict_set_item(app, "SignerIdentity", plist_new_string("Apple iPhone OS Application Signing"));
+        plist_dict_set_item(app, "MinimumOSVersion", plist_new_string("14.0"));
+        plist_dict_set_item(app, "IsAppClip", plist_new_bool(0));
+        plist_dict_set_item(app, "IsUpgradeable", plist_new_bool(1));
+        plist_dict_set_item(app, "StaticDiskUsage", plist_new_uint(rng_next() % 400000000));
+        plist_dict_set_item(app, "DynamicDiskUsage", plist_new_uint(rng_next() % 90000000));
+
+        plist_t families = plist_new_array();
+        plist_array_append_item(families, plist_new_uint(1));
+        plist_array_append_item(families, plist_new_uint(2));
+        plist_dict_set_item(app, "UIDeviceFamily", families);
+
+        plist_t ent = plist_new_dict();
+        char team[16], val[96];
+        rng_word(team, 10);
+        snprintf(val, sizeof(val), "%s.%s", team, bid);
+        plist_dict_set_item(ent, "application-identifier", plist_new_string(val));
+        plist_dict_set_item(ent, "com.apple.developer.team-identifier", plist_new_string(team));
+        plist_dict_set_item(ent, "get-task-allow", plist_new_bool(0));
+        plist_t groups = plist_new_array();
+        for (j = 0; j < 1 + rng_next() % 4; j++) {
+            snprintf(val, sizeof(val), "%s.%s.shared%u", team, bid, j);
+            plist_array_append_item(groups, plist_new_string(val));
+        }
+        plist_dict_set_item(ent, "keychain-access-groups", groups);
+        plist_dict_set_item(app, "Entitlements", ent);
+
+        plist_t schemes = plist_new_array();
+        for (j = 0; j < rng_next() % 3; j++) {
+            plist_t url = plist_new_dict();
+            plist_t s = plist_new_array();
+            rng_word(val, 6);
+            plist_array_append_item(s, plist_new_string(val));
+            plist_dict_set_item(url, "CFBundleURLSchemes", s);
+            plist_dict_set_item(url, "CFBundleURLName", plist_new_string(bid));
+            plist_array_append_item(schemes, url);
+        }
+        plist_dict_set_item(app, "CFBundleURLTypes", schemes);
+        plist_array_append_item(list, app);
+    }
+
+    plist_t reply = plist_new_dict();
+    plist_dict_set_item(reply, "Status", plist_new_string("BrowsingApplications"));
+    plist_dict_set_item(reply, "CurrentIndex", plist_new_uint(0));
+    plist_dict_set_item(reply, "CurrentAmount", plist_new_uint(count));
+    plist_dict_set_item(reply, "Total", plist_new_uint(count));
+    plist_dict_set_item(reply, "CurrentList", list);
+    return reply;
+}
+
+static plist_t generate_lockdown_values(void)
+{
+    static const char *strings[][2] = {
+        { "ActivationState", "Activated" },
+        { "BasebandVersion", "3.02.01" },
+        { "BuildVersion", "21A5291h" },
+        { "CPUArchitecture", "arm64e" },
+        { "DeviceClass", "iPhone" },
+        { "DeviceColor", "1" },
+        { "DeviceName", "iPhone" },
+        { "FirmwareVersion", "iBoot-10151.0.60" },
+        { "HardwareModel", "D74AP" },
+        { "HardwarePlatform", "t8120" },
+        { "ModelNumber", "MU663" },
+        { "ProductName", "iPhone OS" },
+        { "ProductType", "iPhone15,3" },
+        { "ProductVersion", "17.0" },
+        { "RegionInfo", "LL/A" },
+        { "SerialNumber", "F2LZK0QWNRL3" },
+        { "TimeZone", "America/New_York" },
+        { "WiFiAddress", "a4:c3:f0:11:22:33" },
+        { "BluetoothAddress", "a4:c3:f0:11:22:34" },
+        { "EthernetAddress", "a4:c3:f0:11:22:35" },
+    };
+    char uuid[40];
+    size_t i;
+    plist_t dict = plist_new_dict();
+    for (i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        plist_dict_set_item(dict, strings[i][0], plist_new_string(strings[i][1]));
+    }
+    rng_uuid(uuid);
+    plist_dict_set_item(dict, "UniqueDeviceID", plist_new_string(uuid));
+    plist_dict_set_item(dict, "UniqueChipID", plist_new_uint(((uint64_t)rng_next() << 20) | rng_next()));
+    plist_dict_set_item(dict, "ChipID", plist_new_uint(33056));
+    plist_dict_set_item(dict, "BoardId", plist_new_uint(12));
+    plist_dict_set_item(dict, "TimeIntervalSince1970", plist_new_real(1695000000.123));
+    plist_dict_set_item(dict, "PasswordProtected", plist_new_bool(1));
+    plist_dict_set_item(dict, "TrustedHostAttached", plist_new_bool(1));
+    plist_dict_set_item(dict, "DevicePublicKey", rng_data(426));
+    plist_dict_set_item(dict, "DeviceCertificate", rng_data(1216));
+    plist_dict_set_item(dict, "ProductionSOC", plist_new_bool(1));
+    plist_dict_set_item(dict, "SupportedDeviceFamilies", plist_new_array());
+    plist_array_append_item(plist_dict_get_item(dict, "SupportedDeviceFamilies"), plist_new_uint(1));
+
+    plist_t nvram = plist_new_dict();
+    plist_dict_set_item(nvram, "auto-boot", rng_data(4));
+    plist_dict_set_item(nvram, "backlight-level", rng_data(4));
+    plist_dict_set_item(nvram, "boot-args", rng_data(0));
+    plist_dict_set_item(nvram, "system-audio-volume", rng_data(2));
+    plist_dict_set_item(nvram, "oblit-begins", rng_data(40));
+    plist_dict_set_item(dict, "NonVolatileRAM", nvram);
+    return dict;
+}
+
+/* lockdown GetValue reply without a domain (full value dump) */
+static plist_t generate_lockdown_getvalue(unsigned int scale)
+{
+    plist_t reply = plist_new_dict();
+    (void)scale;
+    plist_dict_set_item(reply, "Request", plist_new_string("GetValue"));
+    plist_dict_set_item(reply, "Value", generate_lockdown_values());
+    return reply;
+}
+
+/* MobileBackup2 Manifest.plist */
+static plist_t generate_backup_manifest(unsigned int scale)
+{
+    unsigned int count = 300 * scale;
+    unsigned int i;
+    plist_t apps = plist_new_dict();
+    for (i = 0; i < count; i++) {
+        char bid[64], path[128], name[24];
+        bundle_id(bid, sizeof(bid), i);
+        rng_word(name, 5 + rng_next() % 10);
+        plist_t app = plist_new_dict();
+        plist_dict_set_item(app, "CFBundleIdentifier", plist_new_string(bid));
+        plist_dict_set_item(app, "CFBundleVersion", plist_new_string("312"));
+        plist_dict_set_item(app, "ContainerContentClass", plist_new_string("Data/Application"));
+        snprintf(path, sizeof(path), "/var/containers/Bundle/Application/%s.app", name);
+        plist_dict_set_item(app, "Path", plist_new_string(path));
+        plist_dict_set_item(apps, bid, app);
+    }
+
+    plist_t manifest = plist_new_dict();
+    plist_dict_set_item(manifest, "Applications", apps);
+    plist_dict_set_item(manifest, "BackupKeyBag", rng_data(2048 + 64 * scale));
+    plist_dict_set_item(manifest, "Date", plist_new_date(716000000, 0));
+    plist_dict_set_item(manifest, "IsEncrypted", plist_new_bool(1));
+    plist_dict_set_item(manifest, "Lockdown", generate_lockdown_values());
+    plist_dict_set_item(manifest, "ManifestKey", rng_data(44));
+    plist_dict_set_item(manifest, "SystemDomainsVersion", plist_new_string("24.0"));
+    plist_dict_set_item(manifest, "Version", plist_new_string("10.0"));
+    plist_dict_set_item(manifest, "WasPasscodeSet", plist_new_bool(1));
+    return manifest;
+}
+
+static plist_t generate_ioreg_entry(unsigned int depth, unsigned int breadth, uint64_t *next_id)
+{
+    static const char *classes[] = { "IOService", "AppleARMIODevice", "IOPlatformDevice", "AppleT8120PMGR", "IOUSBHostDevice", "AppleSPUHIDDevice" };
+    char name[24], compat[48];
+    unsigned int i;
+    plist_t entry = plist_new_dict();
+    rng_word(name, 3 + rng_next() % 8);
+    snprintf(compat, sizeof(compat), "%s,t8120", name);
+    plist_dict_set_item(entry, "IOObjectClass", plist_new_string(classes[rng_next() % 6]));
+    plist_dict_set_item(entry, "IORegistryEntryName", plist_new_string(name));
+    plist_dict_set_item(entry, "IORegistryEntryID", plist_new_uint(0x100000000ULL + (*next_id)++));
+    plist_dict_set_item(entry, "IOServiceBusyState", plist_new_uint(0));
+    plist_dict_set_item(entry, "IOObjectRetainCount", plist_new_uint(rng_next() % 40));
+    plist_dict_set_item(entry, "compatible", plist_new_data(compat, strlen(compat) + 1));
+    plist_dict_set_item(entry, "reg", rng_data(16));
+    plist_dict_set_item(entry, "AAPL,phandle", rng_data(4));
+    if (depth > 0) {
+        plist_t children = plist_new_array();
+        unsigned int n = 1 + rng_next() % breadth;
+        for (i = 0; i < n; i++) {
+            plist_array_append_item(children, generate_ioreg_entry(depth - 1, breadth, next_id));
+        }
+        plist_dict_set_item(entry, "IORegistryEntryChildren", children);
+    }
+    return entry;
+}
+
+/* diagnostics_relay IORegistry reply for a whole plane */
+static plist_t generate_ioregistry_plane(unsigned int scale)
+{
+    uint64_t next_id = 1;
+    plist_t reply = plist_new_dict();
+    plist_t diag = plist_new_dict();
+    plist_dict_set_item(diag, "IORegistry", generate_ioreg_entry(7, 3 + scale, &next_id));
+    plist_dict_set_item(reply, "Diagnostics", diag);
+    plist_dict_set_item(reply, "Status", plist_new_string("Success"));
+    return reply;
+}
+
+/* webinspector _rpc_forwardSocketData: message carrying a JSON protocol message */
+static plist_t generate_webinspector_message(unsigned int scale)
+{
+    char uuid[40], json[4096];
+    size_t len = 0;
+    unsigned int i;
+    len += snprintf(json + len, sizeof(json) - len, "{\"id\":17,\"method\":\"Runtime.evaluate\",\"params\":{\"expression\":\"");
+    for (i = 0; i < 40 * scale && len < sizeof(json) - 64; i++) {
+        char word[12];
+        rng_word(word, 2 + rng_next() % 8);
+        len += snprintf(json + len, sizeof(json) - len, "%s.", word);
+    }
+    len += snprintf(json + len, sizeof(json) - len, "\",\"returnByValue\":true}}");
+
+    plist_t args = plist_new_dict();
+    plist_dict_set_item(args, "WIRApplicationIdentifierKey", plist_new_string("PID:1733"));
+    rng_uuid(uuid);
+    plist_dict_set_item(args, "WIRConnectionIdentifierKey", plist_new_string(uuid));
+    rng_uuid(uuid);
+    plist_dict_set_item(args, "WIRSenderKey", plist_new_string(uuid));
+    plist_dict_set_item(args, "WIRPageIdentifierKey", plist_new_uint(3));
+    plist_dict_set_item(args, "WIRSocketDataKey", plist_new_data(json, len));
+
+    plist_t msg = plist_new_dict();
+    plist_dict_set_item(msg, "__selector", plist_new_string("_rpc_forwardSocketData:"));
+    plist_dict_set_item(msg, "__argument", args);
+    return msg;
+}
+
+static const struct {
+    const char *name;
+    plist_t (*generate)(unsigned int scale);
+} generators[] = {
+    { "instproxy_browse", generate_instproxy_browse },
+    { "backup_manifest", generate_backup_manifest },
+    { "lockdown_getvalue", generate_lockdown_getvalue },
+    { "ioregistry_plane", generate_ioregistry_plane },
+    { "webinspector_message", generate_webinspector_message },
+};
+
+static void corpus_add(corpus_t *corpus, const char *name, plist_t root)
+{
+    if (corpus->count == corpus->capacity) {
+        corpus->capacity = corpus->capacity ? corpus->capacity * 2 : 16;
+        corpus->entries = realloc(corpus->entries, corpus->capacity * sizeof(corpus_entry_t));
+    }
+    corpus->entries[corpus->count].name = strdup(name);
+    corpus->entries[corpus->count].root = root;
+    corpus->count++;
+}
+
+static int corpus_add_file(corpus_t *corpus, const char *path, const char *name)
+{
+    FILE *f = fopen(path, "rb");
+    struct stat st;
+    if (!f) {
+        fprintf(stderr, "ERROR: Could not open '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fileno(f), &st) != 0 || st.st_size < 8) {
+        fclose(f);
+        return -1;
+    }
+    char *buf = malloc(st.st_size);
+    size_t len = fread(buf, 1, st.st_size, f);
+    fclose(f);
+    plist_t root = NULL;
+    plist_from_memory(buf, (uint32_t)len, &root);
+    free(buf);
+    if (!root) {
+        fprintf(stderr, "WARNING: Skipping '%s': not a plist\n", path);
+        return -1;
+    }
+    corpus_add(corpus, name, root);
+    return 0;
+}
+
+static int corpus_add_dir(corpus_t *corpus, const char *dir)
+{
+#ifdef WIN32
+    char pattern[MAX_PATH];
+    WIN32_FIND_DATAA fd;
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (h == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "ERROR: Could not open corpus directory '%s'\n", dir);
+        return -1;
+    }
+    do {
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            char path[MAX_PATH];
+            snprintf(path, sizeof(path), "%s\\%s", dir, fd.cFileName);
+            corpus_add_file(corpus, path, fd.cFileName);
+        }
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR *d = opendir(dir);
+    struct dirent *ep;
+    if (!d) {
+        fprintf(stderr, "ERROR: Could not open corpus directory '%s': %s\n", dir, strerror(errno));
+        return -1;
+    }
+    while ((ep = readdir(d))) {
+        char path[4096];
+        struct stat st;
+        if (ep->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, ep->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+            corpus_add_file(corpus, path, ep->d_name);
+        }
+    }
+    closedir(d);
+#endif
+    return 0;
+}
+
+/* ---- operations ---------------------------------------------------------- */
+
+static plist_err_t serialize(plist_t root, int format, char **out, uint32_t *len)
+{
+    switch (format) {
+        case FORMAT_BIN:
+            return plist_to_bin(root, out, len);
+        case FORMAT_XML:
+            return plist_to_xml(root, out, len);
+        default:
+            return plist_to_json(root, out, len, 0);
+    }
+}
+
+static plist_err_t parse(const char *data, uint32_t len, int format, plist_t *root)
+{
+    switch (format) {
+        case FORMAT_BIN:
+            return plist_from_bin(data, len, root);
+        case FORMAT_XML:
+            return plist_from_xml(data, len, root);
+        default:
+            return plist_from_json(data, len, root);
+    }
+}
+
+/* Copy of node with data values as hex strings and dates as seconds since 2001 */
+static plist_t json_projection(plist_t node)
+{
+    plist_t copy = NULL;
+    if (PLIST_IS_DICT(node)) {
+        plist_dict_iter iter = NULL;
+        plist_t sub = NULL;
+        copy = plist_new_dict();
+        plist_dict_new_iter(node, &iter);
+        do {
+            char *key = NULL;
+            sub = NULL;
+            plist_dict_next_item(node, iter, &key, &sub);
+            if (sub) {
+                plist_dict_set_item(copy, key, json_projection(sub));
+            }
+            free(key);
+        } while (sub);
+        free(iter);
+    } else if (PLIST_IS_ARRAY(node)) {
+        uint32_t i, n = plist_array_get_size(node);
+        copy = plist_new_array();
+        for (i = 0; i < n; i++) {
+            plist_array_append_item(copy, json_projection(plist_array_get_item(node, i)));
+        }
+    } else if (PLIST_IS_DATA(node)) {
+        static const char hex[] = "0123456789abcdef";
+        uint64_t i, len = 0;
+        const char *data = plist_get_data_ptr(node, &len);
+        char *str = malloc(len * 2 + 1);
+        for (i = 0; i < len; i++) {
+            str[i * 2] = hex[(unsigned char)data[i] >> 4];
+            str[i * 2 + 1] = hex[(unsigned char)data[i] & 0xF];
+        }
+        str[len * 2] = '\0';
+        copy = plist_new_string(str);
+        free(str);
+    } else if (PLIST_IS_DATE(node)) {
+        int32_t sec = 0, usec = 0;
+        plist_get_date_val(node, &sec, &usec);
+        copy = plist_new_real(sec + usec / 1000000.0);
+    } else {
+        copy = plist_copy(node);
+    }
+    return copy;
+}
+
+typedef struct {
+    plist_t dict;
+    char *key;
+} lookup_t;
+
+typedef struct {
+    lookup_t *items;
+    size_t count;
+    size_t capacity;
+} lookup_list_t;
+
+/* Collects (dict, key) pairs from the whole tree, up to a fixed number */
+static void collect_lookups(plist_t node, lookup_list_t *list)
+{
+    if (list->count >= 4096) {
+        return;
+    }
+    if (PLIST_IS_DICT(node)) {
+        plist_dict_iter iter = NULL;
+        plist_dict_new_iter(node, &iter);
+        plist_t sub = NULL;
+        do {
+            char *key = NULL;
+            sub = NULL;
+            plist_dict_next_item(node, iter, &key, &sub);
+            if (sub) {
+                if (list->count < 4096) {
+                    if (list->count == list->capacity) {
+                        list->capacity = list->capacity ? list->capacity * 2 : 64;
+                        list->items = realloc(list->items, list->capacity * sizeof(lookup_t));
+                    }
+                    list->items[list->count].dict = node;
+                    list->items[list->count].key = key;
+                    list->count++;
+                } else {
+                    free(key);
+                }
+                collect_lookups(sub, list);
+            }
+        } while (sub);
+        free(iter);
+    } else if (PLIST_IS_ARRAY(node)) {
+        uint32_t i, n = plist_array_get_size(node);
+        for (i = 0; i < n; i++) {
+            collect_lookups(plist_array_get_item(node, i), list);
+        }
+    }
+}
+
+static double allocs_per_op(uint64_t allocs, uint64_t ops)
+{
+#ifdef HAVE_ALLOC_COUNT
+    return ops ? (double)allocs / (double)ops : 0;
+#else
+    (void)allocs;
+    (void)ops;
+    return -1;
+#endif
+}
+
+static void add_result(result_t **results, size_t *count, result_t r)
+{
+    *results = realloc(*results, (*count + 1) * sizeof(result_t));
+    (*results)[(*count)++] = r;
+}
+
+/* upper bound for the parse batch so big documents don't exhaust memory */
+#define BATCH_BYTES_MAX (64 * 1024 * 1024)
+#define BATCH_MAX 256
+
+static void bench_format(const corpus_entry_t *entry, int format, const options_t *options, result_t **results, size_t *count)
+{
+    uint64_t min_time = (uint64_t)options->min_time_ms * 1000000ULL;
+    char *data = NULL;
+    uint32_t len = 0;
+    uint64_t ops, elapsed, allocs, t;
+    plist_t root = entry->root;
+    plist_t projection = NULL;
+
+    if (format == FORMAT_JSON && serialize(root, format, &data, &len) == PLIST_ERR_FORMAT) {
+        /* JSON has no data or date type, measure the closest equivalent document */
+        projection = json_projection(root);
+        root = projection;
+        if (!options->json) {
+            fprintf(stderr, "NOTE: %s: data and date values are benchmarked as JSON strings and numbers\n", entry->name);
+        }
+    }
+    if (!data && (serialize(root, format, &data, &len) != PLIST_ERR_SUCCESS || !data)) {
+        fprintf(stderr, "WARNING: %s cannot be represented as %s, skipped\n", entry->name, format_names[format]);
+        plist_mem_free(data);
+        plist_free(projection);
+        return;
+    }
+
+    /* peak memory of parsing and then serializing one document */
+    plist_t tree = NULL;
+    long rss = rss_growth_start();
+    parse(data, len, format, &tree);
+    long parse_rss = rss_growth_kb(rss);
+    char *out = NULL;
+    uint32_t out_len = 0;
+    rss = rss_growth_start();
+    serialize(tree, format, &out, &out_len);
+    long serialize_rss = rss_growth_kb(rss);
+    plist_mem_free(out);
+    plist_free(tree);
+
+    /* parse and free, in batches so free is measured on its own */
+    size_t batch = BATCH_BYTES_MAX / (len + 1);
+    if (batch > BATCH_MAX) {
+        batch = BATCH_MAX;
+    } else if (batch == 0) {
+        batch = 1;
+    }
+    plist_t *trees = calloc(batch, sizeof(plist_t));
+    uint64_t parse_ops = 0, parse_ns = 0, parse_allocs = 0;
+    uint64_t free_ns = 0;
+    size_t i, n = 1;
+    do {
+        allocs = alloc_count;
+        t = now_ns();
+        for (i = 0; i < n; i++) {
+            parse(data, len, format, &trees[i]);
+        }
+        parse_ns += now_ns() - t;
+        parse_allocs += alloc_count - allocs;
+        parse_ops += n;
+        t = now_ns();
+        for (i = 0; i < n; i++) {
+            plist_free(trees[i]);
+            trees[i] = NULL;
+        }
+        free_ns += now_ns() - t;
+        if (n < batch) {
+            n *= 2;
+            if (n > batch) {
+                n = batch;
+            }
+        }
+    } while (parse_ns < min_time);
+    free(trees);
+
+    result_t r = { entry->name, format_names[format], "parse", parse_ops, (double)parse_ns / parse_ops, (double)len * parse_ops / (parse_ns / 1e9) / 1e6, allocs_per_op(parse_allocs, parse_ops), parse_rss };
+    add_result(results, count, r);
+    result_t f = { entry->name, format_names[format], "free", parse_ops, (double)free_ns / parse_ops, -1, allocs_per_op(0, parse_ops), -1 };
+    add_result(results, count, f);
+
+    /* serialize */
+    ops = 0;
+    allocs = alloc_count;
+    t = now_ns();
+    do {
+        out = NULL;
+        serialize(root, format, &out, &out_len);
+        plist_mem_free(out);
+        ops++;
+        elapsed = now_ns() - t;
+    } while (elapsed < min_time);
+    allocs = alloc_count - allocs;
+    result_t s = { entry->name, format_names[format], "serialize", ops, (double)elapsed / ops, (double)len * ops / (elapsed / 1e9) / 1e6, allocs_per_op(allocs, ops), serialize_rss };
+    add_result(results, count, s);
+
+    plist_mem_free(data);
+    plist_free(projection);
+}
+
+/* copy and dict lookup work on the in-memory tree and don't depend on the format */
+static void bench_tree(const corpus_entry_t *entry, const options_t *options, result_t **results, size_t *count)
+{
+    uint64_t min_time = (uint64_t)options->min_time_ms * 1000000ULL;
+    uint64_t ops = 0, copy_ns = 0, copy_allocs = 0, allocs, t;
+    size_t i;
+
+    do {
+        allocs = alloc_count;
+        t = now_ns();
+        plist_t copy = plist_copy(entry->root);
+        copy_ns += now_ns() - t;
+        copy_allocs += alloc_count - allocs;
+        plist_free(copy);
+        ops++;
+    } while (copy_ns < min_time);
+    result_t c = { entry->name, "-", "copy", ops, (double)copy_ns / ops, -1, allocs_per_op(copy_allocs, ops), -1 };
+    add_result(results, count, c);
+
+    lookup_list_t lookups = { NULL, 0, 0 };
+    collect_lookups(entry->root, &lookups);
+    if (lookups.count == 0) {
+        return;
+    }
+    uint64_t found = 0, elapsed;
+    ops = 0;
+    allocs = alloc_count;
+    t = now_ns();
+    do {
+        for (i = 0; i < lookups.count; i++) {
+            found += plist_dict_get_item(lookups.items[i].dict, lookups.items[i].key) != NULL;
+        }
+        ops += lookups.count;
+        elapsed = now_ns() - t;
+    } while (elapsed < min_time);
+    allocs = alloc_count - allocs;
+    if (found != ops) {
+        fprintf(stderr, "WARNING: %s: %llu of %llu lookups failed\n", entry->name, (unsigned long long)(ops - found), (unsigned long long)ops);
+    }
+    result_t l = { entry->name, "-", "lookup", ops, (double)elapsed / ops, -1, allocs_per_op(allocs, ops), -1 };
+    add_result(results, count, l);
+
+    for (i = 0; i < lookups.count; i++) {
+        free(lookups.items[i].key);
+    }
+    free(lookups.items);
+}
+
+/* ---- output ---------------------------------------------------------------- */
+
+static void print_json_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void print_json_number(FILE *out, double value)
+{
+    if (value < 0) {
+        fputs("null", out);
+    } else {
+        fprintf(out, "%.3f", value);
+    }
+}
+
+static void print_results_json(FILE *out, const corpus_t *corpus, const result_t *results, size_t count)
+{
+    size_t i;
+    fprintf(out, "{\n  \"benchmark\": \"plist_bench\",\n  \"corpus\": [");
+    for (i = 0; i < corpus->count; i++) {
+        fputs(i ? ", " : "", out);
+        print_json_string(out, corpus->entries[i].name);
+    }
+    fprintf(out, "],\n  \"results\": [\n");
+    for (i = 0; i < count; i++) {
+        const result_t *r = &results[i];
+        fprintf(out, "    {\"corpus\": ");
+        print_json_string(out, r->corpus);
+        fprintf(out, ", \"format\": \"%s\", \"op\": \"%s\", \"iterations\": %llu, \"ns_per_op\": ", r->format, r->op, (unsigned long long)r->iterations);
+        print_json_number(out, r->ns_per_op);
+        fprintf(out, ", \"mb_per_s\": ");
+        print_json_number(out, r->mb_per_s);
+        fprintf(out, ", \"allocs_per_op\": ");
+        print_json_number(out, r->allocs_per_op);
+        fprintf(out, ", \"peak_rss_growth_kb\": ");
+        if (r->rss_growth_kb < 0) {
+            fputs("null", out);
+        } else {
+            fprintf(out, "%ld", r->rss_growth_kb);
+        }
+        fprintf(out, "}%s\n", (i + 1 < count) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void print_results_table(FILE *out, const result_t *results, size_t count)
+{
+    size_t i;
+    fprintf(out, "%-24s %-6s %-10s %12s %14s %10s %12s %12s\n", "corpus", "format", "op", "iterations", "ns/op", "MB/s", "allocs/op", "peak +RSS kB");
+    for (i = 0; i < count; i++) {
+        const result_t *r = &results[i];
+        char mbs[32] = "-", allocs[32] = "-", rss[32] = "-";
+        if (r->mb_per_s >= 0) {
+            snprintf(mbs, sizeof(mbs), "%.1f", r->mb_per_s);
+        }
+        if (r->allocs_per_op >= 0) {
+            snprintf(allocs, sizeof(allocs), "%.1f", r->allocs_per_op);
+        }
+        if (r->rss_growth_kb >= 0) {
+            snprintf(rss, sizeof(rss), "%ld", r->rss_growth_kb);
+        }
+        fprintf(out, "%-24s %-6s %-10s %12llu %14.1f %10s %12s %12s\n", r->corpus, r->format, r->op, (unsigned long long)r->iterations, r->ns_per_op, mbs, allocs, rss);
+    }
+}
+
+/* ---- main ------------------------------------------------------------------ */
+
+static void print_usage(int argc, char *argv[])
+{
+    char *name = NULL;
+    name = strrchr(argv[0], '/');
+    printf("Usage: %s [OPTIONS]\n", (name ? name + 1: argv[0]));
+    printf("\n");
+    printf("Benchmark parsing, serializing, copying, dictionary lookup and freeing\n");
+    printf("of plists in binary, XML, and JSON format.\n");
+    printf("\n");
+    printf("OPTIONS:\n");
+    printf("  -c, --corpus DIR     Also benchmark every plist file found in DIR\n");
+    printf("  -n, --no-generated   Skip the built-in generated documents\n");
+    printf("  -f, --format FORMAT  Only benchmark FORMAT (bin, xml, or json); repeatable\n");
+    printf("  -t, --time MS        Minimum run time per measurement (default 200)\n");
+    printf("  -s, --scale N        Size multiplier for the generated documents (default 1)\n");
+    printf("  -j, --json           Print machine-readable JSON instead of a table\n");
+    printf("  -o, --outfile FILE   Write results to FILE instead of stdout\n");
+    printf("  -l, --list           List the corpus documents and their sizes, then exit\n");
+    printf("\n");
+}
+
+static options_t *parse_arguments(int argc, char *argv[])
+{
+    int i = 0;
+    int have_format = 0;
+
+    options_t *options = (options_t*)calloc(1, sizeof(options_t));
+    options->min_time_ms = 200;
+    options->scale = 1;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--corpus") || !strcmp(argv[i], "-c"))
+        {
+            if ((i + 1) == argc)
+            {
+                free(options);
+                return NULL;
+            }
+            options->corpus_dir = argv[i + 1];
+            i++;
+            continue;
+        }
+        else if (!strcmp(argv[i], "--outfile") || !strcmp(argv[i], "-o"))
+        {
+            if ((i + 1) == argc)
+            {
+                free(options);
+                return NULL;
+            }
+            options->out_file = argv[i + 1];
+            i++;
+            continue;
+        }
+        else if (!strcmp(argv[i], "--format") || !strcmp(argv[i], "-f"))
+        {
+            int fmt;
+            if ((i + 1) == argc)
+            {
+                free(options);
+                return NULL;
+            }
+            for (fmt = 0; fmt < FORMAT_COUNT; fmt++) {
+                if (!strcmp(argv[i+1], format_names[fmt])) {
+                    break;
+                }
+            }
+            if (fmt == FORMAT_COUNT) {
+                fprintf(stderr, "ERROR: Unsupported format '%s'\n", argv[i+1]);
+                free(options);
+                return NULL;
+            }
+            options->formats[fmt] = 1;
+            have_format = 1;
+            i++;
+            continue;
+        }
+        else if (!strcmp(argv[i], "--time") || !strcmp(argv[i], "-t"))
+        {
+            if ((i + 1) == argc)
+            {
+                free(options);
+                return NULL;
+            }
+            options->min_time_ms = (unsigned int)strtoul(argv[i + 1], NULL, 10);
+            i++;
+            continue;
+        }
+        else if (!strcmp(argv[i], "--scale") || !strcmp(argv[i], "-s"))
+        {
+            if ((i + 1) == argc)
+            {
+                free(options);
+                return NULL;
+            }
+            options->scale = (unsigned int)strtoul(argv[i + 1], NULL, 10);
+            if (options->scale == 0) {
+                options->scale = 1;
+            }
+            i++;
+            continue;
+        }
+        else if (!strcmp(argv[i], "--no-generated") || !strcmp(argv[i], "-n"))
+        {
+            options->no_generated = 1;
+        }
+        else if (!strcmp(argv[i], "--json") || !strcmp(argv[i], "-j"))
+        {
+            options->json = 1;
+        }
+        else if (!strcmp(argv[i], "--list") || !strcmp(argv[i], "-l"))
+        {
+            options->list = 1;
+        }
+        else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+        {
+            free(options);
+            return NULL;
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Invalid option '%s'\n", argv[i]);
+            free(options);
+            return NULL;
+        }
+    }
+
+    if (!have_format) {
+        memset(options->formats, 1, sizeof(options->formats));
+    }
+
+    return options;
+}
+
+int main(int argc, char *argv[])
+{
+    corpus_t corpus = { NULL, 0, 0 };
+    result_t *results = NULL;
+    size_t count = 0;
+    size_t i;
+    int fmt;
+    FILE *out = stdout;
+    options_t *options = parse_arguments(argc, argv);
+
+    if (!options)
+    {
+        print_usage(argc, argv);
+        return 0;
+    }
+
+    if (!options->no_generated) {
+        for (i = 0; i < sizeof(generators) / sizeof(generators[0]); i++) {
+            corpus_add(&corpus, generators[i].name, generators[i].generate(options->scale));
+        }
+    }
+    if (options->corpus_dir && corpus_add_dir(&corpus, options->corpus_dir) < 0) {
+        free(options);
+        return 1;
+    }
+    if (corpus.count == 0) {
+        fprintf(stderr, "ERROR: The corpus is empty\n");
+        free(options);
+        return 1;
+    }
+
+    if (options->out_file && strcmp(options->out_file, "-") != 0) {
+        out = fopen(options->out_file, "w");
+        if (!out) {
+            fprintf(stderr, "ERROR: Could not open output file '%s': %s\n", options->out_file, strerror(errno));
+            free(options);
+            return 1;
+        }
+    }
+
+    if (options->list) {
+        for (i = 0; i < corpus.count; i++) {
+            fprintf(out, "%-24s", corpus.entries[i].name);
+            for (fmt = 0; fmt < FORMAT_COUNT; fmt++) {
+                char *data = NULL;
+                uint32_t len = 0;
+                if (serialize(corpus.entries[i].root, fmt, &data, &len) == PLIST_ERR_SUCCESS) {
+                    fprintf(out, " %s=%u", format_names[fmt], len);
+                }
+                plist_mem_free(data);
+            }
+            fprintf(out, "\n");
+        }
+    } else {
+        for (i = 0; i < corpus.count; i++) {
+            for (fmt = 0; fmt < FORMAT_COUNT; fmt++) {
+                if (options->formats[fmt]) {
+                    bench_format(&corpus.entries[i], fmt, options, &results, &count);
+                }
+            }
+            bench_tree(&corpus.entries[i], options, &results, &count);
+        }
+        if (options->json) {
+            print_results_json(out, &corpus, results, count);
+        } else {
+            print_results_table(out, results, count);
+        }
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    for (i = 0; i < corpus.count; i++) {
+        free(corpus.entries[i].name);
+        plist_free(corpus.entries[i].root);
+    }
+    free(corpus.entries);
+    free(results);
+    free(options);
+    return 0;
+}
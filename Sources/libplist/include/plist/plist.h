@@ -127,6 +127,7 @@ extern "C"
         PLIST_ERR_FORMAT       = -2,  /**< the plist contains nodes not compatible with the output format */
         PLIST_ERR_PARSE        = -3,  /**< parsing of the input format failed */
         PLIST_ERR_NO_MEM       = -4,  /**< not enough memory to handle the operation */
+        PLIST_ERR_IO           = -5,  /**< writing the output failed */
         PLIST_ERR_UNKNOWN      = -255 /**< an unspecified error occurred */
     } plist_err_t;
 
@@ -475,6 +476,19 @@ extern "C"
      */
     void plist_get_key_val(plist_t node, char **val);
 
+    /**
+     * Get a pointer to the buffer of a #PLIST_KEY node.
+     *
+     * @note DO NOT MODIFY the buffer. Mind that the buffer is only available
+     *   until the plist node gets freed. Make a copy if needed.
+     *
+     * @param node The node
+     * @param length If non-NULL, will be set to the length of the key
+     *
+     * @return Pointer to the NULL-terminated buffer.
+     */
+    const char* plist_get_key_ptr(plist_t node, uint64_t* length);
+
     /**
      * Get the value of a #PLIST_STRING node.
      * This function does nothing if node is not of type #PLIST_STRING
@@ -712,6 +726,54 @@ extern "C"
      */
     plist_err_t plist_to_json(plist_t plist, char **plist_json, uint32_t* length, int prettify);
 
+    /**
+     * Callback receiving the output of plist_write_xml() or
+     * plist_write_json(), one chunk at a time.
+     *
+     * @param data the next chunk of output
+     * @param length the length of the chunk
+     * @param user_data the user data passed to the writer
+     * @return 0 on success, or a negative value to stop writing.
+     */
+    typedef int (*plist_write_cb_t)(const char *data, size_t length, void *user_data);
+
+    /**
+     * Write the #plist_t structure in XML format through a callback.
+     *
+     * The document is produced in chunks of at most 64 KiB that are handed
+     * to the callback as soon as they are full, so the memory used does not
+     * depend on the size of the document.
+     *
+     * @param plist the root node to export
+     * @param write_cb the callback receiving the output, e.g. writing it to a
+     *     file, descriptor or socket
+     * @param user_data user data passed to the callback
+     * @return PLIST_ERR_SUCCESS on success, PLIST_ERR_IO if the callback
+     *     failed, or another #plist_err_t on failure
+     * @note The tree is validated first, so the callback is not called if
+     *     it can't be exported. If the callback fails, part of the document
+     *     may already have been written.
+     */
+    plist_err_t plist_write_xml(plist_t plist, plist_write_cb_t write_cb, void *user_data);
+
+    /**
+     * Write the #plist_t structure in JSON format through a callback.
+     *
+     * Like plist_write_xml(), the output is handed to the callback in chunks
+     * while it is being produced.
+     *
+     * @param plist the root node to export
+     * @param write_cb the callback receiving the output
+     * @param user_data user data passed to the callback
+     * @param prettify pretty print the output if != 0
+     * @return PLIST_ERR_SUCCESS on success, PLIST_ERR_IO if the callback
+     *     failed, or another #plist_err_t on failure
+     * @note Nodes of a type JSON can't represent are reported as
+     *     PLIST_ERR_FORMAT before the callback is called. If the callback
+     *     fails, part of the document may already have been written.
+     */
+    plist_err_t plist_write_json(plist_t plist, plist_write_cb_t write_cb, void *user_data, int prettify);
+
     /**
      * Import the #plist_t structure from XML format.
      *
@@ -810,6 +872,19 @@ extern "C"
      */
     char plist_compare_node_value(plist_t node_l, plist_t node_r);
 
+    /**
+     * Compare two plists structurally, including everything below them.
+     *
+     * Arrays are equal if their items are equal in order, dictionaries if
+     * they hold the same keys with equal values in any order. Subtrees and
+     * keys shared by both plists are not walked again.
+     *
+     * @param node_l left plist to compare
+     * @param node_r right plist to compare
+     * @return 1 if both plists are equal, 0 otherwise.
+     */
+    int plist_equal(plist_t node_l, plist_t node_r);
+
     #define _PLIST_IS_TYPE(__plist, __plist_type) (__plist && (plist_get_node_type(__plist) == PLIST_##__plist_type))
 
     /* Helper macros for the different plist types */
@@ -1022,6 +1097,20 @@ extern "C"
      */
     void plist_mem_free(void* ptr);
 
+    /**
+     * Enable or disable the interning of dictionary keys.
+     *
+     * While enabled (the default), every distinct dictionary key is stored
+     * once and shared by all nodes holding it, so keys that repeat across
+     * many dictionaries cost no extra memory. Interned keys stay allocated
+     * until the process exits.
+     *
+     * @param enabled 0 to stop interning new keys, any other value to resume.
+     *
+     * @note Keys interned before interning was disabled remain shared.
+     */
+    void plist_set_key_interning(int enabled);
+
     /*@}*/
 
 #ifdef __cplusplus
@@ -30,12 +30,11 @@
 
 struct node_list_t;
 
-// This class implements the abstract iterator class
+// Children are kept in a contiguous array owned by the parent, so they can
+// be indexed directly and each node knows its position among its siblings
 typedef struct node_t {
-	// Super class
-	struct node_t* next;
-	struct node_t* prev;
 	unsigned int count;
+	unsigned int index;
 
 	// Local Members
 	void *data;
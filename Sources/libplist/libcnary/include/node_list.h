@@ -26,20 +26,17 @@
 
 struct node_t;
 
-// This class implements the list_t abstract class
+// Growable array of the children of a node
 typedef struct node_list_t {
-	// list_t members
-	struct node_t* begin;
-	struct node_t* end;
-
-	// node_list_t members
+	struct node_t** items;
 	unsigned int count;
-
+	unsigned int capacity;
 } node_list_t;
 
 void node_list_destroy(struct node_list_t* list);
 struct node_list_t* node_list_create();
 
+int node_list_reserve(node_list_t* list, unsigned int capacity);
 int node_list_add(node_list_t* list, node_t* node);
 int node_list_insert(node_list_t* list, unsigned int index, node_t* node);
 int node_list_remove(node_list_t* list, node_t* node);
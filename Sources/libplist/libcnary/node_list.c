@@ -29,6 +29,8 @@
 #include "node_list.h"
 
 void node_list_destroy(node_list_t* list) {
+	if (!list) return;
+	free(list->items);
 	free(list);
 }
 
@@ -39,36 +41,55 @@ node_list_t* node_list_create() {
 	}
 
 	// Initialize structure
-	list->begin = NULL;
-	list->end = NULL;
+	list->items = NULL;
 	list->count = 0;
+	list->capacity = 0;
 	return list;
 }
 
-int node_list_add(node_list_t* list, node_t* node) {
-	if (!list || !node) return -1;
-
-	// Find the last element in the list
-	node_t* last = list->end;
+static int node_list_grow(node_list_t* list) {
+	if (list->count < list->capacity) {
+		return 0;
+	}
+	unsigned int capacity = (list->capacity) ? list->capacity * 2 : 4;
+	node_t** items = (node_t**)realloc(list->items, capacity * sizeof(node_t*));
+	if (!items) {
+		return -1;
+	}
+	list->items = items;
+	list->capacity = capacity;
+	return 0;
+}
 
-	// Setup our new node as the new last element
-	node->next = NULL;
-	node->prev = last;
+// Makes room for at least the given number of children without regrowing
+int node_list_reserve(node_list_t* list, unsigned int capacity) {
+	if (!list) return -1;
+	if (capacity <= list->capacity) {
+		return 0;
+	}
+	node_t** items = (node_t**)realloc(list->items, capacity * sizeof(node_t*));
+	if (!items) {
+		return -1;
+	}
+	list->items = items;
+	list->capacity = capacity;
+	return 0;
+}
 
-	// Set the next element of our old "last" element
-	if (last) {
-		// but only if the node list is not empty
-		last->next = node;
-	} else {
-		// otherwise this is the start of the list
-		list->begin = node;
+// Updates the positions stored in the nodes from the given index onwards
+static void node_list_renumber(node_list_t* list, unsigned int node_index) {
+	unsigned int i;
+	for (i = node_index; i < list->count; i++) {
+		list->items[i]->index = i;
 	}
+}
 
-	// Set the lists prev to the new last element
-	list->end = node;
+int node_list_add(node_list_t* list, node_t* node) {
+	if (!list || !node) return -1;
+	if (node_list_grow(list) < 0) return -1;
 
-	// Increment our node count for this list
-	list->count++;
+	node->index = list->count;
+	list->items[list->count++] = node;
 	return 0;
 }
 
@@ -77,46 +98,12 @@ int node_list_insert(node_list_t* list, unsigned int node_index, node_t* node) {
 	if (node_index >= list->count) {
 		return node_list_add(list, node);
 	}
+	if (node_list_grow(list) < 0) return -1;
 
-	// Get the first element in the list
-	node_t* cur = list->begin;
-
-	unsigned int pos = 0;
-	node_t* prev = NULL;
-
-	if (node_index > 0) {
-		while (pos < node_index) {
-			prev = cur;
-			cur = cur->next;
-			pos++;
-		}
-	}
-
-	if (prev) {
-		// Set previous node
-		node->prev = prev;
-		// Set next node of our new node to next node of the previous node
-		node->next = prev->next;
-		// Set next node of previous node to our new node
-		prev->next = node;
-	} else {
-		node->prev = NULL;
-		// get old first element in list
-		node->next = list->begin;
-		// set new node as first element in list
-		list->begin = node;
-	}
-
-	if (node->next == NULL) {
-		// Set the lists prev to the new last element
-		list->end = node;
-	} else {
-		// set prev of the new next element to our node
-		node->next->prev = node;
-	}
-
-	// Increment our node count for this list
+	memmove(&list->items[node_index + 1], &list->items[node_index], (list->count - node_index) * sizeof(node_t*));
+	list->items[node_index] = node;
 	list->count++;
+	node_list_renumber(list, node_index);
 	return 0;
 }
 
@@ -124,33 +111,12 @@ int node_list_remove(node_list_t* list, node_t* node) {
 	if (!list || !node) return -1;
 	if (list->count == 0) return -1;
 
-	int node_index = 0;
-	node_t* n;
-	for (n = list->begin; n; n = n->next) {
-		if (node == n) {
-			node_t* newnode = node->next;
-			if (node->prev) {
-				node->prev->next = newnode;
-				if (newnode) {
-					newnode->prev = node->prev;
-				} else {
-					// last element in the list
-					list->end = node->prev;
-				}
-			} else {
-				// we just removed the first element
-				if (newnode) {
-					newnode->prev = NULL;
-				} else {
-					list->end = NULL;
-				}
-				list->begin = newnode;
-			}
-			list->count--;
-			return node_index;
-		}
-		node_index++;
+	unsigned int node_index = node->index;
+	if (node_index >= list->count || list->items[node_index] != node) {
+		return -1;
 	}
-	return -1;
+	list->count--;
+	memmove(&list->items[node_index], &list->items[node_index + 1], (list->count - node_index) * sizeof(node_t*));
+	node_list_renumber(list, node_index);
+	return (int)node_index;
 }
-
@@ -298,18 +298,12 @@ static plist_t parse_date_node(const char **bnode, uint8_t size)
 
 static plist_t parse_string_node(const char **bnode, uint64_t size)
 {
-    plist_data_t data = plist_new_plist_data();
-
-    data->type = PLIST_STRING;
-    data->strval = (char *) malloc(sizeof(char) * (size + 1));
-    if (!data->strval) {
-        plist_free_data(data);
+    const char *nul = memchr(*bnode, '\0', size);
+    plist_data_t data = plist_new_string_data(PLIST_STRING, *bnode, (nul) ? (size_t)(nul - *bnode) : size);
+    if (!data) {
         PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, sizeof(char) * (size + 1));
         return NULL;
     }
-    memcpy(data->strval, *bnode, size);
-    data->strval[size] = '\0';
-    data->length = strlen(data->strval);
 
     return node_create(NULL, data);
 }
@@ -379,25 +373,26 @@ static char *plist_utf16be_to_utf8(uint16_t *unistr, long len, long *items_read,
 
 static plist_t parse_unicode_node(const char **bnode, uint64_t size)
 {
-    plist_data_t data = plist_new_plist_data();
+    plist_data_t data = NULL;
     char *tmpstr = NULL;
     long items_read = 0;
     long items_written = 0;
 
-    data->type = PLIST_STRING;
-
     tmpstr = plist_utf16be_to_utf8((uint16_t*)(*bnode), size, &items_read, &items_written);
     if (!tmpstr) {
-        plist_free_data(data);
         return NULL;
     }
     tmpstr[items_written] = '\0';
 
-    data->type = PLIST_STRING;
-    data->strval = realloc(tmpstr, items_written+1);
-    if (!data->strval)
-        data->strval = tmpstr;
-    data->length = items_written;
+    if (items_written > PLIST_INLINE_STRING_MAX) {
+        char *shrunk = realloc(tmpstr, items_written+1);
+        if (shrunk)
+            tmpstr = shrunk;
+    }
+    data = plist_new_string_data_take(PLIST_STRING, tmpstr, items_written);
+    if (!data) {
+        return NULL;
+    }
     return node_create(NULL, data);
 }
 
@@ -482,6 +477,13 @@ static plist_t parse_dict_node(struct bplist_data *bplist, const char** bnode, u
             return NULL;
         }
 
+        /* share the interned copy of the key if there is one */
+        plist_data_t atom = plist_intern_key(plist_get_data(key)->strval, plist_get_data(key)->length);
+        if (atom) {
+            plist_free_data(plist_get_data(key));
+            ((node_t*)key)->data = atom;
+        }
+
         /* process value node */
         plist_t val = parse_bin_node_at_index(bplist, index2);
         if (!val) {
@@ -1142,7 +1144,7 @@ static void write_dict(bytearray_t * bplist, node_t* node, hashtable_t* ref_tabl
     }
 
     for (i = 0, cur = node_first_child(node); cur && i < size; cur = node_next_sibling(node_next_sibling(cur)), i++) {
-        uint64_t idx2 = *(uint64_t *) (hash_table_lookup(ref_table, cur->next));
+        uint64_t idx2 = *(uint64_t *) (hash_table_lookup(ref_table, node_next_sibling(cur)));
         idx2 = be64toh(idx2);
         byte_array_append(bplist, (uint8_t*)&idx2 + (sizeof(uint64_t) - ref_size), ref_size);
     }
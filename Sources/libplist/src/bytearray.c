@@ -29,9 +29,39 @@ bytearray_t *byte_array_new(size_t initial)
 	a->capacity = (initial > PAGE_SIZE) ? (initial+(PAGE_SIZE-1)) & (~(PAGE_SIZE-1)) : PAGE_SIZE;
 	a->data = malloc(a->capacity);
 	a->len = 0;
+	a->sink = NULL;
+	a->sink_data = NULL;
+	a->sink_error = 0;
 	return a;
 }
 
+/* Creates a byte array that never grows: whenever it fills up, its contents
+ * are handed to the sink and it starts over, so memory use stays bounded */
+bytearray_t *byte_array_new_with_sink(size_t chunk_size, byte_array_sink_t sink, void *user_data)
+{
+	bytearray_t *a = byte_array_new(chunk_size);
+	if (!a) return NULL;
+	if (!a->data) {
+		free(a);
+		return NULL;
+	}
+	a->sink = sink;
+	a->sink_data = user_data;
+	return a;
+}
+
+/* Writes out what a byte array with a sink holds so far. Returns -1 once
+ * the sink has failed. */
+int byte_array_flush(bytearray_t *ba)
+{
+	if (!ba || !ba->sink) return 0;
+	if (!ba->sink_error && ba->len > 0 && ba->sink((const char*)ba->data, ba->len, ba->sink_data) < 0) {
+		ba->sink_error = 1;
+	}
+	ba->len = 0;
+	return (ba->sink_error) ? -1 : 0;
+}
+
 void byte_array_free(bytearray_t *ba)
 {
 	if (!ba) return;
@@ -51,6 +81,22 @@ void byte_array_grow(bytearray_t *ba, size_t amount)
 void byte_array_append(bytearray_t *ba, void *buf, size_t len)
 {
 	if (!ba || !ba->data || (len <= 0)) return;
+	if (ba->sink) {
+		if (len > ba->capacity - ba->len) {
+			byte_array_flush(ba);
+			if (len >= ba->capacity) {
+				/* too large to buffer, hand it over as is */
+				if (!ba->sink_error && ba->sink((const char*)buf, len, ba->sink_data) < 0) {
+					ba->sink_error = 1;
+				}
+				return;
+			}
+		}
+		if (ba->sink_error) return;
+		memcpy(((char*)ba->data) + ba->len, buf, len);
+		ba->len += len;
+		return;
+	}
 	size_t remaining = ba->capacity-ba->len;
 	if (len > remaining) {
 		size_t needed = len - remaining;
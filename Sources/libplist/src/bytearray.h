@@ -22,15 +22,24 @@
 #define BYTEARRAY_H
 #include <stdlib.h>
 
+/* Receives the contents of a byte array that writes through; returns a
+ * negative value if they could not be written */
+typedef int (*byte_array_sink_t)(const char *data, size_t len, void *user_data);
+
 typedef struct bytearray_t {
 	void *data;
 	size_t len;
 	size_t capacity;
+	byte_array_sink_t sink;
+	void *sink_data;
+	int sink_error;
 } bytearray_t;
 
 bytearray_t *byte_array_new(size_t initial);
+bytearray_t *byte_array_new_with_sink(size_t chunk_size, byte_array_sink_t sink, void *user_data);
 void byte_array_free(bytearray_t *ba);
 void byte_array_grow(bytearray_t *ba, size_t amount);
 void byte_array_append(bytearray_t *ba, void *buf, size_t len);
+int byte_array_flush(bytearray_t *ba);
 
 #endif
@@ -55,6 +55,41 @@ void hash_table_destroy(hashtable_t *ht)
 	free(ht);
 }
 
+// Copies the table without rehashing: every entry keeps its bucket and
+// position, and remap_func translates its key and value for the copy.
+hashtable_t* hash_table_copy(hashtable_t *ht, remap_func_t remap_func, void *userdata)
+{
+	if (!ht) return NULL;
+
+	hashtable_t* copy = hash_table_new(ht->hash_func, ht->compare_func, ht->free_func);
+	if (!copy) return NULL;
+
+	int i;
+	for (i = 0; i < 4096; i++) {
+		hashentry_t** tail = &copy->entries[i];
+		hashentry_t* e = ht->entries[i];
+		while (e) {
+			hashentry_t* entry = (hashentry_t*)malloc(sizeof(hashentry_t));
+			if (!entry) {
+				copy->free_func = NULL;
+				hash_table_destroy(copy);
+				return NULL;
+			}
+			entry->key = e->key;
+			entry->value = e->value;
+			entry->next = NULL;
+			if (remap_func) {
+				remap_func(&entry->key, &entry->value, userdata);
+			}
+			*tail = entry;
+			tail = (hashentry_t**)&entry->next;
+			e = e->next;
+		}
+	}
+	copy->count = ht->count;
+	return copy;
+}
+
 void hash_table_insert(hashtable_t* ht, void *key, void *value)
 {
 	if (!ht || !key) return;
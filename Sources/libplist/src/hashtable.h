@@ -31,6 +31,7 @@ typedef struct hashentry_t {
 typedef unsigned int(*hash_func_t)(const void* key);
 typedef int (*compare_func_t)(const void *a, const void *b);
 typedef void (*free_func_t)(void *ptr);
+typedef void (*remap_func_t)(void **key, void **value, void *userdata);
 
 typedef struct hashtable_t {
 	hashentry_t *entries[4096];
@@ -42,6 +43,7 @@ typedef struct hashtable_t {
 
 hashtable_t* hash_table_new(hash_func_t hash_func, compare_func_t compare_func, free_func_t free_func);
 void hash_table_destroy(hashtable_t *ht);
+hashtable_t* hash_table_copy(hashtable_t *ht, remap_func_t remap_func, void *userdata);
 
 void hash_table_insert(hashtable_t* ht, void *key, void *value);
 void* hash_table_lookup(hashtable_t* ht, void *key);
@@ -32,6 +32,7 @@
 #include <ctype.h>
 #include <math.h>
 #include <limits.h>
+#include <locale.h>
 
 #include <node.h>
 #include <node_list.h>
@@ -160,14 +161,26 @@ static int node_to_json(node_t* node, bytearray_t **outbuf, uint32_t depth, int
 
         len = node_data->length;
         for (j = 0; j < len; j++) {
-            switch (node_data->strval[j]) {
-            case '"':
+            unsigned char c = (unsigned char)node_data->strval[j];
+            if (c == '"' || c == '\\' || c < 0x20) {
+                char esc[8];
+                size_t esc_len = 2;
+                esc[0] = '\\';
+                switch (c) {
+                case '"': esc[1] = '"'; break;
+                case '\\': esc[1] = '\\'; break;
+                case '\b': esc[1] = 'b'; break;
+                case '\f': esc[1] = 'f'; break;
+                case '\n': esc[1] = 'n'; break;
+                case '\r': esc[1] = 'r'; break;
+                case '\t': esc[1] = 't'; break;
+                default:
+                    esc_len = snprintf(esc, sizeof(esc), "\\u%04x", c);
+                    break;
+                }
                 str_buf_append(*outbuf, node_data->strval + start, cur - start);
-                str_buf_append(*outbuf, "\\\"", 2);
+                str_buf_append(*outbuf, esc, esc_len);
                 start = cur+1;
-                break;
-            default:
-                break;
             }
             cur++;
         }
@@ -194,6 +207,9 @@ static int node_to_json(node_t* node, bytearray_t **outbuf, uint32_t depth, int
             if (res < 0) {
                 return res;
             }
+            if ((*outbuf)->sink_error) {
+                return PLIST_ERR_IO;
+            }
             cnt++;
         }
         if (cnt > 0 && prettify) {
@@ -222,6 +238,9 @@ static int node_to_json(node_t* node, bytearray_t **outbuf, uint32_t depth, int
             if (res < 0) {
                 return res;
             }
+            if ((*outbuf)->sink_error) {
+                return PLIST_ERR_IO;
+            }
             if (cnt % 2 == 0) {
                 str_buf_append(*outbuf, ":", 1);
                 if (prettify) {
@@ -418,6 +437,37 @@ PLIST_API int plist_to_json(plist_t plist, char **json, uint32_t* length, int pr
     return PLIST_ERR_SUCCESS;
 }
 
+PLIST_API plist_err_t plist_write_json(plist_t plist, plist_write_cb_t write_cb, void *user_data, int prettify)
+{
+    uint64_t size = 0;
+    int res;
+
+    if (!plist || !write_cb) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+
+    /* reject nodes JSON can't represent before anything is written */
+    res = node_estimate_size(plist, &size, 0, prettify);
+    if (res < 0) {
+        return res;
+    }
+
+    strbuf_t *outbuf = str_buf_new_with_sink(PLIST_WRITE_CHUNK_SIZE, write_cb, user_data);
+    if (!outbuf) {
+        PLIST_JSON_WRITE_ERR("Could not allocate output buffer");
+        return PLIST_ERR_NO_MEM;
+    }
+
+    res = node_to_json(plist, &outbuf, 0, prettify);
+    if (res == PLIST_ERR_SUCCESS && str_buf_flush(outbuf) < 0) {
+        PLIST_JSON_WRITE_ERR("Could not write output");
+        res = PLIST_ERR_IO;
+    }
+    str_buf_free(outbuf);
+
+    return res;
+}
+
 typedef struct {
     jsmntok_t* tokens;
     int count;
@@ -466,6 +516,110 @@ static int64_t parse_decimal(const char* str, const char* str_end, char** endp)
     return result;
 }
 
+/* powers of ten that a double holds exactly */
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * Parses a decimal floating point number whose digits fit into 53 bits and
+ * whose decimal exponent is small, the case of nearly every number found
+ * in practice. The mantissa and the power of ten are then both exact, so
+ * a single multiplication or division yields the correctly rounded value.
+ *
+ * @return 1 if the number was parsed, 0 if it needs the slow path.
+ */
+static int parse_real_exact(const char* str, const char* str_end, double *value)
+{
+    const char* p = str;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    int is_neg = 0;
+
+    if (p < str_end && *p == '-') {
+        is_neg = 1;
+        p++;
+    }
+    while (p < str_end && isdigit(*p)) {
+        if (digits > 0 || *p != '0') {
+            if (++digits > 15) {
+                return 0;
+            }
+        }
+        mantissa = mantissa * 10 + (*p - '0');
+        p++;
+    }
+    if (p < str_end && *p == '.') {
+        p++;
+        while (p < str_end && isdigit(*p)) {
+            if (digits > 0 || *p != '0') {
+                if (++digits > 15) {
+                    return 0;
+                }
+            }
+            mantissa = mantissa * 10 + (*p - '0');
+            exponent--;
+            p++;
+        }
+    }
+    if (p < str_end && (*p == 'e' || *p == 'E')) {
+        int exp_neg = 0;
+        int exp_val = 0;
+        p++;
+        if (p < str_end && *p == '-') {
+            exp_neg = 1;
+            p++;
+        }
+        if (p >= str_end || !isdigit(*p)) {
+            return 0;
+        }
+        while (p < str_end && isdigit(*p)) {
+            if (exp_val > 1000) {
+                return 0;
+            }
+            exp_val = exp_val * 10 + (*p - '0');
+            p++;
+        }
+        exponent += (exp_neg) ? -exp_val : exp_val;
+    }
+    if (p != str_end || exponent < -22 || exponent > 22) {
+        return 0;
+    }
+    *value = (exponent < 0) ? (double)mantissa / exact_powers_of_ten[-exponent] : (double)mantissa * exact_powers_of_ten[exponent];
+    if (is_neg) {
+        *value = -*value;
+    }
+    return 1;
+}
+
+/**
+ * Parses a floating point number with strtod(), which rounds correctly,
+ * regardless of the decimal point of the current locale.
+ *
+ * @return 1 if the whole number was parsed, 0 otherwise.
+ */
+static int parse_real_strtod(const char* str, size_t length, double *value)
+{
+    char buf[64];
+    char *endp = NULL;
+    char *dot = NULL;
+    struct lconv *lc = localeconv();
+
+    if (!lc || !lc->decimal_point || strlen(lc->decimal_point) != 1 || length >= sizeof(buf)) {
+        return 0;
+    }
+    memcpy(buf, str, length);
+    buf[length] = '\0';
+    dot = memchr(buf, '.', length);
+    if (dot) {
+        *dot = lc->decimal_point[0];
+    }
+    *value = strtod(buf, &endp);
+    return (endp == buf + length);
+}
+
 static plist_t parse_primitive(const char* js, jsmntok_info_t* ti, int* index)
 {
     if (ti->tokens[*index].type != JSMN_PRIMITIVE) {
@@ -496,6 +650,9 @@ static plist_t parse_primitive(const char* js, jsmntok_info_t* ti, int* index)
             char* fendp = endp;
             int err = 0;
             do {
+                if (parse_real_exact(str_val, str_end, &dval) || parse_real_strtod(str_val, str_len, &dval)) {
+                    break;
+                }
                 if (*endp == '.') {
                     fendp++;
                     int is_neg = (str_val[0] == '-');
@@ -540,82 +697,146 @@ static plist_t parse_primitive(const char* js, jsmntok_info_t* ti, int* index)
     return val;
 }
 
-static char* unescape_string(const char* str_val, size_t str_len, size_t *new_len)
+static int hex_value(char c)
 {
-    char* strval = strndup(str_val, str_len);
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static int parse_hex4(const char* str, unsigned int *val)
+{
+    int i;
+    *val = 0;
+    for (i = 0; i < 4; i++) {
+        int h = hex_value(str[i]);
+        if (h < 0) {
+            return -1;
+        }
+        *val = (*val << 4) | h;
+    }
+    return 0;
+}
+
+/**
+ * Unescapes a JSON string in place, in a single pass. No escape sequence
+ * is shorter than what it stands for, so the output never overtakes the
+ * input.
+ */
+static int unescape_string(char* str, size_t *length)
+{
+    size_t len = *length;
     size_t i = 0;
-    while (i < str_len) {
-        if (strval[i] == '\\' && i < str_len-1) {
-            switch (strval[i+1]) {
-                case '\"': case '/' : case '\\' : case 'b' :
-                case 'f' : case 'r' : case 'n'  : case 't' :
-                    memmove(strval+i, strval+i+1, str_len - (i+1));
-                    str_len--;
-                    switch (strval[i]) {
-                        case 'b':
-                            strval[i] = '\b';
-                            break;
-                        case 'f':
-                            strval[i] = '\f';
-                            break;
-                        case 'r':
-                            strval[i] = '\r';
-                            break;
-                        case 'n':
-                            strval[i] = '\n';
-                            break;
-                        case 't':
-                            strval[i] = '\t';
-                            break;
-                        default:
-                            break;
-                    }
-                    break;
-                case 'u': {
-                    unsigned int val = 0;
-                    if (str_len-(i+2) < 4) {
-                        PLIST_JSON_ERR("%s: invalid escape sequence '%s' (too short)\n", __func__, strval+i);
-                        free(strval);
-                        return NULL;
-                    }
-                    if (!(isxdigit(strval[i+2]) && isxdigit(strval[i+3]) && isxdigit(strval[i+4]) && isxdigit(strval[i+5])) || sscanf(strval+i+2, "%04x", &val) != 1) {
-                        PLIST_JSON_ERR("%s: invalid escape sequence '%.*s'\n", __func__, 6, strval+i);
-                        free(strval);
-                        return NULL;
-                    }
-                    int bytelen = 0;
-                    if (val >= 0x800) {
-                        /* three bytes */
-                        strval[i]   = (char)(0xE0 + ((val >> 12) & 0xF));
-                        strval[i+1] = (char)(0x80 + ((val >> 6) & 0x3F));
-                        strval[i+2] = (char)(0x80 + (val & 0x3F));
-                        bytelen = 3;
-                    } else if (val >= 0x80) {
-                        /* two bytes */
-                        strval[i]   = (char)(0xC0 + ((val >> 6) & 0x1F));
-                        strval[i+1] = (char)(0x80 + (val & 0x3F));
-                        bytelen = 2;
-                    } else {
-                        /* one byte */
-                        strval[i] = (char)(val & 0x7F);
-                        bytelen = 1;
+    size_t o = 0;
+    while (i < len) {
+        const char *esc = memchr(str + i, '\\', len - i);
+        size_t plain = (esc) ? (size_t)(esc - (str + i)) : len - i;
+        if (o != i) {
+            memmove(str + o, str + i, plain);
+        }
+        i += plain;
+        o += plain;
+        if (!esc) {
+            break;
+        }
+        if (i + 1 >= len) {
+            PLIST_JSON_ERR("%s: invalid escape sequence at end of string\n", __func__);
+            return -1;
+        }
+        switch (str[i+1]) {
+            case '\"': case '/' : case '\\' :
+                str[o++] = str[i+1];
+                i += 2;
+                break;
+            case 'b':
+                str[o++] = '\b';
+                i += 2;
+                break;
+            case 'f':
+                str[o++] = '\f';
+                i += 2;
+                break;
+            case 'r':
+                str[o++] = '\r';
+                i += 2;
+                break;
+            case 'n':
+                str[o++] = '\n';
+                i += 2;
+                break;
+            case 't':
+                str[o++] = '\t';
+                i += 2;
+                break;
+            case 'u': {
+                unsigned int val = 0;
+                if (len - (i+2) < 4 || parse_hex4(str+i+2, &val) < 0) {
+                    PLIST_JSON_ERR("%s: invalid escape sequence '%.*s'\n", __func__, (int)((len - i < 6) ? len - i : 6), str+i);
+                    return -1;
+                }
+                i += 6;
+                if (val >= 0xD800 && val <= 0xDBFF && len - i >= 6 && str[i] == '\\' && str[i+1] == 'u') {
+                    /* surrogate pair */
+                    unsigned int low = 0;
+                    if (parse_hex4(str+i+2, &low) == 0 && low >= 0xDC00 && low <= 0xDFFF) {
+                        val = 0x10000 + ((val - 0xD800) << 10) + (low - 0xDC00);
+                        i += 6;
                     }
-                    memmove(strval+i+bytelen, strval+i+6, str_len - (i+5));
-                    str_len -= (6-bytelen);
-                }   break;
-                default:
-                    PLIST_JSON_ERR("%s: invalid escape sequence '%.*s'\n", __func__, 2, strval+i);
-                    free(strval);
-                    return NULL;
-            }
+                }
+                if (val >= 0x10000) {
+                    /* four bytes */
+                    str[o++] = (char)(0xF0 + ((val >> 18) & 0x7));
+                    str[o++] = (char)(0x80 + ((val >> 12) & 0x3F));
+                    str[o++] = (char)(0x80 + ((val >> 6) & 0x3F));
+                    str[o++] = (char)(0x80 + (val & 0x3F));
+                } else if (val >= 0x800) {
+                    /* three bytes */
+                    str[o++] = (char)(0xE0 + ((val >> 12) & 0xF));
+                    str[o++] = (char)(0x80 + ((val >> 6) & 0x3F));
+                    str[o++] = (char)(0x80 + (val & 0x3F));
+                } else if (val >= 0x80) {
+                    /* two bytes */
+                    str[o++] = (char)(0xC0 + ((val >> 6) & 0x1F));
+                    str[o++] = (char)(0x80 + (val & 0x3F));
+                } else {
+                    /* one byte */
+                    str[o++] = (char)(val & 0x7F);
+                }
+            }   break;
+            default:
+                PLIST_JSON_ERR("%s: invalid escape sequence '%.*s'\n", __func__, 2, str+i);
+                return -1;
         }
-        i++;
     }
-    strval[str_len] = '\0';
-    if (new_len) {
-        *new_len = str_len;
+    str[o] = '\0';
+    *length = o;
+    return 0;
+}
+
+/**
+ * Creates the data of a key or string node from the contents of a JSON
+ * string token. Escape sequences are resolved right in the buffer of the
+ * new node, so the string is copied only once.
+ */
+static plist_data_t string_data_from_token(plist_type type, const char* str, size_t length)
+{
+    plist_data_t data = plist_new_string_data(type, str, length);
+    if (data && memchr(str, '\\', length)) {
+        size_t new_len = length;
+        if (unescape_string(data->strval, &new_len) < 0) {
+            plist_free_data(data);
+            return NULL;
+        }
+        data->length = new_len;
     }
-    return strval;
+    return data;
 }
 
 static plist_t parse_string(const char* js, jsmntok_info_t* ti, int* index)
@@ -625,18 +846,11 @@ static plist_t parse_string(const char* js, jsmntok_info_t* ti, int* index)
         return NULL;
     }
 
-    size_t str_len = 0; ;
-    char* strval = unescape_string(js + ti->tokens[*index].start, ti->tokens[*index].end - ti->tokens[*index].start, &str_len);
-    if (!strval) {
+    plist_data_t data = string_data_from_token(PLIST_STRING, js + ti->tokens[*index].start, ti->tokens[*index].end - ti->tokens[*index].start);
+    if (!data) {
         return NULL;
     }
-    plist_t node;
-
-    plist_data_t data = plist_new_plist_data();
-    data->type = PLIST_STRING;
-    data->strval = strval;
-    data->length = str_len;
-    node = plist_new_node(data);
+    plist_t node = plist_new_node(data);
 
     (*index)++;
     return node;
@@ -709,10 +923,23 @@ static plist_t parse_object(const char* js, jsmntok_info_t* ti, int* index)
             return NULL;
         }
         if (ti->tokens[j].type == JSMN_STRING) {
-            char* key = unescape_string(js + ti->tokens[j].start, ti->tokens[j].end - ti->tokens[j].start, NULL);
-            if (!key) {
-                plist_free(obj);
-                return NULL;
+            /* keys without escape sequences are used right from the input */
+            const char* key = js + ti->tokens[j].start;
+            size_t key_len = ti->tokens[j].end - ti->tokens[j].start;
+            char* unescaped = NULL;
+            if (memchr(key, '\\', key_len)) {
+                unescaped = (char*)malloc(key_len + 1);
+                if (!unescaped) {
+                    plist_free(obj);
+                    return NULL;
+                }
+                memcpy(unescaped, key, key_len);
+                if (unescape_string(unescaped, &key_len) < 0) {
+                    free(unescaped);
+                    plist_free(obj);
+                    return NULL;
+                }
+                key = unescaped;
             }
             plist_t val = NULL;
             j++;
@@ -734,13 +961,13 @@ static plist_t parse_object(const char* js, jsmntok_info_t* ti, int* index)
                     break;
             }
             if (val) {
-                plist_dict_set_item(obj, key, val);
+                plist_dict_set_item_with_length(obj, key, key_len, val);
             } else {
-                free(key);
+                free(unescaped);
                 plist_free(obj);
                 return NULL;
             }
-            free(key);
+            free(unescaped);
         } else {
             PLIST_JSON_ERR("%s: keys must be of type STRING\n", __func__);
             plist_free(obj);
@@ -763,7 +990,8 @@ PLIST_API int plist_from_json(const char *json, uint32_t length, plist_t * plist
 
     jsmn_parser parser;
     jsmn_init(&parser);
-    int maxtoks = 256;
+    /* start with a guess based on the input size, then grow geometrically */
+    int maxtoks = (length / 16 > 256) ? ((length / 16 < INT_MAX / 2) ? (int)(length / 16) : INT_MAX / 2) : 256;
     int curtoks = 0;
     int r = 0;
     jsmntok_t *tokens = NULL;
@@ -772,6 +1000,7 @@ PLIST_API int plist_from_json(const char *json, uint32_t length, plist_t * plist
         jsmntok_t* newtokens = realloc(tokens, sizeof(jsmntok_t)*maxtoks);
         if (!newtokens) {
             PLIST_JSON_ERR("%s: Out of memory\n", __func__);
+            free(tokens);
             return PLIST_ERR_NO_MEM;
         }
         memset((unsigned char*)newtokens + sizeof(jsmntok_t)*curtoks, '\0', sizeof(jsmntok_t)*(maxtoks-curtoks));
@@ -780,7 +1009,10 @@ PLIST_API int plist_from_json(const char *json, uint32_t length, plist_t * plist
 
         r = jsmn_parse(&parser, json, length, tokens, maxtoks);
         if (r == JSMN_ERROR_NOMEM) {
-            maxtoks+=16;
+            if (maxtoks > INT_MAX / 2 || (size_t)maxtoks * 2 > SIZE_MAX / sizeof(jsmntok_t)) {
+                break;
+            }
+            maxtoks *= 2;
             continue;
         }
     } while (r == JSMN_ERROR_NOMEM);
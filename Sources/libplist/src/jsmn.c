@@ -24,9 +24,32 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "jsmn.h"
 
+/* Word-at-a-time byte search: tells whether any of the eight bytes of v is
+ * zero, or equal to the byte b. */
+#define JSMN_ONES 0x0101010101010101ULL
+#define JSMN_HAS_ZERO(v) (((v) - JSMN_ONES) & ~(v) & (JSMN_ONES << 7))
+#define JSMN_HAS_BYTE(v, b) JSMN_HAS_ZERO((v) ^ (JSMN_ONES * (uint8_t)(b)))
+
+/**
+ * Skips the plain characters of a string eight at a time, stopping at the
+ * block holding the next quote, backslash or NUL (or at the last block).
+ */
+static void jsmn_skip_string_chars(jsmn_parser *parser, const char *js) {
+	while (parser->pos + 8 < parser->end) {
+		uint64_t v;
+		memcpy(&v, js + parser->pos, sizeof(v));
+		if (JSMN_HAS_ZERO(v) || JSMN_HAS_BYTE(v, '\"') || JSMN_HAS_BYTE(v, '\\')) {
+			break;
+		}
+		parser->pos += 8;
+	}
+}
+
 /**
  * Allocates a fresh unused token from the token pull.
  */
@@ -116,7 +139,10 @@ static jsmnerr_t jsmn_parse_string(jsmn_parser *parser, const char *js,
 
 	/* Skip starting quote */
 	for (; (parser->end > 0 && parser->pos < parser->end) && js[parser->pos] != '\0'; parser->pos++) {
-		char c = js[parser->pos];
+		char c;
+
+		jsmn_skip_string_chars(parser, js);
+		c = js[parser->pos];
 
 		/* Quote: end of string */
 		if (c == '\"') {
@@ -207,6 +233,10 @@ jsmnerr_t jsmn_parse(jsmn_parser *parser, const char *js, unsigned int length, j
 						break;
 					}
 					if (token->parent == -1) {
+						/* Error if unmatched closing bracket */
+						if (token->type != type || parser->toksuper == -1) {
+							return JSMN_ERROR_INVAL;
+						}
 						break;
 					}
 					token = &tokens[token->parent];
@@ -50,6 +50,10 @@ typedef enum {
 	JSMN_SUCCESS = 0
 } jsmnerr_t;
 
+/* Tokens link to their parent, so closing an object or array only walks up
+ * the nesting instead of scanning back over all earlier tokens. */
+#define JSMN_PARENT_LINKS
+
 /**
  * JSON token description.
  * @param		type	type (object, array, string etc.)
@@ -42,8 +42,8 @@
 #endif
 
 #include <node.h>
+#include <node_list.h>
 #include <hashtable.h>
-#include <ptrarray.h>
 
 extern void plist_xml_init(void);
 extern void plist_xml_deinit(void);
@@ -225,47 +225,234 @@ plist_data_t plist_new_plist_data(void)
     return data;
 }
 
-static unsigned int dict_key_hash(const void *data)
+/**
+ * Creates the data of a key or string node holding a copy of the given
+ * string. Short strings are stored inline behind the node data.
+ */
+plist_data_t plist_new_string_data(plist_type type, const char *str, size_t length)
+{
+    plist_data_t data = NULL;
+    if (length <= PLIST_INLINE_STRING_MAX) {
+        data = (plist_data_t) calloc(sizeof(struct plist_data_s) + length + 1, 1);
+        if (!data) {
+            return NULL;
+        }
+        data->strval = (char*)(data + 1);
+        data->flags |= PLIST_DATA_INLINE_STRING;
+    } else {
+        data = plist_new_plist_data();
+        if (!data) {
+            return NULL;
+        }
+        data->strval = (char*) malloc(length + 1);
+        if (!data->strval) {
+            free(data);
+            return NULL;
+        }
+    }
+    memcpy(data->strval, str, length);
+    data->strval[length] = '\0';
+    data->length = length;
+    data->type = type;
+    return data;
+}
+
+/**
+ * Creates the data of a key or string node from a heap allocated,
+ * NUL-terminated string. The data takes ownership of the string; a short
+ * string is moved inline and freed.
+ */
+plist_data_t plist_new_string_data_take(plist_type type, char *str, size_t length)
+{
+    plist_data_t data = NULL;
+    if (length <= PLIST_INLINE_STRING_MAX) {
+        data = plist_new_string_data(type, str, length);
+        free(str);
+        return data;
+    }
+    data = plist_new_plist_data();
+    if (!data) {
+        free(str);
+        return NULL;
+    }
+    data->strval = str;
+    data->length = length;
+    data->type = type;
+    return data;
+}
+
+static unsigned int plist_key_hash(const char *str, size_t length)
 {
-    plist_data_t keydata = (plist_data_t)data;
     unsigned int hash = 5381;
     size_t i;
-    char *str = keydata->strval;
-    for (i = 0; i < keydata->length; str++, i++) {
+    for (i = 0; i < length; str++, i++) {
         hash = ((hash << 5) + hash) + *str;
     }
     return hash;
 }
 
+/*
+ * Dictionary keys are interned: each distinct key is stored once, as an
+ * immutable atom that key nodes share as their data and that lives until
+ * the process exits. The atom carries the hash of the key, and two atoms
+ * are equal only if they are the same atom.
+ */
+#define PLIST_KEY_ATOM_MAX_LENGTH 127
+#define PLIST_KEY_ATOMS_MAX 8192
+
+typedef struct plist_key_atom {
+    struct plist_data_s data;
+    unsigned int hash;
+    struct plist_key_atom *next;
+    char str[];
+} plist_key_atom_t;
+
+static plist_key_atom_t **key_atoms = NULL;
+static unsigned int key_atoms_buckets = 0;
+static unsigned int key_atoms_count = 0;
+static volatile int key_interning_disabled = 0;
+#ifdef WIN32
+static SRWLOCK key_atoms_lock = SRWLOCK_INIT;
+#define key_atoms_lock_acquire() AcquireSRWLockExclusive(&key_atoms_lock)
+#define key_atoms_lock_release() ReleaseSRWLockExclusive(&key_atoms_lock)
+#else
+static pthread_mutex_t key_atoms_lock = PTHREAD_MUTEX_INITIALIZER;
+#define key_atoms_lock_acquire() pthread_mutex_lock(&key_atoms_lock)
+#define key_atoms_lock_release() pthread_mutex_unlock(&key_atoms_lock)
+#endif
+
+static plist_key_atom_t* key_atoms_find(const char *str, size_t length, unsigned int hash)
+{
+    plist_key_atom_t *atom = NULL;
+    if (key_atoms_buckets == 0) {
+        return NULL;
+    }
+    for (atom = key_atoms[hash & (key_atoms_buckets - 1)]; atom; atom = atom->next) {
+        if (atom->hash == hash && atom->data.length == length && memcmp(atom->str, str, length) == 0) {
+            break;
+        }
+    }
+    return atom;
+}
+
+static int key_atoms_grow(void)
+{
+    unsigned int buckets = (key_atoms_buckets) ? key_atoms_buckets * 2 : 256;
+    plist_key_atom_t **table = (plist_key_atom_t**)calloc(buckets, sizeof(plist_key_atom_t*));
+    unsigned int i;
+    if (!table) {
+        return -1;
+    }
+    for (i = 0; i < key_atoms_buckets; i++) {
+        plist_key_atom_t *atom = key_atoms[i];
+        while (atom) {
+            plist_key_atom_t *next = atom->next;
+            atom->next = table[atom->hash & (buckets - 1)];
+            table[atom->hash & (buckets - 1)] = atom;
+            atom = next;
+        }
+    }
+    free(key_atoms);
+    key_atoms = table;
+    key_atoms_buckets = buckets;
+    return 0;
+}
+
+/**
+ * Returns the shared data of the interned key with the given value, adding
+ * it to the table if needed. Key nodes can use the returned data as their
+ * own; it must never be modified or freed.
+ *
+ * @return The shared key data, or NULL if interning is disabled, the key is
+ *  too long, or the table is full.
+ */
+plist_data_t plist_intern_key(const char *str, size_t length)
+{
+    plist_key_atom_t *atom = NULL;
+    if (key_interning_disabled || length > PLIST_KEY_ATOM_MAX_LENGTH) {
+        return NULL;
+    }
+    unsigned int hash = plist_key_hash(str, length);
+
+    key_atoms_lock_acquire();
+    atom = key_atoms_find(str, length, hash);
+    if (!atom && key_atoms_count < PLIST_KEY_ATOMS_MAX) {
+        if (key_atoms_count >= key_atoms_buckets && key_atoms_grow() < 0) {
+            key_atoms_lock_release();
+            return NULL;
+        }
+        atom = (plist_key_atom_t*)calloc(1, sizeof(plist_key_atom_t) + length + 1);
+        if (atom) {
+            memcpy(atom->str, str, length);
+            atom->str[length] = '\0';
+            atom->data.strval = atom->str;
+            atom->data.length = length;
+            atom->data.type = PLIST_KEY;
+            atom->data.flags = PLIST_DATA_KEY_ATOM;
+            atom->hash = hash;
+            atom->next = key_atoms[hash & (key_atoms_buckets - 1)];
+            key_atoms[hash & (key_atoms_buckets - 1)] = atom;
+            key_atoms_count++;
+        }
+    }
+    key_atoms_lock_release();
+
+    return (atom) ? &atom->data : NULL;
+}
+
+PLIST_API void plist_set_key_interning(int enabled)
+{
+    key_interning_disabled = !enabled;
+}
+
+static unsigned int dict_key_hash(const void *data)
+{
+    plist_data_t keydata = (plist_data_t)data;
+    if (keydata->flags & PLIST_DATA_KEY_ATOM) {
+        return ((plist_key_atom_t*)keydata)->hash;
+    }
+    return plist_key_hash(keydata->strval, keydata->length);
+}
+
 static int dict_key_compare(const void* a, const void* b)
 {
     plist_data_t data_a = (plist_data_t)a;
     plist_data_t data_b = (plist_data_t)b;
+    if (data_a == data_b) {
+        return TRUE;
+    }
+    if ((data_a->flags & PLIST_DATA_KEY_ATOM) && (data_b->flags & PLIST_DATA_KEY_ATOM)) {
+        return FALSE;
+    }
     if (data_a->strval == NULL || data_b->strval == NULL) {
         return FALSE;
     }
     if (data_a->length != data_b->length) {
         return FALSE;
     }
-    return (strcmp(data_a->strval, data_b->strval) == 0) ? TRUE : FALSE;
+    return (memcmp(data_a->strval, data_b->strval, data_a->length) == 0) ? TRUE : FALSE;
 }
 
 void plist_free_data(plist_data_t data)
 {
+    if (data && (data->flags & PLIST_DATA_KEY_ATOM))
+    {
+        /* interned keys are shared */
+        return;
+    }
     if (data)
     {
         switch (data->type)
         {
         case PLIST_KEY:
         case PLIST_STRING:
-            free(data->strval);
+            if (!PLIST_DATA_STRING_IS_INLINE(data)) {
+                free(data->strval);
+            }
             break;
         case PLIST_DATA:
             free(data->buff);
             break;
-        case PLIST_ARRAY:
-            ptr_array_free(data->hashtable);
-            break;
         case PLIST_DICT:
             hash_table_destroy(data->hashtable);
             break;
@@ -284,11 +471,10 @@ static int plist_free_node(node_t* node)
     plist_free_data(data);
     node->data = NULL;
 
-    node_t *ch;
-    for (ch = node_first_child(node); ch; ) {
-        node_t *next = node_next_sibling(ch);
-        plist_free_node(ch);
-        ch = next;
+    /* free the children from the end, so that detaching them moves nothing */
+    unsigned int i;
+    for (i = node_n_children(node); i > 0; i--) {
+        plist_free_node(node_nth_child(node, i - 1));
     }
 
     node_destroy(node);
@@ -311,21 +497,15 @@ PLIST_API plist_t plist_new_array(void)
 }
 
 //These nodes should not be handled by users
-static plist_t plist_new_key(const char *val)
+static plist_t plist_new_key(const char *val, size_t length, plist_data_t atom)
 {
-    plist_data_t data = plist_new_plist_data();
-    data->type = PLIST_KEY;
-    data->strval = strdup(val);
-    data->length = strlen(val);
+    plist_data_t data = (atom) ? atom : plist_new_string_data(PLIST_KEY, val, length);
     return plist_new_node(data);
 }
 
 PLIST_API plist_t plist_new_string(const char *val)
 {
-    plist_data_t data = plist_new_plist_data();
-    data->type = PLIST_STRING;
-    data->strval = strdup(val);
-    data->length = strlen(val);
+    plist_data_t data = plist_new_string_data(PLIST_STRING, val, strlen(val));
     return plist_new_node(data);
 }
 
@@ -409,70 +589,140 @@ PLIST_API void plist_mem_free(void* ptr)
     }
 }
 
-static plist_t plist_copy_node(node_t *node)
+/* pairs of nodes still to be visited while walking two trees side by side */
+typedef struct {
+    node_t *a;
+    node_t *b;
+} plist_node_pair_t;
+
+typedef struct {
+    plist_node_pair_t *pairs;
+    size_t count;
+    size_t capacity;
+} plist_node_stack_t;
+
+static int plist_node_stack_push(plist_node_stack_t *stack, node_t *a, node_t *b)
 {
-    plist_type node_type = PLIST_NONE;
-    plist_t newnode = NULL;
-    plist_data_t data = plist_get_data(node);
-    plist_data_t newdata = plist_new_plist_data();
+    if (stack->count == stack->capacity) {
+        size_t capacity = (stack->capacity) ? stack->capacity * 2 : 32;
+        plist_node_pair_t *pairs = (plist_node_pair_t*)realloc(stack->pairs, capacity * sizeof(plist_node_pair_t));
+        if (!pairs) {
+            return -1;
+        }
+        stack->pairs = pairs;
+        stack->capacity = capacity;
+    }
+    stack->pairs[stack->count].a = a;
+    stack->pairs[stack->count].b = b;
+    stack->count++;
+    return 0;
+}
 
-    assert(data);				// plist should always have data
-    assert(newdata);
+/**
+ * Copies the data of a single node, without its children. Interned keys
+ * are shared rather than copied.
+ */
+static plist_data_t plist_copy_node_data(plist_data_t data)
+{
+    plist_data_t newdata = NULL;
 
+    if (data->flags & PLIST_DATA_KEY_ATOM) {
+        return data;
+    }
+    if (data->type == PLIST_KEY || data->type == PLIST_STRING) {
+        return plist_new_string_data(data->type, data->strval, data->length);
+    }
+    newdata = plist_new_plist_data();
+    if (!newdata) {
+        return NULL;
+    }
     memcpy(newdata, data, sizeof(struct plist_data_s));
+    if (data->type == PLIST_DICT) {
+        /* the lookup table is copied once the children are */
+        newdata->hashtable = NULL;
+    } else if (data->type == PLIST_DATA) {
+        newdata->buff = (uint8_t *) malloc(data->length);
+        if (!newdata->buff && data->length > 0) {
+            free(newdata);
+            return NULL;
+        }
+        memcpy(newdata->buff, data->buff, data->length);
+    }
+    return newdata;
+}
 
-    node_type = plist_get_node_type(node);
-    switch (node_type) {
-        case PLIST_DATA:
-            newdata->buff = (uint8_t *) malloc(data->length);
-            memcpy(newdata->buff, data->buff, data->length);
-            break;
-        case PLIST_KEY:
-        case PLIST_STRING:
-            newdata->strval = strdup(data->strval);
-            break;
-        case PLIST_ARRAY:
-            if (data->hashtable) {
-                ptrarray_t* pa = ptr_array_new(((ptrarray_t*)data->hashtable)->capacity);
-                assert(pa);
-                newdata->hashtable = pa;
-            }
-            break;
-        case PLIST_DICT:
-            if (data->hashtable) {
-                hashtable_t* ht = hash_table_new(dict_key_hash, dict_key_compare, NULL);
-                assert(ht);
-                newdata->hashtable = ht;
-            }
-            break;
-        default:
-            break;
+/* maps a lookup table entry of the source dictionary to the copy */
+static void plist_copy_dict_entry(void **key, void **value, void *userdata)
+{
+    node_t *newdict = (node_t*)userdata;
+    node_t *item = newdict->children->items[((node_t*)*value)->index];
+    *key = node_prev_sibling(item)->data;
+    *value = item;
+}
+
+/**
+ * Copies a node and everything below it. The tree is walked iteratively,
+ * so deep plists cannot overflow the stack; every container gets its
+ * children array sized once, and the lookup table of a dictionary is
+ * cloned entry by entry instead of being rebuilt.
+ */
+static plist_t plist_copy_node(node_t *node)
+{
+    plist_node_stack_t stack = { NULL, 0, 0 };
+    plist_data_t newdata = plist_copy_node_data(plist_get_data(node));
+    plist_t newnode = (newdata) ? plist_new_node(newdata) : NULL;
+    int err = 0;
+
+    if (!newnode) {
+        plist_free_data(newdata);
+        return NULL;
     }
-    newnode = plist_new_node(newdata);
-
-    node_t *ch;
-    unsigned int node_index = 0;
-    for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-        /* copy child node */
-        plist_t newch = plist_copy_node(ch);
-        /* attach to new parent node */
-        node_attach(newnode, newch);
-        /* if needed, add child node to lookup table of parent node */
-        switch (node_type) {
-            case PLIST_ARRAY:
-                if (newdata->hashtable) {
-                    ptr_array_add((ptrarray_t*)newdata->hashtable, newch);
-                }
+    if (node->children && plist_node_stack_push(&stack, node, newnode) < 0) {
+        err++;
+    }
+
+    while (!err && stack.count > 0) {
+        plist_node_pair_t pair = stack.pairs[--stack.count];
+        unsigned int count = pair.a->children->count;
+        unsigned int i;
+
+        if (count == 0) {
+            continue;
+        }
+        pair.b->children = node_list_create();
+        if (!pair.b->children || node_list_reserve(pair.b->children, count) < 0) {
+            err++;
+            break;
+        }
+        for (i = 0; i < count; i++) {
+            node_t *ch = pair.a->children->items[i];
+            plist_data_t chdata = plist_copy_node_data(ch->data);
+            node_t *newch = (chdata) ? (node_t*)plist_new_node(chdata) : NULL;
+            if (!newch) {
+                plist_free_data(chdata);
+                err++;
                 break;
-            case PLIST_DICT:
-                if (newdata->hashtable && (node_index % 2 != 0)) {
-                    hash_table_insert((hashtable_t*)newdata->hashtable, (node_prev_sibling((node_t*)newch))->data, newch);
-                }
+            }
+            node_attach(pair.b, newch);
+            if (ch->children && plist_node_stack_push(&stack, ch, newch) < 0) {
+                err++;
                 break;
-            default:
+            }
+        }
+        if (!err && ((plist_data_t)pair.a->data)->hashtable) {
+            hashtable_t *ht = hash_table_copy((hashtable_t*)((plist_data_t)pair.a->data)->hashtable, plist_copy_dict_entry, pair.b);
+            if (!ht) {
+                err++;
                 break;
+            }
+            ((plist_data_t)pair.b->data)->hashtable = ht;
         }
-        node_index++;
+    }
+    free(stack.pairs);
+
+    if (err) {
+        plist_free(newnode);
+        return NULL;
     }
     return newnode;
 }
@@ -497,12 +747,7 @@ PLIST_API plist_t plist_array_get_item(plist_t node, uint32_t n)
     plist_t ret = NULL;
     if (node && PLIST_ARRAY == plist_get_node_type(node) && n < INT_MAX)
     {
-        ptrarray_t *pa = ((plist_data_t)((node_t*)node)->data)->hashtable;
-        if (pa) {
-            ret = (plist_t)ptr_array_index(pa, n);
-        } else {
-            ret = (plist_t)node_nth_child(node, n);
-        }
+        ret = (plist_t)node_nth_child(node, n);
     }
     return ret;
 }
@@ -517,28 +762,6 @@ PLIST_API uint32_t plist_array_get_item_index(plist_t node)
     return UINT_MAX;
 }
 
-static void _plist_array_post_insert(plist_t node, plist_t item, long n)
-{
-    ptrarray_t *pa = ((plist_data_t)((node_t*)node)->data)->hashtable;
-    if (pa) {
-        /* store pointer to item in array */
-        ptr_array_insert(pa, item, n);
-    } else {
-        if (((node_t*)node)->count > 100) {
-            /* make new lookup array */
-            pa = ptr_array_new(128);
-            plist_t current = NULL;
-            for (current = (plist_t)node_first_child(node);
-                 pa && current;
-                 current = (plist_t)node_next_sibling(current))
-            {
-                ptr_array_add(pa, current);
-            }
-            ((plist_data_t)((node_t*)node)->data)->hashtable = pa;
-        }
-    }
-}
-
 PLIST_API void plist_array_set_item(plist_t node, plist_t item, uint32_t n)
 {
     if (node && PLIST_ARRAY == plist_get_node_type(node) && n < INT_MAX)
@@ -552,10 +775,6 @@ PLIST_API void plist_array_set_item(plist_t node, plist_t item, uint32_t n)
                 return;
             }
             node_insert(node, idx, item);
-            ptrarray_t* pa = ((plist_data_t)((node_t*)node)->data)->hashtable;
-            if (pa) {
-                ptr_array_set(pa, item, idx);
-            }
         }
     }
 }
@@ -565,7 +784,6 @@ PLIST_API void plist_array_append_item(plist_t node, plist_t item)
     if (node && PLIST_ARRAY == plist_get_node_type(node))
     {
         node_attach(node, item);
-        _plist_array_post_insert(node, item, -1);
     }
 }
 
@@ -574,7 +792,6 @@ PLIST_API void plist_array_insert_item(plist_t node, plist_t item, uint32_t n)
     if (node && PLIST_ARRAY == plist_get_node_type(node) && n < INT_MAX)
     {
         node_insert(node, n, item);
-        _plist_array_post_insert(node, item, (long)n);
     }
 }
 
@@ -585,10 +802,6 @@ PLIST_API void plist_array_remove_item(plist_t node, uint32_t n)
         plist_t old_item = plist_array_get_item(node, n);
         if (old_item)
         {
-            ptrarray_t* pa = ((plist_data_t)((node_t*)node)->data)->hashtable;
-            if (pa) {
-                ptr_array_remove(pa, n);
-            }
             plist_free(old_item);
         }
     }
@@ -599,12 +812,6 @@ PLIST_API void plist_array_item_remove(plist_t node)
     plist_t father = plist_get_parent(node);
     if (PLIST_ARRAY == plist_get_node_type(father))
     {
-        int n = node_child_position(father, node);
-        if (n < 0) return;
-        ptrarray_t* pa = ((plist_data_t)((node_t*)father)->data)->hashtable;
-        if (pa) {
-            ptr_array_remove(pa, n);
-        }
         plist_free(node);
     }
 }
@@ -704,43 +911,69 @@ PLIST_API plist_t plist_dict_item_get_key(plist_t node)
     return ret;
 }
 
-PLIST_API plist_t plist_dict_get_item(plist_t node, const char* key)
+/**
+ * Looks up the value for a key in a dictionary. If the key was interned,
+ * its atom can be passed to compare interned keys by identity.
+ */
+static plist_t plist_dict_find(plist_t node, const char* key, size_t length, plist_data_t atom)
 {
     plist_t ret = NULL;
+    plist_data_t data = plist_get_data(node);
+    hashtable_t *ht = (hashtable_t*)data->hashtable;
+    if (ht) {
+        struct plist_data_s sdata;
+        memset(&sdata, 0, sizeof(sdata));
+        sdata.strval = (char*)key;
+        sdata.length = length;
+        ret = (plist_t)hash_table_lookup(ht, (atom) ? atom : &sdata);
+    } else if (((node_t*)node)->children) {
+        /* keys and values alternate in the children, so each value follows its key */
+        node_t **items = ((node_t*)node)->children->items;
+        uint32_t count = ((node_t*)node)->children->count;
+        uint32_t i;
+        for (i = 0; i + 1 < count; i += 2)
+        {
+            data = plist_get_data(items[i]);
+            assert( PLIST_KEY == plist_get_node_type(items[i]) );
 
-    if (node && PLIST_DICT == plist_get_node_type(node))
-    {
-        plist_data_t data = plist_get_data(node);
-        hashtable_t *ht = (hashtable_t*)data->hashtable;
-        if (ht) {
-            struct plist_data_s sdata;
-            sdata.strval = (char*)key;
-            sdata.length = strlen(key);
-            ret = (plist_t)hash_table_lookup(ht, &sdata);
-        } else {
-            plist_t current = NULL;
-            for (current = (plist_t)node_first_child(node);
-                current;
-                current = (plist_t)node_next_sibling(node_next_sibling(current)))
+            if (data == atom) {
+                ret = (plist_t)items[i + 1];
+                break;
+            }
+            if (atom && (data->flags & PLIST_DATA_KEY_ATOM)) {
+                /* a different atom holds a different key */
+                continue;
+            }
+            if (data->length == length && memcmp(key, data->strval, length) == 0)
             {
-                data = plist_get_data(current);
-                assert( PLIST_KEY == plist_get_node_type(current) );
-
-                if (data && !strcmp(key, data->strval))
-                {
-                    ret = (plist_t)node_next_sibling(current);
-                    break;
-                }
+                ret = (plist_t)items[i + 1];
+                break;
             }
         }
     }
     return ret;
 }
 
-PLIST_API void plist_dict_set_item(plist_t node, const char* key, plist_t item)
+PLIST_API plist_t plist_dict_get_item(plist_t node, const char* key)
+{
+    plist_t ret = NULL;
+
+    if (node && key && PLIST_DICT == plist_get_node_type(node))
+    {
+        ret = plist_dict_find(node, key, strlen(key), NULL);
+    }
+    return ret;
+}
+
+/**
+ * Sets the value for a key of the given length in a dictionary. The key
+ * does not need to be NUL-terminated.
+ */
+void plist_dict_set_item_with_length(plist_t node, const char* key, size_t length, plist_t item)
 {
     if (node && PLIST_DICT == plist_get_node_type(node)) {
-        node_t* old_item = plist_dict_get_item(node, key);
+        plist_data_t atom = plist_intern_key(key, length);
+        node_t* old_item = plist_dict_find(node, key, length, atom);
         plist_t key_node = NULL;
         if (old_item) {
             int idx = plist_free_node(old_item);
@@ -751,7 +984,7 @@ PLIST_API void plist_dict_set_item(plist_t node, const char* key, plist_t item)
             node_insert(node, idx, item);
             key_node = node_prev_sibling(item);
         } else {
-            key_node = plist_new_key(key);
+            key_node = plist_new_key(key, length, atom);
             node_attach(node, key_node);
             node_attach(node, item);
         }
@@ -778,6 +1011,13 @@ PLIST_API void plist_dict_set_item(plist_t node, const char* key, plist_t item)
     }
 }
 
+PLIST_API void plist_dict_set_item(plist_t node, const char* key, plist_t item)
+{
+    if (key) {
+        plist_dict_set_item_with_length(node, key, strlen(key), item);
+    }
+}
+
 PLIST_API void plist_dict_insert_item(plist_t node, const char* key, plist_t item)
 {
     plist_dict_set_item(node, key, item);
@@ -930,6 +1170,19 @@ PLIST_API void plist_get_key_val(plist_t node, char **val)
     assert(length == strlen(*val));
 }
 
+PLIST_API const char* plist_get_key_ptr(plist_t node, uint64_t* length)
+{
+    if (!node)
+        return NULL;
+    plist_type type = plist_get_node_type(node);
+    if (PLIST_KEY != type)
+        return NULL;
+    plist_data_t data = plist_get_data(node);
+    if (length)
+        *length = data->length;
+    return (const char*)data->strval;
+}
+
 PLIST_API void plist_get_string_val(plist_t node, char **val)
 {
     if (!node || !val)
@@ -1064,6 +1317,7 @@ int plist_data_compare(const void *a, const void *b)
     switch (val_a->type)
     {
     case PLIST_BOOLEAN:
+        return !val_a->boolval == !val_b->boolval;
     case PLIST_UINT:
     case PLIST_REAL:
     case PLIST_DATE:
@@ -1097,18 +1351,119 @@ PLIST_API char plist_compare_node_value(plist_t node_l, plist_t node_r)
     return plist_data_compare(node_l, node_r);
 }
 
+/* compares the values of two nodes that are not containers */
+static int plist_leaf_equal(plist_data_t val_a, plist_data_t val_b)
+{
+    switch (val_a->type)
+    {
+    case PLIST_KEY:
+    case PLIST_STRING:
+        return val_a->length == val_b->length && memcmp(val_a->strval, val_b->strval, val_a->length) == 0;
+    case PLIST_DATA:
+        return val_a->length == val_b->length && memcmp(val_a->buff, val_b->buff, val_a->length) == 0;
+    case PLIST_BOOLEAN:
+        /* only boolval is set, the rest of the union may be stale */
+        return !val_a->boolval == !val_b->boolval;
+    case PLIST_UINT:
+    case PLIST_REAL:
+    case PLIST_DATE:
+    case PLIST_UID:
+        return val_a->length == val_b->length && val_a->intval == val_b->intval;
+    case PLIST_NULL:
+        return TRUE;
+    default:
+        break;
+    }
+    return FALSE;
+}
+
+PLIST_API int plist_equal(plist_t node_l, plist_t node_r)
+{
+    plist_node_stack_t stack = { NULL, 0, 0 };
+    int equal = TRUE;
+
+    if (!node_l || !node_r) {
+        return node_l == node_r;
+    }
+    if (plist_node_stack_push(&stack, (node_t*)node_l, (node_t*)node_r) < 0) {
+        return FALSE;
+    }
+
+    while (equal && stack.count > 0) {
+        plist_node_pair_t pair = stack.pairs[--stack.count];
+        plist_data_t val_a = (plist_data_t)pair.a->data;
+        plist_data_t val_b = (plist_data_t)pair.b->data;
+        unsigned int count = node_n_children(pair.a);
+        unsigned int i;
+
+        /* the same subtree, or the same interned key */
+        if (pair.a == pair.b || val_a == val_b) {
+            continue;
+        }
+        if (val_a->type != val_b->type) {
+            equal = FALSE;
+            break;
+        }
+        if (val_a->type != PLIST_ARRAY && val_a->type != PLIST_DICT) {
+            equal = plist_leaf_equal(val_a, val_b);
+            continue;
+        }
+        if (count != node_n_children(pair.b)) {
+            equal = FALSE;
+            break;
+        }
+        if (val_a->type == PLIST_ARRAY) {
+            for (i = 0; i < count && equal; i++) {
+                if (plist_node_stack_push(&stack, pair.a->children->items[i], pair.b->children->items[i]) < 0) {
+                    equal = FALSE;
+                }
+            }
+            continue;
+        }
+        /* dictionaries are equal regardless of the order of their keys, but
+         * usually share it, so look for each key at the same position first */
+        for (i = 0; i + 1 < count && equal; i += 2) {
+            plist_data_t key_a = (plist_data_t)pair.a->children->items[i]->data;
+            plist_data_t key_b = (plist_data_t)pair.b->children->items[i]->data;
+            node_t *item_b = NULL;
+            if (key_a == key_b || (!((key_a->flags & key_b->flags) & PLIST_DATA_KEY_ATOM) && plist_leaf_equal(key_a, key_b))) {
+                item_b = pair.b->children->items[i + 1];
+            } else {
+                item_b = (node_t*)plist_dict_find(pair.b, key_a->strval, key_a->length, (key_a->flags & PLIST_DATA_KEY_ATOM) ? key_a : NULL);
+            }
+            if (!item_b || plist_node_stack_push(&stack, pair.a->children->items[i + 1], item_b) < 0) {
+                equal = FALSE;
+            }
+        }
+    }
+    free(stack.pairs);
+
+    return equal;
+}
+
 static void plist_set_element_val(plist_t node, plist_type type, const void *value, uint64_t length)
 {
     //free previous allocated buffer
     plist_data_t data = plist_get_data(node);
     assert(data);				// a node should always have data attached
 
+    if (data->flags & PLIST_DATA_KEY_ATOM) {
+        /* the interned key is shared, so the node gets data of its own */
+        data = plist_new_plist_data();
+        assert(data);
+        ((node_t*)node)->data = data;
+    }
+
     switch (data->type)
     {
     case PLIST_KEY:
     case PLIST_STRING:
-        free(data->strval);
+        /* an inline string stays with the data, the new value goes to the heap */
+        if (!PLIST_DATA_STRING_IS_INLINE(data)) {
+            free(data->strval);
+        }
         data->strval = NULL;
+        data->flags &= ~PLIST_DATA_INLINE_STRING;
         break;
     case PLIST_DATA:
         free(data->buff);
@@ -1155,10 +1510,21 @@ PLIST_API void plist_set_key_val(plist_t node, const char *val)
 {
     plist_t father = plist_get_parent(node);
     plist_t item = plist_dict_get_item(father, val);
+    hashtable_t *ht = NULL;
     if (item) {
         return;
     }
+    if (PLIST_DICT == plist_get_node_type(father)) {
+        /* the index is keyed by the key's data and hashed by its value, so re-file it */
+        ht = (hashtable_t*)((plist_data_t)((node_t*)father)->data)->hashtable;
+    }
+    if (ht) {
+        hash_table_remove(ht, ((node_t*)node)->data);
+    }
     plist_set_element_val(node, PLIST_KEY, val, strlen(val));
+    if (ht) {
+        hash_table_insert(ht, ((node_t*)node)->data, node_next_sibling(node));
+    }
 }
 
 PLIST_API void plist_set_string_val(plist_t node, const char *val)
@@ -62,14 +62,32 @@ struct plist_data_s
     };
     uint64_t length;
     plist_type type;
+    uint32_t flags;
 };
 
 typedef struct plist_data_s *plist_data_t;
 
+/* Keys and strings up to this length are stored in the same allocation as
+ * their node data, right behind it, instead of in a buffer of their own */
+#define PLIST_INLINE_STRING_MAX 23
+
+/* size of the chunks that the streaming writers hand to their callback */
+#define PLIST_WRITE_CHUNK_SIZE 65536
+
+/* flags */
+#define PLIST_DATA_INLINE_STRING 1
+#define PLIST_DATA_KEY_ATOM 2 /* shared interned key, see plist_intern_key() */
+
+#define PLIST_DATA_STRING_IS_INLINE(data) (((data)->flags & PLIST_DATA_INLINE_STRING) != 0)
+
 plist_t plist_new_node(plist_data_t data);
 plist_data_t plist_get_data(plist_t node);
 plist_data_t plist_new_plist_data(void);
+plist_data_t plist_new_string_data(plist_type type, const char *str, size_t length);
+plist_data_t plist_new_string_data_take(plist_type type, char *str, size_t length);
+plist_data_t plist_intern_key(const char *str, size_t length);
 void plist_free_data(plist_data_t data);
+void plist_dict_set_item_with_length(plist_t node, const char* key, size_t length, plist_t item);
 int plist_data_compare(const void *a, const void *b);
 
 
@@ -29,6 +29,8 @@ typedef struct bytearray_t strbuf_t;
 #define str_buf_new(__sz) byte_array_new(__sz)
 #define str_buf_free(__ba) byte_array_free(__ba)
 #define str_buf_grow(__ba, __am) byte_array_grow(__ba, __am)
+#define str_buf_new_with_sink(__sz, __sink, __data) byte_array_new_with_sink(__sz, __sink, __data)
 #define str_buf_append(__ba, __str, __len) byte_array_append(__ba, (void*)(__str), __len)
+#define str_buf_flush(__ba) byte_array_flush(__ba)
 
 #endif
@@ -294,17 +294,14 @@ static int node_to_xml(node_t* node, bytearray_t **outbuf, uint32_t depth)
             uint32_t indent = (depth > 8) ? 8 : depth;
             uint32_t maxread = MAX_DATA_BYTES_PER_LINE(indent);
             size_t count = 0;
-            size_t amount = (node_data->length / 3 * 4) + 4 + (((node_data->length / maxread) + 1) * (indent+1));
-            if ((*outbuf)->len + amount > (*outbuf)->capacity) {
-                str_buf_grow(*outbuf, amount);
-            }
+            /* one line of base64 at a time, so that the output can be streamed */
+            char line[MAX_DATA_BYTES_PER_LINE(0) / 3 * 4 + 8];
             while (j < node_data->length) {
                 for (i = 0; i < indent; i++) {
                     str_buf_append(*outbuf, "\t", 1);
                 }
                 count = (node_data->length-j < maxread) ? node_data->length-j : maxread;
-                assert((*outbuf)->len + count < (*outbuf)->capacity);
-                (*outbuf)->len += base64encode((char*)(*outbuf)->data + (*outbuf)->len, node_data->buff + j, count);
+                str_buf_append(*outbuf, line, base64encode(line, node_data->buff + j, count));
                 str_buf_append(*outbuf, "\n", 1);
                 j+=count;
             }
@@ -362,6 +359,7 @@ static int node_to_xml(node_t* node, bytearray_t **outbuf, uint32_t depth)
         for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
             int res = node_to_xml(ch, outbuf, depth+1);
             if (res < 0) return res;
+            if ((*outbuf)->sink_error) return PLIST_ERR_IO;
         }
 
         /* fix indent for structured types */
@@ -565,6 +563,42 @@ PLIST_API plist_err_t plist_to_xml(plist_t plist, char **plist_xml, uint32_t * l
     return PLIST_ERR_SUCCESS;
 }
 
+PLIST_API plist_err_t plist_write_xml(plist_t plist, plist_write_cb_t write_cb, void *user_data)
+{
+    uint64_t size = 0;
+    int res;
+
+    if (!plist || !write_cb) {
+        return PLIST_ERR_INVALID_ARG;
+    }
+
+    /* validate the whole tree before anything is written */
+    res = node_estimate_size(plist, &size, 0);
+    if (res < 0) {
+        return res;
+    }
+
+    strbuf_t *outbuf = str_buf_new_with_sink(PLIST_WRITE_CHUNK_SIZE, write_cb, user_data);
+    if (!outbuf) {
+        PLIST_XML_WRITE_ERR("Could not allocate output buffer");
+        return PLIST_ERR_NO_MEM;
+    }
+
+    str_buf_append(outbuf, XML_PLIST_PROLOG, sizeof(XML_PLIST_PROLOG)-1);
+
+    res = node_to_xml(plist, &outbuf, 0);
+    if (res == PLIST_ERR_SUCCESS) {
+        str_buf_append(outbuf, XML_PLIST_EPILOG, sizeof(XML_PLIST_EPILOG)-1);
+        if (str_buf_flush(outbuf) < 0) {
+            PLIST_XML_WRITE_ERR("Could not write output");
+            res = PLIST_ERR_IO;
+        }
+    }
+    str_buf_free(outbuf);
+
+    return res;
+}
+
 PLIST_API void plist_to_xml_free(char **plist_xml)
 {
     free(plist_xml);
@@ -1243,11 +1277,11 @@ static int node_from_xml(parse_ctx ctx, plist_t *plist)
                 data->boolval = 0;
                 data->length = 1;
             } else if (!strcmp(tag, XPLIST_STRING) || !strcmp(tag, XPLIST_KEY)) {
+                char *str = NULL;
+                size_t length = 0;
                 if (!is_empty) {
                     text_part_t first_part = { NULL, 0, 0, NULL };
                     text_part_t *tp = get_text_parts(ctx, tag, taglen, 0, &first_part);
-                    char *str = NULL;
-                    size_t length = 0;
                     if (!tp) {
                         PLIST_XML_ERR("Could not parse text content for '%s' node\n", tag);
                         text_parts_free(first_part.next);
@@ -1268,15 +1302,20 @@ static int node_from_xml(parse_ctx ctx, plist_t *plist)
                         plist_free(subnode);
                         subnode = NULL;
                         continue;
-                    } else {
-                        data->strval = str;
-                        data->length = length;
                     }
                 } else {
-                    data->strval = strdup("");
-                    data->length = 0;
+                    str = strdup("");
+                }
+                /* swap in node data that can hold a short string inline */
+                plist_data_t strdata = (str) ? plist_new_string_data_take(PLIST_STRING, str, length) : NULL;
+                if (!strdata) {
+                    PLIST_XML_ERR("Could not allocate string for '%s' node\n", tag);
+                    ctx->err++;
+                    goto err_out;
                 }
-                data->type = PLIST_STRING;
+                free(data);
+                data = strdata;
+                ((node_t*)subnode)->data = data;
             } else if (!strcmp(tag, XPLIST_DATA)) {
                 if (!is_empty) {
                     text_part_t first_part = { NULL, 0, 0, NULL };
@@ -147,6 +147,28 @@ static options_t *parse_arguments(int argc, char *argv[])
     return options;
 }
 
+typedef struct _output
+{
+    const char *filename;
+    FILE *file;
+    int open_error;
+} output_t;
+
+/* the output file is only created with the first chunk, so a plist that
+ * can't be converted leaves an existing file untouched */
+static int write_to_file(const char *data, size_t length, void *user_data)
+{
+    output_t *output = (output_t*)user_data;
+    if (!output->file) {
+        output->file = fopen(output->filename, "wb");
+        if (!output->file) {
+            output->open_error = errno;
+            return -1;
+        }
+    }
+    return (fwrite(data, 1, length, output->file) == length) ? 0 : -1;
+}
+
 int main(int argc, char *argv[])
 {
     int ret = 0;
@@ -252,58 +274,61 @@ int main(int argc, char *argv[])
         fclose(iplist);
     }
 
-    if (options->out_fmt == 0) {
+    int out_fmt = options->out_fmt;
+    if (out_fmt == 0) {
         // convert from binary to xml or vice-versa
         if (plist_is_binary(plist_entire, read_size))
         {
             input_res = plist_from_bin(plist_entire, read_size, &root_node);
-            if (input_res == PLIST_ERR_SUCCESS) {
-                output_res = plist_to_xml(root_node, &plist_out, &size);
-            }
+            out_fmt = 2;
         }
         else
         {
             input_res = plist_from_xml(plist_entire, read_size, &root_node);
-            if (input_res == PLIST_ERR_SUCCESS) {
-                output_res = plist_to_bin(root_node, &plist_out, &size);
-            }
+            out_fmt = 1;
         }
     }
     else
     {
         input_res = plist_from_memory(plist_entire, read_size, &root_node);
-        if (input_res == PLIST_ERR_SUCCESS) {
-            if (options->out_fmt == 1) {
-                output_res = plist_to_bin(root_node, &plist_out, &size);
-            } else if (options->out_fmt == 2) {
-                output_res = plist_to_xml(root_node, &plist_out, &size);
-            } else if (options->out_fmt == 3) {
-                output_res = plist_to_json(root_node, &plist_out, &size, 0);
-            }
-        }
     }
-    plist_free(root_node);
     free(plist_entire);
 
-    if (plist_out)
+    if (input_res == PLIST_ERR_SUCCESS)
     {
+        output_t output = { NULL, stdout, 0 };
         if (options->out_file != NULL && strcmp(options->out_file, "-") != 0)
         {
-            FILE *oplist = fopen(options->out_file, "wb");
-            if (!oplist) {
-                fprintf(stderr, "ERROR: Could not open output file '%s': %s\n", options->out_file, strerror(errno));
-                free(options);
-                return 1;
+            output.filename = options->out_file;
+            output.file = NULL;
+        }
+
+        if (out_fmt == 1) {
+            output_res = plist_to_bin(root_node, &plist_out, &size);
+            if (plist_out) {
+                if (write_to_file(plist_out, size, &output) < 0) {
+                    output_res = PLIST_ERR_IO;
+                }
+                free(plist_out);
             }
-            fwrite(plist_out, size, sizeof(char), oplist);
-            fclose(oplist);
+        } else if (out_fmt == 2) {
+            // XML and JSON are written out while they are produced
+            output_res = plist_write_xml(root_node, write_to_file, &output);
+        } else if (out_fmt == 3) {
+            output_res = plist_write_json(root_node, write_to_file, &output, 0);
         }
-        // if no output file specified, write to stdout
-        else
-            fwrite(plist_out, size, sizeof(char), stdout);
 
-        free(plist_out);
+        if (output.file && output.file != stdout) {
+            fclose(output.file);
+        }
+        if (output.open_error) {
+            fprintf(stderr, "ERROR: Could not open output file '%s': %s\n", options->out_file, strerror(output.open_error));
+            plist_free(root_node);
+            free(options);
+            return 1;
+        }
     }
+    plist_free(root_node);
 
     if (input_res == PLIST_ERR_SUCCESS) {
         switch (output_res) {
@@ -313,6 +338,10 @@ int main(int argc, char *argv[])
                 fprintf(stderr, "ERROR: Input plist data is not compatible with output format.\n");
                 ret = 2;
                 break;
+            case PLIST_ERR_IO:
+                fprintf(stderr, "ERROR: Could not write output: %s\n", strerror(errno));
+                ret = 1;
+                break;
             default:
                 fprintf(stderr, "ERROR: Failed to convert plist data (%d)\n", output_res);
                 ret = 1;
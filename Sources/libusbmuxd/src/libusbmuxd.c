@@ -120,7 +120,41 @@ static int libusbmuxd_debug = 0;
 #define LIBUSBMUXD_DEBUG(level, format, ...) if (level <= libusbmuxd_debug) fprintf(stderr, ("[" PACKAGE "] " format), __VA_ARGS__); fflush(stderr);
 #define LIBUSBMUXD_ERROR(format, ...) LIBUSBMUXD_DEBUG(0, format, __VA_ARGS__)
 
-static struct collection devices;
+/* number of hash buckets of the device table, must be a power of 2 */
+#define DEVICE_TABLE_BUCKETS 256
+
+struct device_entry {
+	usbmuxd_device_info_t info;
+	struct device_entry *next_by_handle;
+	struct device_entry *next_by_udid;
+	struct device_entry *prev;  /* in the order the devices were attached */
+	struct device_entry *next;
+};
+
+/* the devices reported by the device monitor, indexed by handle and UDID;
+ * only accessed with listener_mutex held */
+static struct device_table {
+	struct device_entry *by_handle[DEVICE_TABLE_BUCKETS];
+	struct device_entry *by_udid[DEVICE_TABLE_BUCKETS];
+	struct device_entry *first;
+	struct device_entry *last;
+	uint32_t count;
+} devices;
+
+/* immutable copy of the device table that readers can use without waiting
+ * for the device monitor or event delivery */
+struct device_snapshot {
+	int refs;
+	uint32_t count;
+	usbmuxd_device_info_t *devices;
+	int32_t *index;  /* open addressing by UDID hash, -1 marks a free slot */
+	uint32_t index_mask;
+};
+
+static struct device_snapshot *device_snapshot = NULL;
+static mutex_t snapshot_mutex;
+static thread_once_t snapshot_init_once = THREAD_ONCE_INIT;
+
 static THREAD_T devmon = THREAD_T_NULL;
 static int listenfd = -1;
 static int running = 0;
@@ -130,9 +164,34 @@ static volatile int use_tag = 0;
 static volatile int proto_version = 1;
 static volatile int try_list_devices = 1;
 
+#ifdef WIN32
+typedef DWORD thread_id_t;
+#define THREAD_ID_EQUAL(a, b) ((a) == (b))
+#else
+typedef pthread_t thread_id_t;
+#define THREAD_ID_EQUAL(a, b) pthread_equal(a, b)
+#endif
+
+struct usbmuxd_event_item {
+	usbmuxd_event_t event;
+	struct usbmuxd_event_item *next;
+};
+
 struct usbmuxd_subscription_context {
 	usbmuxd_event_cb_t callback;
 	void *user_data;
+
+	/* events are queued and delivered on a thread of their own, so that a
+	 * slow subscriber does not hold up the device monitor or other subscribers */
+	THREAD_T thread;
+	thread_id_t thread_id;
+	int has_thread_id;
+	mutex_t mutex;
+	cond_t cond;
+	struct usbmuxd_event_item *head;
+	struct usbmuxd_event_item *tail;
+	int quit;
+	int detached;
 };
 
 static struct usbmuxd_subscription_context *event_ctx = NULL;
@@ -141,20 +200,276 @@ static struct collection listeners;
 thread_once_t listener_init_once = THREAD_ONCE_INIT;
 mutex_t listener_mutex;
 
+static uint32_t udid_hash(const char *udid)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+	while (*udid) {
+		hash ^= (unsigned char)*udid++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
 /**
  * Finds a device info record by its handle.
  * if the record is not found, NULL is returned.
  */
 static usbmuxd_device_info_t *devices_find(uint32_t handle)
 {
-	FOREACH(usbmuxd_device_info_t *dev, &devices) {
-		if (dev && dev->handle == handle) {
-			return dev;
+	struct device_entry *entry = devices.by_handle[handle & (DEVICE_TABLE_BUCKETS-1)];
+	while (entry) {
+		if (entry->info.handle == handle) {
+			return &entry->info;
 		}
-	} ENDFOREACH
+		entry = entry->next_by_handle;
+	}
 	return NULL;
 }
 
+/**
+ * Adds a device info record to the device table. The record is copied.
+ */
+static usbmuxd_device_info_t *devices_add(const usbmuxd_device_info_t *dev)
+{
+	struct device_entry *entry = (struct device_entry*)malloc(sizeof(struct device_entry));
+	if (!entry) {
+		return NULL;
+	}
+	memcpy(&entry->info, dev, sizeof(usbmuxd_device_info_t));
+	uint32_t hb = dev->handle & (DEVICE_TABLE_BUCKETS-1);
+	uint32_t ub = udid_hash(dev->udid) & (DEVICE_TABLE_BUCKETS-1);
+	entry->next_by_handle = devices.by_handle[hb];
+	devices.by_handle[hb] = entry;
+	entry->next_by_udid = devices.by_udid[ub];
+	devices.by_udid[ub] = entry;
+	entry->prev = devices.last;
+	entry->next = NULL;
+	if (devices.last) {
+		devices.last->next = entry;
+	} else {
+		devices.first = entry;
+	}
+	devices.last = entry;
+	devices.count++;
+	return &entry->info;
+}
+
+/**
+ * Removes a device info record, as returned by devices_find(), from the
+ * device table and frees it.
+ */
+static void devices_remove(usbmuxd_device_info_t *dev)
+{
+	struct device_entry *entry = (struct device_entry*)dev;
+	struct device_entry **link;
+
+	link = &devices.by_handle[dev->handle & (DEVICE_TABLE_BUCKETS-1)];
+	while (*link && *link != entry) {
+		link = &(*link)->next_by_handle;
+	}
+	if (*link) {
+		*link = entry->next_by_handle;
+	}
+	link = &devices.by_udid[udid_hash(dev->udid) & (DEVICE_TABLE_BUCKETS-1)];
+	while (*link && *link != entry) {
+		link = &(*link)->next_by_udid;
+	}
+	if (*link) {
+		*link = entry->next_by_udid;
+	}
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		devices.first = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		devices.last = entry->prev;
+	}
+	devices.count--;
+	free(entry);
+}
+
+static void init_snapshot(void)
+{
+	mutex_init(&snapshot_mutex);
+}
+
+static void snapshot_release(struct device_snapshot *snapshot)
+{
+	int refs;
+	if (!snapshot) {
+		return;
+	}
+	mutex_lock(&snapshot_mutex);
+	refs = --snapshot->refs;
+	mutex_unlock(&snapshot_mutex);
+	if (refs == 0) {
+		free(snapshot->index);
+		free(snapshot->devices);
+		free(snapshot);
+	}
+}
+
+/**
+ * Returns a reference to the current device snapshot, or NULL if the device
+ * monitor is not running. Release it with snapshot_release().
+ */
+static struct device_snapshot *snapshot_acquire(void)
+{
+	struct device_snapshot *snapshot;
+	thread_once(&snapshot_init_once, init_snapshot);
+	mutex_lock(&snapshot_mutex);
+	snapshot = device_snapshot;
+	if (snapshot) {
+		snapshot->refs++;
+	}
+	mutex_unlock(&snapshot_mutex);
+	return snapshot;
+}
+
+/**
+ * Replaces the device snapshot with a copy of the device table, or removes
+ * it if publish is 0. Must be called with listener_mutex held.
+ */
+static void snapshot_update(int publish)
+{
+	struct device_snapshot *snapshot = NULL;
+	struct device_snapshot *old;
+
+	if (publish) {
+		snapshot = (struct device_snapshot*)calloc(1, sizeof(struct device_snapshot));
+		uint32_t size = 16;
+		while (size < devices.count * 2) {
+			size <<= 1;
+		}
+		if (snapshot) {
+			snapshot->devices = (usbmuxd_device_info_t*)malloc(sizeof(usbmuxd_device_info_t) * (devices.count + 1));
+			snapshot->index = (int32_t*)malloc(sizeof(int32_t) * size);
+		}
+		if (!snapshot || !snapshot->devices || !snapshot->index) {
+			if (snapshot) {
+				free(snapshot->devices);
+				free(snapshot->index);
+				free(snapshot);
+			}
+			snapshot = NULL;
+		} else {
+			struct device_entry *entry;
+			snapshot->refs = 1;
+			snapshot->index_mask = size - 1;
+			memset(snapshot->index, 0xff, sizeof(int32_t) * size);
+			for (entry = devices.first; entry; entry = entry->next) {
+				uint32_t slot = udid_hash(entry->info.udid) & snapshot->index_mask;
+				while (snapshot->index[slot] >= 0) {
+					slot = (slot + 1) & snapshot->index_mask;
+				}
+				snapshot->index[slot] = snapshot->count;
+				memcpy(&snapshot->devices[snapshot->count++], &entry->info, sizeof(usbmuxd_device_info_t));
+			}
+		}
+	}
+
+	thread_once(&snapshot_init_once, init_snapshot);
+	mutex_lock(&snapshot_mutex);
+	old = device_snapshot;
+	device_snapshot = snapshot;
+	mutex_unlock(&snapshot_mutex);
+	snapshot_release(old);
+}
+
+/**
+ * Picks a device from the device snapshot the same way usbmuxd_get_device()
+ * picks it from the device list, looking it up by UDID through the index.
+ * Returns 1 if a matching device was found, 0 otherwise, including when the
+ * device monitor is not running.
+ */
+static int snapshot_get_device(const char *udid, usbmuxd_device_info_t *device, enum usbmux_lookup_options options)
+{
+	struct device_snapshot *snapshot = snapshot_acquire();
+	usbmuxd_device_info_t *dev_network = NULL;
+	usbmuxd_device_info_t *dev_usbmuxd = NULL;
+	usbmuxd_device_info_t *dev = NULL;
+
+	if (!snapshot) {
+		return 0;
+	}
+
+	if (!udid) {
+		uint32_t i;
+		for (i = 0; i < snapshot->count; i++) {
+			if ((options & DEVICE_LOOKUP_USBMUX) && (snapshot->devices[i].conn_type == CONNECTION_TYPE_USB)) {
+				dev_usbmuxd = &snapshot->devices[i];
+				break;
+			}
+			if ((options & DEVICE_LOOKUP_NETWORK) && (snapshot->devices[i].conn_type == CONNECTION_TYPE_NETWORK)) {
+				dev_network = &snapshot->devices[i];
+				break;
+			}
+		}
+	} else {
+		/* The device list is walked in attach order, keeping the last
+		 * connection of each type seen but stopping once both types were
+		 * seen. The index yields matches in any order, so first find where
+		 * that walk would stop, then the last match of each type before it. */
+		usbmuxd_device_info_t *first_network = NULL;
+		usbmuxd_device_info_t *first_usbmuxd = NULL;
+		usbmuxd_device_info_t *stop = NULL;
+		uint32_t start = udid_hash(udid) & snapshot->index_mask;
+		uint32_t slot;
+		for (slot = start; snapshot->index[slot] >= 0; slot = (slot + 1) & snapshot->index_mask) {
+			usbmuxd_device_info_t *di = &snapshot->devices[snapshot->index[slot]];
+			if (strcmp(udid, di->udid) != 0) {
+				continue;
+			}
+			if ((options & DEVICE_LOOKUP_USBMUX) && (di->conn_type == CONNECTION_TYPE_USB)) {
+				if (!first_usbmuxd || di < first_usbmuxd) {
+					first_usbmuxd = di;
+				}
+			} else if ((options & DEVICE_LOOKUP_NETWORK) && (di->conn_type == CONNECTION_TYPE_NETWORK)) {
+				if (!first_network || di < first_network) {
+					first_network = di;
+				}
+			}
+		}
+		if (first_usbmuxd && first_network) {
+			stop = (first_usbmuxd > first_network) ? first_usbmuxd : first_network;
+		}
+		for (slot = start; snapshot->index[slot] >= 0; slot = (slot + 1) & snapshot->index_mask) {
+			usbmuxd_device_info_t *di = &snapshot->devices[snapshot->index[slot]];
+			if (strcmp(udid, di->udid) != 0 || (stop && di > stop)) {
+				continue;
+			}
+			if ((options & DEVICE_LOOKUP_USBMUX) && (di->conn_type == CONNECTION_TYPE_USB)) {
+				if (!dev_usbmuxd || di > dev_usbmuxd) {
+					dev_usbmuxd = di;
+				}
+			} else if ((options & DEVICE_LOOKUP_NETWORK) && (di->conn_type == CONNECTION_TYPE_NETWORK)) {
+				if (!dev_network || di > dev_network) {
+					dev_network = di;
+				}
+			}
+		}
+	}
+
+	if (dev_network && dev_usbmuxd) {
+		dev = (options & DEVICE_LOOKUP_PREFER_NETWORK) ? dev_network : dev_usbmuxd;
+	} else if (dev_network) {
+		dev = dev_network;
+	} else if (dev_usbmuxd) {
+		dev = dev_usbmuxd;
+	}
+
+	if (dev) {
+		memcpy(device, dev, sizeof(usbmuxd_device_info_t));
+	}
+	snapshot_release(snapshot);
+
+	return (dev) ? 1 : 0;
+}
+
 /**
  * Creates a socket connection to usbmuxd.
  * For Mac/Linux it is a unix domain socket,
@@ -840,26 +1155,139 @@ static int send_pair_record_packet(int sfd, uint32_t tag, const char* msgtype, c
 }
 
 /**
- * Generates an event, i.e. calls the callback function.
- * A reference to a populated usbmuxd_event_t with information about the event
- * and the corresponding device will be passed to the callback function.
+ * Queues an event for delivery on the dispatch thread of a subscriber.
  */
-static void generate_event(const usbmuxd_device_info_t *dev, enum usbmuxd_event_type event)
+static void listener_queue_event(struct usbmuxd_subscription_context *context, const usbmuxd_device_info_t *dev, enum usbmuxd_event_type event)
+{
+	struct usbmuxd_event_item *item = (struct usbmuxd_event_item*)malloc(sizeof(struct usbmuxd_event_item));
+	if (!item) {
+		return;
+	}
+	item->event.event = event;
+	memcpy(&item->event.device, dev, sizeof(usbmuxd_device_info_t));
+	item->next = NULL;
+
+	mutex_lock(&context->mutex);
+	if (context->tail) {
+		context->tail->next = item;
+	} else {
+		context->head = item;
+	}
+	context->tail = item;
+	cond_signal(&context->cond);
+	mutex_unlock(&context->mutex);
+}
+
+static void listener_context_free(struct usbmuxd_subscription_context *context)
 {
-	usbmuxd_event_t ev;
+	while (context->head) {
+		struct usbmuxd_event_item *item = context->head;
+		context->head = item->next;
+		free(item);
+	}
+	cond_destroy(&context->cond);
+	mutex_destroy(&context->mutex);
+	free(context);
+}
 
+/**
+ * Dispatch thread of a subscriber, passing the queued events to its callback.
+ */
+static void *listener_dispatch(void *data)
+{
+	struct usbmuxd_subscription_context *context = (struct usbmuxd_subscription_context*)data;
+	int detached;
+
+	mutex_lock(&context->mutex);
+	context->thread_id = THREAD_ID;
+	context->has_thread_id = 1;
+	while (1) {
+		while (!context->head && !context->quit) {
+			cond_wait(&context->cond, &context->mutex);
+		}
+		struct usbmuxd_event_item *item = context->head;
+		if (!item || (context->quit && context->detached)) {
+			/* a subscriber that unsubscribed from its callback gets no further events */
+			break;
+		}
+		context->head = item->next;
+		if (!context->head) {
+			context->tail = NULL;
+		}
+		mutex_unlock(&context->mutex);
+		context->callback(&item->event, context->user_data);
+		free(item);
+		mutex_lock(&context->mutex);
+	}
+	detached = context->detached;
+	mutex_unlock(&context->mutex);
+
+	if (detached) {
+		listener_context_free(context);
+	}
+	return NULL;
+}
+
+/**
+ * Returns 1 if called from the dispatch thread of the subscriber, i.e. from
+ * within its callback.
+ */
+static int listener_is_dispatching(struct usbmuxd_subscription_context *context)
+{
+	int self;
+	mutex_lock(&context->mutex);
+	self = (context->has_thread_id && THREAD_ID_EQUAL(context->thread_id, THREAD_ID));
+	mutex_unlock(&context->mutex);
+	return self;
+}
+
+/**
+ * Delivers the remaining queued events of a subscriber and frees it. When
+ * called from the subscriber's own callback, the queued events are dropped
+ * instead, since the caller may free the callback's user data as soon as
+ * this returns, and the subscriber is freed after the callback returns.
+ */
+static void listener_stop(struct usbmuxd_subscription_context *context)
+{
+	int self = listener_is_dispatching(context);
+	mutex_lock(&context->mutex);
+	if (self) {
+		while (context->head) {
+			struct usbmuxd_event_item *item = context->head;
+			context->head = item->next;
+			free(item);
+		}
+		context->tail = NULL;
+	}
+	context->quit = 1;
+	context->detached = self;
+	cond_signal(&context->cond);
+	mutex_unlock(&context->mutex);
+
+	if (self) {
+		thread_detach(context->thread);
+	} else {
+		thread_join(context->thread);
+		thread_free(context->thread);
+		listener_context_free(context);
+	}
+}
+
+/**
+ * Generates an event, i.e. queues it for the callback function of every
+ * subscriber. A populated usbmuxd_event_t with information about the event
+ * and the corresponding device will be passed to the callback functions.
+ * Must be called with listener_mutex held.
+ */
+static void generate_event(const usbmuxd_device_info_t *dev, enum usbmuxd_event_type event)
+{
 	if (!dev) {
 		return;
 	}
 
-	ev.event = event;
-	memcpy(&ev.device, dev, sizeof(usbmuxd_device_info_t));
-
-	mutex_lock(&listener_mutex);
 	FOREACH(struct usbmuxd_subscription_context* context, &listeners) {
-		context->callback(&ev, context->user_data);
+		listener_queue_event(context, dev, event);
 	} ENDFOREACH
-	mutex_unlock(&listener_mutex);
 }
 
 static int usbmuxd_listen_poll()
@@ -1052,11 +1480,13 @@ static int get_next_event(int sfd)
 		// when then usbmuxd connection fails,
 		// generate remove events for every device that
 		// is still present so applications know about it
-		FOREACH(usbmuxd_device_info_t *dev, &devices) {
-			generate_event(dev, UE_DEVICE_REMOVE);
-			collection_remove(&devices, dev);
-			free(dev);
-		} ENDFOREACH
+		mutex_lock(&listener_mutex);
+		while (devices.first) {
+			generate_event(&devices.first->info, UE_DEVICE_REMOVE);
+			devices_remove(&devices.first->info);
+		}
+		snapshot_update(0);
+		mutex_unlock(&listener_mutex);
 		return -EIO;
 	}
 
@@ -1066,23 +1496,27 @@ static int get_next_event(int sfd)
 	}
 
 	if (hdr.message == MESSAGE_DEVICE_ADD) {
-		usbmuxd_device_info_t *devinfo = (usbmuxd_device_info_t*)payload;
-		collection_add(&devices, devinfo);
+		mutex_lock(&listener_mutex);
+		usbmuxd_device_info_t *devinfo = devices_add((usbmuxd_device_info_t*)payload);
 		generate_event(devinfo, UE_DEVICE_ADD);
-		payload = NULL;
+		snapshot_update(1);
+		mutex_unlock(&listener_mutex);
 	} else if (hdr.message == MESSAGE_DEVICE_REMOVE) {
 		uint32_t handle;
 		usbmuxd_device_info_t *devinfo;
 
 		memcpy(&handle, payload, sizeof(uint32_t));
 
+		mutex_lock(&listener_mutex);
 		devinfo = devices_find(handle);
+		if (devinfo) {
+			generate_event(devinfo, UE_DEVICE_REMOVE);
+			devices_remove(devinfo);
+			snapshot_update(1);
+		}
+		mutex_unlock(&listener_mutex);
 		if (!devinfo) {
 			LIBUSBMUXD_DEBUG(1, "%s: WARNING: got device remove message for handle %d, but couldn't find the corresponding handle in the device list. This event will be ignored.\n", __func__, handle);
-		} else {
-			generate_event(devinfo, UE_DEVICE_REMOVE);
-			collection_remove(&devices, devinfo);
-			free(devinfo);
 		}
 	} else if (hdr.message == MESSAGE_DEVICE_PAIRED) {
 		uint32_t handle;
@@ -1090,11 +1524,14 @@ static int get_next_event(int sfd)
 
 		memcpy(&handle, payload, sizeof(uint32_t));
 
+		mutex_lock(&listener_mutex);
 		devinfo = devices_find(handle);
+		if (devinfo) {
+			generate_event(devinfo, UE_DEVICE_PAIRED);
+		}
+		mutex_unlock(&listener_mutex);
 		if (!devinfo) {
 			LIBUSBMUXD_DEBUG(1, "%s: WARNING: got paired message for device handle %d, but couldn't find the corresponding handle in the device list. This event will be ignored.\n", __func__, handle);
-		} else {
-			generate_event(devinfo, UE_DEVICE_PAIRED);
 		}
 	} else if (hdr.length > 0) {
 		LIBUSBMUXD_DEBUG(1, "%s: Unexpected message type %d length %d received!\n", __func__, hdr.message, hdr.length);
@@ -1105,11 +1542,12 @@ static int get_next_event(int sfd)
 
 static void device_monitor_cleanup(void* data)
 {
-	FOREACH(usbmuxd_device_info_t *dev, &devices) {
-		collection_remove(&devices, dev);
-		free(dev);
-	} ENDFOREACH
-	collection_free(&devices);
+	mutex_lock(&listener_mutex);
+	while (devices.first) {
+		devices_remove(&devices.first->info);
+	}
+	snapshot_update(0);
+	mutex_unlock(&listener_mutex);
 
 	socket_close(listenfd);
 	listenfd = -1;
@@ -1123,7 +1561,6 @@ static void device_monitor_cleanup(void* data)
 static void *device_monitor(void *data)
 {
 	running = 1;
-	collection_init(&devices);
 	cancelling = 0;
 
 #ifdef HAVE_THREAD_CLEANUP
@@ -1173,36 +1610,43 @@ USBMUXD_API int usbmuxd_events_subscribe(usbmuxd_subscription_context_t *context
 
 	thread_once(&listener_init_once, init_listeners);
 
-	mutex_lock(&listener_mutex);
-	*context = malloc(sizeof(struct usbmuxd_subscription_context));
+	*context = calloc(1, sizeof(struct usbmuxd_subscription_context));
 	if (!*context) {
-		mutex_unlock(&listener_mutex);
 		LIBUSBMUXD_ERROR("ERROR: %s: malloc failed\n", __func__);
 		return -ENOMEM;
 	}
 	(*context)->callback = callback;
 	(*context)->user_data = user_data;
+	mutex_init(&(*context)->mutex);
+	cond_init(&(*context)->cond);
+	if (thread_new(&(*context)->thread, listener_dispatch, *context) != 0) {
+		listener_context_free(*context);
+		*context = NULL;
+		LIBUSBMUXD_DEBUG(1, "%s: ERROR: Could not start event dispatch thread!\n", __func__);
+		return -ENOMEM;
+	}
 
+	mutex_lock(&listener_mutex);
 	collection_add(&listeners, *context);
 
 	if (devmon == THREAD_T_NULL || !thread_alive(devmon)) {
 		mutex_unlock(&listener_mutex);
 		int res = thread_new(&devmon, device_monitor, NULL);
 		if (res != 0) {
-			free(*context);
+			mutex_lock(&listener_mutex);
+			collection_remove(&listeners, *context);
+			mutex_unlock(&listener_mutex);
+			listener_stop(*context);
+			*context = NULL;
 			LIBUSBMUXD_DEBUG(1, "%s: ERROR: Could not start device watcher thread!\n", __func__);
 			return res;
 		}
 	} else {
 		/* we need to submit DEVICE_ADD events to the new listener */
-		FOREACH(usbmuxd_device_info_t *dev, &devices) {
-			if (dev) {
-				usbmuxd_event_t ev;
-				ev.event = UE_DEVICE_ADD;
-				memcpy(&ev.device, dev, sizeof(usbmuxd_device_info_t));
-				(*context)->callback(&ev, (*context)->user_data);
-			}
-		} ENDFOREACH
+		struct device_entry *entry;
+		for (entry = devices.first; entry; entry = entry->next) {
+			listener_queue_event(*context, &entry->info, UE_DEVICE_ADD);
+		}
 		mutex_unlock(&listener_mutex);
 	}
 
@@ -1218,21 +1662,25 @@ USBMUXD_API int usbmuxd_events_unsubscribe(usbmuxd_subscription_context_t contex
 		return -EINVAL;
 	}
 
+	/* from within its own callback, the subscriber gets no remove events,
+	 * they would arrive after it returned from unsubscribing */
+	int self = listener_is_dispatching(context);
+
 	mutex_lock(&listener_mutex);
-	if (collection_remove(&listeners, context) == 0) {
-		FOREACH(usbmuxd_device_info_t *dev, &devices) {
-			if (dev) {
-				usbmuxd_event_t ev;
-				ev.event = UE_DEVICE_REMOVE;
-				memcpy(&ev.device, dev, sizeof(usbmuxd_device_info_t));
-				(context)->callback(&ev, (context)->user_data);
-			}
-		} ENDFOREACH
-		free(context);
+	int found = (collection_remove(&listeners, context) == 0);
+	if (found && !self) {
+		struct device_entry *entry;
+		for (entry = devices.first; entry; entry = entry->next) {
+			listener_queue_event(context, &entry->info, UE_DEVICE_REMOVE);
+		}
 	}
 	num = collection_count(&listeners);
 	mutex_unlock(&listener_mutex);
 
+	if (found) {
+		listener_stop(context);
+	}
+
 	if (num == 0) {
 		int res = 0;
 		cancelling = 1;
@@ -1435,6 +1883,9 @@ USBMUXD_API int usbmuxd_get_device_by_udid(const char *udid, usbmuxd_device_info
 	if (!device) {
 		return -EINVAL;
 	}
+	if (snapshot_get_device(udid, device, DEVICE_LOOKUP_USBMUX)) {
+		return 1;
+	}
 	if (usbmuxd_get_device_list(&dev_list) < 0) {
 		return -ENODEV;
 	}
@@ -1480,14 +1931,19 @@ USBMUXD_API int usbmuxd_get_device(const char *udid, usbmuxd_device_info_t *devi
 	if (!device) {
 		return -EINVAL;
 	}
-	if (usbmuxd_get_device_list(&dev_list) < 0) {
-		return -ENODEV;
-	}
 
 	if (options == 0) {
 		options = DEVICE_LOOKUP_USBMUX;
 	}
 
+	/* while the device monitor is running, its device table is current */
+	if (snapshot_get_device(udid, device, options)) {
+		return 1;
+	}
+	if (usbmuxd_get_device_list(&dev_list) < 0) {
+		return -ENODEV;
+	}
+
 	for (i = 0; dev_list[i].handle > 0; i++) {
 		if (!udid) {
 			if ((options & DEVICE_LOOKUP_USBMUX) && (dev_list[i].conn_type == CONNECTION_TYPE_USB)) {
@@ -67,6 +67,18 @@
 #error "MBEDTLS_AESNI_C defined, but not all prerequisites"
 #endif
 
+#if defined(MBEDTLS_SHA1_USE_CPU_EXT_IF_PRESENT) && !defined(MBEDTLS_SHA1_C)
+#error "MBEDTLS_SHA1_USE_CPU_EXT_IF_PRESENT defined, but not all prerequisites"
+#endif
+
+#if defined(MBEDTLS_SHA256_USE_CPU_EXT_IF_PRESENT) && !defined(MBEDTLS_SHA256_C)
+#error "MBEDTLS_SHA256_USE_CPU_EXT_IF_PRESENT defined, but not all prerequisites"
+#endif
+
+#if defined(MBEDTLS_SHA512_USE_CPU_EXT_IF_PRESENT) && !defined(MBEDTLS_SHA512_C)
+#error "MBEDTLS_SHA512_USE_CPU_EXT_IF_PRESENT defined, but not all prerequisites"
+#endif
+
 #if defined(MBEDTLS_CTR_DRBG_C) && !defined(MBEDTLS_AES_C)
 #error "MBEDTLS_CTR_DRBG_C defined, but not all prerequisites"
 #endif
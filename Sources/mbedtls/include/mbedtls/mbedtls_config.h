@@ -1293,6 +1293,54 @@
  */
 //#define MBEDTLS_SHA512_SMALLER
 
+/**
+ * \def MBEDTLS_SHA1_USE_CPU_EXT_IF_PRESENT
+ *
+ * Enable the SHA-1 implementation that uses the SHA instructions of the CPU
+ * if a runtime check finds them: the SHA extensions (SHA-NI) on x86-64, which
+ * needs MBEDTLS_HAVE_ASM and GCC 5 or Clang, and the ARMv8 cryptographic
+ * extension on AArch64 Linux and Apple platforms. Elsewhere, and on CPUs
+ * without these instructions, the C implementation is used.
+ *
+ * Module:  library/sha1.c
+ *
+ * Requires: MBEDTLS_SHA1_C
+ *
+ * Comment to always use the C implementation of SHA-1.
+ */
+#define MBEDTLS_SHA1_USE_CPU_EXT_IF_PRESENT
+
+/**
+ * \def MBEDTLS_SHA256_USE_CPU_EXT_IF_PRESENT
+ *
+ * Enable the SHA-224 and SHA-256 implementation that uses the SHA
+ * instructions of the CPU if a runtime check finds them, on the same
+ * platforms as MBEDTLS_SHA1_USE_CPU_EXT_IF_PRESENT.
+ *
+ * Module:  library/sha256.c
+ *
+ * Requires: MBEDTLS_SHA256_C
+ *
+ * Comment to always use the C implementation of SHA-256.
+ */
+#define MBEDTLS_SHA256_USE_CPU_EXT_IF_PRESENT
+
+/**
+ * \def MBEDTLS_SHA512_USE_CPU_EXT_IF_PRESENT
+ *
+ * Enable the SHA-384 and SHA-512 implementation that uses the ARMv8.2 SHA-512
+ * instructions if a runtime check finds them, on AArch64 Linux and Apple
+ * platforms (GCC 8 or Clang 7 and later). x86-64 has no SHA-512 instructions
+ * in its SHA extensions, so there the C implementation is always used.
+ *
+ * Module:  library/sha512.c
+ *
+ * Requires: MBEDTLS_SHA512_C
+ *
+ * Comment to always use the C implementation of SHA-512.
+ */
+#define MBEDTLS_SHA512_USE_CPU_EXT_IF_PRESENT
+
 /**
  * \def MBEDTLS_SSL_ALL_ALERT_MESSAGES
  *
@@ -208,6 +208,34 @@ int mbedtls_sha1( const unsigned char *input,
                   size_t ilen,
                   unsigned char output[20] );
 
+/**
+ * \brief          This function calculates the SHA-1 checksums of several
+ *                 independent buffers.
+ *
+ *                 The result is the same as calling mbedtls_sha1() on each
+ *                 buffer. When the CPU has the SHA extensions, two buffers
+ *                 are hashed at a time with their rounds interleaved, which
+ *                 is faster for many small buffers.
+ *
+ * \warning        SHA-1 is considered a weak message digest and its use
+ *                 constitutes a security risk. We recommend considering
+ *                 stronger message digests instead.
+ *
+ * \param input    The buffers holding the data. \p input[i] must be a
+ *                 readable buffer of length \p ilen[i] Bytes.
+ * \param ilen     The lengths of the buffers in Bytes.
+ * \param output   The SHA-1 checksum results. \p output[i] must be a
+ *                 writable buffer of length \c 20 Bytes.
+ * \param count    The number of buffers.
+ *
+ * \return         \c 0 on success.
+ * \return         A negative error code on failure.
+ */
+int mbedtls_sha1_multi( const unsigned char * const input[],
+                        const size_t ilen[],
+                        unsigned char * const output[],
+                        size_t count );
+
 #if defined(MBEDTLS_SELF_TEST)
 
 /**
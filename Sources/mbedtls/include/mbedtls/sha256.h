@@ -176,6 +176,34 @@ int mbedtls_sha256( const unsigned char *input,
                     unsigned char *output,
                     int is224 );
 
+/**
+ * \brief          This function calculates the SHA-224 or SHA-256
+ *                 checksums of several independent buffers.
+ *
+ *                 The result is the same as calling mbedtls_sha256() on
+ *                 each buffer. When the CPU has the SHA extensions, two
+ *                 buffers are hashed at a time with their rounds
+ *                 interleaved, which is faster for many small buffers.
+ *
+ * \param input    The buffers holding the data. \p input[i] must be a
+ *                 readable buffer of length \p ilen[i] Bytes.
+ * \param ilen     The lengths of the buffers in Bytes.
+ * \param output   The checksum results. \p output[i] must be a writable
+ *                 buffer of length \c 32 bytes for SHA-256, \c 28 bytes
+ *                 for SHA-224.
+ * \param count    The number of buffers.
+ * \param is224    Determines which function to use. This must be
+ *                 either \c 0 for SHA-256, or \c 1 for SHA-224.
+ *
+ * \return         \c 0 on success.
+ * \return         A negative error code on failure.
+ */
+int mbedtls_sha256_multi( const unsigned char * const input[],
+                          const size_t ilen[],
+                          unsigned char * const output[],
+                          size_t count,
+                          int is224 );
+
 #if defined(MBEDTLS_SELF_TEST)
 
 /**
@@ -1404,6 +1404,29 @@ int mbedtls_aes_crypt_ctr( mbedtls_aes_context *ctx,
     if ( n > 0x0F )
         return( MBEDTLS_ERR_AES_BAD_INPUT_DATA );
 
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_AESNI_HAVE_BULK)
+    if( mbedtls_aesni_has_support( MBEDTLS_AESNI_AES ) )
+    {
+        /* Use up the current key stream block, then do whole blocks
+         * several at a time; the rest goes through the loop below */
+        for( ; n != 0 && length > 0; length-- )
+        {
+            c = *input++;
+            *output++ = (unsigned char)( c ^ stream_block[n] );
+            n = ( n + 1 ) & 0x0F;
+        }
+
+        if( length >= 16 )
+        {
+            mbedtls_aesni_crypt_ctr( ctx, length / 16, nonce_counter,
+                                     input, output );
+            input += length & ~(size_t) 0x0F;
+            output += length & ~(size_t) 0x0F;
+            length &= 0x0F;
+        }
+    }
+#endif
+
     while( length-- )
     {
         if( n == 0 ) {
@@ -459,6 +459,539 @@ int mbedtls_aesni_setkey_enc( unsigned char *rk,
     return( 0 );
 }
 
+#if defined(MBEDTLS_AESNI_HAVE_BULK)
+
+#include <immintrin.h>
+
+#define AESNI_TARGET    __attribute__((target("aes,pclmul,ssse3")))
+
+/*
+ * 256-bit VAES/VPCLMULQDQ detection: CPUID leaf 7 for the instructions,
+ * and XGETBV for the operating system saving the YMM registers.
+ */
+int mbedtls_aesni_has_vaes_support( void )
+{
+    static int done = 0;
+    static int vaes = 0;
+
+    if( ! done )
+    {
+        unsigned int max, c1, b7 = 0, c7 = 0, xcr0 = 0;
+
+        asm( "xorl  %%eax, %%eax    \n\t"
+             "cpuid                 \n\t"
+             : "=a" (max)
+             :
+             : "ebx", "ecx", "edx" );
+        asm( "movl  $1, %%eax       \n\t"
+             "cpuid                 \n\t"
+             : "=c" (c1)
+             :
+             : "eax", "ebx", "edx" );
+
+        /* OSXSAVE and AVX */
+        if( max >= 7 && ( c1 & 0x18000000u ) == 0x18000000u )
+        {
+            asm( ".byte 0x0F,0x01,0xD0  \n\t" // xgetbv
+                 : "=a" (xcr0)
+                 : "c" (0)
+                 : "edx" );
+            asm( "movl  $7, %%eax       \n\t"
+                 "xorl  %%ecx, %%ecx    \n\t"
+                 "cpuid                 \n\t"
+                 : "=b" (b7), "=c" (c7)
+                 :
+                 : "eax", "edx" );
+        }
+
+        /* XMM and YMM state, AVX2, VAES and VPCLMULQDQ */
+        vaes = ( xcr0 & 6 ) == 6 &&
+               ( b7 & 0x00000020u ) != 0 &&
+               ( c7 & 0x00000600u ) == 0x00000600u;
+        done = 1;
+    }
+
+    return( vaes );
+}
+
+/*
+ * The kernels keep counter blocks and GHASH values byte-reversed in the
+ * registers, like mbedtls_aesni_gcm_mult() does: the big-endian counter
+ * then lies in the low lanes, where paddd/paddq can increment it, and the
+ * GCM bit order matches [CLMUL-WP].
+ */
+#define AESNI_BSWAP_MASK    _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7, \
+                                          8, 9, 10, 11, 12, 13, 14, 15 )
+
+static inline AESNI_TARGET void aesni_load_keys( __m128i rk[15],
+                                                 const mbedtls_aes_context *ctx )
+{
+    int i;
+
+    for( i = 0; i <= ctx->nr; i++ )
+        rk[i] = _mm_loadu_si128( (const __m128i *) ctx->rk + i );
+}
+
+static inline AESNI_TARGET __m128i aesni_encrypt1( __m128i b,
+                                                   const __m128i rk[15],
+                                                   int nr )
+{
+    int r;
+
+    b = _mm_xor_si128( b, rk[0] );
+    for( r = 1; r < nr; r++ )
+        b = _mm_aesenc_si128( b, rk[r] );
+    return( _mm_aesenclast_si128( b, rk[nr] ) );
+}
+
+/* Encrypt eight blocks with their rounds interleaved, as in [AES-WP] */
+#define AESNI_ROUND8( OP, b, k )                                          \
+    do {                                                                  \
+        (b)[0] = OP( (b)[0], (k) ); (b)[1] = OP( (b)[1], (k) );           \
+        (b)[2] = OP( (b)[2], (k) ); (b)[3] = OP( (b)[3], (k) );           \
+        (b)[4] = OP( (b)[4], (k) ); (b)[5] = OP( (b)[5], (k) );           \
+        (b)[6] = OP( (b)[6], (k) ); (b)[7] = OP( (b)[7], (k) );           \
+    } while( 0 )
+
+static inline AESNI_TARGET void aesni_encrypt8( __m128i b[8],
+                                                const __m128i rk[15],
+                                                int nr )
+{
+    int r;
+
+    AESNI_ROUND8( _mm_xor_si128, b, rk[0] );
+    for( r = 1; r < nr; r++ )
+        AESNI_ROUND8( _mm_aesenc_si128, b, rk[r] );
+    AESNI_ROUND8( _mm_aesenclast_si128, b, rk[nr] );
+}
+
+/*
+ * Reduce the 256-bit carry-less product hi:lo modulo the GCM polynomial,
+ * [CLMUL-WP] eq. 27 and algorithm 5, as in mbedtls_aesni_gcm_mult().
+ */
+static inline AESNI_TARGET __m128i aesni_gcm_reduce( __m128i lo, __m128i hi )
+{
+    __m128i t3, t4, t5, r;
+
+    /* Shift hi:lo one bit to the left */
+    t3 = _mm_srli_epi64( lo, 63 );
+    t4 = _mm_srli_epi64( hi, 63 );
+    t5 = _mm_srli_si128( t3, 8 );
+    lo = _mm_or_si128( _mm_slli_epi64( lo, 1 ), _mm_slli_si128( t3, 8 ) );
+    hi = _mm_or_si128( _mm_slli_epi64( hi, 1 ), _mm_slli_si128( t4, 8 ) );
+    hi = _mm_or_si128( hi, t5 );
+
+    /* Step 2 */
+    t3 = _mm_xor_si128( _mm_slli_epi64( lo, 63 ), _mm_slli_epi64( lo, 62 ) );
+    t3 = _mm_xor_si128( t3, _mm_slli_epi64( lo, 57 ) );
+    lo = _mm_xor_si128( lo, _mm_slli_si128( t3, 8 ) );          // d:x0
+
+    /* Steps 3 and 4 */
+    r = _mm_xor_si128( _mm_srli_epi64( lo, 1 ), _mm_srli_epi64( lo, 2 ) );
+    r = _mm_xor_si128( r, _mm_srli_epi64( lo, 7 ) );
+    t3 = _mm_xor_si128( _mm_slli_epi64( lo, 63 ), _mm_slli_epi64( lo, 62 ) );
+    t3 = _mm_xor_si128( t3, _mm_slli_epi64( lo, 57 ) );
+    r = _mm_xor_si128( r, _mm_srli_si128( t3, 8 ) );
+    r = _mm_xor_si128( r, lo );
+
+    return( _mm_xor_si128( r, hi ) );
+}
+
+/*
+ * Accumulate the unreduced product x * h into lo, mid, hi
+ * ([CLMUL-WP] algorithm 1); products of several blocks can be summed
+ * before a single reduction ([CLMUL-WP] algorithm 3, aggregated reduction).
+ */
+#define AESNI_CLMUL_ACC( lo, mid, hi, x, h )                                \
+    do {                                                                    \
+        (lo)  = _mm_xor_si128( (lo),  _mm_clmulepi64_si128( x, h, 0x00 ) ); \
+        (hi)  = _mm_xor_si128( (hi),  _mm_clmulepi64_si128( x, h, 0x11 ) ); \
+        (mid) = _mm_xor_si128( (mid), _mm_clmulepi64_si128( x, h, 0x10 ) ); \
+        (mid) = _mm_xor_si128( (mid), _mm_clmulepi64_si128( x, h, 0x01 ) ); \
+    } while( 0 )
+
+static inline AESNI_TARGET __m128i aesni_gcm_finish( __m128i lo, __m128i mid,
+                                                     __m128i hi )
+{
+    lo = _mm_xor_si128( lo, _mm_slli_si128( mid, 8 ) );
+    hi = _mm_xor_si128( hi, _mm_srli_si128( mid, 8 ) );
+    return( aesni_gcm_reduce( lo, hi ) );
+}
+
+static inline AESNI_TARGET __m128i aesni_gcm_mult1( __m128i x, __m128i h )
+{
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+
+    AESNI_CLMUL_ACC( lo, mid, hi, x, h );
+    return( aesni_gcm_finish( lo, mid, hi ) );
+}
+
+/*
+ * Hash key table: H^(i+1) at offset 16 * i
+ */
+AESNI_TARGET
+void mbedtls_aesni_gcm_init_table( unsigned char *table,
+                                   const unsigned char h[16] )
+{
+    __m128i h1, hi;
+    int i;
+
+    h1 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) h ),
+                           AESNI_BSWAP_MASK );
+    hi = h1;
+    _mm_storeu_si128( (__m128i *) table, hi );
+    for( i = 1; i < 8; i++ )
+    {
+        hi = aesni_gcm_mult1( hi, h1 );
+        _mm_storeu_si128( (__m128i *) table + i, hi );
+    }
+}
+
+/*
+ * CTR over blocks that do not carry out of the low 64 bits of the counter,
+ * ctr being the byte-reversed counter block
+ */
+static AESNI_TARGET __m128i aesni_ctr_128( const mbedtls_aes_context *ctx,
+                                           __m128i ctr, size_t blocks,
+                                           const unsigned char *input,
+                                           unsigned char *output )
+{
+    const __m128i bswap = AESNI_BSWAP_MASK;
+    const __m128i one = _mm_set_epi64x( 0, 1 );
+    __m128i rk[15], b[8];
+    int nr = ctx->nr;
+    int i;
+
+    aesni_load_keys( rk, ctx );
+
+    for( ; blocks >= 8; blocks -= 8, input += 128, output += 128 )
+    {
+        for( i = 0; i < 8; i++ )
+        {
+            b[i] = _mm_shuffle_epi8( ctr, bswap );
+            ctr = _mm_add_epi64( ctr, one );
+        }
+        aesni_encrypt8( b, rk, nr );
+        for( i = 0; i < 8; i++ )
+        {
+            b[i] = _mm_xor_si128( b[i],
+                        _mm_loadu_si128( (const __m128i *) input + i ) );
+            _mm_storeu_si128( (__m128i *) output + i, b[i] );
+        }
+    }
+
+    for( ; blocks > 0; blocks--, input += 16, output += 16 )
+    {
+        b[0] = aesni_encrypt1( _mm_shuffle_epi8( ctr, bswap ), rk, nr );
+        ctr = _mm_add_epi64( ctr, one );
+        b[0] = _mm_xor_si128( b[0], _mm_loadu_si128( (const __m128i *) input ) );
+        _mm_storeu_si128( (__m128i *) output, b[0] );
+    }
+
+    return( ctr );
+}
+
+/*
+ * GCM over whole blocks: eight counter blocks are encrypted together, and
+ * the eight ciphertext blocks are hashed with H^8..H^1 and one reduction
+ */
+static AESNI_TARGET void aesni_gcm_128( const mbedtls_aes_context *ctx,
+                                        int encrypt,
+                                        const unsigned char *table,
+                                        __m128i *y, __m128i *x,
+                                        size_t blocks,
+                                        const unsigned char *input,
+                                        unsigned char *output )
+{
+    const __m128i bswap = AESNI_BSWAP_MASK;
+    const __m128i one = _mm_set_epi32( 0, 0, 0, 1 );
+    const __m128i *ht = (const __m128i *) table;
+    __m128i rk[15], b[8], c[8], h[8];
+    __m128i ctr = *y, acc = *x, lo, mid, hi;
+    int nr = ctx->nr;
+    int i;
+
+    aesni_load_keys( rk, ctx );
+    for( i = 0; i < 8; i++ )
+        h[i] = _mm_loadu_si128( ht + i );
+
+    for( ; blocks >= 8; blocks -= 8, input += 128, output += 128 )
+    {
+        for( i = 0; i < 8; i++ )
+        {
+            ctr = _mm_add_epi32( ctr, one );
+            b[i] = _mm_shuffle_epi8( ctr, bswap );
+        }
+        aesni_encrypt8( b, rk, nr );
+        for( i = 0; i < 8; i++ )
+        {
+            c[i] = _mm_loadu_si128( (const __m128i *) input + i );
+            b[i] = _mm_xor_si128( b[i], c[i] );
+            _mm_storeu_si128( (__m128i *) output + i, b[i] );
+            if( encrypt )
+                c[i] = b[i];
+        }
+
+        lo = mid = hi = _mm_setzero_si128();
+        acc = _mm_xor_si128( acc, _mm_shuffle_epi8( c[0], bswap ) );
+        AESNI_CLMUL_ACC( lo, mid, hi, acc, h[7] );
+        for( i = 1; i < 8; i++ )
+        {
+            c[i] = _mm_shuffle_epi8( c[i], bswap );
+            AESNI_CLMUL_ACC( lo, mid, hi, c[i], h[7 - i] );
+        }
+        acc = aesni_gcm_finish( lo, mid, hi );
+    }
+
+    for( ; blocks > 0; blocks--, input += 16, output += 16 )
+    {
+        ctr = _mm_add_epi32( ctr, one );
+        b[0] = aesni_encrypt1( _mm_shuffle_epi8( ctr, bswap ), rk, nr );
+        c[0] = _mm_loadu_si128( (const __m128i *) input );
+        b[0] = _mm_xor_si128( b[0], c[0] );
+        _mm_storeu_si128( (__m128i *) output, b[0] );
+        if( encrypt )
+            c[0] = b[0];
+        acc = _mm_xor_si128( acc, _mm_shuffle_epi8( c[0], bswap ) );
+        acc = aesni_gcm_mult1( acc, h[0] );
+    }
+
+    *y = ctr;
+    *x = acc;
+}
+
+#if defined(MBEDTLS_AESNI_HAVE_VAES)
+
+#define VAES_TARGET \
+    __attribute__((target("aes,pclmul,ssse3,avx,avx2,vaes,vpclmulqdq")))
+
+/* Two counter blocks per register: the low lane holds the earlier one */
+static inline VAES_TARGET __m256i vaes_pair( __m128i a, __m128i b )
+{
+    return( _mm256_inserti128_si256( _mm256_castsi128_si256( a ), b, 1 ) );
+}
+
+#define VAES_ROUND4( OP, b, k )                                           \
+    do {                                                                  \
+        (b)[0] = OP( (b)[0], (k) ); (b)[1] = OP( (b)[1], (k) );           \
+        (b)[2] = OP( (b)[2], (k) ); (b)[3] = OP( (b)[3], (k) );           \
+    } while( 0 )
+
+static inline VAES_TARGET void vaes_encrypt8( __m256i b[4],
+                                              const __m256i rk[15],
+                                              int nr )
+{
+    int r;
+
+    VAES_ROUND4( _mm256_xor_si256, b, rk[0] );
+    for( r = 1; r < nr; r++ )
+        VAES_ROUND4( _mm256_aesenc_epi128, b, rk[r] );
+    VAES_ROUND4( _mm256_aesenclast_epi128, b, rk[nr] );
+}
+
+static inline VAES_TARGET void vaes_load_keys( __m256i rk[15],
+                                               const mbedtls_aes_context *ctx )
+{
+    int i;
+
+    for( i = 0; i <= ctx->nr; i++ )
+        rk[i] = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128( (const __m128i *) ctx->rk + i ) );
+}
+
+#define VAES_CLMUL_ACC( lo, mid, hi, x, h )                                       \
+    do {                                                                          \
+        (lo)  = _mm256_xor_si256( (lo),  _mm256_clmulepi64_epi128( x, h, 0x00 ) ); \
+        (hi)  = _mm256_xor_si256( (hi),  _mm256_clmulepi64_epi128( x, h, 0x11 ) ); \
+        (mid) = _mm256_xor_si256( (mid), _mm256_clmulepi64_epi128( x, h, 0x10 ) ); \
+        (mid) = _mm256_xor_si256( (mid), _mm256_clmulepi64_epi128( x, h, 0x01 ) ); \
+    } while( 0 )
+
+static inline VAES_TARGET __m128i vaes_fold( __m256i v )
+{
+    return( _mm_xor_si128( _mm256_castsi256_si128( v ),
+                           _mm256_extracti128_si256( v, 1 ) ) );
+}
+
+static VAES_TARGET __m128i vaes_ctr_128( const mbedtls_aes_context *ctx,
+                                         __m128i ctr, size_t blocks,
+                                         const unsigned char *input,
+                                         unsigned char *output )
+{
+    const __m256i bswap = _mm256_broadcastsi128_si256( AESNI_BSWAP_MASK );
+    const __m256i two = _mm256_set_epi64x( 0, 2, 0, 2 );
+    __m256i rk[15], b[4], c;
+    int nr = ctx->nr;
+    int i;
+
+    vaes_load_keys( rk, ctx );
+    c = vaes_pair( ctr, _mm_add_epi64( ctr, _mm_set_epi64x( 0, 1 ) ) );
+
+    for( ; blocks >= 8; blocks -= 8, input += 128, output += 128 )
+    {
+        for( i = 0; i < 4; i++ )
+        {
+            b[i] = _mm256_shuffle_epi8( c, bswap );
+            c = _mm256_add_epi64( c, two );
+        }
+        vaes_encrypt8( b, rk, nr );
+        for( i = 0; i < 4; i++ )
+        {
+            b[i] = _mm256_xor_si256( b[i],
+                        _mm256_loadu_si256( (const __m256i *) input + i ) );
+            _mm256_storeu_si256( (__m256i *) output + i, b[i] );
+        }
+    }
+
+    ctr = _mm256_castsi256_si128( c );
+    _mm256_zeroupper();
+
+    return( aesni_ctr_128( ctx, ctr, blocks, input, output ) );
+}
+
+static VAES_TARGET void vaes_gcm_128( const mbedtls_aes_context *ctx,
+                                      int encrypt,
+                                      const unsigned char *table,
+                                      __m128i *y, __m128i *x,
+                                      size_t blocks,
+                                      const unsigned char *input,
+                                      unsigned char *output )
+{
+    const __m256i bswap = _mm256_broadcastsi128_si256( AESNI_BSWAP_MASK );
+    const __m256i two = _mm256_set_epi32( 0, 0, 0, 2, 0, 0, 0, 2 );
+    const __m128i *ht = (const __m128i *) table;
+    __m256i rk[15], b[4], c[4], h[4], lo, mid, hi, ctr;
+    __m128i acc = *x;
+    int nr = ctx->nr;
+    int i;
+
+    vaes_load_keys( rk, ctx );
+    /* Block j of eight is hashed with H^(8-j): pair up H^8:H^7 and so on */
+    for( i = 0; i < 4; i++ )
+        h[i] = vaes_pair( _mm_loadu_si128( ht + 7 - 2 * i ),
+                          _mm_loadu_si128( ht + 6 - 2 * i ) );
+    ctr = vaes_pair( _mm_add_epi32( *y, _mm_set_epi32( 0, 0, 0, 1 ) ),
+                     _mm_add_epi32( *y, _mm_set_epi32( 0, 0, 0, 2 ) ) );
+
+    for( ; blocks >= 8; blocks -= 8, input += 128, output += 128 )
+    {
+        for( i = 0; i < 4; i++ )
+        {
+            b[i] = _mm256_shuffle_epi8( ctr, bswap );
+            ctr = _mm256_add_epi32( ctr, two );
+        }
+        vaes_encrypt8( b, rk, nr );
+        for( i = 0; i < 4; i++ )
+        {
+            c[i] = _mm256_loadu_si256( (const __m256i *) input + i );
+            b[i] = _mm256_xor_si256( b[i], c[i] );
+            _mm256_storeu_si256( (__m256i *) output + i, b[i] );
+            if( encrypt )
+                c[i] = b[i];
+            c[i] = _mm256_shuffle_epi8( c[i], bswap );
+        }
+
+        c[0] = _mm256_xor_si256( c[0], vaes_pair( acc, _mm_setzero_si128() ) );
+        lo = mid = hi = _mm256_setzero_si256();
+        for( i = 0; i < 4; i++ )
+            VAES_CLMUL_ACC( lo, mid, hi, c[i], h[i] );
+        acc = aesni_gcm_finish( vaes_fold( lo ), vaes_fold( mid ),
+                                vaes_fold( hi ) );
+    }
+
+    /* The low lane holds the next counter; go back to the last one used */
+    *y = _mm_sub_epi32( _mm256_castsi256_si128( ctr ),
+                        _mm_set_epi32( 0, 0, 0, 1 ) );
+    *x = acc;
+    _mm256_zeroupper();
+
+    if( blocks > 0 )
+        aesni_gcm_128( ctx, encrypt, table, y, x, blocks, input, output );
+}
+
+#endif /* MBEDTLS_AESNI_HAVE_VAES */
+
+/*
+ * AES-CTR, whole blocks
+ */
+AESNI_TARGET
+void mbedtls_aesni_crypt_ctr( const mbedtls_aes_context *ctx,
+                              size_t blocks,
+                              unsigned char nonce_counter[16],
+                              const unsigned char *input,
+                              unsigned char *output )
+{
+    const __m128i bswap = AESNI_BSWAP_MASK;
+    __m128i ctr;
+    uint64_t low;
+    size_t n;
+
+    ctr = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) nonce_counter ),
+                            bswap );
+
+    while( blocks > 0 )
+    {
+        /*
+         * The kernels only increment the low 64 bits: stop where they wrap
+         * around and carry into the high half here
+         */
+        low = (uint64_t) _mm_cvtsi128_si64( ctr );
+        n = blocks;
+        if( (uint64_t) n - 1 > UINT64_MAX - low )
+            n = (size_t) ( UINT64_MAX - low ) + 1;
+
+#if defined(MBEDTLS_AESNI_HAVE_VAES)
+        if( n >= 8 && mbedtls_aesni_has_vaes_support() )
+            ctr = vaes_ctr_128( ctx, ctr, n, input, output );
+        else
+#endif
+            ctr = aesni_ctr_128( ctx, ctr, n, input, output );
+
+        if( _mm_cvtsi128_si64( ctr ) == 0 )
+            ctr = _mm_add_epi64( ctr, _mm_set_epi64x( 1, 0 ) );
+
+        blocks -= n;
+        input += 16 * n;
+        output += 16 * n;
+    }
+
+    _mm_storeu_si128( (__m128i *) nonce_counter, _mm_shuffle_epi8( ctr, bswap ) );
+}
+
+/*
+ * AES-GCM, whole blocks
+ */
+AESNI_TARGET
+void mbedtls_aesni_gcm_crypt( const mbedtls_aes_context *ctx,
+                              int encrypt,
+                              const unsigned char *table,
+                              unsigned char y[16],
+                              unsigned char buf[16],
+                              size_t blocks,
+                              const unsigned char *input,
+                              unsigned char *output )
+{
+    const __m128i bswap = AESNI_BSWAP_MASK;
+    __m128i ctr, acc;
+
+    ctr = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) y ), bswap );
+    acc = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) buf ), bswap );
+
+#if defined(MBEDTLS_AESNI_HAVE_VAES)
+    if( blocks >= 8 && mbedtls_aesni_has_vaes_support() )
+        vaes_gcm_128( ctx, encrypt, table, &ctr, &acc, blocks, input, output );
+    else
+#endif
+        aesni_gcm_128( ctx, encrypt, table, &ctr, &acc, blocks, input, output );
+
+    _mm_storeu_si128( (__m128i *) y, _mm_shuffle_epi8( ctr, bswap ) );
+    _mm_storeu_si128( (__m128i *) buf, _mm_shuffle_epi8( acc, bswap ) );
+}
+
+#endif /* MBEDTLS_AESNI_HAVE_BULK */
+
 #endif /* MBEDTLS_HAVE_X86_64 */
 
 #endif /* MBEDTLS_AESNI_C */
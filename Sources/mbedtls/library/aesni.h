@@ -38,6 +38,29 @@
 #define MBEDTLS_HAVE_X86_64
 #endif
 
+/*
+ * The multi-block CTR and GCM kernels are written with compiler intrinsics
+ * and per-function target attributes, so that the library does not need to
+ * be built with -maes -mpclmul: the accelerated code is only entered after
+ * the CPU has been checked at runtime.
+ */
+#if defined(MBEDTLS_HAVE_X86_64) && \
+    ( defined(__clang__) || __GNUC__ >= 5 ) && \
+    ! defined(MBEDTLS_AESNI_HAVE_BULK)
+#define MBEDTLS_AESNI_HAVE_BULK
+#endif
+
+/* The VAES/VPCLMULQDQ variants need a compiler that knows these targets */
+#if defined(MBEDTLS_AESNI_HAVE_BULK) && \
+    ( ( defined(__clang__) && __clang_major__ >= 8 ) || \
+      ( ! defined(__clang__) && __GNUC__ >= 8 ) ) && \
+    ! defined(MBEDTLS_AESNI_HAVE_VAES)
+#define MBEDTLS_AESNI_HAVE_VAES
+#endif
+
+/** Size in bytes of the hash key table used by mbedtls_aesni_gcm_crypt() */
+#define MBEDTLS_AESNI_GCM_TABLE_SIZE    128
+
 #if defined(MBEDTLS_HAVE_X86_64)
 
 #ifdef __cplusplus
@@ -123,6 +146,82 @@ int mbedtls_aesni_setkey_enc( unsigned char *rk,
                               const unsigned char *key,
                               size_t bits );
 
+#if defined(MBEDTLS_AESNI_HAVE_BULK)
+/**
+ * \brief          Internal function to detect the 256-bit VAES and
+ *                 VPCLMULQDQ instructions, including operating system
+ *                 support for the AVX register state.
+ *
+ * \note           This function is only for internal use by other library
+ *                 functions; you must not call it directly.
+ *
+ * \return         1 if the wide kernels can be used, 0 otherwise
+ */
+int mbedtls_aesni_has_vaes_support( void );
+
+/**
+ * \brief          Internal AES-NI AES-CTR encryption of whole blocks,
+ *                 eight blocks at a time.
+ *
+ * \note           This function is only for internal use by other library
+ *                 functions; you must not call it directly.
+ *
+ * \param ctx      AES context set up for encryption
+ * \param blocks   Number of 16-byte blocks to process
+ * \param nonce_counter  128-bit big-endian counter block; it is used and
+ *                 then incremented for every block, as in
+ *                 mbedtls_aes_crypt_ctr()
+ * \param input    Input data, \p blocks * 16 bytes
+ * \param output   Output data, \p blocks * 16 bytes (may equal \p input)
+ */
+void mbedtls_aesni_crypt_ctr( const mbedtls_aes_context *ctx,
+                              size_t blocks,
+                              unsigned char nonce_counter[16],
+                              const unsigned char *input,
+                              unsigned char *output );
+
+/**
+ * \brief          Internal computation of the hash key table used by
+ *                 mbedtls_aesni_gcm_crypt(): the powers H^1 to H^8 of the
+ *                 hash key, in the byte order of the CLMUL kernels.
+ *
+ * \note           This function is only for internal use by other library
+ *                 functions; you must not call it directly.
+ *
+ * \param table    Destination, MBEDTLS_AESNI_GCM_TABLE_SIZE bytes
+ * \param h        Hash key H (big-endian, as per the GCM spec)
+ */
+void mbedtls_aesni_gcm_init_table( unsigned char *table,
+                                   const unsigned char h[16] );
+
+/**
+ * \brief          Internal AES-GCM encryption or decryption of whole
+ *                 blocks, with the counter mode encryption of eight blocks
+ *                 interleaved with an aggregated GHASH of eight blocks.
+ *
+ * \note           This function is only for internal use by other library
+ *                 functions; you must not call it directly.
+ *
+ * \param ctx      AES context set up for encryption
+ * \param encrypt  Nonzero to encrypt, 0 to decrypt
+ * \param table    Hash key table from mbedtls_aesni_gcm_init_table()
+ * \param y        GCM counter block; the low 32 bits are incremented
+ *                 before every block, as in mbedtls_gcm_update()
+ * \param buf      GHASH accumulator, updated with the ciphertext
+ * \param blocks   Number of 16-byte blocks to process
+ * \param input    Input data, \p blocks * 16 bytes
+ * \param output   Output data, \p blocks * 16 bytes (may equal \p input)
+ */
+void mbedtls_aesni_gcm_crypt( const mbedtls_aes_context *ctx,
+                              int encrypt,
+                              const unsigned char *table,
+                              unsigned char y[16],
+                              unsigned char buf[16],
+                              size_t blocks,
+                              const unsigned char *input,
+                              unsigned char *output );
+#endif /* MBEDTLS_AESNI_HAVE_BULK */
+
 #ifdef __cplusplus
 }
 #endif
@@ -103,7 +103,14 @@ static int gcm_gen_table( mbedtls_gcm_context *ctx )
 #if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
     /* With CLMUL support, we need only h, not the rest of the table */
     if( mbedtls_aesni_has_support( MBEDTLS_AESNI_CLMUL ) )
+    {
+#if defined(MBEDTLS_AESNI_HAVE_BULK)
+        /* The table space holds the powers of h for the multi-block
+         * kernel instead; gcm_mult() reads h back from there */
+        mbedtls_aesni_gcm_init_table( (unsigned char *) ctx->HL, h );
+#endif
         return( 0 );
+    }
 #endif
 
     /* 0 corresponds to 0 in GF(2^128) */
@@ -200,10 +207,18 @@ static void gcm_mult( mbedtls_gcm_context *ctx, const unsigned char x[16],
     if( mbedtls_aesni_has_support( MBEDTLS_AESNI_CLMUL ) ) {
         unsigned char h[16];
 
+#if defined(MBEDTLS_AESNI_HAVE_BULK)
+        /* The first table entry is h, byte-reversed */
+        const unsigned char *table = (const unsigned char *) ctx->HL;
+
+        for( i = 0; i < 16; i++ )
+            h[i] = table[15 - i];
+#else
         MBEDTLS_PUT_UINT32_BE( ctx->HH[8] >> 32, h,  0 );
         MBEDTLS_PUT_UINT32_BE( ctx->HH[8],       h,  4 );
         MBEDTLS_PUT_UINT32_BE( ctx->HL[8] >> 32, h,  8 );
         MBEDTLS_PUT_UINT32_BE( ctx->HL[8],       h, 12 );
+#endif
 
         mbedtls_aesni_gcm_mult( output, x, h );
         return;
@@ -391,6 +406,30 @@ static void gcm_incr( unsigned char y[16] )
             break;
 }
 
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_AESNI_HAVE_BULK) && \
+    defined(MBEDTLS_AES_C) && !defined(MBEDTLS_AES_ALT)
+/* The AES context behind the cipher context, if whole blocks can go through
+ * the multi-block AES-NI kernel (which also needs the CLMUL table from
+ * gcm_gen_table()), or NULL */
+static const mbedtls_aes_context *gcm_aesni_context( const mbedtls_gcm_context *ctx )
+{
+    if( ! mbedtls_aesni_has_support( MBEDTLS_AESNI_AES ) ||
+        ! mbedtls_aesni_has_support( MBEDTLS_AESNI_CLMUL ) )
+        return( NULL );
+
+    switch( mbedtls_cipher_get_type( &ctx->cipher_ctx ) )
+    {
+        case MBEDTLS_CIPHER_AES_128_ECB:
+        case MBEDTLS_CIPHER_AES_192_ECB:
+        case MBEDTLS_CIPHER_AES_256_ECB:
+            return( ctx->cipher_ctx.cipher_ctx );
+        default:
+            return( NULL );
+    }
+}
+#define GCM_AESNI_BULK
+#endif
+
 /* Calculate and apply the encryption mask. Process use_len bytes of data,
  * starting at position offset in the mask block. */
 static int gcm_mask( mbedtls_gcm_context *ctx,
@@ -485,6 +524,25 @@ int mbedtls_gcm_update( mbedtls_gcm_context *ctx,
 
     ctx->len += input_length;
 
+#if defined(GCM_AESNI_BULK)
+    if( input_length >= 16 )
+    {
+        const mbedtls_aes_context *aes = gcm_aesni_context( ctx );
+
+        if( aes != NULL )
+        {
+            size_t blocks = input_length / 16;
+
+            mbedtls_aesni_gcm_crypt( aes, ctx->mode == MBEDTLS_GCM_ENCRYPT,
+                                     (const unsigned char *) ctx->HL,
+                                     ctx->y, ctx->buf, blocks, p, out_p );
+            input_length -= blocks * 16;
+            p += blocks * 16;
+            out_p += blocks * 16;
+        }
+    }
+#endif
+
     while( input_length >= 16 )
     {
         gcm_incr( ctx->y );
@@ -41,6 +41,33 @@
 #endif /* MBEDTLS_PLATFORM_C */
 #endif /* MBEDTLS_SELF_TEST */
 
+/*
+ * SHA-1 with the SHA extensions of x86-64 (SHA-NI) or the ARMv8
+ * cryptographic extension, used when the CPU has them
+ */
+#if defined(MBEDTLS_SHA1_USE_CPU_EXT_IF_PRESENT) && \
+    !defined(MBEDTLS_SHA1_ALT) && !defined(MBEDTLS_SHA1_PROCESS_ALT)
+#if defined(MBEDTLS_HAVE_ASM) && defined(__GNUC__) &&               \
+    ( defined(__amd64__) || defined(__x86_64__) ) &&                \
+    ( defined(__clang__) || __GNUC__ >= 5 )
+#define SHA1_USE_SHANI
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON) &&                \
+    ( defined(__clang__) || __GNUC__ >= 6 )
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#if defined(HWCAP_SHA1) || defined(__APPLE__)
+#define SHA1_USE_A64_CRYPTO
+#include <arm_neon.h>
+#endif
+#endif
+#endif
+
+#if defined(SHA1_USE_SHANI) || defined(SHA1_USE_A64_CRYPTO)
+#define SHA1_USE_CPU_EXT
+#endif
+
 #define SHA1_VALIDATE_RET(cond)                             \
     MBEDTLS_INTERNAL_VALIDATE_RET( cond, MBEDTLS_ERR_SHA1_BAD_INPUT_DATA )
 
@@ -92,6 +119,290 @@ int mbedtls_sha1_starts( mbedtls_sha1_context *ctx )
 }
 
 #if !defined(MBEDTLS_SHA1_PROCESS_ALT)
+#if defined(SHA1_USE_CPU_EXT)
+/*
+ * SHA extensions detection routine
+ */
+static int sha1_cpu_ext_support( void )
+{
+    static int done = 0;
+    static int supported = 0;
+
+    if( ! done )
+    {
+#if defined(SHA1_USE_SHANI)
+        unsigned int max, c1, b7 = 0;
+
+        __asm__( "xorl  %%eax, %%eax    \n\t"
+                 "cpuid                 \n\t"
+                 : "=a" (max) : : "ebx", "ecx", "edx" );
+        __asm__( "movl  $1, %%eax       \n\t"
+                 "cpuid                 \n\t"
+                 : "=c" (c1) : : "eax", "ebx", "edx" );
+        if( max >= 7 )
+            __asm__( "movl  $7, %%eax       \n\t"
+                     "xorl  %%ecx, %%ecx    \n\t"
+                     "cpuid                 \n\t"
+                     : "=b" (b7) : : "eax", "ecx", "edx" );
+
+        /* SSSE3 and SSE4.1, SHA */
+        supported = ( c1 & 0x00080200u ) == 0x00080200u &&
+                    ( b7 & 0x20000000u ) != 0;
+#elif defined(__APPLE__)
+        /* Every 64-bit Apple CPU has the SHA-1 instructions */
+        supported = 1;
+#else
+        supported = ( getauxval( AT_HWCAP ) & HWCAP_SHA1 ) != 0;
+#endif
+        done = 1;
+    }
+
+    return( supported );
+}
+
+#if defined(SHA1_USE_SHANI)
+
+#define SHANI_TARGET    __attribute__((target("sha,sse4.1,ssse3")))
+
+/*
+ * ABCD is kept in one register, with A in the top lane, and E in the top
+ * lane of another. As in sha256.c, the macros take a lane prefix so that
+ * sha1_shani_x2() can interleave the rounds of two messages.
+ */
+#define SHANI_LOAD_STATE( L, st )                                           \
+    do {                                                                    \
+        L##abcd = _mm_shuffle_epi32(                                        \
+                    _mm_loadu_si128( (const __m128i *) (st) ), 0x1B );      \
+        L##e0 = _mm_set_epi32( (int) (st)[4], 0, 0, 0 );                    \
+    } while( 0 )
+
+#define SHANI_STORE_STATE( L, st )                                          \
+    do {                                                                    \
+        _mm_storeu_si128( (__m128i *) (st),                                 \
+                          _mm_shuffle_epi32( L##abcd, 0x1B ) );             \
+        (st)[4] = (uint32_t) _mm_extract_epi32( L##e0, 3 );                 \
+    } while( 0 )
+
+#define SHANI_LOAD_BLOCK( L, p )                                            \
+    do {                                                                    \
+        L##abcd_save = L##abcd;                                             \
+        L##e_save = L##e0;                                                  \
+        L##m0 = _mm_shuffle_epi8(                                           \
+                    _mm_loadu_si128( (const __m128i *) (p) + 0 ), mask );   \
+        L##m1 = _mm_shuffle_epi8(                                           \
+                    _mm_loadu_si128( (const __m128i *) (p) + 1 ), mask );   \
+        L##m2 = _mm_shuffle_epi8(                                           \
+                    _mm_loadu_si128( (const __m128i *) (p) + 2 ), mask );   \
+        L##m3 = _mm_shuffle_epi8(                                           \
+                    _mm_loadu_si128( (const __m128i *) (p) + 3 ), mask );   \
+    } while( 0 )
+
+#define SHANI_END_BLOCK( L )                                                \
+    do {                                                                    \
+        L##e0 = _mm_sha1nexte_epu32( L##e0, L##e_save );                    \
+        L##abcd = _mm_add_epi32( L##abcd, L##abcd_save );                   \
+    } while( 0 )
+
+/*
+ * Rounds 4i to 4i+3 with message words mi. Words 4i+16.. are computed
+ * over three steps: sha1msg1 here on mp (i+1 to i+3), the xor with the
+ * words of step i+2 on mp2 (i+2), and sha1msg2 on mn (i+3).
+ * E alternates between e and f.
+ */
+#define SHANI_QROUND( L, i, e, f, mi, mp, mp2, mn )                         \
+    do {                                                                    \
+        if( (i) == 0 )                                                      \
+            L##e = _mm_add_epi32( L##e, L##mi );                            \
+        else                                                                \
+            L##e = _mm_sha1nexte_epu32( L##e, L##mi );                      \
+        L##f = L##abcd;                                                     \
+        if( (i) >= 3 && (i) <= 18 )                                         \
+            L##mn = _mm_sha1msg2_epu32( L##mn, L##mi );                     \
+        L##abcd = _mm_sha1rnds4_epu32( L##abcd, L##e, (i) / 5 );            \
+        if( (i) >= 1 && (i) <= 16 )                                         \
+            L##mp = _mm_sha1msg1_epu32( L##mp, L##mi );                     \
+        if( (i) >= 2 && (i) <= 17 )                                         \
+            L##mp2 = _mm_xor_si128( L##mp2, L##mi );                        \
+    } while( 0 )
+
+#define SHANI_ROUNDS( QR )                                                  \
+    do {                                                                    \
+        QR(  0, e0, e1, m0, m3, m2, m1 ); QR(  1, e1, e0, m1, m0, m3, m2 ); \
+        QR(  2, e0, e1, m2, m1, m0, m3 ); QR(  3, e1, e0, m3, m2, m1, m0 ); \
+        QR(  4, e0, e1, m0, m3, m2, m1 ); QR(  5, e1, e0, m1, m0, m3, m2 ); \
+        QR(  6, e0, e1, m2, m1, m0, m3 ); QR(  7, e1, e0, m3, m2, m1, m0 ); \
+        QR(  8, e0, e1, m0, m3, m2, m1 ); QR(  9, e1, e0, m1, m0, m3, m2 ); \
+        QR( 10, e0, e1, m2, m1, m0, m3 ); QR( 11, e1, e0, m3, m2, m1, m0 ); \
+        QR( 12, e0, e1, m0, m3, m2, m1 ); QR( 13, e1, e0, m1, m0, m3, m2 ); \
+        QR( 14, e0, e1, m2, m1, m0, m3 ); QR( 15, e1, e0, m3, m2, m1, m0 ); \
+        QR( 16, e0, e1, m0, m3, m2, m1 ); QR( 17, e1, e0, m1, m0, m3, m2 ); \
+        QR( 18, e0, e1, m2, m1, m0, m3 ); QR( 19, e1, e0, m3, m2, m1, m0 ); \
+    } while( 0 )
+
+#define SHANI_QROUND_A( i, e, f, mi, mp, mp2, mn )                          \
+    SHANI_QROUND( a_, i, e, f, mi, mp, mp2, mn )
+#define SHANI_QROUND_AB( i, e, f, mi, mp, mp2, mn )                         \
+    do {                                                                    \
+        SHANI_QROUND( a_, i, e, f, mi, mp, mp2, mn );                       \
+        SHANI_QROUND( b_, i, e, f, mi, mp, mp2, mn );                       \
+    } while( 0 )
+
+#define SHANI_LANE_VARS( L )                                                \
+    __m128i L##abcd, L##e0, L##e1, L##abcd_save, L##e_save,                 \
+            L##m0, L##m1, L##m2, L##m3
+
+static SHANI_TARGET void sha1_shani( uint32_t state[5],
+                                     const unsigned char *data,
+                                     size_t blocks )
+{
+    const __m128i mask = _mm_set_epi64x( 0x0001020304050607ULL,
+                                         0x08090A0B0C0D0E0FULL );
+    SHANI_LANE_VARS( a_ );
+
+    SHANI_LOAD_STATE( a_, state );
+
+    for( ; blocks > 0; blocks--, data += 64 )
+    {
+        SHANI_LOAD_BLOCK( a_, data );
+        SHANI_ROUNDS( SHANI_QROUND_A );
+        SHANI_END_BLOCK( a_ );
+    }
+
+    SHANI_STORE_STATE( a_, state );
+}
+
+/* The same number of blocks of two messages, interleaved */
+static SHANI_TARGET void sha1_shani_x2( uint32_t state_a[5],
+                                        const unsigned char *data_a,
+                                        uint32_t state_b[5],
+                                        const unsigned char *data_b,
+                                        size_t blocks )
+{
+    const __m128i mask = _mm_set_epi64x( 0x0001020304050607ULL,
+                                         0x08090A0B0C0D0E0FULL );
+    SHANI_LANE_VARS( a_ );
+    SHANI_LANE_VARS( b_ );
+
+    SHANI_LOAD_STATE( a_, state_a );
+    SHANI_LOAD_STATE( b_, state_b );
+
+    for( ; blocks > 0; blocks--, data_a += 64, data_b += 64 )
+    {
+        SHANI_LOAD_BLOCK( a_, data_a );
+        SHANI_LOAD_BLOCK( b_, data_b );
+        SHANI_ROUNDS( SHANI_QROUND_AB );
+        SHANI_END_BLOCK( a_ );
+        SHANI_END_BLOCK( b_ );
+    }
+
+    SHANI_STORE_STATE( a_, state_a );
+    SHANI_STORE_STATE( b_, state_b );
+}
+
+static void sha1_cpu_ext( uint32_t state[5], const unsigned char *data,
+                          size_t blocks )
+{
+    sha1_shani( state, data, blocks );
+}
+
+#define SHA1_CPU_EXT_HAVE_X2
+static void sha1_cpu_ext_x2( uint32_t state_a[5], const unsigned char *data_a,
+                             uint32_t state_b[5], const unsigned char *data_b,
+                             size_t blocks )
+{
+    sha1_shani_x2( state_a, data_a, state_b, data_b, blocks );
+}
+
+#endif /* SHA1_USE_SHANI */
+
+#if defined(SHA1_USE_A64_CRYPTO)
+
+#if !defined(__ARM_FEATURE_CRYPTO) && !defined(__ARM_FEATURE_SHA2)
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("crypto"))), apply_to=function)
+#define SHA1_POP_TARGET_PRAGMA
+#else
+#pragma GCC push_options
+#pragma GCC target ("arch=armv8-a+crypto")
+#define SHA1_POP_TARGET_PRAGMA
+#endif
+#endif
+
+static void sha1_cpu_ext( uint32_t state[5], const unsigned char *data,
+                          size_t blocks )
+{
+    uint32x4_t abcd = vld1q_u32( &state[0] );
+    uint32_t e = state[4];
+
+    for( ; blocks > 0; blocks--, data += 64 )
+    {
+        uint32x4_t abcd_orig = abcd;
+        uint32_t e_orig = e;
+        uint32x4_t m0, m1, m2, m3, tmp;
+        uint32_t e_next;
+
+        m0 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data +  0 ) ) );
+        m1 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 16 ) ) );
+        m2 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 32 ) ) );
+        m3 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 48 ) ) );
+
+/* Rounds 4i to 4i+3; mi then receives the words of rounds 4i+16.. */
+#define A64_QROUND( i, OP, k, mi, mj, mk, ml )                              \
+        do {                                                                \
+            tmp = vaddq_u32( (mi), vdupq_n_u32( k ) );                      \
+            e_next = vsha1h_u32( vgetq_lane_u32( abcd, 0 ) );               \
+            abcd = OP( abcd, e, tmp );                                      \
+            e = e_next;                                                     \
+            if( (i) < 16 )                                                  \
+                (mi) = vsha1su1q_u32( vsha1su0q_u32( (mi), (mj), (mk) ),    \
+                                      (ml) );                               \
+        } while( 0 )
+
+        /* Rounds 0-19 use Ch, 20-39 and 60-79 parity, 40-59 Maj */
+        A64_QROUND(  0, vsha1cq_u32, 0x5A827999, m0, m1, m2, m3 );
+        A64_QROUND(  1, vsha1cq_u32, 0x5A827999, m1, m2, m3, m0 );
+        A64_QROUND(  2, vsha1cq_u32, 0x5A827999, m2, m3, m0, m1 );
+        A64_QROUND(  3, vsha1cq_u32, 0x5A827999, m3, m0, m1, m2 );
+        A64_QROUND(  4, vsha1cq_u32, 0x5A827999, m0, m1, m2, m3 );
+        A64_QROUND(  5, vsha1pq_u32, 0x6ED9EBA1, m1, m2, m3, m0 );
+        A64_QROUND(  6, vsha1pq_u32, 0x6ED9EBA1, m2, m3, m0, m1 );
+        A64_QROUND(  7, vsha1pq_u32, 0x6ED9EBA1, m3, m0, m1, m2 );
+        A64_QROUND(  8, vsha1pq_u32, 0x6ED9EBA1, m0, m1, m2, m3 );
+        A64_QROUND(  9, vsha1pq_u32, 0x6ED9EBA1, m1, m2, m3, m0 );
+        A64_QROUND( 10, vsha1mq_u32, 0x8F1BBCDC, m2, m3, m0, m1 );
+        A64_QROUND( 11, vsha1mq_u32, 0x8F1BBCDC, m3, m0, m1, m2 );
+        A64_QROUND( 12, vsha1mq_u32, 0x8F1BBCDC, m0, m1, m2, m3 );
+        A64_QROUND( 13, vsha1mq_u32, 0x8F1BBCDC, m1, m2, m3, m0 );
+        A64_QROUND( 14, vsha1mq_u32, 0x8F1BBCDC, m2, m3, m0, m1 );
+        A64_QROUND( 15, vsha1pq_u32, 0xCA62C1D6, m3, m0, m1, m2 );
+        A64_QROUND( 16, vsha1pq_u32, 0xCA62C1D6, m0, m1, m2, m3 );
+        A64_QROUND( 17, vsha1pq_u32, 0xCA62C1D6, m1, m2, m3, m0 );
+        A64_QROUND( 18, vsha1pq_u32, 0xCA62C1D6, m2, m3, m0, m1 );
+        A64_QROUND( 19, vsha1pq_u32, 0xCA62C1D6, m3, m0, m1, m2 );
+
+#undef A64_QROUND
+
+        abcd = vaddq_u32( abcd, abcd_orig );
+        e += e_orig;
+    }
+
+    vst1q_u32( &state[0], abcd );
+    state[4] = e;
+}
+
+#if defined(SHA1_POP_TARGET_PRAGMA)
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#undef SHA1_POP_TARGET_PRAGMA
+#endif
+
+#endif /* SHA1_USE_A64_CRYPTO */
+
+#endif /* SHA1_USE_CPU_EXT */
+
 int mbedtls_internal_sha1_process( mbedtls_sha1_context *ctx,
                                    const unsigned char data[64] )
 {
@@ -103,6 +414,14 @@ int mbedtls_internal_sha1_process( mbedtls_sha1_context *ctx,
     SHA1_VALIDATE_RET( ctx != NULL );
     SHA1_VALIDATE_RET( (const unsigned char *)data != NULL );
 
+#if defined(SHA1_USE_CPU_EXT)
+    if( sha1_cpu_ext_support() )
+    {
+        sha1_cpu_ext( ctx->state, data, 1 );
+        return( 0 );
+    }
+#endif
+
     local.W[ 0] = MBEDTLS_GET_UINT32_BE( data,  0 );
     local.W[ 1] = MBEDTLS_GET_UINT32_BE( data,  4 );
     local.W[ 2] = MBEDTLS_GET_UINT32_BE( data,  8 );
@@ -304,6 +623,15 @@ int mbedtls_sha1_update( mbedtls_sha1_context *ctx,
         left = 0;
     }
 
+#if defined(SHA1_USE_CPU_EXT)
+    if( ilen >= 64 && sha1_cpu_ext_support() )
+    {
+        sha1_cpu_ext( ctx->state, input, ilen / 64 );
+        input += ilen & ~(size_t) 0x3F;
+        ilen  &= 0x3F;
+    }
+#endif
+
     while( ilen >= 64 )
     {
         if( ( ret = mbedtls_internal_sha1_process( ctx, input ) ) != 0 )
@@ -412,6 +740,151 @@ exit:
     return( ret );
 }
 
+#if defined(SHA1_CPU_EXT_HAVE_X2)
+/*
+ * One message in mbedtls_sha1_multi(): its whole blocks are read from the
+ * input, then the padded last block(s) from tail
+ */
+typedef struct
+{
+    uint32_t state[5];
+    const unsigned char *p;     /* next block */
+    size_t blocks;              /* blocks left at p */
+    size_t tail_blocks;         /* blocks in tail, after those */
+    size_t msg;                 /* message index */
+    unsigned char tail[128];
+} sha1_lane;
+
+static void sha1_lane_start( sha1_lane *lane, size_t msg,
+                             const unsigned char *input, size_t ilen )
+{
+    mbedtls_sha1_context ctx;
+    size_t used = ilen & 0x3F;
+    size_t end;
+
+    mbedtls_sha1_starts( &ctx );
+    memcpy( lane->state, ctx.state, sizeof( lane->state ) );
+
+    lane->msg = msg;
+    lane->p = input;
+    lane->blocks = ilen / 64;
+    lane->tail_blocks = used < 56 ? 1 : 2;
+
+    memset( lane->tail, 0, sizeof( lane->tail ) );
+    if( used > 0 )
+        memcpy( lane->tail, input + ilen - used, used );
+    lane->tail[used] = 0x80;
+
+    end = 64 * lane->tail_blocks;
+    MBEDTLS_PUT_UINT32_BE( (uint32_t) ( (uint64_t) ilen >> 29 ), lane->tail, end - 8 );
+    MBEDTLS_PUT_UINT32_BE( (uint32_t) ( ilen << 3 ), lane->tail, end - 4 );
+}
+
+/* Blocks available at lane->p, moving on to the tail; 0 when done */
+static size_t sha1_lane_blocks( sha1_lane *lane )
+{
+    if( lane->blocks == 0 && lane->tail_blocks != 0 )
+    {
+        lane->p = lane->tail;
+        lane->blocks = lane->tail_blocks;
+        lane->tail_blocks = 0;
+    }
+
+    return( lane->blocks );
+}
+
+static void sha1_lane_output( const sha1_lane *lane, unsigned char *output )
+{
+    int i;
+
+    for( i = 0; i < 5; i++ )
+        MBEDTLS_PUT_UINT32_BE( lane->state[i], output, 4 * i );
+}
+#endif /* SHA1_CPU_EXT_HAVE_X2 */
+
+/*
+ * output[i] = SHA-1( input[i] ) for count buffers
+ */
+int mbedtls_sha1_multi( const unsigned char * const input[],
+                        const size_t ilen[],
+                        unsigned char * const output[],
+                        size_t count )
+{
+    int ret = MBEDTLS_ERR_ERROR_CORRUPTION_DETECTED;
+    size_t i;
+
+    SHA1_VALIDATE_RET( count == 0 || input != NULL );
+    SHA1_VALIDATE_RET( count == 0 || ilen != NULL );
+    SHA1_VALIDATE_RET( count == 0 || output != NULL );
+
+#if defined(SHA1_CPU_EXT_HAVE_X2)
+    if( count >= 2 && sha1_cpu_ext_support() )
+    {
+        sha1_lane lanes[2];
+        size_t next, n;
+
+        for( next = 0; next < 2; next++ )
+            sha1_lane_start( &lanes[next], next, input[next], ilen[next] );
+
+        for( ;; )
+        {
+            /* Retire finished messages and refill their lanes; a lane with
+             * msg == count is idle */
+            for( i = 0; i < 2; i++ )
+            {
+                while( lanes[i].msg < count &&
+                       sha1_lane_blocks( &lanes[i] ) == 0 )
+                {
+                    sha1_lane_output( &lanes[i], output[lanes[i].msg] );
+                    if( next < count )
+                    {
+                        sha1_lane_start( &lanes[i], next, input[next],
+                                         ilen[next] );
+                        next++;
+                    }
+                    else
+                        lanes[i].msg = count;
+                }
+            }
+
+            if( lanes[0].msg == count && lanes[1].msg == count )
+                break;
+
+            if( lanes[0].msg == count || lanes[1].msg == count )
+            {
+                sha1_lane *lane = &lanes[lanes[0].msg == count ? 1 : 0];
+
+                sha1_cpu_ext( lane->state, lane->p, lane->blocks );
+                lane->p += 64 * lane->blocks;
+                lane->blocks = 0;
+                continue;
+            }
+
+            n = lanes[0].blocks < lanes[1].blocks ? lanes[0].blocks
+                                                  : lanes[1].blocks;
+            sha1_cpu_ext_x2( lanes[0].state, lanes[0].p,
+                             lanes[1].state, lanes[1].p, n );
+            for( i = 0; i < 2; i++ )
+            {
+                lanes[i].p += 64 * n;
+                lanes[i].blocks -= n;
+            }
+        }
+
+        mbedtls_platform_zeroize( lanes, sizeof( lanes ) );
+        return( 0 );
+    }
+#endif /* SHA1_CPU_EXT_HAVE_X2 */
+
+    for( i = 0; i < count; i++ )
+    {
+        if( ( ret = mbedtls_sha1( input[i], ilen[i], output[i] ) ) != 0 )
+            return( ret );
+    }
+
+    return( 0 );
+}
+
 #if defined(MBEDTLS_SELF_TEST)
 /*
  * FIPS-180-1 test vectors
@@ -44,6 +44,33 @@
 #endif /* MBEDTLS_PLATFORM_C */
 #endif /* MBEDTLS_SELF_TEST */
 
+/*
+ * SHA-256 with the SHA extensions of x86-64 (SHA-NI) or the ARMv8
+ * cryptographic extension, used when the CPU has them
+ */
+#if defined(MBEDTLS_SHA256_USE_CPU_EXT_IF_PRESENT) && \
+    !defined(MBEDTLS_SHA256_ALT) && !defined(MBEDTLS_SHA256_PROCESS_ALT)
+#if defined(MBEDTLS_HAVE_ASM) && defined(__GNUC__) &&               \
+    ( defined(__amd64__) || defined(__x86_64__) ) &&                \
+    ( defined(__clang__) || __GNUC__ >= 5 )
+#define SHA256_USE_SHANI
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON) &&                \
+    ( defined(__clang__) || __GNUC__ >= 6 )
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#if defined(HWCAP_SHA2) || defined(__APPLE__)
+#define SHA256_USE_A64_CRYPTO
+#include <arm_neon.h>
+#endif
+#endif
+#endif
+
+#if defined(SHA256_USE_SHANI) || defined(SHA256_USE_A64_CRYPTO)
+#define SHA256_USE_CPU_EXT
+#endif
+
 #define SHA256_VALIDATE_RET(cond)                           \
     MBEDTLS_INTERNAL_VALIDATE_RET( cond, MBEDTLS_ERR_SHA256_BAD_INPUT_DATA )
 #define SHA256_VALIDATE(cond)  MBEDTLS_INTERNAL_VALIDATE( cond )
@@ -169,6 +196,283 @@ static const uint32_t K[] =
         (d) += local.temp1; (h) = local.temp1 + local.temp2;        \
     } while( 0 )
 
+#if defined(SHA256_USE_CPU_EXT)
+/*
+ * SHA extensions detection routine
+ */
+static int sha256_cpu_ext_support( void )
+{
+    static int done = 0;
+    static int supported = 0;
+
+    if( ! done )
+    {
+#if defined(SHA256_USE_SHANI)
+        unsigned int max, c1, b7 = 0;
+
+        __asm__( "xorl  %%eax, %%eax    \n\t"
+                 "cpuid                 \n\t"
+                 : "=a" (max) : : "ebx", "ecx", "edx" );
+        __asm__( "movl  $1, %%eax       \n\t"
+                 "cpuid                 \n\t"
+                 : "=c" (c1) : : "eax", "ebx", "edx" );
+        if( max >= 7 )
+            __asm__( "movl  $7, %%eax       \n\t"
+                     "xorl  %%ecx, %%ecx    \n\t"
+                     "cpuid                 \n\t"
+                     : "=b" (b7) : : "eax", "ecx", "edx" );
+
+        /* SSSE3 and SSE4.1, SHA */
+        supported = ( c1 & 0x00080200u ) == 0x00080200u &&
+                    ( b7 & 0x20000000u ) != 0;
+#elif defined(__APPLE__)
+        /* Every 64-bit Apple CPU has the SHA-256 instructions */
+        supported = 1;
+#else
+        supported = ( getauxval( AT_HWCAP ) & HWCAP_SHA2 ) != 0;
+#endif
+        done = 1;
+    }
+
+    return( supported );
+}
+
+#if defined(SHA256_USE_SHANI)
+
+#define SHANI_TARGET    __attribute__((target("sha,sse4.1,ssse3")))
+
+/*
+ * The state is kept as ABEF and CDGH, the operand layout of sha256rnds2.
+ * The macros below take a lane prefix so that sha256_shani_x2() can run
+ * the rounds of two independent messages side by side: each message is
+ * one long dependency chain through sha256rnds2, and the CPU can execute
+ * the rounds of a second one in its shadow.
+ */
+#define SHANI_LOAD_STATE( L, st )                                           \
+    do {                                                                    \
+        L##tmp = _mm_shuffle_epi32(                                         \
+                    _mm_loadu_si128( (const __m128i *) (st) ), 0xB1 );      \
+        L##s1 = _mm_shuffle_epi32(                                          \
+                    _mm_loadu_si128( (const __m128i *) (st) + 1 ), 0x1B );  \
+        L##s0 = _mm_alignr_epi8( L##tmp, L##s1, 8 );       /* ABEF */       \
+        L##s1 = _mm_blend_epi16( L##s1, L##tmp, 0xF0 );    /* CDGH */       \
+    } while( 0 )
+
+#define SHANI_STORE_STATE( L, st )                                          \
+    do {                                                                    \
+        L##tmp = _mm_shuffle_epi32( L##s0, 0x1B );         /* FEBA */       \
+        L##s1 = _mm_shuffle_epi32( L##s1, 0xB1 );          /* DCHG */       \
+        _mm_storeu_si128( (__m128i *) (st),                                 \
+                          _mm_blend_epi16( L##tmp, L##s1, 0xF0 ) );         \
+        _mm_storeu_si128( (__m128i *) (st) + 1,                             \
+                          _mm_alignr_epi8( L##s1, L##tmp, 8 ) );            \
+    } while( 0 )
+
+#define SHANI_LOAD_BLOCK( L, p )                                            \
+    do {                                                                    \
+        L##save0 = L##s0;                                                   \
+        L##save1 = L##s1;                                                   \
+        L##m0 = _mm_shuffle_epi8(                                           \
+                    _mm_loadu_si128( (const __m128i *) (p) + 0 ), mask );   \
+        L##m1 = _mm_shuffle_epi8(                                           \
+                    _mm_loadu_si128( (const __m128i *) (p) + 1 ), mask );   \
+        L##m2 = _mm_shuffle_epi8(                                           \
+                    _mm_loadu_si128( (const __m128i *) (p) + 2 ), mask );   \
+        L##m3 = _mm_shuffle_epi8(                                           \
+                    _mm_loadu_si128( (const __m128i *) (p) + 3 ), mask );   \
+    } while( 0 )
+
+#define SHANI_END_BLOCK( L )                                                \
+    do {                                                                    \
+        L##s0 = _mm_add_epi32( L##s0, L##save0 );                           \
+        L##s1 = _mm_add_epi32( L##s1, L##save1 );                           \
+    } while( 0 )
+
+/* Rounds 4i to 4i+3 with message words mi, and the message schedule:
+ * mn (the words for rounds 4i+4) is completed and mp (4i+12) started */
+#define SHANI_QROUND( L, i, mi, mp, mn )                                    \
+    do {                                                                    \
+        L##msg = _mm_add_epi32( L##mi,                                      \
+                    _mm_loadu_si128( (const __m128i *) K + (i) ) );         \
+        L##s1 = _mm_sha256rnds2_epu32( L##s1, L##s0, L##msg );              \
+        if( (i) >= 3 && (i) < 15 )                                          \
+        {                                                                   \
+            L##mn = _mm_add_epi32( L##mn,                                   \
+                        _mm_alignr_epi8( L##mi, L##mp, 4 ) );               \
+            L##mn = _mm_sha256msg2_epu32( L##mn, L##mi );                   \
+        }                                                                   \
+        L##msg = _mm_shuffle_epi32( L##msg, 0x0E );                         \
+        L##s0 = _mm_sha256rnds2_epu32( L##s0, L##s1, L##msg );              \
+        if( (i) >= 1 && (i) < 13 )                                          \
+            L##mp = _mm_sha256msg1_epu32( L##mp, L##mi );                   \
+    } while( 0 )
+
+#define SHANI_ROUNDS( QR )                                                  \
+    do {                                                                    \
+        QR(  0, m0, m3, m1 ); QR(  1, m1, m0, m2 );                         \
+        QR(  2, m2, m1, m3 ); QR(  3, m3, m2, m0 );                         \
+        QR(  4, m0, m3, m1 ); QR(  5, m1, m0, m2 );                         \
+        QR(  6, m2, m1, m3 ); QR(  7, m3, m2, m0 );                         \
+        QR(  8, m0, m3, m1 ); QR(  9, m1, m0, m2 );                         \
+        QR( 10, m2, m1, m3 ); QR( 11, m3, m2, m0 );                         \
+        QR( 12, m0, m3, m1 ); QR( 13, m1, m0, m2 );                         \
+        QR( 14, m2, m1, m3 ); QR( 15, m3, m2, m0 );                         \
+    } while( 0 )
+
+#define SHANI_QROUND_A( i, mi, mp, mn )     SHANI_QROUND( a_, i, mi, mp, mn )
+#define SHANI_QROUND_AB( i, mi, mp, mn )                                    \
+    do {                                                                    \
+        SHANI_QROUND( a_, i, mi, mp, mn );                                  \
+        SHANI_QROUND( b_, i, mi, mp, mn );                                  \
+    } while( 0 )
+
+#define SHANI_LANE_VARS( L )                                                \
+    __m128i L##s0, L##s1, L##save0, L##save1, L##msg, L##tmp,               \
+            L##m0, L##m1, L##m2, L##m3
+
+static SHANI_TARGET void sha256_shani( uint32_t state[8],
+                                       const unsigned char *data,
+                                       size_t blocks )
+{
+    const __m128i mask = _mm_set_epi64x( 0x0C0D0E0F08090A0BULL,
+                                         0x0405060700010203ULL );
+    SHANI_LANE_VARS( a_ );
+
+    SHANI_LOAD_STATE( a_, state );
+
+    for( ; blocks > 0; blocks--, data += 64 )
+    {
+        SHANI_LOAD_BLOCK( a_, data );
+        SHANI_ROUNDS( SHANI_QROUND_A );
+        SHANI_END_BLOCK( a_ );
+    }
+
+    SHANI_STORE_STATE( a_, state );
+}
+
+/* The same number of blocks of two messages, interleaved */
+static SHANI_TARGET void sha256_shani_x2( uint32_t state_a[8],
+                                          const unsigned char *data_a,
+                                          uint32_t state_b[8],
+                                          const unsigned char *data_b,
+                                          size_t blocks )
+{
+    const __m128i mask = _mm_set_epi64x( 0x0C0D0E0F08090A0BULL,
+                                         0x0405060700010203ULL );
+    SHANI_LANE_VARS( a_ );
+    SHANI_LANE_VARS( b_ );
+
+    SHANI_LOAD_STATE( a_, state_a );
+    SHANI_LOAD_STATE( b_, state_b );
+
+    for( ; blocks > 0; blocks--, data_a += 64, data_b += 64 )
+    {
+        SHANI_LOAD_BLOCK( a_, data_a );
+        SHANI_LOAD_BLOCK( b_, data_b );
+        SHANI_ROUNDS( SHANI_QROUND_AB );
+        SHANI_END_BLOCK( a_ );
+        SHANI_END_BLOCK( b_ );
+    }
+
+    SHANI_STORE_STATE( a_, state_a );
+    SHANI_STORE_STATE( b_, state_b );
+}
+
+static void sha256_cpu_ext( uint32_t state[8], const unsigned char *data,
+                            size_t blocks )
+{
+    sha256_shani( state, data, blocks );
+}
+
+#define SHA256_CPU_EXT_HAVE_X2
+static void sha256_cpu_ext_x2( uint32_t state_a[8], const unsigned char *data_a,
+                               uint32_t state_b[8], const unsigned char *data_b,
+                               size_t blocks )
+{
+    sha256_shani_x2( state_a, data_a, state_b, data_b, blocks );
+}
+
+#endif /* SHA256_USE_SHANI */
+
+#if defined(SHA256_USE_A64_CRYPTO)
+
+#if !defined(__ARM_FEATURE_CRYPTO) && !defined(__ARM_FEATURE_SHA2)
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("crypto"))), apply_to=function)
+#define SHA256_POP_TARGET_PRAGMA
+#else
+#pragma GCC push_options
+#pragma GCC target ("arch=armv8-a+crypto")
+#define SHA256_POP_TARGET_PRAGMA
+#endif
+#endif
+
+static void sha256_cpu_ext( uint32_t state[8], const unsigned char *data,
+                            size_t blocks )
+{
+    uint32x4_t abcd = vld1q_u32( &state[0] );
+    uint32x4_t efgh = vld1q_u32( &state[4] );
+
+    for( ; blocks > 0; blocks--, data += 64 )
+    {
+        uint32x4_t abcd_orig = abcd;
+        uint32x4_t efgh_orig = efgh;
+        uint32x4_t s0, s1, s2, s3, tmp, abcd_prev;
+        int t;
+
+        s0 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data +  0 ) ) );
+        s1 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 16 ) ) );
+        s2 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 32 ) ) );
+        s3 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 48 ) ) );
+
+#define A64_QROUND( s, k )                                                  \
+        do {                                                                \
+            tmp = vaddq_u32( (s), vld1q_u32( &K[k] ) );                     \
+            abcd_prev = abcd;                                               \
+            abcd = vsha256hq_u32( abcd_prev, efgh, tmp );                   \
+            efgh = vsha256h2q_u32( efgh, abcd_prev, tmp );                  \
+        } while( 0 )
+
+        A64_QROUND( s0,  0 );
+        A64_QROUND( s1,  4 );
+        A64_QROUND( s2,  8 );
+        A64_QROUND( s3, 12 );
+
+        for( t = 16; t < 64; t += 16 )
+        {
+            s0 = vsha256su1q_u32( vsha256su0q_u32( s0, s1 ), s2, s3 );
+            A64_QROUND( s0, t );
+            s1 = vsha256su1q_u32( vsha256su0q_u32( s1, s2 ), s3, s0 );
+            A64_QROUND( s1, t + 4 );
+            s2 = vsha256su1q_u32( vsha256su0q_u32( s2, s3 ), s0, s1 );
+            A64_QROUND( s2, t + 8 );
+            s3 = vsha256su1q_u32( vsha256su0q_u32( s3, s0 ), s1, s2 );
+            A64_QROUND( s3, t + 12 );
+        }
+
+#undef A64_QROUND
+
+        abcd = vaddq_u32( abcd, abcd_orig );
+        efgh = vaddq_u32( efgh, efgh_orig );
+    }
+
+    vst1q_u32( &state[0], abcd );
+    vst1q_u32( &state[4], efgh );
+}
+
+#if defined(SHA256_POP_TARGET_PRAGMA)
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#undef SHA256_POP_TARGET_PRAGMA
+#endif
+
+#endif /* SHA256_USE_A64_CRYPTO */
+
+#endif /* SHA256_USE_CPU_EXT */
+
 int mbedtls_internal_sha256_process( mbedtls_sha256_context *ctx,
                                 const unsigned char data[64] )
 {
@@ -183,6 +487,14 @@ int mbedtls_internal_sha256_process( mbedtls_sha256_context *ctx,
     SHA256_VALIDATE_RET( ctx != NULL );
     SHA256_VALIDATE_RET( (const unsigned char *)data != NULL );
 
+#if defined(SHA256_USE_CPU_EXT)
+    if( sha256_cpu_ext_support() )
+    {
+        sha256_cpu_ext( ctx->state, data, 1 );
+        return( 0 );
+    }
+#endif
+
     for( i = 0; i < 8; i++ )
         local.A[i] = ctx->state[i];
 
@@ -297,6 +609,15 @@ int mbedtls_sha256_update( mbedtls_sha256_context *ctx,
         left = 0;
     }
 
+#if defined(SHA256_USE_CPU_EXT)
+    if( ilen >= 64 && sha256_cpu_ext_support() )
+    {
+        sha256_cpu_ext( ctx->state, input, ilen / 64 );
+        input += ilen & ~(size_t) 0x3F;
+        ilen  &= 0x3F;
+    }
+#endif
+
     while( ilen >= 64 )
     {
         if( ( ret = mbedtls_internal_sha256_process( ctx, input ) ) != 0 )
@@ -419,6 +740,161 @@ exit:
     return( ret );
 }
 
+#if defined(SHA256_CPU_EXT_HAVE_X2)
+/*
+ * One message in mbedtls_sha256_multi(): its whole blocks are read from
+ * the input, then the padded last block(s) from tail
+ */
+typedef struct
+{
+    uint32_t state[8];
+    const unsigned char *p;     /* next block */
+    size_t blocks;              /* blocks left at p */
+    size_t tail_blocks;         /* blocks in tail, after those */
+    size_t msg;                 /* message index */
+    unsigned char tail[128];
+} sha256_lane;
+
+static void sha256_lane_start( sha256_lane *lane, size_t msg,
+                               const unsigned char *input, size_t ilen,
+                               int is224 )
+{
+    mbedtls_sha256_context ctx;
+    size_t used = ilen & 0x3F;
+    size_t end;
+
+    mbedtls_sha256_starts( &ctx, is224 );
+    memcpy( lane->state, ctx.state, sizeof( lane->state ) );
+
+    lane->msg = msg;
+    lane->p = input;
+    lane->blocks = ilen / 64;
+    lane->tail_blocks = used < 56 ? 1 : 2;
+
+    memset( lane->tail, 0, sizeof( lane->tail ) );
+    if( used > 0 )
+        memcpy( lane->tail, input + ilen - used, used );
+    lane->tail[used] = 0x80;
+
+    end = 64 * lane->tail_blocks;
+    MBEDTLS_PUT_UINT32_BE( (uint32_t) ( (uint64_t) ilen >> 29 ), lane->tail, end - 8 );
+    MBEDTLS_PUT_UINT32_BE( (uint32_t) ( ilen << 3 ), lane->tail, end - 4 );
+}
+
+/* Blocks available at lane->p, moving on to the tail; 0 when done */
+static size_t sha256_lane_blocks( sha256_lane *lane )
+{
+    if( lane->blocks == 0 && lane->tail_blocks != 0 )
+    {
+        lane->p = lane->tail;
+        lane->blocks = lane->tail_blocks;
+        lane->tail_blocks = 0;
+    }
+
+    return( lane->blocks );
+}
+
+static void sha256_lane_output( const sha256_lane *lane,
+                                unsigned char *output, int is224 )
+{
+    int i;
+
+    for( i = 0; i < ( is224 ? 7 : 8 ); i++ )
+        MBEDTLS_PUT_UINT32_BE( lane->state[i], output, 4 * i );
+}
+#endif /* SHA256_CPU_EXT_HAVE_X2 */
+
+/*
+ * output[i] = SHA-256( input[i] ) for count buffers
+ */
+int mbedtls_sha256_multi( const unsigned char * const input[],
+                          const size_t ilen[],
+                          unsigned char * const output[],
+                          size_t count,
+                          int is224 )
+{
+    int ret = MBEDTLS_ERR_ERROR_CORRUPTION_DETECTED;
+    size_t i;
+
+#if defined(MBEDTLS_SHA224_C)
+    SHA256_VALIDATE_RET( is224 == 0 || is224 == 1 );
+#else
+    SHA256_VALIDATE_RET( is224 == 0 );
+#endif
+
+    SHA256_VALIDATE_RET( count == 0 || input != NULL );
+    SHA256_VALIDATE_RET( count == 0 || ilen != NULL );
+    SHA256_VALIDATE_RET( count == 0 || output != NULL );
+
+#if defined(SHA256_CPU_EXT_HAVE_X2)
+    if( count >= 2 && sha256_cpu_ext_support() )
+    {
+        sha256_lane lanes[2];
+        size_t next, n;
+
+        for( next = 0; next < 2; next++ )
+            sha256_lane_start( &lanes[next], next, input[next], ilen[next],
+                               is224 );
+
+        for( ;; )
+        {
+            /* Retire finished messages and refill their lanes; a lane with
+             * msg == count is idle */
+            for( i = 0; i < 2; i++ )
+            {
+                while( lanes[i].msg < count &&
+                       sha256_lane_blocks( &lanes[i] ) == 0 )
+                {
+                    sha256_lane_output( &lanes[i], output[lanes[i].msg], is224 );
+                    if( next < count )
+                    {
+                        sha256_lane_start( &lanes[i], next, input[next],
+                                           ilen[next], is224 );
+                        next++;
+                    }
+                    else
+                        lanes[i].msg = count;
+                }
+            }
+
+            if( lanes[0].msg == count && lanes[1].msg == count )
+                break;
+
+            if( lanes[0].msg == count || lanes[1].msg == count )
+            {
+                sha256_lane *lane = &lanes[lanes[0].msg == count ? 1 : 0];
+
+                sha256_cpu_ext( lane->state, lane->p, lane->blocks );
+                lane->p += 64 * lane->blocks;
+                lane->blocks = 0;
+                continue;
+            }
+
+            n = lanes[0].blocks < lanes[1].blocks ? lanes[0].blocks
+                                                  : lanes[1].blocks;
+            sha256_cpu_ext_x2( lanes[0].state, lanes[0].p,
+                               lanes[1].state, lanes[1].p, n );
+            for( i = 0; i < 2; i++ )
+            {
+                lanes[i].p += 64 * n;
+                lanes[i].blocks -= n;
+            }
+        }
+
+        mbedtls_platform_zeroize( lanes, sizeof( lanes ) );
+        return( 0 );
+    }
+#endif /* SHA256_CPU_EXT_HAVE_X2 */
+
+    for( i = 0; i < count; i++ )
+    {
+        if( ( ret = mbedtls_sha256( input[i], ilen[i], output[i], is224 ) ) != 0 )
+            return( ret );
+    }
+
+    return( 0 );
+}
+
 #if defined(MBEDTLS_SELF_TEST)
 /*
  * FIPS-180-2 test vectors
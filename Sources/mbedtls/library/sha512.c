@@ -50,6 +50,28 @@
 #endif /* MBEDTLS_PLATFORM_C */
 #endif /* MBEDTLS_SELF_TEST */
 
+/*
+ * SHA-512 with the ARMv8.2 SHA-512 instructions, used when the CPU has them
+ */
+#if defined(MBEDTLS_SHA512_USE_CPU_EXT_IF_PRESENT) && \
+    !defined(MBEDTLS_SHA512_ALT) && !defined(MBEDTLS_SHA512_PROCESS_ALT)
+#if defined(__aarch64__) && defined(__ARM_NEON) &&                  \
+    ( ( defined(__clang__) && __clang_major__ >= 7 ) ||             \
+      ( ! defined(__clang__) && __GNUC__ >= 8 ) )
+#if defined(__linux__)
+#include <sys/auxv.h>
+#elif defined(__APPLE__)
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#endif
+#if defined(HWCAP_SHA512) || defined(__APPLE__)
+#define SHA512_USE_A64_CRYPTO
+#define SHA512_USE_CPU_EXT
+#include <arm_neon.h>
+#endif
+#endif
+#endif
+
 #define SHA512_VALIDATE_RET(cond)                           \
     MBEDTLS_INTERNAL_VALIDATE_RET( cond, MBEDTLS_ERR_SHA512_BAD_INPUT_DATA )
 #define SHA512_VALIDATE(cond)  MBEDTLS_INTERNAL_VALIDATE( cond )
@@ -189,6 +211,139 @@ static const uint64_t K[80] =
     UL64(0x5FCB6FAB3AD6FAEC),  UL64(0x6C44198C4A475817)
 };
 
+#if defined(SHA512_USE_CPU_EXT)
+/*
+ * SHA-512 instructions detection routine
+ */
+static int sha512_cpu_ext_support( void )
+{
+    static int done = 0;
+    static int supported = 0;
+
+    if( ! done )
+    {
+#if defined(__APPLE__)
+        int value = 0;
+        size_t value_len = sizeof( value );
+
+        supported = sysctlbyname( "hw.optional.armv8_2_sha512", &value,
+                                  &value_len, NULL, 0 ) == 0 && value != 0;
+#else
+        supported = ( getauxval( AT_HWCAP ) & HWCAP_SHA512 ) != 0;
+#endif
+        done = 1;
+    }
+
+    return( supported );
+}
+
+#if !defined(__ARM_FEATURE_SHA512)
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sha3"))), apply_to=function)
+#define SHA512_POP_TARGET_PRAGMA
+#else
+#pragma GCC push_options
+#pragma GCC target ("arch=armv8.2-a+sha3")
+#define SHA512_POP_TARGET_PRAGMA
+#endif
+#endif
+
+static void sha512_cpu_ext( uint64_t state[8], const unsigned char *data,
+                            size_t blocks )
+{
+    uint64x2_t ab = vld1q_u64( &state[0] );
+    uint64x2_t cd = vld1q_u64( &state[2] );
+    uint64x2_t ef = vld1q_u64( &state[4] );
+    uint64x2_t gh = vld1q_u64( &state[6] );
+
+    for( ; blocks > 0; blocks--, data += 128 )
+    {
+        uint64x2_t ab_orig = ab, cd_orig = cd, ef_orig = ef, gh_orig = gh;
+        uint64x2_t s0, s1, s2, s3, s4, s5, s6, s7;
+        uint64x2_t initial_sum, sum, intermed;
+        int t;
+
+        s0 = vreinterpretq_u64_u8( vrev64q_u8( vld1q_u8( data +   0 ) ) );
+        s1 = vreinterpretq_u64_u8( vrev64q_u8( vld1q_u8( data +  16 ) ) );
+        s2 = vreinterpretq_u64_u8( vrev64q_u8( vld1q_u8( data +  32 ) ) );
+        s3 = vreinterpretq_u64_u8( vrev64q_u8( vld1q_u8( data +  48 ) ) );
+        s4 = vreinterpretq_u64_u8( vrev64q_u8( vld1q_u8( data +  64 ) ) );
+        s5 = vreinterpretq_u64_u8( vrev64q_u8( vld1q_u8( data +  80 ) ) );
+        s6 = vreinterpretq_u64_u8( vrev64q_u8( vld1q_u8( data +  96 ) ) );
+        s7 = vreinterpretq_u64_u8( vrev64q_u8( vld1q_u8( data + 112 ) ) );
+
+/* Rounds k and k+1 with message words s; the state pairs rotate through
+ * the four roles from one pair of rounds to the next */
+#define A64_DROUND( s, k, gh, ef, cd, ab )                                  \
+        do {                                                                \
+            initial_sum = vaddq_u64( (s), vld1q_u64( &K[k] ) );             \
+            sum = vaddq_u64( vextq_u64( initial_sum, initial_sum, 1 ), gh ); \
+            intermed = vsha512hq_u64( sum, vextq_u64( ef, gh, 1 ),          \
+                                      vextq_u64( cd, ef, 1 ) );             \
+            gh = vsha512h2q_u64( intermed, cd, ab );                        \
+            cd = vaddq_u64( cd, intermed );                                 \
+        } while( 0 )
+
+/* Message words k and k+1 from those 16, 15, 7 and 2 places before */
+#define A64_SCHED( s, s1, s4, s5, s7 )                                      \
+        ( s = vsha512su1q_u64( vsha512su0q_u64( (s), (s1) ), (s7),          \
+                               vextq_u64( (s4), (s5), 1 ) ) )
+
+        A64_DROUND( s0,  0, gh, ef, cd, ab );
+        A64_DROUND( s1,  2, ef, cd, ab, gh );
+        A64_DROUND( s2,  4, cd, ab, gh, ef );
+        A64_DROUND( s3,  6, ab, gh, ef, cd );
+        A64_DROUND( s4,  8, gh, ef, cd, ab );
+        A64_DROUND( s5, 10, ef, cd, ab, gh );
+        A64_DROUND( s6, 12, cd, ab, gh, ef );
+        A64_DROUND( s7, 14, ab, gh, ef, cd );
+
+        for( t = 16; t < 80; t += 16 )
+        {
+            A64_SCHED( s0, s1, s4, s5, s7 );
+            A64_DROUND( s0, t +  0, gh, ef, cd, ab );
+            A64_SCHED( s1, s2, s5, s6, s0 );
+            A64_DROUND( s1, t +  2, ef, cd, ab, gh );
+            A64_SCHED( s2, s3, s6, s7, s1 );
+            A64_DROUND( s2, t +  4, cd, ab, gh, ef );
+            A64_SCHED( s3, s4, s7, s0, s2 );
+            A64_DROUND( s3, t +  6, ab, gh, ef, cd );
+            A64_SCHED( s4, s5, s0, s1, s3 );
+            A64_DROUND( s4, t +  8, gh, ef, cd, ab );
+            A64_SCHED( s5, s6, s1, s2, s4 );
+            A64_DROUND( s5, t + 10, ef, cd, ab, gh );
+            A64_SCHED( s6, s7, s2, s3, s5 );
+            A64_DROUND( s6, t + 12, cd, ab, gh, ef );
+            A64_SCHED( s7, s0, s3, s4, s6 );
+            A64_DROUND( s7, t + 14, ab, gh, ef, cd );
+        }
+
+#undef A64_SCHED
+#undef A64_DROUND
+
+        ab = vaddq_u64( ab, ab_orig );
+        cd = vaddq_u64( cd, cd_orig );
+        ef = vaddq_u64( ef, ef_orig );
+        gh = vaddq_u64( gh, gh_orig );
+    }
+
+    vst1q_u64( &state[0], ab );
+    vst1q_u64( &state[2], cd );
+    vst1q_u64( &state[4], ef );
+    vst1q_u64( &state[6], gh );
+}
+
+#if defined(SHA512_POP_TARGET_PRAGMA)
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#undef SHA512_POP_TARGET_PRAGMA
+#endif
+
+#endif /* SHA512_USE_CPU_EXT */
+
 int mbedtls_internal_sha512_process( mbedtls_sha512_context *ctx,
                                      const unsigned char data[128] )
 {
@@ -202,6 +357,14 @@ int mbedtls_internal_sha512_process( mbedtls_sha512_context *ctx,
     SHA512_VALIDATE_RET( ctx != NULL );
     SHA512_VALIDATE_RET( (const unsigned char *)data != NULL );
 
+#if defined(SHA512_USE_CPU_EXT)
+    if( sha512_cpu_ext_support() )
+    {
+        sha512_cpu_ext( ctx->state, data, 1 );
+        return( 0 );
+    }
+#endif
+
 #define  SHR(x,n) ((x) >> (n))
 #define ROTR(x,n) (SHR((x),(n)) | ((x) << (64 - (n))))
 
@@ -330,6 +493,15 @@ int mbedtls_sha512_update( mbedtls_sha512_context *ctx,
         left = 0;
     }
 
+#if defined(SHA512_USE_CPU_EXT)
+    if( ilen >= 128 && sha512_cpu_ext_support() )
+    {
+        sha512_cpu_ext( ctx->state, input, ilen / 128 );
+        input += ilen & ~(size_t) 0x7F;
+        ilen  &= 0x7F;
+    }
+#endif
+
     while( ilen >= 128 )
     {
         if( ( ret = mbedtls_internal_sha512_process( ctx, input ) ) != 0 )
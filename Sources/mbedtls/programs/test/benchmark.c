@@ -124,7 +124,7 @@ static void mbedtls_set_alarm( int seconds );
 #define OPTIONS                                                         \
     "md5, ripemd160, sha1, sha256, sha512,\n"                      \
     "des3, des, camellia, chacha20,\n"                  \
-    "aes_cbc, aes_gcm, aes_ccm, aes_xts, chachapoly,\n"                 \
+    "aes_cbc, aes_ctr, aes_gcm, aes_ccm, aes_xts, chachapoly,\n"        \
     "aes_cmac, des3_cmac, poly1305\n"                                   \
     "ctr_drbg, hmac_drbg\n"                                     \
     "rsa, dhm, ecdsa, ecdh.\n"
@@ -164,9 +164,9 @@ do {                                                                    \
     }                                                                   \
     else                                                                \
     {                                                                   \
-        mbedtls_printf( "%9lu KiB/s,  %9lu cycles/byte\n",              \
+        mbedtls_printf( "%9lu KiB/s,  %9.2f cycles/byte\n",            \
                          ii * BUFSIZE / 1024,                           \
-                         ( mbedtls_timing_hardclock() - tsc )           \
+                         (double) ( mbedtls_timing_hardclock() - tsc )  \
                          / ( jj * BUFSIZE ) );                          \
     }                                                                   \
 } while( 0 )
@@ -479,6 +479,77 @@ static int myrand( void *rng_state, unsigned char *output, size_t len )
     return( 0 );
 }
 
+/*
+ * Hash BUFSIZE bytes as MULTI_COUNT short messages, either one call at a time
+ * or through the multi-buffer interface, to show what interleaving gains
+ */
+#define MULTI_COUNT     16
+#define MULTI_LEN       ( BUFSIZE / MULTI_COUNT )
+
+#if defined(MBEDTLS_SHA1_C) || defined(MBEDTLS_SHA256_C)
+static unsigned char multi_out[MULTI_COUNT][32];
+
+#if defined(MBEDTLS_SHA1_C)
+static int sha1_each( const unsigned char *buf )
+{
+    size_t i;
+    int ret = 0;
+
+    for( i = 0; ret == 0 && i < MULTI_COUNT; i++ )
+        ret = mbedtls_sha1( buf + i * MULTI_LEN, MULTI_LEN, multi_out[i] );
+
+    return( ret );
+}
+
+static int sha1_multi( const unsigned char *buf )
+{
+    const unsigned char *in[MULTI_COUNT];
+    unsigned char *out[MULTI_COUNT];
+    size_t len[MULTI_COUNT];
+    size_t i;
+
+    for( i = 0; i < MULTI_COUNT; i++ )
+    {
+        in[i] = buf + i * MULTI_LEN;
+        len[i] = MULTI_LEN;
+        out[i] = multi_out[i];
+    }
+
+    return( mbedtls_sha1_multi( in, len, out, MULTI_COUNT ) );
+}
+#endif /* MBEDTLS_SHA1_C */
+
+#if defined(MBEDTLS_SHA256_C)
+static int sha256_each( const unsigned char *buf )
+{
+    size_t i;
+    int ret = 0;
+
+    for( i = 0; ret == 0 && i < MULTI_COUNT; i++ )
+        ret = mbedtls_sha256( buf + i * MULTI_LEN, MULTI_LEN, multi_out[i], 0 );
+
+    return( ret );
+}
+
+static int sha256_multi( const unsigned char *buf )
+{
+    const unsigned char *in[MULTI_COUNT];
+    unsigned char *out[MULTI_COUNT];
+    size_t len[MULTI_COUNT];
+    size_t i;
+
+    for( i = 0; i < MULTI_COUNT; i++ )
+    {
+        in[i] = buf + i * MULTI_LEN;
+        len[i] = MULTI_LEN;
+        out[i] = multi_out[i];
+    }
+
+    return( mbedtls_sha256_multi( in, len, out, MULTI_COUNT, 0 ) );
+}
+#endif /* MBEDTLS_SHA256_C */
+#endif /* MBEDTLS_SHA1_C || MBEDTLS_SHA256_C */
+
 #define CHECK_AND_CONTINUE( R )                                         \
     {                                                                   \
         int CHECK_AND_CONTINUE_ret = ( R );                             \
@@ -535,7 +606,7 @@ unsigned char buf[BUFSIZE];
 typedef struct {
     char md5, ripemd160, sha1, sha256, sha512,
          des3, des,
-         aes_cbc, aes_gcm, aes_ccm, aes_xts, chachapoly,
+         aes_cbc, aes_ctr, aes_gcm, aes_ccm, aes_xts, chachapoly,
          aes_cmac, des3_cmac,
          aria, camellia, chacha20,
          poly1305,
@@ -591,6 +662,8 @@ int main( int argc, char *argv[] )
                 todo.des = 1;
             else if( strcmp( argv[i], "aes_cbc" ) == 0 )
                 todo.aes_cbc = 1;
+            else if( strcmp( argv[i], "aes_ctr" ) == 0 )
+                todo.aes_ctr = 1;
             else if( strcmp( argv[i], "aes_xts" ) == 0 )
                 todo.aes_xts = 1;
             else if( strcmp( argv[i], "aes_gcm" ) == 0 )
@@ -655,12 +728,20 @@ int main( int argc, char *argv[] )
 
 #if defined(MBEDTLS_SHA1_C)
     if( todo.sha1 )
+    {
         TIME_AND_TSC( "SHA-1", mbedtls_sha1( buf, BUFSIZE, tmp ) );
+        TIME_AND_TSC( "SHA-1 16x64 one by one", sha1_each( buf ) );
+        TIME_AND_TSC( "SHA-1 16x64 multi", sha1_multi( buf ) );
+    }
 #endif
 
 #if defined(MBEDTLS_SHA256_C)
     if( todo.sha256 )
+    {
         TIME_AND_TSC( "SHA-256", mbedtls_sha256( buf, BUFSIZE, tmp, 0 ) );
+        TIME_AND_TSC( "SHA-256 16x64 one by one", sha256_each( buf ) );
+        TIME_AND_TSC( "SHA-256 16x64 multi", sha256_multi( buf ) );
+    }
 #endif
 
 #if defined(MBEDTLS_SHA512_C)
@@ -732,6 +813,30 @@ int main( int argc, char *argv[] )
         mbedtls_aes_free( &aes );
     }
 #endif
+#if defined(MBEDTLS_CIPHER_MODE_CTR)
+    if( todo.aes_ctr )
+    {
+        int keysize;
+        size_t nc_off;
+        unsigned char stream_block[16];
+        mbedtls_aes_context aes;
+        mbedtls_aes_init( &aes );
+        for( keysize = 128; keysize <= 256; keysize += 64 )
+        {
+            mbedtls_snprintf( title, sizeof( title ), "AES-CTR-%d", keysize );
+
+            memset( buf, 0, sizeof( buf ) );
+            memset( tmp, 0, sizeof( tmp ) );
+            nc_off = 0;
+            CHECK_AND_CONTINUE( mbedtls_aes_setkey_enc( &aes, tmp, keysize ) );
+
+            TIME_AND_TSC( title,
+                mbedtls_aes_crypt_ctr( &aes, BUFSIZE, &nc_off, tmp, stream_block,
+                                       buf, buf ) );
+        }
+        mbedtls_aes_free( &aes );
+    }
+#endif
 #if defined(MBEDTLS_CIPHER_MODE_XTS)
     if( todo.aes_xts )
     {
@@ -50,6 +50,7 @@ class BusqTests: XCTestCase {
              try testSpringboardServiceClient(lfc)
              try testHouseArrestClient(lfc)
              try testSyslogRelayClient(lfc)
+             try testDevicePool(udid: deviceInfo.udid)
             // try testFileRelayClient(lfc) // muxError
             // try testDebugServer(lfc) // seems to require manual start of the service
         }
@@ -97,12 +98,208 @@ class BusqTests: XCTestCase {
     #endif
     #endif
     
+    /// A browse reply as returned by installation_proxy, with the given number of apps.
+    func browseReply(apps: Int) -> Plist {
+        Plist(xml: browseReplyXML(apps: apps))!
+    }
+
+    /// The XML of a browse reply with the given number of apps.
+    func browseReplyXML(apps: Int) -> String {
+        let app = """
+        <dict>
+            <key>ApplicationType</key><string>User</string>
+            <key>CFBundleDevelopmentRegion</key><string>en</string>
+            <key>CFBundleDisplayName</key><string>App %ld</string>
+            <key>CFBundleExecutable</key><string>App</string>
+            <key>CFBundleIdentifier</key><string>org.example.app%ld</string>
+            <key>CFBundleName</key><string>App</string>
+            <key>CFBundleShortVersionString</key><string>1.2.%ld</string>
+            <key>CFBundleVersion</key><string>%ld</string>
+            <key>CFBundleSupportedPlatforms</key><array><string>iPhoneOS</string></array>
+            <key>Entitlements</key><dict>
+                <key>application-identifier</key><string>ABCDE12345.org.example.app%ld</string>
+                <key>get-task-allow</key><false/>
+                <key>keychain-access-groups</key><array><string>ABCDE12345.*</string></array>
+            </dict>
+            <key>IsAppClip</key><false/>
+            <key>IsDemotedApp</key><false/>
+            <key>IsHostBackupEligible</key><true/>
+            <key>IsUpgradeable</key><true/>
+            <key>Path</key><string>/private/var/containers/Bundle/Application/6C1E93D6-4B8A-4F5E-9A0B-%012ld/App.app</string>
+            <key>SignerIdentity</key><string>Apple iPhone OS Application Signing</string>
+            <key>StaticDiskUsage</key><integer>%ld</integer>
+        </dict>
+        """
+        let items = (0..<apps).map { i in
+            String(format: app, i, i, i, i, i, i, i * 4096)
+        }
+        return #"<?xml version="1.0" encoding="UTF-8"?><plist version="1.0"><array>"# + items.joined() + "</array></plist>"
+    }
+
+    func testDecodeBrowseReply() throws {
+        var reply = browseReply(apps: 3)
+        defer { reply.free() }
+
+        let apps = try PlistDecoder().decode([InstalledApp].self, from: reply)
+        XCTAssertEqual(3, apps.count)
+        XCTAssertEqual("org.example.app2", apps.last?.CFBundleIdentifier)
+        XCTAssertEqual("App 1", apps[1].CFBundleDisplayName)
+        XCTAssertEqual(true, apps[0].IsUpgradeable)
+        XCTAssertEqual(apps.map(\.CFBundleIdentifier), reply.array?.map(InstalledAppInfo.init).map(\.CFBundleIdentifier))
+    }
+
+    func testDecodeBrowseReplyPerformance() throws {
+        var reply = browseReply(apps: 2_000)
+        defer { reply.free() }
+
+        measure {
+            let apps = try? PlistDecoder().decode([InstalledApp].self, from: reply)
+            XCTAssertEqual(2_000, apps?.count)
+        }
+    }
+
+    /// Bounds the heap blocks and bytes that a parsed browse reply keeps alive per app, and times the parse.
+    /// Each app holds 43 nodes; with short keys and strings stored inline that is under 100 blocks.
+    func testPlistNodeFootprint() throws {
+        let apps = 2_000
+        let xml = browseReplyXML(apps: apps)
+
+        #if canImport(Darwin)
+        var before = malloc_statistics_t()
+        malloc_zone_statistics(nil, &before)
+        #endif
+        var reply = try XCTUnwrap(Plist(xml: xml))
+        defer { reply.free() }
+        #if canImport(Darwin)
+        var after = malloc_statistics_t()
+        malloc_zone_statistics(nil, &after)
+        let blocks = Int(after.blocks_in_use) - Int(before.blocks_in_use)
+        let bytes = Int(after.size_in_use) - Int(before.size_in_use)
+        XCTAssertLessThan(blocks / apps, 100, "allocations per app")
+        XCTAssertLessThan(bytes / apps, 6_144, "bytes per app")
+        #endif
+        XCTAssertEqual(apps, reply.array?.count)
+
+        measure {
+            var plist = Plist(xml: xml)
+            XCTAssertNotNil(plist)
+            plist?.free()
+        }
+    }
+
+    func testPlistJSONParsePerformance() throws {
+        var reply = browseReply(apps: 2_000)
+        defer { reply.free() }
+        let json = try XCTUnwrap(reply.json())
+        var parsed = try XCTUnwrap(Plist(json: json))
+        defer { parsed.free() }
+        XCTAssertEqual(reply, parsed)
+
+        measure {
+            var plist = Plist(json: json)
+            XCTAssertNotNil(plist)
+            plist?.free()
+        }
+    }
+
+    func testPlistEquality() throws {
+        let xml = browseReplyXML(apps: 50)
+        var lhs = try XCTUnwrap(Plist(xml: xml))
+        defer { lhs.free() }
+        var rhs = try XCTUnwrap(Plist(xml: xml))
+        defer { rhs.free() }
+        XCTAssertEqual(lhs, rhs)
+
+        var ab = Plist(dictionary: [:])
+        defer { ab.free() }
+        ab["a"] = Plist(string: "1")
+        ab["b"] = Plist(array: [Plist(string: "2")])
+        var ba = Plist(dictionary: [:])
+        defer { ba.free() }
+        ba["b"] = Plist(array: [Plist(string: "2")])
+        ba["a"] = Plist(string: "1")
+        XCTAssertEqual(ab, ba, "dictionaries should compare regardless of key order")
+
+        var app = try XCTUnwrap(rhs[7])
+        app["CFBundleName"] = Plist(string: "Other")
+        XCTAssertNotEqual(lhs, rhs)
+    }
+
+    /// A small .ipa-shaped zip with deflated (dynamic and fixed huffman) and stored entries
+    let sampleArchive = """
+            UEsDBBQAAAAIAABgoVTzLTnyKgIAAMIpAAAYAAAAUGF5bG9hZC9BcHAuYXBwL0luZm8udHh0ndjLcdRQAEXBPVEoBB39RTZ8BjAM
+            HrAxYEdPQQb0WnVXOiW919e7+8swvh5+fLoM35/u3n0Z3j7cft0PH26/h89PX789Drefl4d/j69vXp6H97ePr65/N8Fmgs0MmwU2
+            K2w22OywOWBzyjulEKSEJIWkhSSGpIYkh6SHJIikiEmKmOjbIEVMUsQkRUxSxCRFTFLEJEVMUsQsRcxSxEy/CyliliJmKWKWImYp
+            YpYiZilikSIWKWKRIhY6QUgRixSxSBGLFLFIEYsUsUoRqxSxShGrFLHSoVKKWKWIVYpYpYhVitikiE2K2KSITYrYpIiN7hlSxCZF
+            bFLEJkXsUsQuRexSxC5F7FLELkXsdPWUInYpYpciDinikCIOKeKQIg4p4pAiDiniII2QIg4p4pQiTinilCJOKeKUIk4p4pQiTini
+            JKAyoSKiGsmoRkKqkZRqJKYayalGgqqRpGokqhqpDeRLasMA0wTTCNMM0xDTFNMYkxwzgsxIMiPKjCwzwsxIMyPOjDwzAs1INCPS
+            jEwzQs1INSPWjFwzgs1INiPajGwzws1INyPejHwzAs5IOCPijIwzQs5IOSPmjJwzgs5IOiPqjKwzws5IOyPujLwzAs9IPCPyjMwz
+            Qs9IPSP2jNwzgs9IPiP6jOwzws9IPyP+jPwzAtBIQCMCjQw0QtBIQSMGjRw0gtBIQiMKjSw0wtBIQyMOjTw0AtFIRCMSjUw0QtFI
+            RSMW7X9d9A9QSwMEFAAAAAgAAGChVICI+eUKAAAAEQAAABkAAABQYXlsb2FkL0FwcC5hcHAvc2hvcnQudHh0y0jNyclXyECQAFBL
+            AwQUAAAAAAAAYKFUc4wFKQABAAAAAQAAGgAAAFBheWxvYWQvQXBwLmFwcC9zdG9yZWQuYmluAAECAwQFBgcICQoLDA0ODxAREhMU
+            FRYXGBkaGxwdHh8gISIjJCUmJygpKissLS4vMDEyMzQ1Njc4OTo7PD0+P0BBQkNERUZHSElKS0xNTk9QUVJTVFVWV1hZWltcXV5f
+            YGFiY2RlZmdoaWprbG1ub3BxcnN0dXZ3eHl6e3x9fn+AgYKDhIWGh4iJiouMjY6PkJGSk5SVlpeYmZqbnJ2en6ChoqOkpaanqKmq
+            q6ytrq+wsbKztLW2t7i5uru8vb6/wMHCw8TFxsfIycrLzM3Oz9DR0tPU1dbX2Nna29zd3t/g4eLj5OXm5+jp6uvs7e7v8PHy8/T1
+            9vf4+fr7/P3+/1BLAQIUAxQAAAAIAABgoVTzLTnyKgIAAMIpAAAYAAAAAAAAAAAAAACkgQAAAABQYXlsb2FkL0FwcC5hcHAvSW5m
+            by50eHRQSwECFAMUAAAACAAAYKFUgIj55QoAAAARAAAAGQAAAAAAAAAAAAAA7YFgAgAAUGF5bG9hZC9BcHAuYXBwL3Nob3J0LnR4
+            dFBLAQIUAxQAAAAAAABgoVRzjAUpAAEAAAABAAAaAAAAAAAAAAAAAACAAaECAABQYXlsb2FkL0FwcC5hcHAvc3RvcmVkLmJpblBL
+            BQYAAAAAAwADANUAAADZAwAAAAA=
+            """
+
+    func testZipArchive() throws {
+        let tmp = URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent(UUID().uuidString)
+        try FileManager.default.createDirectory(at: tmp, withIntermediateDirectories: true)
+        defer { try? FileManager.default.removeItem(at: tmp) }
+
+        let ipa = tmp.appendingPathComponent("App.ipa")
+        try XCTUnwrap(Data(base64Encoded: sampleArchive, options: .ignoreUnknownCharacters)).write(to: ipa)
+
+        let archive = try ZipArchive(url: ipa)
+        XCTAssertEqual(["Payload/App.app/Info.txt", "Payload/App.app/short.txt", "Payload/App.app/stored.bin"], archive.entries.map(\.path))
+
+        let text = (0..<200).map { "line \($0): the quick brown fox jumps over the lazy dog\n" }.joined()
+        XCTAssertEqual(text, String(decoding: try archive.contents(of: archive.entries[0]), as: UTF8.self))
+        XCTAssertEqual("hello hello hello", String(decoding: try archive.contents(of: archive.entries[1]), as: UTF8.self))
+        XCTAssertEqual(Data(0...255), try archive.contents(of: archive.entries[2]))
+
+        // extract, modify one file, and repackage: unchanged entries are copied verbatim
+        let expanded = tmp.appendingPathComponent("App")
+        try archive.extractAll(to: expanded)
+        XCTAssertEqual(0o755, try FileManager.default.attributesOfItem(atPath: expanded.appendingPathComponent("Payload/App.app/short.txt").path)[.posixPermissions] as? Int)
+        try "signed".write(to: expanded.appendingPathComponent("Payload/App.app/short.txt"), atomically: false, encoding: .utf8)
+        try FileManager.default.createSymbolicLink(atPath: expanded.appendingPathComponent("Payload/App.app/link").path, withDestinationPath: "Info.txt")
+
+        let repackaged = tmp.appendingPathComponent("Repackaged.ipa")
+        try FileManager.default.repackageFolder(expanded, to: repackaged, reusing: archive)
+
+        let result = try ZipArchive(url: repackaged)
+        let entries = Dictionary(uniqueKeysWithValues: result.entries.map { ($0.path, $0) })
+        XCTAssertEqual(["Payload/", "Payload/App.app/", "Payload/App.app/Info.txt", "Payload/App.app/link", "Payload/App.app/short.txt", "Payload/App.app/stored.bin"], result.entries.map(\.path).sorted())
+        let info = try XCTUnwrap(entries["Payload/App.app/Info.txt"])
+        XCTAssertEqual(8, info.method)
+        XCTAssertEqual(archive.entries[0].compressedSize, info.compressedSize)
+        XCTAssertEqual(text, String(decoding: try result.contents(of: info), as: UTF8.self))
+        XCTAssertEqual("signed", String(decoding: try result.contents(of: XCTUnwrap(entries["Payload/App.app/short.txt"])), as: UTF8.self))
+        XCTAssertEqual(true, entries["Payload/App.app/link"]?.isSymbolicLink)
+        XCTAssertEqual(true, entries["Payload/App.app/"]?.isDirectory)
+    }
+
+    func testZipPathSanitization() throws {
+        XCTAssertEqual("Payload/App.app", try ZipArchive.sanitize("./Payload/App.app/"))
+        XCTAssertThrowsError(try ZipArchive.sanitize("../etc/passwd"))
+        XCTAssertThrowsError(try ZipArchive.sanitize("/etc/passwd"))
+        XCTAssertThrowsError(try ZipArchive.sanitize("Payload/../../x"))
+    }
+
     func testLockdownClient(_ lfc: LockdownClient) throws {
         print(" - lockdown client:", try lfc.getName()) // “Bob's iPhone”
         print(" - device UDID:", try lfc.getDeviceUDID())
         print(" - query:", try lfc.getQueryType()) // “com.apple.mobile.lockdown”
 
         print(" - battery:", try lfc.getValue(domain: "com.apple.mobile.battery", key: "BatteryCurrentCapacity").uint ?? 0) // e.g.: 100
+
+        let inventory = try lfc.inventory()
+        print(" - inventory:", inventory.count, "values; OS", inventory[.productVersion]?.string ?? "?")
     }
 
     func testInstallationProxy(_ lfc: LockdownClient) throws {
@@ -157,6 +354,23 @@ class BusqTests: XCTestCase {
 
     }
 
+    func testDevicePool(udid: String) throws {
+        let pool = DevicePool(label: "BusqTests")
+        let first = try pool.withLockdown(udid: udid) { lfc in
+            _ = try lfc.getDeviceUDID()
+            return ObjectIdentifier(lfc)
+        }
+        let second = try pool.withLockdown(udid: udid) { ObjectIdentifier($0) }
+        XCTAssertEqual(first, second, "the idle lockdown client should have been reused")
+
+        let info = try pool.withService(FileConduit.self, udid: udid) { try $0.getDeviceInfo() }
+        XCTAssertNotNil(info["Model"])
+
+        pool.evict(udid: udid)
+        let third = try pool.withLockdown(udid: udid) { ObjectIdentifier($0) }
+        let _ = third // a new client after eviction; the identifier may be recycled, so it isn't compared
+    }
+
     func testHouseArrestClient(_ lfc: LockdownClient) throws {
         let client = try lfc.createHouseArrestClient(escrow: true)
         let _ = client